@@ -3,23 +3,19 @@
 //
 
 #include "appendcommand.h"
-#include "../common/common.h"
+#include "../common/tokenizer.h"
 
 using namespace std;
 
 void AppendCommand::Handle(const std::string &line) {
-    // TODO this may need to be redone because of whitespace in the data they're trying to add.
-    //  for now we will ignore, clean it up later
-    vector<string> tokens = split(line);
-    assert(tokens.size() >= 3);
-    string key = tokens[1];
-    string value = tokens[2];
-    for(int i = 3; i < tokens.size(); i ++) {
-        // assumes single space delimiter for now
-        value += " " + tokens[i];
-    }
-
-    client.Append(key, value);
+    Tokenizer tokens(line);
+    string_view command, key;
+    tokens.Next(&command);
+    tokens.Next(&key);
+    // the value is the rest of the line as it was typed, whitespace included
+    string_view value = tokens.Rest();
+    value.remove_suffix(value.size() - (value.find_last_not_of(WHITESPACE) + 1));
+    client.Append(string(key), string(value));
 }
 
 void AppendCommand::PrintHelpMessage() {
@@ -5,13 +5,13 @@
 #ifndef SHARDING_APPENDCOMMAND_H
 #define SHARDING_APPENDCOMMAND_H
 
-#include "../repl/regexcommand.h"
+#include "../repl/tokencommand.h"
 #include "client.h"
 
-class AppendCommand : public RegexCommand {
+class AppendCommand : public TokenCommand {
 public:
     // match: append <key> <value>
-    explicit AppendCommand(Client& cl) : RegexCommand("append .+"), client(cl) {}
+    explicit AppendCommand(Client& cl) : TokenCommand("append", 2), client(cl) {}
     void Handle(const std::string& line) override;
     void PrintHelpMessage() override;
 private:
@@ -3,6 +3,7 @@
 //
 
 #include <iostream>
+#include <thread>
 
 #include "client.h"
 #include "../build/shardkv.grpc.pb.h"
@@ -21,19 +22,69 @@ void Client::Query() {
 
     Status status = stub->Query(&cc, query, &response);
     if(status.ok()) {
-        // start by resetting config
-        configuration.Clear();
-        for(const auto& config : response.config()) {
-            // now set up shards
-            for(const auto& shard : config.shards()) {
-                configuration.Insert(config.server(), {shard.lower(), shard.upper()});
+        setConfig(response);
+    } else {
+        logError("Query", status);
+    }
+}
+
+void Client::Watch() {
+    std::thread watch([this]() {
+        while (true) {
+            ClientContext cc;
+            WatchRequest req;
+            {
+                std::lock_guard<std::mutex> lock(configMutex);
+                req.set_from_version(configVersion);
+                req.set_epoch(configEpoch);
+            }
+            auto reader = stub->Watch(&cc, req);
+            QueryResponse response;
+            while (reader->Read(&response)) {
+                setConfig(response);
             }
+            reader->Finish();
+            // the stream broke (most likely the shardmaster went away): try again
+            std::this_thread::sleep_for(std::chrono::seconds(1));
         }
+    });
+    watch.detach();
+}
+
+void Client::setConfig(const QueryResponse& response) {
+    std::lock_guard<std::mutex> lock(configMutex);
+    // a restarted shardmaster counts versions from 0 again
+    if (response.epoch() == configEpoch && response.version() < configVersion) {
+        return;
+    }
+    configEpoch = response.epoch();
+    configVersion = response.version();
+    // start by resetting config
+    configuration.Clear();
+    std::vector<std::string> servers;
+    std::vector<std::vector<shard_t>> shards;
+    for(const auto& config : response.config()) {
+        servers.push_back(config.server());
+        // now set up shards
+        shards.emplace_back();
+        for(const auto& shard : config.shards()) {
+            shards.back().push_back({shard.lower(), shard.upper()});
+        }
+    }
+    if (response.placement() == PLACEMENT_HASH) {
+        configuration.PlaceByHash(servers, response.vnodes(),
+                                  {response.key_space().lower(), response.key_space().upper()});
     } else {
-        logError("Query", status);
+        configuration.Assign(servers, shards);
     }
 }
 
+std::optional<std::string> Client::serverOf(const std::string& key) {
+    uint64_t key_id = parse_key(key).id;
+    std::lock_guard<std::mutex> lock(configMutex);
+    return configuration.GetServer(key_id);
+}
+
 void Client::Move(const std::string& server, const shard_t &shard) {
     MoveRequest req;
     Empty response;
@@ -76,15 +127,19 @@ void Client::Leave(const std::vector<std::string>& servers) {
 }
 
 void Client::PrintConfig() {
+    std::lock_guard<std::mutex> lock(configMutex);
     configuration.Print();
 }
 
 void Client::Get(const std::string& key) {
     if (key == "all_users") {
-        std::vector<std::string> servers = configuration.AllServers();
+        std::vector<std::string> servers;
+        {
+            std::lock_guard<std::mutex> lock(configMutex);
+            servers = configuration.AllServers();
+        }
         for (std::string server : servers) {
-            auto channel = grpc::CreateChannel(server, grpc::InsecureChannelCredentials());
-            auto kvStub = Shardkv::NewStub(channel);
+            auto kvStub = ChannelPool::Shared().Stub<Shardkv>(server);
             std::cout << "Get server: " << server << "\n";
 
             ::grpc::ClientContext cc;
@@ -105,8 +160,7 @@ void Client::Get(const std::string& key) {
             return;
         }
 
-        unsigned int key_id = (unsigned int)extractID(key);
-        std::cout << "Get server: " << configuration.GetServer(key_id).value() << "\n";
+        std::cout << "Get server: " << serverOf(key).value_or("?") << "\n";
 
         ::grpc::ClientContext cc;
         GetRequest req;
@@ -128,8 +182,7 @@ void Client::Delete(const std::string& key) {
         return;
     }
 
-    unsigned int key_id = (unsigned int)extractID(key);
-    std::cout << "Delete server: " << configuration.GetServer(key_id).value() << "\n";
+    std::cout << "Delete server: " << serverOf(key).value_or("?") << "\n";
 
     ::grpc::ClientContext cc;
     DeleteRequest req;
@@ -150,8 +203,7 @@ void Client::Put(const std::string &key, const std::string &value, const std::st
         return;
     }
 
-    unsigned int key_id = (unsigned int)extractID(key);
-    std::cout << "Put server: " << configuration.GetServer(key_id).value() << "\n";
+    std::cout << "Put server: " << serverOf(key).value_or("?") << "\n";
 
     ::grpc::ClientContext cc;
     PutRequest req;
@@ -172,8 +224,7 @@ void Client::Append(const std::string &key, const std::string &value) {
         return;
     }
 
-    unsigned int key_id = (unsigned int)extractID(key);
-    std::cout << "Append server: " << configuration.GetServer(key_id).value() << "\n";
+    std::cout << "Append server: " << serverOf(key).value_or("?") << "\n";
 
     ::grpc::ClientContext cc;
     AppendRequest req;
@@ -187,11 +238,117 @@ void Client::Append(const std::string &key, const std::string &value) {
     }
 }
 
+void Client::MultiGet(const std::vector<std::string>& keys) {
+    auto groups = groupByServer(keys);
+    // one slot per group, written only by the thread of that group
+    std::vector<MultiGetResponse> responses(groups.size());
+    std::vector<Status> statuses(groups.size());
+    std::vector<std::thread> requests;
+    for (size_t g = 0; g < groups.size(); g++) {
+        requests.emplace_back([&, g]() {
+            ::grpc::ClientContext cc;
+            MultiGetRequest req;
+            for (size_t k : groups[g].second) {
+                req.add_keys(keys[k]);
+            }
+            statuses[g] = ChannelPool::Shared().Stub<Shardkv>(groups[g].first)->MultiGet(&cc, req, &responses[g]);
+        });
+    }
+    for (auto& t : requests) {
+        t.join();
+    }
+    for (size_t g = 0; g < groups.size(); g++) {
+        const auto& [server, server_keys] = groups[g];
+        std::cout << "MultiGet server: " << server << "\n";
+        if (!statuses[g].ok()) {
+            logError("MultiGet", statuses[g]);
+            continue;
+        }
+        const MultiGetResponse& res = responses[g];
+        for (int i = 0; i < res.values_size(); i++) {
+            std::cout << keys[server_keys[i]] << ": " << (res.found(i) ? res.values(i) : "(not found)") << "\n";
+        }
+    }
+}
+
+void Client::MultiPut(const std::vector<std::pair<std::string, std::string>>& entries) {
+    std::vector<std::string> keys;
+    for (const auto& entry : entries) {
+        keys.push_back(entry.first);
+    }
+    auto groups = groupByServer(keys);
+    std::vector<Status> statuses(groups.size());
+    std::vector<std::thread> requests;
+    for (size_t g = 0; g < groups.size(); g++) {
+        requests.emplace_back([&, g]() {
+            ::grpc::ClientContext cc;
+            MultiPutRequest req;
+            for (size_t k : groups[g].second) {
+                PutRequest* put = req.add_puts();
+                put->set_key(entries[k].first);
+                put->set_data(entries[k].second);
+            }
+            Empty res;
+            statuses[g] = ChannelPool::Shared().Stub<Shardkv>(groups[g].first)->MultiPut(&cc, req, &res);
+        });
+    }
+    for (auto& t : requests) {
+        t.join();
+    }
+    for (size_t g = 0; g < groups.size(); g++) {
+        std::cout << "MultiPut server: " << groups[g].first << "\n";
+        if (!statuses[g].ok()) {
+            logError("MultiPut", statuses[g]);
+        }
+    }
+}
+
+void Client::MultiDelete(const std::vector<std::string>& keys) {
+    auto groups = groupByServer(keys);
+    // one slot per group, written only by the thread of that group
+    std::vector<MultiDeleteResponse> responses(groups.size());
+    std::vector<Status> statuses(groups.size());
+    std::vector<std::thread> requests;
+    for (size_t g = 0; g < groups.size(); g++) {
+        requests.emplace_back([&, g]() {
+            ::grpc::ClientContext cc;
+            MultiDeleteRequest req;
+            for (size_t k : groups[g].second) {
+                req.add_keys(keys[k]);
+            }
+            statuses[g] = ChannelPool::Shared().Stub<Shardkv>(groups[g].first)->MultiDelete(&cc, req, &responses[g]);
+        });
+    }
+    for (auto& t : requests) {
+        t.join();
+    }
+    for (size_t g = 0; g < groups.size(); g++) {
+        std::cout << "MultiDelete server: " << groups[g].first << "\n";
+        if (statuses[g].ok()) {
+            std::cout << "Deleted " << responses[g].deleted() << " of " << groups[g].second.size() << " keys\n";
+        } else {
+            logError("MultiDelete", statuses[g]);
+        }
+    }
+}
+
+std::vector<std::pair<std::string, std::vector<size_t>>> Client::groupByServer(const std::vector<std::string>& keys) {
+    std::map<std::string, std::vector<size_t>> groups;
+    for (size_t i = 0; i < keys.size(); i++) {
+        auto server = serverOf(keys[i]);
+        if (!server.has_value()) {
+            std::cerr << "no server is responsible for " << keys[i] << "\n";
+            continue;
+        }
+        groups[server.value()].push_back(i);
+    }
+    return {groups.begin(), groups.end()};
+}
+
 // helper for getting key-value server stubs given a key. returns nullptr on error
 std::unique_ptr<Shardkv::Stub> Client::getKVStub(const std::string key) {
     // get servername
-    unsigned int key_id = (unsigned int)extractID(key);
-    auto addr = configuration.GetServer(key_id);
+    auto addr = serverOf(key);
     if(!addr.has_value()) {
         // not sure how we could get this case UNLESS we have just never run query, so we'll just do that I guess
         // oh I guess this could happen if the key is out of range too... think more about this - can we assume it
@@ -199,6 +356,5 @@ std::unique_ptr<Shardkv::Stub> Client::getKVStub(const std::string key) {
         Query();
         return nullptr;
     }
-    auto channel = grpc::CreateChannel(addr.value(), grpc::InsecureChannelCredentials());
-    return Shardkv::NewStub(channel);
+    return ChannelPool::Shared().Stub<Shardkv>(addr.value());
 }
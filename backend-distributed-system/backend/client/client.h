@@ -7,11 +7,14 @@
 
 #include <grpcpp/grpcpp.h>
 #include <map>
+#include <mutex>
+#include <optional>
 #include <vector>
 
 #include "../build/shardmaster.grpc.pb.h"
 #include "../build/shardkv.grpc.pb.h"
 #include "../common/common.h"
+#include "../common/channel_pool.h"
 #include "../config/config.h"
 
 using grpc::Channel;
@@ -22,10 +25,14 @@ class Client {
     using Empty = google::protobuf::Empty;
 public:
     explicit Client(const std::string& addr) :
-        stub(Shardmaster::NewStub(grpc::CreateChannel(addr, grpc::InsecureChannelCredentials()))) {}
+        stub(ChannelPool::Shared().Stub<Shardmaster>(addr)) {}
 
     void Query();
 
+    // from now on, keeps the configuration up to date in the background
+    // through the shardmaster's Watch stream
+    void Watch();
+
     void Join(const std::string& server);
 
     void Leave(const std::vector<std::string>& servers);
@@ -42,14 +49,39 @@ public:
 
     void Delete(const std::string& key);
 
+    // like Get and Delete for every one of keys, with a single request to
+    // every server responsible for some of them, all sent at the same time
+    void MultiGet(const std::vector<std::string>& keys);
+
+    // like Put (with no user_id) for every one of entries, {key, value}
+    void MultiPut(const std::vector<std::pair<std::string, std::string>>& entries);
+
+    void MultiDelete(const std::vector<std::string>& keys);
+
 private:
+    // groups the indices of keys by the server responsible for them, as far
+    // as we know, in server order
+    std::vector<std::pair<std::string, std::vector<size_t>>> groupByServer(const std::vector<std::string>& keys);
+
     // helper for getting stubs to shardkv servers given a key
     std::unique_ptr<Shardkv::Stub> getKVStub(const std::string key);
 
+    // helper for getting the server responsible for a key, if we know it
+    std::optional<std::string> serverOf(const std::string& key);
+
+    // replaces the configuration with response, unless it is older
+    void setConfig(const QueryResponse& response);
+
     // grpc stub
     std::unique_ptr<Shardmaster::Stub> stub;
 
+    // guards configuration, configEpoch and configVersion, which the Watch
+    // thread updates
+    std::mutex configMutex;
     Config configuration;
+    // see QueryResponse
+    uint64_t configEpoch = 0;
+    uint64_t configVersion = 0;
 };
 
 
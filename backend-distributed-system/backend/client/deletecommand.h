@@ -2,13 +2,13 @@
 #define SHARDING_DELETECOMMAND_H
 
 
-#include "../repl/regexcommand.h"
+#include "../repl/tokencommand.h"
 #include "client.h"
 
-class DeleteCommand : public RegexCommand {
+class DeleteCommand : public TokenCommand {
 public:
     // matches: del <key>
-    explicit DeleteCommand(Client& cl) : RegexCommand("del .+"), client(cl) {}
+    explicit DeleteCommand(Client& cl) : TokenCommand("del", 1, 1), client(cl) {}
     void Handle(const std::string& line) override;
     void PrintHelpMessage() override ;
 private:
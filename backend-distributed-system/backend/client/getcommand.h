@@ -6,13 +6,13 @@
 #define SHARDING_GETCOMMAND_H
 
 
-#include "../repl/regexcommand.h"
+#include "../repl/tokencommand.h"
 #include "client.h"
 
-class GetCommand : public RegexCommand {
+class GetCommand : public TokenCommand {
 public:
     // matches: get <key>
-    explicit GetCommand(Client& cl) : RegexCommand("get .+"), client(cl) {}
+    explicit GetCommand(Client& cl) : TokenCommand("get", 1, 1), client(cl) {}
     void Handle(const std::string& line) override;
     void PrintHelpMessage() override ;
 private:
@@ -5,17 +5,17 @@
 #ifndef SHARDING_JOINCOMMAND_H
 #define SHARDING_JOINCOMMAND_H
 
-#include <regex>
-
-#include "../repl/regexcommand.h"
+#include "../repl/tokencommand.h"
 #include "client.h"
 
-class JoinCommand : public RegexCommand {
+class JoinCommand : public TokenCommand {
 public:
     // matches: join <server>
-    explicit JoinCommand(Client& cl) : RegexCommand("join .*:\\d+"), client(cl) {}
+    explicit JoinCommand(Client& cl) : TokenCommand("join", 1, 1), client(cl) {}
     void Handle(const std::string& line) override;
     void PrintHelpMessage() override;
+protected:
+    bool ValidArg(size_t /*i*/, std::string_view arg) override { return IsAddress(arg); }
 private:
     Client& client;
 };
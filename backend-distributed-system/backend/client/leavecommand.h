@@ -6,15 +6,17 @@
 #define SHARDING_LEAVECOMMAND_H
 
 
-#include "../repl/regexcommand.h"
+#include "../repl/tokencommand.h"
 #include "client.h"
 
-class LeaveCommand : public RegexCommand {
+class LeaveCommand : public TokenCommand {
 public:
     // Match: leave <server1> <server2> ... <serverN>
-    explicit LeaveCommand(Client& cl): RegexCommand("leave .*:\\d+( .*:\\d+)*"), client(cl) {}
+    explicit LeaveCommand(Client& cl): TokenCommand("leave", 1), client(cl) {}
     void Handle(const std::string& line) override;
     void PrintHelpMessage() override ;
+protected:
+    bool ValidArg(size_t /*i*/, std::string_view arg) override { return IsAddress(arg); }
 private:
     Client& client;
 };
@@ -15,6 +15,9 @@
 #include "appendcommand.h"
 #include "putcommand.h"
 #include "deletecommand.h"
+#include "mgetcommand.h"
+#include "mputcommand.h"
+#include "mdeletecommand.h"
 
 using namespace std;
 
@@ -28,6 +31,8 @@ int main(int argc, char **argv) {
     const string addr = string(argv[1]) + ":" + string(argv[2]);
     // construct client
     Client client(addr);
+    // follow configuration changes instead of relying on explicit queries
+    client.Watch();
 
     // construct repl and add commands
     Repl repl;
@@ -47,6 +52,12 @@ int main(int argc, char **argv) {
     repl.AddCommand(ac);
     DeleteCommand dc(client);
     repl.AddCommand(dc);
+    MultiGetCommand mgc(client);
+    repl.AddCommand(mgc);
+    MultiPutCommand mpc(client);
+    repl.AddCommand(mpc);
+    MultiDeleteCommand mdc(client);
+    repl.AddCommand(mdc);
 
     // now start repl
     repl.Start();
@@ -0,0 +1,14 @@
+#include "mdeletecommand.h"
+#include "../common/common.h"
+
+using namespace std;
+
+void MultiDeleteCommand::Handle(const std::string &line) {
+    vector<string> tokens = split(line);
+    assert(tokens.size() >= 2);
+    client.MultiDelete(vector<string>(tokens.begin() + 1, tokens.end()));
+}
+
+void MultiDeleteCommand::PrintHelpMessage() {
+    std::cout << "mdel <key> [<key> ...]\ndeletes every <key> that exists, with one request per server\n";
+}
@@ -0,0 +1,19 @@
+#ifndef SHARDING_MDELETECOMMAND_H
+#define SHARDING_MDELETECOMMAND_H
+
+
+#include "../repl/tokencommand.h"
+#include "client.h"
+
+class MultiDeleteCommand : public TokenCommand {
+public:
+    // matches: mdel <key> [<key> ...]
+    explicit MultiDeleteCommand(Client& cl) : TokenCommand("mdel", 1), client(cl) {}
+    void Handle(const std::string& line) override;
+    void PrintHelpMessage() override ;
+private:
+    Client& client;
+};
+
+
+#endif //SHARDING_MDELETECOMMAND_H
@@ -0,0 +1,14 @@
+#include "mgetcommand.h"
+#include "../common/common.h"
+
+using namespace std;
+
+void MultiGetCommand::Handle(const std::string &line) {
+    vector<string> tokens = split(line);
+    assert(tokens.size() >= 2);
+    client.MultiGet(vector<string>(tokens.begin() + 1, tokens.end()));
+}
+
+void MultiGetCommand::PrintHelpMessage() {
+    std::cout << "mget <key> [<key> ...]\nretrieves the values associated with every <key>, with one request per server\n";
+}
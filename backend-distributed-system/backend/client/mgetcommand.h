@@ -0,0 +1,19 @@
+#ifndef SHARDING_MGETCOMMAND_H
+#define SHARDING_MGETCOMMAND_H
+
+
+#include "../repl/tokencommand.h"
+#include "client.h"
+
+class MultiGetCommand : public TokenCommand {
+public:
+    // matches: mget <key> [<key> ...]
+    explicit MultiGetCommand(Client& cl) : TokenCommand("mget", 1), client(cl) {}
+    void Handle(const std::string& line) override;
+    void PrintHelpMessage() override ;
+private:
+    Client& client;
+};
+
+
+#endif //SHARDING_MGETCOMMAND_H
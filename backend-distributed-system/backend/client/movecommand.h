@@ -6,15 +6,19 @@
 #define SHARDING_MOVECOMMAND_H
 
 
-#include "../repl/regexcommand.h"
+#include "../repl/tokencommand.h"
 #include "client.h"
 
-class MoveCommand : public RegexCommand {
+class MoveCommand : public TokenCommand {
 public:
     // Matches: move <server> <lower> <upper>
-    explicit MoveCommand(Client& cl): RegexCommand("move .*:\\d+ \\d+ \\d+"), client(cl) {}
+    explicit MoveCommand(Client& cl): TokenCommand("move", 3, 3), client(cl) {}
     void Handle(const std::string& line) override;
     void PrintHelpMessage() override;
+protected:
+    bool ValidArg(size_t i, std::string_view arg) override {
+        return i == 0 ? IsAddress(arg) : IsNumber(arg);
+    }
 private:
     Client& client;
 };
@@ -0,0 +1,23 @@
+#include "mputcommand.h"
+#include "../common/common.h"
+
+using namespace std;
+
+bool MultiPutCommand::Matches(const std::string &line) {
+    // the name and pairs of arguments
+    return TokenCommand::Matches(line) && split(line).size() % 2 == 1;
+}
+
+void MultiPutCommand::Handle(const std::string &line) {
+    vector<string> tokens = split(line);
+    assert(tokens.size() >= 3 && tokens.size() % 2 == 1);
+    vector<pair<string, string>> entries;
+    for (size_t i = 1; i < tokens.size(); i += 2) {
+        entries.push_back({tokens[i], tokens[i + 1]});
+    }
+    client.MultiPut(entries);
+}
+
+void MultiPutCommand::PrintHelpMessage() {
+    std::cout << "mput <key> <value> [<key> <value> ...]\ninserts a mapping of every <key> to the <value> after it (a single word, with no user_id), with one request per server\n";
+}
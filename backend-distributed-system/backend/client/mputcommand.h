@@ -0,0 +1,20 @@
+#ifndef SHARDING_MPUTCOMMAND_H
+#define SHARDING_MPUTCOMMAND_H
+
+
+#include "../repl/tokencommand.h"
+#include "client.h"
+
+class MultiPutCommand : public TokenCommand {
+public:
+    // matches: mput <key> <value> [<key> <value> ...]
+    explicit MultiPutCommand(Client& cl) : TokenCommand("mput", 2), client(cl) {}
+    bool Matches(const std::string& line) override;
+    void Handle(const std::string& line) override;
+    void PrintHelpMessage() override ;
+private:
+    Client& client;
+};
+
+
+#endif //SHARDING_MPUTCOMMAND_H
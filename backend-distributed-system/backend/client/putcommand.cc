@@ -3,27 +3,26 @@
 //
 
 #include "putcommand.h"
-#include "../common/common.h"
+#include "../common/tokenizer.h"
 
 using namespace std;
 
 void PutCommand::Handle(const std::string &line) {
-    // TODO this may need to be redone because of whitespace in the data they're trying to add.
-    //  for now we will ignore, clean it up later
-    vector<string> tokens = split(line);
-    assert(tokens.size() >= 3);
-    if(tokens.size() == 3){
-        string user_id = tokens[1];
-        string user_name = tokens[2];
-        client.Put(user_id, user_name, "");
+    Tokenizer tokens(line);
+    string_view command, key;
+    tokens.Next(&command);
+    tokens.Next(&key);
+    // the value is the rest of the line as it was typed, whitespace included,
+    // except for the last word which is the user_id if there is more than one
+    string_view value = tokens.Rest();
+    value.remove_suffix(value.size() - (value.find_last_not_of(WHITESPACE) + 1));
+    size_t last = value.find_last_of(WHITESPACE);
+    if(last == string_view::npos){
+        client.Put(string(key), string(value), "");
     }else{
-        string key = tokens[1];
-        string user_id = tokens[tokens.size()-1];
-        string value = tokens[2];
-        for(int i = 3; i < tokens.size()-1; i++){
-            value += " " + tokens[i];
-        }
-        client.Put(key, value, user_id);
+        string_view user_id = value.substr(last + 1);
+        value = value.substr(0, value.find_last_not_of(WHITESPACE, last) + 1);
+        client.Put(string(key), string(value), string(user_id));
     }
 }
 
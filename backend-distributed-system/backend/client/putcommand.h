@@ -6,13 +6,13 @@
 #define SHARDING_PUTCOMMAND_H
 
 
-#include "../repl/regexcommand.h"
+#include "../repl/tokencommand.h"
 #include "client.h"
 
-class PutCommand : public RegexCommand {
+class PutCommand : public TokenCommand {
 public:
-    // match: put <key> <value>
-    explicit PutCommand(Client& cl) : RegexCommand("put .+"), client(cl) {}
+    // match: put <key> <value> [user_id]
+    explicit PutCommand(Client& cl) : TokenCommand("put", 2), client(cl) {}
     void Handle(const std::string& line) override;
     void PrintHelpMessage() override;
 private:
@@ -6,12 +6,12 @@
 #define SHARDING_QUERYCOMMAND_H
 
 
-#include "../repl/regexcommand.h"
+#include "../repl/tokencommand.h"
 #include "client.h"
 
-class QueryCommand : public RegexCommand {
+class QueryCommand : public TokenCommand {
 public:
-    explicit QueryCommand(Client& cl) : RegexCommand("query"), client(cl) {}
+    explicit QueryCommand(Client& cl) : TokenCommand("query", 0, 0), client(cl) {}
     void Handle(const std::string& line) override;
     void PrintHelpMessage() override;
 private:
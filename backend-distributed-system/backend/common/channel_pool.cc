@@ -0,0 +1,86 @@
+#include "channel_pool.h"
+#include <algorithm>
+#include <random>
+
+namespace {
+
+bool is_transport_failure(const grpc::Status& status) {
+  return status.error_code() == grpc::StatusCode::UNAVAILABLE ||
+         status.error_code() == grpc::StatusCode::DEADLINE_EXCEEDED;
+}
+
+std::shared_ptr<grpc::Channel> create_channel(const std::string& addr) {
+  grpc::ChannelArguments args;
+  // grpc's own reconnect backoff goes up to two minutes, far too long for a
+  // channel kept around while the server at the other end restarts
+  args.SetInt(GRPC_ARG_INITIAL_RECONNECT_BACKOFF_MS, 100);
+  args.SetInt(GRPC_ARG_MIN_RECONNECT_BACKOFF_MS, 100);
+  args.SetInt(GRPC_ARG_MAX_RECONNECT_BACKOFF_MS, 1000);
+  return grpc::CreateCustomChannel(addr, grpc::InsecureChannelCredentials(), args);
+}
+
+}  // namespace
+
+ChannelPool& ChannelPool::Shared() {
+  static ChannelPool pool;
+  return pool;
+}
+
+std::shared_ptr<grpc::Channel> ChannelPool::Get(const std::string& addr) {
+  auto now = std::chrono::steady_clock::now();
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (now - _last_eviction > _idle_timeout / 2) {
+    _evict_idle(now);
+    _last_eviction = now;
+  }
+  pooled_channel_t& c = _channels[addr];
+  if (c.channel == nullptr) {
+    c.channel = create_channel(addr);
+  }
+  c.last_used = now;
+  return c.channel;
+}
+
+std::chrono::milliseconds ChannelPool::Report(const std::string& addr,
+                                              const grpc::Status& status) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  auto it = _channels.find(addr);
+  if (it == _channels.end()) {
+    // evicted in the meantime, nothing to keep track of
+    return status.ok() ? std::chrono::milliseconds(0) : RETRY_BACKOFF_INITIAL;
+  }
+  pooled_channel_t& c = it->second;
+  if (status.ok()) {
+    c.failures = 0;
+    return std::chrono::milliseconds(0);
+  }
+  c.failures++;
+  if (is_transport_failure(status) && c.failures % RECREATE_AFTER_FAILURES == 0) {
+    // whoever still holds the old channel keeps it, the next Get makes a new one
+    c.channel = nullptr;
+  }
+  std::chrono::milliseconds backoff = std::min(
+      RETRY_BACKOFF_MAX, RETRY_BACKOFF_INITIAL * (1 << std::min(c.failures - 1, 16)));
+  // up to 25% of jitter, so that callers failing together do not all come
+  // back at the same time
+  thread_local std::minstd_rand rng(std::random_device{}());
+  return backoff + std::chrono::milliseconds(
+      std::uniform_int_distribution<long>(0, backoff.count() / 4)(rng));
+}
+
+size_t ChannelPool::Size() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _channels.size();
+}
+
+void ChannelPool::_evict_idle(std::chrono::steady_clock::time_point now) {
+  for (auto it = _channels.begin(); it != _channels.end();) {
+    const pooled_channel_t& c = it->second;
+    bool in_use = c.channel != nullptr && c.channel.use_count() > 1;
+    if (!in_use && now - c.last_used > _idle_timeout) {
+      it = _channels.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
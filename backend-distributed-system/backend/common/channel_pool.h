@@ -0,0 +1,75 @@
+#ifndef SHARDING_CHANNEL_POOL_H
+#define SHARDING_CHANNEL_POOL_H
+
+#include <grpcpp/grpcpp.h>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// a channel nobody but the pool holds is closed after this long without use
+constexpr std::chrono::milliseconds CHANNEL_IDLE_TIMEOUT(60000);
+// wait before retrying a server after a failed call: doubles with every
+// consecutive failure, from the initial to the max value
+constexpr std::chrono::milliseconds RETRY_BACKOFF_INITIAL(50);
+constexpr std::chrono::milliseconds RETRY_BACKOFF_MAX(2000);
+// after this many consecutive transport failures (UNAVAILABLE,
+// DEADLINE_EXCEEDED) the channel is thrown away and a new one is created
+constexpr int RECREATE_AFTER_FAILURES = 3;
+
+// Channels to the other servers, keyed by address and shared by every thread
+// of the process. A grpc::Channel is thread safe and multiplexes calls over a
+// single connection, so there is no point in paying for a new one (name
+// resolution, TCP and HTTP/2 handshakes) on every call.
+//
+// Callers report how their calls went: consecutive failures make Report
+// return an increasing backoff to wait before the next attempt, and a channel
+// that keeps failing at the transport level is replaced by a fresh one.
+// Channels that only the pool still holds are dropped once idle for long
+// enough.
+class ChannelPool {
+ public:
+  // the pool used by everyone in the process
+  static ChannelPool& Shared();
+
+  explicit ChannelPool(std::chrono::milliseconds idle_timeout = CHANNEL_IDLE_TIMEOUT)
+      : _idle_timeout(idle_timeout) {}
+
+  // the channel to addr, created on first use
+  std::shared_ptr<grpc::Channel> Get(const std::string& addr);
+
+  // a stub of Service (Shardkv, Shardmaster) on the channel to addr. stubs are
+  // cheap; loops that retry should get a new one every time around, so that
+  // they pick up a channel the pool replaced
+  template <typename Service>
+  std::unique_ptr<typename Service::Stub> Stub(const std::string& addr) {
+    return Service::NewStub(Get(addr));
+  }
+
+  // records the outcome of a call to addr. returns how long to wait before
+  // calling addr again: zero if status is ok, otherwise a backoff that grows
+  // with the number of consecutive failures
+  std::chrono::milliseconds Report(const std::string& addr, const grpc::Status& status);
+
+  size_t Size();
+
+ private:
+  typedef struct pooled_channel {
+    std::shared_ptr<grpc::Channel> channel;
+    std::chrono::steady_clock::time_point last_used;
+    // consecutive failed calls reported
+    int failures = 0;
+  } pooled_channel_t;
+
+  // drops the channels nobody else holds that have not been used for
+  // _idle_timeout. called with _mutex held
+  void _evict_idle(std::chrono::steady_clock::time_point now);
+
+  const std::chrono::milliseconds _idle_timeout;
+  std::mutex _mutex;
+  std::unordered_map<std::string, pooled_channel_t> _channels;
+  std::chrono::steady_clock::time_point _last_eviction;
+};
+
+#endif  // SHARDING_CHANNEL_POOL_H
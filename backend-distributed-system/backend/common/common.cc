@@ -1,8 +1,8 @@
 #include "common.h"
+#include "tokenizer.h"
 #include <algorithm>
 #include <cassert>
-#include <regex>
-#include <cstring>
+#include <stdexcept>
 
 void sortAscendingInterval(std::vector<shard_t>& shards) {
   std::sort(
@@ -12,12 +12,12 @@ void sortAscendingInterval(std::vector<shard_t>& shards) {
 
 size_t size(const shard_t& s) { return s.upper - s.lower + 1; }
 
-bool shard_has_key(const shard_t& s, unsigned int key) { return s.lower <= key && key <= s.upper; }
+bool shard_has_key(const shard_t& s, uint64_t key) { return s.lower <= key && key <= s.upper; }
 
 std::pair<shard_t, shard_t> split_shard(const shard_t& s) {
   // can't get midpoint of size 1 shard
   assert(s.lower < s.upper);
-  unsigned int midpoint = s.lower + ((s.upper - s.lower) / 2);
+  uint64_t midpoint = s.lower + ((s.upper - s.lower) / 2);
   return std::make_pair<shard_t, shard_t>({s.lower, midpoint},
                                           {midpoint + 1, s.upper});
 }
@@ -29,7 +29,7 @@ std::vector<shard_t> split_shard(const shard_t& s, size_t num_shards) {
   size_t remainder = size(s) % num_shards;
   std::vector<shard_t> shards;
 
-  unsigned int lower = s.lower, upper;
+  uint64_t lower = s.lower, upper;
   for(size_t i = 0; i < num_shards; i++) {
     upper = lower + shard_size - (i < remainder ? 0 : 1);
     shards.push_back({lower, upper});
@@ -40,7 +40,7 @@ std::vector<shard_t> split_shard(const shard_t& s, size_t num_shards) {
   return shards;
 }
 
-std::pair<shard_t, shard_t> split_shard_at(const shard_t& s, unsigned int pos) {
+std::pair<shard_t, shard_t> split_shard_at(const shard_t& s, uint64_t pos) {
   return std::make_pair<shard_t, shard_t>({s.lower, pos}, {pos + 1, s.upper});
 }
 
@@ -69,7 +69,7 @@ void sortDescendingSize(std::vector<shard_t>& shards) {
 size_t shardRangeSize(const std::vector<shard_t>& vec) {
   size_t tot = 0;
   for (const shard_t& s : vec) {
-    tot += size(vec);
+    tot += size(s);
   }
   return tot;
 }
@@ -111,38 +111,46 @@ OverlapStatus get_overlap(const shard_t& a, const shard_t& b) {
   }
 }
 
-std::vector<std::string> split(const std::string& s) {
-  std::vector<std::string> v;
-  std::regex ws_re("\\s+");  // whitespace
-  std::copy(std::sregex_token_iterator(s.begin(), s.end(), ws_re, -1),
-            std::sregex_token_iterator(), std::back_inserter(v));
-  return v;
+std::vector<std::string> split(std::string_view s) {
+  return parse_value(s, WHITESPACE);
 }
 
-std::vector<std::string> parse_value(std::string val, std::string delim) {
+std::vector<std::string> parse_value(std::string_view val, std::string_view delim) {
   std::vector<std::string> tokens;
-
-  char *save;
-  char *tok = strtok_r((char *)val.c_str(), delim.c_str(), &save);
-  while(tok != NULL){
-    tokens.push_back(std::string(tok));
-    tok = strtok_r(NULL, delim.c_str(), &save);
+  Tokenizer tokenizer(val, delim);
+  for (std::string_view token; tokenizer.Next(&token);) {
+    tokens.emplace_back(token);
   }
-
   return tokens;
 }
 
-int extractID(std::string key){
-  std::vector<std::string> tokens;
-
-  char *save;
-  char *tok = strtok_r((char *)key.c_str(), "_", &save);
-  while(tok != NULL){
-    tokens.push_back(std::string(tok));
-    tok = strtok_r(NULL, "_", &save);
+parsed_key_t parse_key(std::string_view key) {
+  parsed_key_t parsed{KeyType::OTHER, 0};
+  size_t sep = key.find('_');
+  if (sep != std::string_view::npos) {
+    for (size_t i = sep + 1; i < key.size() && key[i] >= '0' && key[i] <= '9'; i++) {
+      parsed.id = parsed.id * 10 + (key[i] - '0');
+    }
   }
-  
-  assert(tokens.size() > 1); //illformed key
+  std::string_view prefix = key.substr(0, sep == std::string_view::npos ? key.size() : sep + 1);
+  if (key == "all_users") {
+    parsed.type = KeyType::ALL_USERS;
+  } else if (prefix == "outbox_") {
+    parsed.type = KeyType::OUTBOX;
+  } else if (prefix == "post_") {
+    parsed.type = KeyType::POST;
+  } else if (prefix == "user_") {
+    const std::string_view posts = "_posts";
+    bool is_posts = key.size() > posts.size() &&
+                    key.substr(key.size() - posts.size()) == posts;
+    parsed.type = is_posts ? KeyType::USER_POSTS : KeyType::USER;
+  }
+  return parsed;
+}
+
+uint64_t extractID(std::string_view key){
+  size_t sep = key.find('_');
+  assert(sep != std::string_view::npos && sep + 1 < key.size()); //illformed key
 
-  return stoi(tokens[1]);
+  return parse_key(key).id;
 }
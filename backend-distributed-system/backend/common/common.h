@@ -1,7 +1,9 @@
 #ifndef SHARDING_COMMON_H
 #define SHARDING_COMMON_H
 
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <iostream>
 
@@ -9,21 +11,23 @@
 /* ====== Definitions ====== */
 /* ========================= */
 
-// thresholds for shard splitting and merging
-// ignore these unless you implement part 4
+// thresholds for shard splitting and merging, in requests per second: a
+// shardmaster balancing the load splits shards busier than HOT_THRESH, and
+// merges neighbouring shards of a server together quieter than COLD_THRESH
 constexpr unsigned int HOT_THRESH = 100;
 constexpr unsigned int COLD_THRESH = 10;
 
-// range of keys -- be sure to use these as your bounds
-// when sharding in any part of the project
-constexpr unsigned int MIN_KEY = 0;
-constexpr unsigned int MAX_KEY = 1000;
+// range of keys a shardmaster shards, unless it is given another one (see
+// shardmaster_options_t). the shardmaster sends the range it uses with every
+// configuration, so nothing but the shardmaster should rely on these
+constexpr uint64_t MIN_KEY = 0;
+constexpr uint64_t MAX_KEY = 1000;
 
 // a simple struct to represent a shard!
 // lower should be always be <= higher
 typedef struct shard {
-  unsigned int lower;
-  unsigned int upper;
+  uint64_t lower;
+  uint64_t upper;
 
   bool operator==(const shard& rhs) const {
     return lower == rhs.lower && upper == rhs.upper;
@@ -37,6 +41,15 @@ typedef struct shard {
   }
 } shard_t;
 
+// the requests a server got for a shard over some period, and where to cut
+// the shard to split them in halves: [lower, split] and [split + 1, upper]
+typedef struct shard_load {
+  shard_t shard;
+  // requests per second
+  double rate;
+  uint64_t split;
+} shard_load_t;
+
 // An enum used to represent the overlap between two shards - returned by the
 // get_overlap function
 enum class OverlapStatus {
@@ -74,13 +87,13 @@ std::pair<shard_t, shard_t> split_shard(const shard_t& s);
 std::vector<shard_t> split_shard(const shard_t& s, size_t num_shards);
 
 // tells if key is in shard s
-bool shard_has_key(const shard_t& s, unsigned int key);
+bool shard_has_key(const shard_t& s, uint64_t key);
 
 // splits a shard into two shards at the given position. assumes that pos is
 // between the lower and upper bounds of the shard. if that's not the case, will
 // have undefined behavior.
 // note that pos will be contained in the first shard of the returned pair.
-std::pair<shard_t, shard_t> split_shard_at(const shard_t& s, unsigned int pos);
+std::pair<shard_t, shard_t> split_shard_at(const shard_t& s, uint64_t pos);
 
 // splits a shard by extracting s_sub from s. assumes that s_sub is a subset of
 // s. if that's not the case, will have undefined behavior.
@@ -94,14 +107,36 @@ std::pair<shard_t, std::vector<shard_t>> extract_shard(const shard_t& s, const s
 // RPC!
 OverlapStatus get_overlap(const shard_t& a, const shard_t& b);
 
-// utility function for splitting strings on whitespace
-std::vector<std::string> split(const std::string& s);
+// utility function for splitting strings on whitespace. see Tokenizer
+// (tokenizer.h) to go through the words without copying them
+std::vector<std::string> split(std::string_view s);
+
+// like split, but for an arbitrary set of delimiters
+std::vector<std::string> parse_value(std::string_view val, std::string_view delim);
+
+// what a key holds
+enum class KeyType : uint8_t {
+  USER,        // user_<id>
+  USER_POSTS,  // user_<id>_posts
+  POST,        // post_<id>
+  ALL_USERS,   // all_users
+  OUTBOX,      // outbox_<key>, kept by a server for itself (see Outbox)
+  OTHER
+};
+
+// a key as the servers route it: what it holds, and the id that places it
+// in a shard
+typedef struct parsed_key {
+  KeyType type;
+  uint64_t id;
+} parsed_key_t;
 
-// like split, but for an arbitrary delimiter 
-std::vector<std::string> parse_value(std::string val, std::string delim);
+// parses key, without copying it. id is the number after the first '_', or
+// 0 if there is none. ids past UINT64_MAX wrap around
+parsed_key_t parse_key(std::string_view key);
 
 //extracts the ID number out of the key
 //you may find the utility helpful when implementing shardmaster
-int extractID(std::string key);
+uint64_t extractID(std::string_view key);
 
 #endif  // SHARDING_COMMON_H
@@ -0,0 +1,48 @@
+#include "hash_ring.h"
+#include <algorithm>
+
+void HashRing::Build(const std::vector<std::string>& servers, uint32_t vnodes) {
+  std::vector<std::pair<uint64_t, uint16_t>> points;
+  points.reserve(servers.size() * vnodes);
+  for (size_t s = 0; s < servers.size(); s++)
+    for (uint32_t v = 0; v < vnodes; v++)
+      points.push_back({Point(servers[s], v), (uint16_t)s});
+  // points that collide go to the server that comes first by name, so that
+  // the order servers are given in does not matter
+  std::sort(points.begin(), points.end(), [&servers](const auto& a, const auto& b) {
+    if (a.first != b.first) return a.first < b.first;
+    return servers[a.second] < servers[b.second];
+  });
+  _points.clear();
+  _owners.clear();
+  for (const auto& [point, owner] : points) {
+    if (!_points.empty() && _points.back() == point) continue;
+    _points.push_back(point);
+    _owners.push_back(owner);
+  }
+}
+
+void HashRing::Clear() {
+  _points.clear();
+  _owners.clear();
+}
+
+uint16_t HashRing::OwnerOfHash(uint64_t hash) const {
+  if (_points.empty()) {
+    return NONE;
+  }
+  // the first point at or after the hash, or the first one of all if there
+  // is none
+  size_t i = std::lower_bound(_points.begin(), _points.end(), hash) - _points.begin();
+  return _owners[i == _points.size() ? 0 : i];
+}
+
+uint64_t HashRing::Point(std::string_view server, uint32_t vnode) {
+  // FNV-1a of the address, then mixed together with the vnode number
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (char c : server) {
+    h ^= (unsigned char)c;
+    h *= 0x100000001b3ULL;
+  }
+  return _mix(h ^ _mix(vnode));
+}
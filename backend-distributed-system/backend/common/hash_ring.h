@@ -0,0 +1,58 @@
+#ifndef SHARDING_HASH_RING_H
+#define SHARDING_HASH_RING_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// virtual nodes every server gets on the ring, unless told otherwise
+constexpr uint32_t DEFAULT_VNODES = 128;
+
+// Consistent hashing of key ids onto servers. Every server has vnodes points
+// on a ring of 64-bit hashes, and an id belongs to the server of the first
+// point at or after the hash of the id, wrapping around. Ids created one
+// after the other land on unrelated servers, and a server joining or leaving
+// only takes or gives up the ids next to its own points.
+//
+// The frontend (shard_config.py) places ids the same way, so Point and
+// HashId must not change.
+class HashRing {
+ public:
+  // the index of no server
+  static constexpr uint16_t NONE = UINT16_MAX;
+
+  // puts vnodes points of every server on the ring, replacing what was
+  // there. servers are then designated by their index in servers
+  void Build(const std::vector<std::string>& servers, uint32_t vnodes);
+  void Clear();
+  bool Empty() const { return _points.empty(); }
+
+  // the index of the server holding id, or NONE if the ring is empty
+  uint16_t OwnerOf(uint64_t id) const { return OwnerOfHash(HashId(id)); }
+  // the same, for the ids whose hash is hash
+  uint16_t OwnerOfHash(uint64_t hash) const;
+  // the points, in ascending order
+  const std::vector<uint64_t>& Points() const { return _points; }
+
+  // where id is on the ring
+  static uint64_t HashId(uint64_t id) { return _mix(id); }
+  // where the vnode-th point of server is on the ring
+  static uint64_t Point(std::string_view server, uint32_t vnode);
+
+ private:
+  // the splitmix64 finalizer: every bit of x changes about half of the bits
+  // of the result
+  static uint64_t _mix(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+  }
+
+  // the points, in ascending order, and the index of the server of each
+  std::vector<uint64_t> _points;
+  std::vector<uint16_t> _owners;
+};
+
+#endif  // SHARDING_HASH_RING_H
@@ -0,0 +1,178 @@
+#include "log.h"
+
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <thread>
+
+namespace {
+
+const char LEVEL_LETTERS[] = {'D', 'I', 'W', 'E'};
+
+// hh:mm:ss.uuuuuu L line
+void format(int64_t time, LogLevel level, const std::string& line, std::string* out) {
+  time_t seconds = time / 1000000;
+  struct tm local;
+  localtime_r(&seconds, &local);
+  char prefix[32];
+  snprintf(prefix, sizeof(prefix), "%02d:%02d:%02d.%06lld %c ", local.tm_hour, local.tm_min,
+           local.tm_sec, (long long)(time % 1000000), LEVEL_LETTERS[static_cast<int>(level)]);
+  *out += prefix;
+  *out += line;
+  *out += '\n';
+}
+
+void write_all(const std::string& data) {
+  size_t done = 0;
+  while (done < data.size()) {
+    ssize_t n = write(STDERR_FILENO, data.data() + done, data.size() - done);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return;
+    done += n;
+  }
+}
+
+thread_local std::ostringstream line_stream;
+thread_local bool line_stream_taken = false;
+
+}  // namespace
+
+LogLine::LogLine(LogLevel level) : _level(level) {
+  if (line_stream_taken) {
+    _own = std::make_unique<std::ostringstream>();
+    _stream = _own.get();
+    return;
+  }
+  line_stream_taken = true;
+  // as new: empty, and without the manipulators of the last line
+  line_stream.str("");
+  line_stream.clear();
+  line_stream.flags(std::ios_base::dec | std::ios_base::skipws);
+  line_stream.precision(6);
+  line_stream.fill(' ');
+  _stream = &line_stream;
+}
+
+LogLine::~LogLine() {
+  Logger::Shared().Log(_level, _stream->str());
+  if (!_own) line_stream_taken = false;
+}
+
+std::optional<LogLevel> parse_log_level(const std::string& name) {
+  if (name == "debug") return LogLevel::DEBUG;
+  if (name == "info") return LogLevel::INFO;
+  if (name == "warn") return LogLevel::WARN;
+  if (name == "error") return LogLevel::ERROR;
+  if (name == "off") return LogLevel::OFF;
+  return std::nullopt;
+}
+
+Logger& Logger::Shared() {
+  // never destroyed: threads may still log while the process exits
+  static Logger* logger = new Logger();
+  return *logger;
+}
+
+Logger::Logger() : _level(LogLevel::INFO) {
+  const char* level = getenv("SHARDING_LOG_LEVEL");
+  if (level) {
+    if (auto parsed = parse_log_level(level))
+      _level = *parsed;
+  }
+  std::thread flusher([this]() {
+    while (true) {
+      std::this_thread::sleep_for(FLUSH_INTERVAL);
+      Flush();
+    }
+  });
+  flusher.detach();
+  // whatever is still buffered when main returns or exit is called
+  atexit([]() { Logger::Shared().Flush(); });
+}
+
+Logger::ring_t& Logger::_ring() {
+  // tells the flusher when the thread is gone
+  struct owner {
+    std::shared_ptr<ring_t> ring;
+    ~owner() {
+      if (ring) ring->orphaned.store(true, std::memory_order_release);
+    }
+  };
+  static thread_local owner self;
+  if (!self.ring) {
+    self.ring = std::make_shared<ring_t>();
+    self.ring->refilled = std::chrono::steady_clock::now();
+    self.ring->tokens = _rate.load(std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(_rings_mutex);
+    _rings.push_back(self.ring);
+  }
+  return *self.ring;
+}
+
+bool Logger::_admit(ring_t& r) {
+  uint32_t rate = _rate.load(std::memory_order_relaxed);
+  if (rate == 0) return true;
+  auto now = std::chrono::steady_clock::now();
+  std::chrono::duration<double> elapsed = now - r.refilled;
+  r.refilled = now;
+  r.tokens = std::min<double>(rate, r.tokens + elapsed.count() * rate);
+  if (r.tokens < 1) return false;
+  r.tokens -= 1;
+  return true;
+}
+
+void Logger::Log(LogLevel level, std::string line) {
+  ring_t& r = _ring();
+  uint64_t head = r.head.load(std::memory_order_relaxed);
+  if (!_admit(r) || head - r.tail.load(std::memory_order_acquire) >= RING_SLOTS) {
+    r.dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  auto now = std::chrono::system_clock::now().time_since_epoch();
+  record_t& slot = r.slots[head % RING_SLOTS];
+  slot.time = std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+  slot.level = level;
+  slot.line = std::move(line);
+  r.head.store(head + 1, std::memory_order_release);
+}
+
+void Logger::Flush() {
+  std::lock_guard<std::mutex> flush_lock(_flush_mutex);
+  std::vector<std::shared_ptr<ring_t>> rings;
+  {
+    std::lock_guard<std::mutex> lock(_rings_mutex);
+    rings = _rings;
+  }
+  std::vector<record_t> records;
+  uint64_t dropped = 0;
+  for (const auto& r : rings) {
+    // orphaned is read first: once it is set, the owner logs nothing more
+    // and what head says is all there is
+    bool orphaned = r->orphaned.load(std::memory_order_acquire);
+    uint64_t head = r->head.load(std::memory_order_acquire);
+    uint64_t tail = r->tail.load(std::memory_order_relaxed);
+    for (; tail < head; tail++)
+      records.push_back(std::move(r->slots[tail % RING_SLOTS]));
+    r->tail.store(tail, std::memory_order_release);
+    dropped += r->dropped.exchange(0, std::memory_order_relaxed);
+    if (orphaned) {
+      std::lock_guard<std::mutex> lock(_rings_mutex);
+      _rings.erase(std::find(_rings.begin(), _rings.end(), r));
+    }
+  }
+  if (records.empty() && dropped == 0) return;
+  // the lines of every thread, in the order they were logged
+  std::stable_sort(records.begin(), records.end(),
+                   [](const record_t& a, const record_t& b) { return a.time < b.time; });
+  std::string out;
+  for (const auto& record : records) format(record.time, record.level, record.line, &out);
+  if (dropped) {
+    auto now = std::chrono::system_clock::now().time_since_epoch();
+    format(std::chrono::duration_cast<std::chrono::microseconds>(now).count(), LogLevel::WARN,
+           std::to_string(dropped) + " lines dropped (rate limit or full buffer)", &out);
+  }
+  write_all(out);
+}
@@ -0,0 +1,126 @@
+#ifndef SHARDING_LOG_H
+#define SHARDING_LOG_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+enum class LogLevel { DEBUG, INFO, WARN, ERROR, OFF };
+
+// debug, info, warn, error or off
+std::optional<LogLevel> parse_log_level(const std::string& name);
+
+// The process-wide log, written to stderr. Logging a line never waits on
+// stderr or on another thread: the line goes into a ring buffer of the
+// calling thread, which only that thread writes and only the flusher thread
+// reads, and the flusher writes out what every thread logged every
+// FLUSH_INTERVAL, with one write. A thread that logs more than the rate
+// limit, or faster than the flusher keeps up with, loses the lines that do
+// not fit, and the flusher says how many.
+//
+// Lines below the level (INFO unless SHARDING_LOG_LEVEL says otherwise) are
+// not even formatted, see LOG.
+class Logger {
+ public:
+  static constexpr size_t RING_SLOTS = 1024;
+  static constexpr std::chrono::milliseconds FLUSH_INTERVAL{20};
+  // lines every thread may log per second, in bursts of as many
+  static constexpr uint32_t DEFAULT_RATE_LIMIT = 1000;
+
+  static Logger& Shared();
+
+  void SetLevel(LogLevel level) { _level.store(level, std::memory_order_relaxed); }
+  LogLevel Level() const { return _level.load(std::memory_order_relaxed); }
+  bool Enabled(LogLevel level) const { return level >= Level() && level != LogLevel::OFF; }
+  // 0 for no limit
+  void SetRateLimit(uint32_t lines_per_second) { _rate.store(lines_per_second, std::memory_order_relaxed); }
+
+  void Log(LogLevel level, std::string line);
+  // writes out every line logged so far, before returning
+  void Flush();
+
+ private:
+  typedef struct record {
+    // microseconds since the epoch
+    int64_t time;
+    LogLevel level;
+    std::string line;
+  } record_t;
+
+  typedef struct ring {
+    record_t slots[RING_SLOTS];
+    // slots up to head are written by the owner, slots up to tail are read
+    std::atomic<uint64_t> head{0};
+    std::atomic<uint64_t> tail{0};
+    // lines the owner could not log, since the flusher last looked (the
+    // flusher resets it)
+    std::atomic<uint64_t> dropped{0};
+    // set once the owner exited, for the flusher to let go of the ring
+    std::atomic<bool> orphaned{false};
+    // the owner's token bucket
+    double tokens = 0;
+    std::chrono::steady_clock::time_point refilled;
+  } ring_t;
+
+  Logger();
+  // the ring of the calling thread, created on its first line
+  ring_t& _ring();
+  // whether the rate limit lets the owner of r log one more line
+  bool _admit(ring_t& r);
+
+  std::atomic<LogLevel> _level;
+  std::atomic<uint32_t> _rate{DEFAULT_RATE_LIMIT};
+  // guards _rings
+  std::mutex _rings_mutex;
+  std::vector<std::shared_ptr<ring_t>> _rings;
+  // only one thread at a time reads the rings and writes to stderr
+  std::mutex _flush_mutex;
+};
+
+// One line of the log, handed to the Logger when it goes out of scope. It is
+// formatted in a stream every thread keeps for that, rather than a new one
+// for every line.
+class LogLine {
+ public:
+  explicit LogLine(LogLevel level);
+  ~LogLine();
+  LogLine(const LogLine&) = delete;
+  LogLine& operator=(const LogLine&) = delete;
+
+  template <typename T>
+  LogLine& operator<<(T&& value) {
+    *_stream << std::forward<T>(value);
+    return *this;
+  }
+
+ private:
+  LogLevel _level;
+  std::ostringstream* _stream;
+  // set when the stream of the thread is already taken, by a line logged
+  // while formatting another one
+  std::unique_ptr<std::ostringstream> _own;
+};
+
+// turns a LogLine and what was streamed into it into void, for both arms of
+// the conditional in LOG. & binds looser than << and tighter than ?:
+class LogVoidify {
+ public:
+  void operator&(const LogLine&) {}
+};
+
+// LOG(INFO) << "a line, " << with << " anything ostream takes";
+// nothing after the << is evaluated when the level is not enabled. a single
+// expression, so it is safe in an if or else without braces
+#define LOG(level)                                   \
+  !Logger::Shared().Enabled(LogLevel::level) ? (void)0 \
+                                             : LogVoidify() & LogLine(LogLevel::level)
+
+#endif  // SHARDING_LOG_H
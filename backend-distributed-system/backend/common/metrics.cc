@@ -0,0 +1,250 @@
+#include "metrics.h"
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <thread>
+
+namespace {
+
+std::atomic<uint64_t> next_id{1};
+
+// name{labels}, or name{labels,extra}
+std::string series(const std::string& name, const std::string& labels,
+                   const std::string& extra = "") {
+  std::string all = labels.empty() ? extra : extra.empty() ? labels : labels + "," + extra;
+  return all.empty() ? name : name + "{" + all + "}";
+}
+
+std::string seconds(double ns) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.9g", ns / 1e9);
+  return buf;
+}
+
+}  // namespace
+
+thread_local Metrics::_thread_cells_t Metrics::_thread_cells;
+
+Metrics::thread_cells::~thread_cells() {
+  for (auto& e : entries) {
+    if (auto pool = e.pool.lock()) {
+      std::lock_guard<std::mutex> lock(pool->mutex);
+      pool->free.push_back(e.cells);
+    }
+  }
+}
+
+Metrics::Metrics() : _id(next_id++), _pool(std::make_shared<_pool_t>()) {}
+
+// a thread that outlives us keeps a pointer to its cells in _thread_cells,
+// which it never follows again: no other Metrics has our _id, and our pool
+// is gone when it exits
+Metrics::~Metrics() = default;
+
+size_t Metrics::Histogram(const std::string& name, const std::string& help,
+                          const std::string& labels) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  assert(_histograms.size() < MAX_HISTOGRAMS);
+  _histograms.push_back({name, help, labels});
+  return _histograms.size() - 1;
+}
+
+size_t Metrics::Counter(const std::string& name, const std::string& help,
+                        const std::string& labels) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  assert(_counters.size() < MAX_COUNTERS);
+  _counters.push_back({name, help, labels});
+  return _counters.size() - 1;
+}
+
+Metrics::_cells_t& Metrics::_new_cells() {
+  // entries of Metrics that are gone
+  auto& entries = _thread_cells.entries;
+  entries.erase(std::remove_if(entries.begin(), entries.end(),
+                               [](const auto& e) { return e.pool.expired(); }),
+                entries.end());
+  _cells_t* cells;
+  {
+    std::lock_guard<std::mutex> lock(_pool->mutex);
+    if (!_pool->free.empty()) {
+      // what the thread that had them recorded stays in them
+      cells = _pool->free.back();
+      _pool->free.pop_back();
+    } else {
+      // zeroed
+      _pool->all.push_back(std::make_unique<_cells_t>());
+      cells = _pool->all.back().get();
+    }
+  }
+  entries.push_back({_id, _pool, cells});
+  return *cells;
+}
+
+uint64_t Metrics::BucketBound(size_t b) {
+  if (b == 0) return 1024;
+  if (b >= BUCKETS - 1) return UINT64_MAX;
+  // bucket 1 + 2 * (msb - 10) + half holds [2^(msb - 1) * (2 + half), 2^(msb - 1) * (3 + half))
+  size_t msb = (b - 1) / 2 + 10, half = (b - 1) % 2;
+  return (uint64_t{1} << (msb - 1)) * (3 + half);
+}
+
+double Metrics::histogram_stats::Quantile(double q) const {
+  if (count == 0) return 0;
+  double rank = q * count;
+  uint64_t below = 0;
+  for (size_t b = 0; b < buckets.size(); b++) {
+    if (below + buckets[b] >= rank && buckets[b] > 0) {
+      double lower = b == 0 ? 0 : BucketBound(b - 1);
+      double upper = b == BUCKETS - 1 ? max : BucketBound(b);
+      double at = lower + (upper - lower) * (rank - below) / buckets[b];
+      return std::min(at, (double)max);
+    }
+    below += buckets[b];
+  }
+  return max;
+}
+
+std::vector<Metrics::histogram_stats_t> Metrics::CollectHistograms() const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  std::lock_guard<std::mutex> pool_lock(_pool->mutex);
+  std::vector<histogram_stats_t> all(_histograms.size());
+  for (size_t h = 0; h < _histograms.size(); h++) {
+    histogram_stats_t& s = all[h];
+    s.name = _histograms[h].name;
+    s.labels = _histograms[h].labels;
+    s.buckets.resize(BUCKETS);
+    for (const auto& cells : _pool->all) {
+      for (size_t b = 0; b < BUCKETS; b++) {
+        uint64_t n = cells->buckets[h][b].load(std::memory_order_relaxed);
+        s.buckets[b] += n;
+        s.count += n;
+      }
+      s.sum += cells->sums[h].load(std::memory_order_relaxed);
+      s.max = std::max(s.max, cells->maxes[h].load(std::memory_order_relaxed));
+    }
+  }
+  return all;
+}
+
+std::vector<Metrics::counter_stats_t> Metrics::CollectCounters() const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  std::lock_guard<std::mutex> pool_lock(_pool->mutex);
+  std::vector<counter_stats_t> all(_counters.size());
+  for (size_t c = 0; c < _counters.size(); c++) {
+    all[c].name = _counters[c].name;
+    all[c].labels = _counters[c].labels;
+    for (const auto& cells : _pool->all)
+      all[c].value += cells->counters[c].load(std::memory_order_relaxed);
+  }
+  return all;
+}
+
+void Metrics::Fill(StatsResponse* response) const {
+  for (const auto& h : CollectHistograms()) {
+    HistogramStats* out = response->add_histograms();
+    out->set_name(h.name);
+    out->set_labels(h.labels);
+    out->set_count(h.count);
+    out->set_sum_us(h.sum / 1e3);
+    out->set_p50_us(h.Quantile(0.5) / 1e3);
+    out->set_p99_us(h.Quantile(0.99) / 1e3);
+    out->set_p999_us(h.Quantile(0.999) / 1e3);
+    out->set_max_us(h.max / 1e3);
+  }
+  for (const auto& c : CollectCounters()) {
+    CounterStats* out = response->add_counters();
+    out->set_name(c.name);
+    out->set_labels(c.labels);
+    out->set_value(c.value);
+  }
+}
+
+std::string Metrics::Prometheus() const {
+  std::vector<definition_t> histograms, counters;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    histograms = _histograms;
+    counters = _counters;
+  }
+  std::string out;
+  // the series of a metric have to come together, after its HELP and TYPE
+  auto header = [&out](const std::string& name, const std::string& help, const char* type) {
+    out += "# HELP " + name + " " + help + "\n# TYPE " + name + " " + type + "\n";
+  };
+  auto hs = CollectHistograms();
+  for (size_t i = 0; i < hs.size(); i++) {
+    if (std::find_if(histograms.begin(), histograms.begin() + i,
+                     [&](const definition_t& d) { return d.name == hs[i].name; }) != histograms.begin() + i)
+      continue;
+    header(hs[i].name, histograms[i].help, "histogram");
+    for (size_t j = i; j < hs.size(); j++) {
+      const histogram_stats_t& h = hs[j];
+      if (h.name != hs[i].name) continue;
+      uint64_t cumulative = 0;
+      for (size_t b = 0; b < BUCKETS; b++) {
+        cumulative += h.buckets[b];
+        std::string le = b == BUCKETS - 1 ? "+Inf" : seconds(BucketBound(b));
+        out += series(h.name + "_bucket", h.labels, "le=\"" + le + "\"") + " " +
+               std::to_string(cumulative) + "\n";
+      }
+      out += series(h.name + "_sum", h.labels) + " " + seconds(h.sum) + "\n";
+      out += series(h.name + "_count", h.labels) + " " + std::to_string(h.count) + "\n";
+    }
+  }
+  auto cs = CollectCounters();
+  for (size_t i = 0; i < cs.size(); i++) {
+    if (std::find_if(counters.begin(), counters.begin() + i,
+                     [&](const definition_t& d) { return d.name == cs[i].name; }) != counters.begin() + i)
+      continue;
+    header(cs[i].name, counters[i].help, "counter");
+    for (size_t j = i; j < cs.size(); j++)
+      if (cs[j].name == cs[i].name)
+        out += series(cs[j].name, cs[j].labels) + " " + std::to_string(cs[j].value) + "\n";
+  }
+  return out;
+}
+
+bool ServeMetrics(int port, std::function<std::string()> render) {
+  int fd = socket(AF_INET6, SOCK_STREAM, 0);
+  if (fd < 0) return false;
+  int on = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  sockaddr_in6 addr = {};
+  addr.sin6_family = AF_INET6;
+  addr.sin6_addr = in6addr_any;
+  addr.sin6_port = htons(port);
+  if (bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+    close(fd);
+    return false;
+  }
+  std::thread([fd, render = std::move(render)]() {
+    while (true) {
+      int conn = accept(fd, nullptr, nullptr);
+      if (conn < 0) continue;
+      // whatever was asked for, the answer is the same: read the request
+      // up to its blank line and drop it
+      std::string request;
+      char buf[1024];
+      while (request.find("\r\n\r\n") == std::string::npos && request.size() < 16384) {
+        ssize_t n = read(conn, buf, sizeof(buf));
+        if (n <= 0) break;
+        request.append(buf, n);
+      }
+      std::string body = render();
+      std::string response =
+          "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+          std::to_string(body.size()) + "\r\n\r\n" + body;
+      for (size_t sent = 0; sent < response.size();) {
+        ssize_t n = write(conn, response.data() + sent, response.size() - sent);
+        if (n <= 0) break;
+        sent += n;
+      }
+      close(conn);
+    }
+  }).detach();
+  return true;
+}
@@ -0,0 +1,167 @@
+#ifndef SHARDING_METRICS_H
+#define SHARDING_METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "../build/shardmaster.pb.h"
+
+// Latency histograms and counters of one server, for the Stats RPC and the
+// Prometheus endpoint (ServeMetrics). Every thread that records something
+// gets cells of its own, which only it writes to, so recording takes no lock
+// and no atomic read-modify-write: a lookup of the thread's cells, a bucket
+// increment and, for histograms, a sum and a max. Collect adds up the cells
+// of every thread, whenever someone asks. The cells of a thread that exits
+// are taken over, counts and all, by the next thread that records, so there
+// are never more cells than threads recording at the same time.
+//
+// Histograms and counters are registered up front (Histogram, Counter), by
+// the name and labels Prometheus shows them under. Registering can happen
+// at any time, the rest can be called concurrently with anything.
+class Metrics {
+ public:
+  static constexpr size_t MAX_HISTOGRAMS = 64;
+  static constexpr size_t MAX_COUNTERS = 32;
+  // bucket 0 holds latencies under 1024 ns, then every power of two is cut in
+  // two buckets, up to about 50 s; the last bucket holds everything above
+  static constexpr size_t BUCKETS = 53;
+
+  typedef struct histogram_stats {
+    std::string name;
+    std::string labels;
+    uint64_t count = 0;
+    // in nanoseconds
+    uint64_t sum = 0;
+    uint64_t max = 0;
+    std::vector<uint64_t> buckets;
+    // the latency under which fraction q of the samples are, interpolated
+    // inside its bucket
+    double Quantile(double q) const;
+  } histogram_stats_t;
+
+  typedef struct counter_stats {
+    std::string name;
+    std::string labels;
+    uint64_t value = 0;
+  } counter_stats_t;
+
+  Metrics();
+  ~Metrics();
+  Metrics(const Metrics&) = delete;
+  Metrics& operator=(const Metrics&) = delete;
+
+  // registers a latency histogram, labels as Prometheus has them (rpc="Get"),
+  // and returns what to pass to Record
+  size_t Histogram(const std::string& name, const std::string& help,
+                   const std::string& labels = "");
+  size_t Counter(const std::string& name, const std::string& help,
+                 const std::string& labels = "");
+
+  void Record(size_t histogram, std::chrono::nanoseconds elapsed) {
+    uint64_t ns = elapsed.count() > 0 ? elapsed.count() : 0;
+    _cells_t& c = _cells();
+    _bump(c.buckets[histogram][_bucket(ns)], 1);
+    _bump(c.sums[histogram], ns);
+    if (ns > c.maxes[histogram].load(std::memory_order_relaxed))
+      c.maxes[histogram].store(ns, std::memory_order_relaxed);
+  }
+  void Add(size_t counter, uint64_t n = 1) { _bump(_cells().counters[counter], n); }
+
+  // records the time from its creation to its destruction
+  class Timer {
+   public:
+    Timer(Metrics* metrics, size_t histogram)
+        : _metrics(metrics), _histogram(histogram), _start(std::chrono::steady_clock::now()) {}
+    ~Timer() { _metrics->Record(_histogram, std::chrono::steady_clock::now() - _start); }
+
+   private:
+    Metrics* _metrics;
+    size_t _histogram;
+    std::chrono::steady_clock::time_point _start;
+  };
+
+  // the sum over every thread, in the order things were registered
+  std::vector<histogram_stats_t> CollectHistograms() const;
+  std::vector<counter_stats_t> CollectCounters() const;
+  // the same, as a Stats RPC answers it
+  void Fill(StatsResponse* response) const;
+  // in the Prometheus text format (latencies in seconds)
+  std::string Prometheus() const;
+
+  // the upper bound of bucket b, in nanoseconds (UINT64_MAX for the last)
+  static uint64_t BucketBound(size_t b);
+
+ private:
+  typedef struct cells {
+    std::atomic<uint64_t> buckets[MAX_HISTOGRAMS][BUCKETS];
+    std::atomic<uint64_t> sums[MAX_HISTOGRAMS];
+    std::atomic<uint64_t> maxes[MAX_HISTOGRAMS];
+    std::atomic<uint64_t> counters[MAX_COUNTERS];
+  } _cells_t;
+
+  // the cells of every thread that recorded something, shared with the
+  // threads so that they can hand theirs back when they exit
+  typedef struct pool {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<_cells_t>> all;
+    // of all, the cells of threads that exited
+    std::vector<_cells_t*> free;
+  } _pool_t;
+
+  // the cells of the calling thread, one per Metrics it recorded to
+  typedef struct thread_cells {
+    typedef struct entry {
+      uint64_t id;
+      std::weak_ptr<_pool_t> pool;
+      _cells_t* cells;
+    } entry_t;
+    std::vector<entry_t> entries;
+    // hands the cells back to the pools still there
+    ~thread_cells();
+  } _thread_cells_t;
+
+  typedef struct definition {
+    std::string name;
+    std::string help;
+    std::string labels;
+  } definition_t;
+
+  static size_t _bucket(uint64_t ns) {
+    if (ns < 1024) return 0;
+    int msb = 63 - __builtin_clzll(ns);
+    size_t b = 1 + 2 * (msb - 10) + ((ns >> (msb - 1)) & 1);
+    return b < BUCKETS ? b : BUCKETS - 1;
+  }
+  // only the thread owning a cell writes to it
+  static void _bump(std::atomic<uint64_t>& cell, uint64_t n) {
+    cell.store(cell.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+  // the cells of the calling thread, taken on its first call
+  _cells_t& _cells() {
+    for (const auto& e : _thread_cells.entries)
+      if (e.id == _id) return *e.cells;
+    return _new_cells();
+  }
+  _cells_t& _new_cells();
+
+  // tells apart the Metrics of the servers in one process, in _thread_cells
+  const uint64_t _id;
+  // guards the definitions; taken before _pool->mutex
+  mutable std::mutex _mutex;
+  std::vector<definition_t> _histograms;
+  std::vector<definition_t> _counters;
+  const std::shared_ptr<_pool_t> _pool;
+  static thread_local _thread_cells_t _thread_cells;
+};
+
+// answers every HTTP request on port with render(), in a detached thread, for
+// Prometheus to scrape. returns false if the port cannot be listened on
+bool ServeMetrics(int port, std::function<std::string()> render);
+
+#endif  // SHARDING_METRICS_H
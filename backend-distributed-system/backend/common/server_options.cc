@@ -0,0 +1,71 @@
+#include "server_options.h"
+
+#include <grpcpp/resource_quota.h>
+#include <optional>
+
+const char SERVER_FLAGS_USAGE[] =
+    "[--server-mode=sync|callback] [--cqs=<N>] [--cq-threads=<MIN>[,<MAX>]] "
+    "[--max-threads=<N>] [--max-memory-mb=<MB>] [--max-message-mb=<MB>] "
+    "[--keepalive-ms=<MS>] [--keepalive-timeout-ms=<MS>]";
+
+bool parse_server_flag(const std::string& flag, server_options_t* options) {
+  auto value = [&flag](const std::string& name) -> std::optional<std::string> {
+    if (flag.rfind(name + "=", 0) != 0) return std::nullopt;
+    return flag.substr(name.size() + 1);
+  };
+  if (flag == "--server-mode=sync") {
+    options->mode = ServerMode::SYNC;
+  } else if (flag == "--server-mode=callback") {
+    options->mode = ServerMode::CALLBACK;
+  } else if (auto n = value("--cqs")) {
+    options->cqs = std::stoi(*n);
+  } else if (auto n = value("--cq-threads")) {
+    // MIN, or MIN,MAX
+    size_t comma = n->find(',');
+    options->min_pollers = std::stoi(n->substr(0, comma));
+    options->max_pollers = comma == std::string::npos ? options->min_pollers : std::stoi(n->substr(comma + 1));
+  } else if (auto n = value("--max-threads")) {
+    options->max_threads = std::stoi(*n);
+  } else if (auto mb = value("--max-memory-mb")) {
+    options->max_memory_bytes = std::stoul(*mb) << 20;
+  } else if (auto mb = value("--max-message-mb")) {
+    options->max_message_bytes = std::stoi(*mb) << 20;
+  } else if (auto ms = value("--keepalive-ms")) {
+    options->keepalive = std::chrono::milliseconds(std::stoul(*ms));
+  } else if (auto ms = value("--keepalive-timeout-ms")) {
+    options->keepalive_timeout = std::chrono::milliseconds(std::stoul(*ms));
+  } else {
+    return false;
+  }
+  return true;
+}
+
+std::unique_ptr<grpc::Server> StartServer(const std::string& addr, const server_options_t& options,
+                                          grpc::Service* service) {
+  grpc::ServerBuilder builder;
+  builder.AddListeningPort(addr, grpc::InsecureServerCredentials());
+  builder.RegisterService(service);
+  if (options.cqs) builder.SetSyncServerOption(grpc::ServerBuilder::SyncServerOption::NUM_CQS, options.cqs);
+  if (options.min_pollers)
+    builder.SetSyncServerOption(grpc::ServerBuilder::SyncServerOption::MIN_POLLERS, options.min_pollers);
+  if (options.max_pollers)
+    builder.SetSyncServerOption(grpc::ServerBuilder::SyncServerOption::MAX_POLLERS, options.max_pollers);
+  if (options.max_threads || options.max_memory_bytes) {
+    grpc::ResourceQuota quota("server");
+    if (options.max_threads) quota.SetMaxThreads(options.max_threads);
+    if (options.max_memory_bytes) quota.Resize(options.max_memory_bytes);
+    builder.SetResourceQuota(quota);
+  }
+  if (options.max_message_bytes) {
+    builder.SetMaxReceiveMessageSize(options.max_message_bytes);
+    builder.SetMaxSendMessageSize(options.max_message_bytes);
+  }
+  if (options.keepalive.count()) {
+    builder.AddChannelArgument(GRPC_ARG_KEEPALIVE_TIME_MS, options.keepalive.count());
+    builder.AddChannelArgument(GRPC_ARG_KEEPALIVE_TIMEOUT_MS, options.keepalive_timeout.count());
+    // the servers keep their channels to each other open while idle
+    builder.AddChannelArgument(GRPC_ARG_KEEPALIVE_PERMIT_WITHOUT_CALLS, 1);
+    builder.AddChannelArgument(GRPC_ARG_HTTP2_MAX_PINGS_WITHOUT_DATA, 0);
+  }
+  return builder.BuildAndStart();
+}
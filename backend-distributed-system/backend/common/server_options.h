@@ -0,0 +1,52 @@
+#ifndef SHARDING_SERVER_OPTIONS_H
+#define SHARDING_SERVER_OPTIONS_H
+
+#include <grpcpp/grpcpp.h>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <string>
+
+// how a server serves its RPCs
+enum class ServerMode {
+  // every RPC holds a thread of the server's pool until it returns, waits
+  // included
+  SYNC,
+  // the unary RPCs are served by callbacks that finish once the answer is
+  // there (forwarded by another server, committed by the backup), without
+  // holding a thread while they wait. streams are still served as in SYNC
+  CALLBACK
+};
+
+typedef struct server_options {
+  ServerMode mode = ServerMode::SYNC;
+  // completion queues the synchronous part of the server polls, and the
+  // threads polling each of them, at least and at most. 0 for gRPC's default
+  int cqs = 0;
+  int min_pollers = 0;
+  int max_pollers = 0;
+  // threads the server may have at most, pollers and handlers alike, and
+  // memory it may use for its buffers. 0 for no limit
+  int max_threads = 0;
+  size_t max_memory_bytes = 0;
+  // largest message received or sent. 0 for gRPC's default (4 MB received)
+  int max_message_bytes = 0;
+  // pings clients idle for this long, and drops them if they do not answer
+  // within keepalive_timeout. 0 for no pings
+  std::chrono::milliseconds keepalive{0};
+  std::chrono::milliseconds keepalive_timeout{20000};
+} server_options_t;
+
+// the flags parse_server_flag takes, for usage messages
+extern const char SERVER_FLAGS_USAGE[];
+
+// sets what flag says in options, if it is one of SERVER_FLAGS_USAGE.
+// returns false if it is not
+bool parse_server_flag(const std::string& flag, server_options_t* options);
+
+// starts a server listening on addr and serving service (a Service for
+// ServerMode::SYNC, a callback service otherwise), as options say
+std::unique_ptr<grpc::Server> StartServer(const std::string& addr, const server_options_t& options,
+                                          grpc::Service* service);
+
+#endif  // SHARDING_SERVER_OPTIONS_H
@@ -0,0 +1,89 @@
+#include "shard_table.h"
+#include <algorithm>
+
+void ShardTable::Insert(const std::string& server, const shard_t& shard) {
+  uint16_t owner = IndexOf(server);
+  if (owner == NONE) {
+    owner = _servers.size();
+    _servers.push_back(server);
+  }
+  size_t i = std::lower_bound(_lowers.begin(), _lowers.end(), shard.lower) - _lowers.begin();
+  _lowers.insert(_lowers.begin() + i, shard.lower);
+  _uppers.insert(_uppers.begin() + i, shard.upper);
+  _owners.insert(_owners.begin() + i, owner);
+}
+
+void ShardTable::Assign(const std::vector<std::string>& servers,
+                        const std::vector<std::vector<shard_t>>& shards) {
+  Clear();
+  std::vector<std::pair<shard_t, uint16_t>> all;
+  for (size_t s = 0; s < servers.size(); s++) {
+    if (shards[s].empty()) continue;
+    for (const shard_t& shard : shards[s]) all.push_back({shard, (uint16_t)_servers.size()});
+    _servers.push_back(servers[s]);
+  }
+  std::sort(all.begin(), all.end(),
+            [](const auto& a, const auto& b) { return a.first.lower < b.first.lower; });
+  _lowers.reserve(all.size());
+  _uppers.reserve(all.size());
+  _owners.reserve(all.size());
+  for (const auto& [shard, owner] : all) {
+    _lowers.push_back(shard.lower);
+    _uppers.push_back(shard.upper);
+    _owners.push_back(owner);
+  }
+}
+
+void ShardTable::PlaceByHash(const std::vector<std::string>& servers, uint32_t vnodes,
+                             const shard_t& key_space) {
+  _servers = servers;
+  _key_space = key_space;
+  _ring.Build(_servers, vnodes);
+}
+
+void ShardTable::Clear() {
+  _lowers.clear();
+  _uppers.clear();
+  _owners.clear();
+  _servers.clear();
+  _ring.Clear();
+}
+
+uint16_t ShardTable::OwnerOf(uint64_t key) const {
+  if (Hashed()) {
+    return shard_has_key(_key_space, key) ? _ring.OwnerOf(key) : NONE;
+  }
+  size_t i = ShardOf(key);
+  return i == NO_SHARD ? NONE : _owners[i];
+}
+
+size_t ShardTable::ShardOf(uint64_t key) const {
+  if (_lowers.empty()) {
+    return NO_SHARD;
+  }
+  // the last shard starting at or before key (or the first one)
+  size_t i = _last_at_most(_lowers.data(), _lowers.size(), key);
+  if (key < _lowers[i] || key > _uppers[i]) {
+    return NO_SHARD;
+  }
+  return i;
+}
+
+size_t ShardTable::_last_at_most(const uint64_t* values, size_t n, uint64_t key) {
+  // a binary search without branches to mispredict, which fetches both
+  // halves it may go on with while it compares
+  const uint64_t* base = values;
+  while (n > 1) {
+    size_t half = n / 2;
+    __builtin_prefetch(base + half / 2);
+    __builtin_prefetch(base + half + half / 2);
+    base = base[half] <= key ? base + half : base;
+    n -= half;
+  }
+  return base - values;
+}
+
+uint16_t ShardTable::IndexOf(const std::string& server) const {
+  auto it = std::find(_servers.begin(), _servers.end(), server);
+  return it == _servers.end() ? NONE : it - _servers.begin();
+}
@@ -0,0 +1,74 @@
+#ifndef SHARDING_SHARD_TABLE_H
+#define SHARDING_SHARD_TABLE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "hash_ring.h"
+
+// Which server every shard of a configuration is on, as flat arrays of shard
+// bounds sorted by lower bound. Finding the server of a key is a binary
+// search over a few contiguous integers, and servers are designated by a
+// small index into Servers() rather than by their address, so that telling
+// whether a key is ours is an integer comparison.
+//
+// Keys can also be placed by consistent hashing (see HashRing) rather than
+// by shard, in which case the table has servers but no shards.
+class ShardTable {
+ public:
+  // the index of no server
+  static constexpr uint16_t NONE = UINT16_MAX;
+
+  // puts shard on server. shards must not overlap. linear in the number of
+  // shards already in the table: use Assign to build a whole configuration
+  void Insert(const std::string& server, const shard_t& shard);
+  // replaces the table with shards[i] on servers[i], for every i, in
+  // O(n log n). servers without shards are left out. shards must not overlap
+  void Assign(const std::vector<std::string>& servers,
+              const std::vector<std::vector<shard_t>>& shards);
+  // places every key of key_space on one of servers by consistent hashing,
+  // with vnodes points per server, instead of by shard. no shard must be
+  // inserted
+  void PlaceByHash(const std::vector<std::string>& servers, uint32_t vnodes,
+                   const shard_t& key_space);
+  bool Hashed() const { return !_ring.Empty(); }
+  void Clear();
+
+  // the index of no shard
+  static constexpr size_t NO_SHARD = SIZE_MAX;
+
+  // the index of the server holding key, or NONE if no shard covers it (or
+  // it is out of the key space, when keys are placed by hash)
+  uint16_t OwnerOf(uint64_t key) const;
+  // the index of the shard holding key, or NO_SHARD (always, when keys are
+  // placed by hash)
+  size_t ShardOf(uint64_t key) const;
+  // the index of server, or NONE if it holds no shard
+  uint16_t IndexOf(const std::string& server) const;
+  const std::string& Server(uint16_t index) const { return _servers[index]; }
+  // every server holding a shard (or on the ring), in the order they first
+  // got one
+  const std::vector<std::string>& Servers() const { return _servers; }
+
+  // the shards, in ascending order, and the index of the server of each
+  size_t NumShards() const { return _lowers.size(); }
+  shard_t Shard(size_t i) const { return {_lowers[i], _uppers[i]}; }
+  uint16_t ShardOwner(size_t i) const { return _owners[i]; }
+
+ private:
+  std::vector<uint64_t> _lowers;
+  std::vector<uint64_t> _uppers;
+  std::vector<uint16_t> _owners;
+  std::vector<std::string> _servers;
+  // empty unless keys are placed by hash
+  HashRing _ring;
+  shard_t _key_space{};
+
+  // the index of the last of the n sorted values at most key, or 0 if there
+  // is none
+  static size_t _last_at_most(const uint64_t* values, size_t n, uint64_t key);
+};
+
+#endif  // SHARDING_SHARD_TABLE_H
@@ -0,0 +1,53 @@
+#ifndef SHARDING_TOKENIZER_H
+#define SHARDING_TOKENIZER_H
+
+#include <cstddef>
+#include <string_view>
+
+// the characters split() and Tokenizer separate words on by default
+constexpr std::string_view WHITESPACE = " \t\n\v\f\r";
+
+// Walks the tokens of a string, separated by any of a set of delimiters,
+// as views into the string: nothing is copied or allocated, so the string
+// must outlive the tokens. Runs of delimiters count as one, and there are
+// no empty tokens.
+class Tokenizer {
+ public:
+  explicit Tokenizer(std::string_view s, std::string_view delims = WHITESPACE)
+      : _rest(s), _delims(delims) {}
+
+  // sets token to the next token. returns false if there is none left
+  bool Next(std::string_view* token) {
+    size_t start = _rest.find_first_not_of(_delims);
+    if (start == std::string_view::npos) {
+      _rest = {};
+      return false;
+    }
+    size_t end = _rest.find_first_of(_delims, start);
+    if (end == std::string_view::npos) end = _rest.size();
+    *token = _rest.substr(start, end - start);
+    _rest.remove_prefix(end);
+    return true;
+  }
+
+  // what is left of the string, from the next token on ("" if there is none)
+  std::string_view Rest() {
+    size_t start = _rest.find_first_not_of(_delims);
+    _rest.remove_prefix(start == std::string_view::npos ? _rest.size() : start);
+    return _rest;
+  }
+
+  // the number of tokens left, without consuming them
+  size_t Count() const {
+    Tokenizer copy = *this;
+    size_t n = 0;
+    for (std::string_view token; copy.Next(&token);) n++;
+    return n;
+  }
+
+ private:
+  std::string_view _rest;
+  std::string_view _delims;
+};
+
+#endif  // SHARDING_TOKENIZER_H
@@ -5,35 +5,43 @@
 #include "config.h"
 
 void Config::Print() {
+    if (shards.Hashed()) {
+        for (const auto& server : shards.Servers()) {
+            printf("Server %s on the hash ring\n", server.c_str());
+        }
+        return;
+    }
     // guaranteed iteration order, so it doesn't matter how these have been inserted
-    for(const auto&[upper, data] : shardToServer) {
-        printf("Shard {%d, %d} on server %s\n", data.lower, upper, data.server.c_str());
+    for (size_t i = 0; i < shards.NumShards(); i++) {
+        shard_t shard = shards.Shard(i);
+        printf("Shard {%llu, %llu} on server %s\n", (unsigned long long)shard.lower,
+               (unsigned long long)shard.upper,
+               shards.Server(shards.ShardOwner(i)).c_str());
     }
 }
 
-void Config::Insert(const std::string &server, const shard_t &shard) {
-    ServerAndLower s = {server, shard.lower};
-    shardToServer.emplace(shard.upper, s);
+void Config::Assign(const std::vector<std::string>& servers,
+                    const std::vector<std::vector<shard_t>>& shards) {
+    this->shards.Assign(servers, shards);
+}
+
+void Config::PlaceByHash(const std::vector<std::string>& servers, uint32_t vnodes,
+                         const shard_t& key_space) {
+    shards.PlaceByHash(servers, vnodes, key_space);
 }
 
-std::optional<std::string> Config::GetServer(unsigned int key) {
-    auto it = shardToServer.lower_bound(key);
-    if(it == shardToServer.end()) {
+std::optional<std::string> Config::GetServer(uint64_t key) {
+    uint16_t owner = shards.OwnerOf(key);
+    if (owner == ShardTable::NONE) {
         return std::nullopt;
     }
-    return std::optional<std::string>(it->second.server);
+    return shards.Server(owner);
 }
 
 std::vector<std::string> Config::AllServers() {
-    std::vector<std::string> servers;
-    auto it = shardToServer.begin();
-    while (it != shardToServer.end()) {
-        servers.push_back(it->second.server);
-        it++;
-    }
-    return servers;
+    return shards.Servers();
 }
 
 void Config::Clear() {
-    shardToServer.clear();
+    shards.Clear();
 }
@@ -10,21 +10,23 @@
 #include <vector>
 #include <optional>
 #include "../common/common.h"
-
-typedef struct {
-    std::string server;
-    unsigned int lower;
-} ServerAndLower;
+#include "../common/shard_table.h"
 
 class Config {
 public:
-    // inserts a server and a shard on that server
-    void Insert(const std::string& server, const shard_t& shard);
+    // puts shards[i] on servers[i], for every i, replacing the config
+    void Assign(const std::vector<std::string>& servers,
+                const std::vector<std::vector<shard_t>>& shards);
+
+    // places the keys of key_space on servers by consistent hashing, with
+    // vnodes points per server, rather than by shard
+    void PlaceByHash(const std::vector<std::string>& servers, uint32_t vnodes,
+                     const shard_t& key_space);
 
     // retrieves the server currently responsible for the given key. returns none if no such server exists
-    std::optional<std::string> GetServer(unsigned int key);
+    std::optional<std::string> GetServer(uint64_t key);
 
-    // returns list of all servers
+    // returns list of all servers, once each
     std::vector<std::string> AllServers();
 
     // deletes all entries from the config
@@ -32,9 +34,8 @@ public:
 
     void Print();
 private:
-    // we map the upper bound on a shard (i.e shard.upper) to the server that holds it and the lower bound
-    // of the shard
-    std::map<unsigned int, ServerAndLower> shardToServer;
+    // the shards, sorted, and the server holding each
+    ShardTable shards;
 };
 
 
@@ -5,31 +5,53 @@
 #include <iostream>
 
 #include "repl.h"
+#include "../common/tokenizer.h"
 
 void Repl::AddCommand(ReplCommand &command) {
     commands.push_back(&command);
+    if(command.Name().empty()) {
+        unnamed.push_back(&command);
+    } else {
+        by_name[command.Name()].push_back(&command);
+    }
 }
 
 void Repl::ProcessLine(const std::string& line) {
-    for(ReplCommand *c : commands) {
-        if(line == "help") {
+    if(line == "help") {
+        for(ReplCommand *c : commands) {
             c->PrintHelpMessage();
-        } else if(c->Matches(line)) {
-            c->Handle(line);
-            return;
         }
+        return;
     }
 
-    if(line == "help") {
-    	return;
+    // only the commands named after the first word of the line can match it
+    std::string_view first;
+    Tokenizer(line).Next(&first);
+    auto named = by_name.find(first);
+    if(named != by_name.end()) {
+        for(ReplCommand *c : named->second) {
+            if(c->Matches(line)) {
+                c->Handle(line);
+                return;
+            }
+        }
+    }
+    for(ReplCommand *c : unnamed) {
+        if(c->Matches(line)) {
+            c->Handle(line);
+            return;
+        }
     }
 
     std::cout << "invalid command: " << line << "\ntype 'help' for a list of commands\n";
 }
 
-void Repl::Start() {
+void Repl::Start(std::istream& in) {
     std::cout << "run 'help' for a list of commands\n";
-    for(std::string line; getline(std::cin, line);) {
+    // output goes out as it is written anyway (std::cout is synced with
+    // stdio), there is no need to flush it before reading every line
+    in.tie(nullptr);
+    for(std::string line; getline(in, line);) {
         ProcessLine(line);
     }
 }
@@ -5,6 +5,10 @@
 #ifndef SHARDING_REPL_H
 #define SHARDING_REPL_H
 
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 #include "replcommand.h"
@@ -12,12 +16,17 @@
 class Repl {
 public:
     void AddCommand(ReplCommand& command);
-    void Start();
-private:
+    // runs every line of in (standard input by default) until it ends
+    void Start(std::istream& in = std::cin);
     // handles a single line of input
     void ProcessLine(const std::string& line);
-
+private:
+    // every command, in the order they were added
     std::vector<ReplCommand*> commands;
+    // the commands that have a Name, by name
+    std::unordered_map<std::string_view, std::vector<ReplCommand*>> by_name;
+    // the commands that do not
+    std::vector<ReplCommand*> unnamed;
 };
 
 
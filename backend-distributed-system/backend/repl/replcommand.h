@@ -6,11 +6,15 @@
 #define SHARDING_REPLCOMMAND_H
 
 #include <string>
+#include <string_view>
 #include <vector>
-#include <regex>
 
 class ReplCommand {
 public:
+    // the word every line of this command starts with, which the Repl uses
+    // to find the command of a line without asking every command. empty if
+    // the command has no such word, and must be asked whether it Matches
+    virtual std::string_view Name() { return {}; }
     virtual bool Matches(const std::string& line) = 0;
     virtual void Handle(const std::string& line) = 0;
     // help text for this command
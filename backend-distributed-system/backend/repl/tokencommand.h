@@ -0,0 +1,58 @@
+#ifndef SHARDING_TOKENCOMMAND_H
+#define SHARDING_TOKENCOMMAND_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "replcommand.h"
+#include "../common/tokenizer.h"
+
+// implementation of ReplCommand for commands made of their name followed by
+// arguments separated by whitespace: a line matches if its first word is the
+// name and between min_args and max_args words follow it. Arguments are
+// checked one at a time with ValidArg, without copying the line
+class TokenCommand : public ReplCommand {
+public:
+    TokenCommand(std::string name, size_t min_args, size_t max_args = SIZE_MAX)
+        : name(std::move(name)), min_args(min_args), max_args(max_args) {}
+
+    std::string_view Name() override { return name; }
+
+    bool Matches(const std::string& line) override {
+        Tokenizer tokens(line);
+        std::string_view word;
+        if (!tokens.Next(&word) || word != name) {
+            return false;
+        }
+        size_t n = 0;
+        for (; tokens.Next(&word); n++) {
+            if (n == max_args || !ValidArg(n, word)) {
+                return false;
+            }
+        }
+        return n >= min_args;
+    }
+
+protected:
+    // whether arg can be argument i (from 0) of the command
+    virtual bool ValidArg(size_t /*i*/, std::string_view /*arg*/) { return true; }
+
+    // helpers for ValidArg
+    static bool IsNumber(std::string_view arg) {
+        return !arg.empty() && arg.find_first_not_of("0123456789") == std::string_view::npos;
+    }
+    // <host>:<port>
+    static bool IsAddress(std::string_view arg) {
+        size_t colon = arg.rfind(':');
+        return colon != std::string_view::npos && IsNumber(arg.substr(colon + 1));
+    }
+
+private:
+    std::string name;
+    size_t min_args;
+    size_t max_args;
+};
+
+
+#endif //SHARDING_TOKENCOMMAND_H
@@ -0,0 +1,42 @@
+#ifndef SHARDING_ENTRY_H
+#define SHARDING_ENTRY_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "member_set.h"
+
+// what we keep for every key. author is only set for post_ keys, so that a
+// post can be moved to another server together with the user who wrote it.
+// seq is the sequence number of the last mutation applied to the entry.
+// set-valued keys (all_users, user_<id>_posts: every key ever changed with
+// AddToList/RemoveFromList) keep their members in members instead of value
+typedef struct entry {
+  std::string value;
+  std::string author;
+  uint64_t seq = 0;
+  std::unique_ptr<MemberSet> members;
+
+  entry() = default;
+  entry(const entry& other)
+      : value(other.value), author(other.author), seq(other.seq),
+        members(other.members ? std::make_unique<MemberSet>(*other.members)
+                              : nullptr) {}
+  entry(entry&& other) = default;
+  entry& operator=(const entry& other) {
+    if (this != &other) *this = entry(other);
+    return *this;
+  }
+  entry& operator=(entry&& other) = default;
+
+  // the value as clients see it: set-valued keys read as a comma terminated
+  // list of their members. an entry about to be thrown away gives up its
+  // value instead of copying it
+  std::string Flatten() const& { return members ? members->Join() : value; }
+  std::string Flatten() && {
+    return members ? members->Join() : std::move(value);
+  }
+} entry_t;
+
+#endif  // SHARDING_ENTRY_H
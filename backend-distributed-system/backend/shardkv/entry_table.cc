@@ -0,0 +1,104 @@
+#include <functional>
+
+#include "entry_table.h"
+using namespace std;
+
+uint32_t EntryTable::_hash(string_view key) {
+    return hash<string_view>{}(key) >> 32;
+}
+
+size_t EntryTable::_slot_of(string_view key, uint32_t hash) const {
+    size_t mask = _index.size() - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        const slot_t& s = _index[i];
+        if (!s.pos || (s.hash == hash && _at(s.pos - 1).first == key))
+            return i;
+    }
+}
+
+size_t EntryTable::_slot_at(size_t pos) const {
+    size_t mask = _index.size() - 1;
+    for (size_t i = _hash(_at(pos).first) & mask;; i = (i + 1) & mask)
+        if (_index[i].pos == pos + 1)
+            return i;
+}
+
+EntryTable::iterator EntryTable::find(string_view key) {
+    if (_index.empty())
+        return end();
+    const slot_t& s = _index[_slot_of(key, _hash(key))];
+    return s.pos ? iterator(this, s.pos - 1) : end();
+}
+
+EntryTable::const_iterator EntryTable::find(string_view key) const {
+    if (_index.empty())
+        return end();
+    const slot_t& s = _index[_slot_of(key, _hash(key))];
+    return s.pos ? const_iterator(this, s.pos - 1) : end();
+}
+
+pair<EntryTable::iterator, bool> EntryTable::emplace(string key, entry_t e) {
+    if ((_size + 1) * 4 > _index.size() * 3)
+        _grow_index();
+    uint32_t hash = _hash(key);
+    slot_t& s = _index[_slot_of(key, hash)];
+    if (s.pos)
+        return {iterator(this, s.pos - 1), false};
+    if (_size == _slabs.size() * SLAB_ENTRIES)
+        _slabs.push_back(make_unique<value_type[]>(SLAB_ENTRIES));
+    value_type& v = _at(_size);
+    v.first = move(key);
+    v.second = move(e);
+    s = {hash, static_cast<uint32_t>(++_size)};
+    return {iterator(this, _size - 1), true};
+}
+
+void EntryTable::erase(iterator it) {
+    size_t pos = it._pos, last = _size - 1;
+    _free_slot(_slot_at(pos));
+    if (pos != last) {
+        _index[_slot_at(last)].pos = pos + 1;
+        _at(pos) = move(_at(last));
+    }
+    // leave the slot as a default constructed entry would be, releasing
+    // whatever memory it held
+    _at(last) = value_type();
+    _size--;
+    if (_size % SLAB_ENTRIES == 0 && _slabs.size() > _size / SLAB_ENTRIES + 1)
+        _slabs.pop_back();
+}
+
+void EntryTable::_free_slot(size_t i) {
+    size_t mask = _index.size() - 1;
+    _index[i] = {0, 0};
+    // backward shift deletion: every slot that follows, up to the next empty
+    // one, moves into the hole if the hole is on the way from its home slot
+    for (size_t j = (i + 1) & mask; _index[j].pos; j = (j + 1) & mask) {
+        size_t home = _index[j].hash & mask;
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            _index[i] = _index[j];
+            _index[j] = {0, 0};
+            i = j;
+        }
+    }
+}
+
+void EntryTable::_grow_index() {
+    vector<slot_t> old(max<size_t>(_index.size() * 2, 16));
+    old.swap(_index);
+    size_t mask = _index.size() - 1;
+    for (const slot_t& s : old) {
+        if (!s.pos)
+            continue;
+        size_t i = s.hash & mask;
+        while (_index[i].pos)
+            i = (i + 1) & mask;
+        _index[i] = s;
+    }
+}
+
+void EntryTable::clear() {
+    _slabs.clear();
+    _index.clear();
+    _size = 0;
+}
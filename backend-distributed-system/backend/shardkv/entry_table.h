@@ -0,0 +1,107 @@
+#ifndef SHARDING_ENTRY_TABLE_H
+#define SHARDING_ENTRY_TABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "entry.h"
+
+// Hash table from keys to their entry_t, laid out to keep the memory spent
+// per key low. Entries are kept back to back in fixed-size slabs, so there
+// is no allocation per entry, and keys and values short enough to be stored
+// inside their std::string (post_123, user_42_posts) take no memory of their
+// own. They are found through an open-addressing index of 8-byte slots,
+// each holding 32 bits of the hash of its key and where its entry is.
+//
+// Erasing an entry moves the last one into its place, so that entries stay
+// packed and walking the table is a scan of the slabs. This is the only
+// thing that moves entries: iterators and references stay valid until
+// something is erased (or the table cleared).
+class EntryTable {
+ public:
+  using value_type = std::pair<std::string, entry_t>;
+
+  template <typename Table, typename Value>
+  class Iterator {
+   public:
+    Iterator(Table* table, size_t pos) : _table(table), _pos(pos) {}
+    Value& operator*() const { return _table->_at(_pos); }
+    Value* operator->() const { return &_table->_at(_pos); }
+    Iterator& operator++() {
+      _pos++;
+      return *this;
+    }
+    bool operator==(const Iterator& other) const { return _pos == other._pos; }
+    bool operator!=(const Iterator& other) const { return _pos != other._pos; }
+
+   private:
+    friend class EntryTable;
+    Table* _table;
+    size_t _pos;
+  };
+  using iterator = Iterator<EntryTable, value_type>;
+  using const_iterator = Iterator<const EntryTable, const value_type>;
+
+  iterator begin() { return {this, 0}; }
+  iterator end() { return {this, _size}; }
+  const_iterator begin() const { return {this, 0}; }
+  const_iterator end() const { return {this, _size}; }
+  size_t size() const { return _size; }
+  bool empty() const { return _size == 0; }
+
+  iterator find(std::string_view key);
+  const_iterator find(std::string_view key) const;
+  // inserts e for key unless key is there already. returns where the entry
+  // of key is, and whether it was inserted
+  std::pair<iterator, bool> emplace(std::string key, entry_t e);
+  // the entry of key, inserted empty if needed
+  entry_t& operator[](const std::string& key) {
+    auto it = find(key);
+    return it != end() ? it->second : emplace(key, entry_t()).first->second;
+  }
+  // erases the entry at it, and moves the last entry into its place
+  void erase(iterator it);
+  void clear();
+
+ private:
+  // entries per slab
+  static constexpr size_t SLAB_ENTRIES = 256;
+
+  value_type& _at(size_t pos) {
+    return _slabs[pos / SLAB_ENTRIES][pos % SLAB_ENTRIES];
+  }
+  const value_type& _at(size_t pos) const {
+    return _slabs[pos / SLAB_ENTRIES][pos % SLAB_ENTRIES];
+  }
+  // the bits of the hash of key kept in the index. they are not the ones
+  // picking the stripe of the key (see KVStore), which are the same for
+  // every key of a table
+  static uint32_t _hash(std::string_view key);
+  // the index slot of key, or of the empty slot where it would go
+  size_t _slot_of(std::string_view key, uint32_t hash) const;
+  // the index slot pointing to the entry at pos
+  size_t _slot_at(size_t pos) const;
+  // empties index slot i, moving up the slots after it that would then be
+  // out of reach of their key
+  void _free_slot(size_t i);
+  void _grow_index();
+
+  // an index slot: hash bits of the key, and position of its entry + 1 (0
+  // for an empty slot)
+  typedef struct slot {
+    uint32_t hash;
+    uint32_t pos;
+  } slot_t;
+
+  std::vector<std::unique_ptr<value_type[]>> _slabs;
+  size_t _size = 0;
+  // its size is a power of two, and it is kept at most 3/4 full
+  std::vector<slot_t> _index;
+};
+
+#endif  // SHARDING_ENTRY_TABLE_H
@@ -0,0 +1,419 @@
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <mutex>
+
+#include "kvstore.h"
+#include "mapped_snapshot.h"
+#include "../common/common.h"
+using namespace std;
+
+KVStore::KVStore(size_t num_stripes) {
+    assert(num_stripes > 0);
+    for (size_t i = 0; i < num_stripes; i++)
+        _stripes.push_back(make_unique<Stripe>());
+}
+
+size_t KVStore::_stripe_index(string_view key) const {
+    // the same hash as hash<string>, so that keys of the base can be placed
+    // without copying them
+    return hash<string_view>{}(key) % _stripes.size();
+}
+
+KVStore::Stripe& KVStore::_stripe_of(const string& key) {
+    return *_stripes[_stripe_index(key)];
+}
+
+const KVStore::Stripe& KVStore::_stripe_of(const string& key) const {
+    return *_stripes[_stripe_index(key)];
+}
+
+vector<vector<size_t>> KVStore::_by_stripe(const vector<const string*>& keys) const {
+    vector<vector<size_t>> groups(_stripes.size());
+    for (size_t i = 0; i < keys.size(); i++)
+        groups[_stripe_index(*keys[i])].push_back(i);
+    return groups;
+}
+
+void KVStore::SetBase(shared_ptr<const MappedSnapshot> base) {
+    _base = move(base);
+    for (auto& s : _stripes)
+        s->use_base = _base != nullptr;
+}
+
+optional<snapshot_entry_t> KVStore::_base_find(const Stripe& s, const string& key) const {
+    if (!s.use_base || s.shadowed.count(key))
+        return nullopt;
+    return _base->Find(key);
+}
+
+EntryTable::iterator KVStore::_promote(Stripe& s, const string& key) {
+    auto base = _base_find(s, key);
+    if (!base)
+        return s.entries.end();
+    s.shadowed.insert(key);
+    auto it = s.entries.emplace(key, entry_t()).first;
+    it->second.value = base->value;
+    it->second.author = base->author;
+    it->second.seq = base->seq;
+    return it;
+}
+
+const vector<size_t>& KVStore::_base_keys_of(size_t i) const {
+    call_once(_base_index_once, [this]() {
+        _base_index.resize(_stripes.size());
+        for (size_t k = 0; k < _base->Size(); k++)
+            _base_index[_stripe_index(_base->At(k).key)].push_back(k);
+    });
+    return _base_index[i];
+}
+
+bool KVStore::Get(const string& key, string* value) const {
+    const Stripe& s = _stripe_of(key);
+    auto lock = _lock_shared(s);
+    auto it = s.entries.find(key);
+    if (it != s.entries.end()) {
+        *value = it->second.Flatten();
+        return true;
+    }
+    auto base = _base_find(s, key);
+    if (!base)
+        return false;
+    *value = base->value;
+    return true;
+}
+
+bool KVStore::GetAuthor(const string& key, string* author) const {
+    const Stripe& s = _stripe_of(key);
+    auto lock = _lock_shared(s);
+    auto it = s.entries.find(key);
+    if (it != s.entries.end()) {
+        *author = it->second.author;
+        return true;
+    }
+    auto base = _base_find(s, key);
+    if (!base)
+        return false;
+    *author = base->author;
+    return true;
+}
+
+bool KVStore::GetEntry(const string& key, entry_t* e) const {
+    const Stripe& s = _stripe_of(key);
+    auto lock = _lock_shared(s);
+    auto it = s.entries.find(key);
+    if (it != s.entries.end()) {
+        e->value = it->second.Flatten();
+        e->author = it->second.author;
+        e->seq = it->second.seq;
+        return true;
+    }
+    auto base = _base_find(s, key);
+    if (!base)
+        return false;
+    e->value = base->value;
+    e->author = base->author;
+    e->seq = base->seq;
+    return true;
+}
+
+bool KVStore::Contains(const string& key) const {
+    const Stripe& s = _stripe_of(key);
+    auto lock = _lock_shared(s);
+    return s.entries.find(key) != s.entries.end() || _base_find(s, key);
+}
+
+bool KVStore::ListMembers(const string& key, uint64_t cursor, size_t limit,
+                          vector<string>* members, uint64_t* next) const {
+    const Stripe& s = _stripe_of(key);
+    auto lock = _lock_shared(s);
+    auto it = s.entries.find(key);
+    string value;
+    if (it != s.entries.end() && it->second.members) {
+        *next = it->second.members->Page(cursor, limit, members);
+        return true;
+    } else if (it != s.entries.end()) {
+        value = it->second.value;
+    } else if (auto base = _base_find(s, key)) {
+        // sets are kept in snapshots as their list, whose positions are the
+        // ones the set gets back once it changes
+        value = base->value;
+    } else {
+        return false;
+    }
+    // a plain list: its items are at positions 1, 2, ...
+    vector<string> items = parse_value(value, ",");
+    size_t i = cursor;
+    for (; i < items.size() && members->size() < limit; i++)
+        members->push_back(items[i]);
+    *next = i < items.size() ? i : 0;
+    return true;
+}
+
+vector<optional<string>> KVStore::MultiGet(const vector<string>& keys) const {
+    vector<const string*> key_ptrs;
+    for (const auto& k : keys)
+        key_ptrs.push_back(&k);
+    return MultiGet(key_ptrs);
+}
+
+vector<optional<string>> KVStore::MultiGet(const vector<const string*>& keys) const {
+    vector<optional<string>> values(keys.size());
+    auto groups = _by_stripe(keys);
+    for (size_t i = 0; i < groups.size(); i++) {
+        if (groups[i].empty())
+            continue;
+        const Stripe& s = *_stripes[i];
+        auto lock = _lock_shared(s);
+        for (size_t k : groups[i]) {
+            auto it = s.entries.find(*keys[k]);
+            if (it != s.entries.end())
+                values[k] = it->second.Flatten();
+            else if (auto base = _base_find(s, *keys[k]))
+                values[k] = string(base->value);
+        }
+    }
+    return values;
+}
+
+uint64_t KVStore::Put(const string& key, const string& value, const string& author) {
+    return _mutate({0, MutationOp::PUT, key, value, author}, false, false);
+}
+
+uint64_t KVStore::Append(const string& key, const string& value) {
+    return _mutate({0, MutationOp::APPEND, key, value, ""}, false, false);
+}
+
+uint64_t KVStore::AppendIfPresent(const string& key, const string& value) {
+    return _mutate({0, MutationOp::APPEND, key, value, ""}, true, false);
+}
+
+uint64_t KVStore::AddToList(const string& key, const string& item) {
+    return _mutate({0, MutationOp::ADD_TO_LIST, key, item + ",", ""}, false, false);
+}
+
+uint64_t KVStore::AddToList(const string& key, const vector<string>& items) {
+    string value;
+    for (const auto& item : items)
+        value += item + ",";
+    return _mutate({0, MutationOp::ADD_TO_LIST, key, value, ""}, false, false);
+}
+
+uint64_t KVStore::RemoveFromList(const string& key, const string& item) {
+    return _mutate({0, MutationOp::REMOVE_FROM_LIST, key, item + ",", ""}, true, false);
+}
+
+uint64_t KVStore::RemoveFromList(const string& key, const vector<string>& items) {
+    string value;
+    for (const auto& item : items)
+        value += item + ",";
+    return _mutate({0, MutationOp::REMOVE_FROM_LIST, key, value, ""}, true, false);
+}
+
+uint64_t KVStore::Erase(const string& key) {
+    return _mutate({0, MutationOp::ERASE, key, "", ""}, true, false);
+}
+
+vector<uint64_t> KVStore::MultiMutate(vector<mutation_t>* changes) {
+    vector<uint64_t> seqs(changes->size());
+    vector<const string*> keys;
+    for (const auto& m : *changes)
+        keys.push_back(&m.key);
+    auto groups = _by_stripe(keys);
+    for (size_t i = 0; i < groups.size(); i++) {
+        if (groups[i].empty())
+            continue;
+        Stripe& s = *_stripes[i];
+        auto lock = _lock(s);
+        for (size_t c : groups[i]) {
+            mutation_t& m = (*changes)[c];
+            bool only_if_present = m.op == MutationOp::REMOVE_FROM_LIST || m.op == MutationOp::ERASE;
+            seqs[c] = _mutate_locked(s, m, only_if_present, false);
+        }
+    }
+    return seqs;
+}
+
+uint64_t KVStore::Apply(mutation_t m) {
+    bool only_if_present = m.op == MutationOp::REMOVE_FROM_LIST || m.op == MutationOp::ERASE;
+    return _mutate(move(m), only_if_present, true);
+}
+
+void KVStore::Clear() {
+    for (auto& s : _stripes) {
+        auto lock = _lock(*s);
+        s->entries.clear();
+        s->use_base = false;
+        s->shadowed.clear();
+    }
+    // no stripe reads from the base anymore: it can be unmapped
+    _base.reset();
+    vector<vector<size_t>>().swap(_base_index);
+}
+
+unique_lock<shared_mutex> KVStore::_lock(Stripe& s) const {
+    unique_lock<shared_mutex> lock(s.mutex, try_to_lock);
+    if (lock.owns_lock() || !_on_lock_wait)
+        return lock;
+    auto start = chrono::steady_clock::now();
+    lock.lock();
+    _on_lock_wait(chrono::steady_clock::now() - start);
+    return lock;
+}
+
+shared_lock<shared_mutex> KVStore::_lock_shared(const Stripe& s) const {
+    shared_lock<shared_mutex> lock(s.mutex, try_to_lock);
+    if (lock.owns_lock() || !_on_lock_wait)
+        return lock;
+    auto start = chrono::steady_clock::now();
+    lock.lock();
+    _on_lock_wait(chrono::steady_clock::now() - start);
+    return lock;
+}
+
+uint64_t KVStore::_mutate(mutation_t&& m, bool only_if_present, bool replay) {
+    Stripe& s = _stripe_of(m.key);
+    auto lock = _lock(s);
+    return _mutate_locked(s, m, only_if_present, replay);
+}
+
+uint64_t KVStore::_mutate_locked(Stripe& s, mutation_t& m, bool only_if_present, bool replay) {
+    auto it = s.entries.find(m.key);
+    if (it == s.entries.end())
+        it = _promote(s, m.key);
+    if (it == s.entries.end() && only_if_present)
+        return 0;
+    if (replay && it != s.entries.end() && it->second.seq >= m.seq)
+        return 0;
+
+    // sets only change if some item is (not) there already
+    vector<string> items;
+    if (m.op == MutationOp::ADD_TO_LIST || m.op == MutationOp::REMOVE_FROM_LIST) {
+        items = parse_value(m.value, ",");
+        if (it != s.entries.end() && !it->second.members) {
+            // first time this key is used as a set: take over its list
+            auto members = make_unique<MemberSet>();
+            for (const auto& item : parse_value(it->second.value, ","))
+                members->Add(item);
+            it->second.members = move(members);
+            it->second.value.clear();
+        }
+        const MemberSet* members = it == s.entries.end() ? nullptr : it->second.members.get();
+        bool adding = m.op == MutationOp::ADD_TO_LIST;
+        if (none_of(items.begin(), items.end(), [&](const string& item) {
+                bool listed = members && members->Contains(item);
+                return listed != adding;
+            }))
+            return 0;
+    }
+
+    uint64_t seq = _journal ? _journal(m) : (m.seq ? m.seq : ++_last_seq);
+    if (m.op == MutationOp::ERASE) {
+        s.entries.erase(it);
+        return seq;
+    }
+    entry_t& e = it == s.entries.end() ? s.entries[m.key] : it->second;
+    switch (m.op) {
+        case MutationOp::PUT:
+            // the journal is done with m
+            e.value = move(m.value);
+            e.author = move(m.author);
+            e.members.reset();
+            break;
+        case MutationOp::APPEND:
+            if (e.members) {
+                e.value = e.members->Join();
+                e.members.reset();
+            }
+            e.value += m.value;
+            break;
+        case MutationOp::ADD_TO_LIST:
+            if (!e.members)
+                e.members = make_unique<MemberSet>();
+            for (const auto& item : items)
+                e.members->Add(item);
+            break;
+        case MutationOp::REMOVE_FROM_LIST:
+            for (const auto& item : items)
+                e.members->Remove(item);
+            break;
+        case MutationOp::ERASE:
+            break;
+    }
+    e.seq = seq;
+    return seq;
+}
+
+vector<pair<string, entry_t>> KVStore::Collect(const function<bool(const string&)>& pred) const {
+    vector<pair<string, entry_t>> result;
+    ForEach([&](const string& k, const entry_t& e) {
+        if (pred(k))
+            result.push_back({k, e});
+    });
+    return result;
+}
+
+void KVStore::_walk_locked(size_t i, const function<void(const string&, const entry_t&)>& fn) const {
+    const Stripe& s = *_stripes[i];
+    for (const auto& [k, e] : s.entries)
+        fn(k, e);
+    if (!s.use_base)
+        return;
+    for (size_t k : _base_keys_of(i)) {
+        snapshot_entry_t base = _base->At(k);
+        string key(base.key);
+        if (s.shadowed.count(key))
+            continue;
+        entry_t e;
+        e.value = base.value;
+        e.author = base.author;
+        e.seq = base.seq;
+        fn(key, e);
+    }
+}
+
+vector<pair<string, entry_t>> KVStore::CollectStripe(size_t i) const {
+    auto lock = _lock_shared(*_stripes.at(i));
+    vector<pair<string, entry_t>> result;
+    _walk_locked(i, [&](const string& k, const entry_t& e) { result.push_back({k, e}); });
+    return result;
+}
+
+void KVStore::ForEach(const function<void(const string&, const entry_t&)>& fn) const {
+    for (size_t i = 0; i < _stripes.size(); i++) {
+        auto lock = _lock_shared(*_stripes[i]);
+        _walk_locked(i, fn);
+    }
+}
+
+vector<string> KVStore::Keys() const {
+    vector<string> keys;
+    for (size_t i = 0; i < _stripes.size(); i++) {
+        const Stripe& s = *_stripes[i];
+        auto lock = _lock_shared(s);
+        for (const auto& [k, e] : s.entries)
+            keys.push_back(k);
+        if (!s.use_base)
+            continue;
+        for (size_t k : _base_keys_of(i)) {
+            string key(_base->At(k).key);
+            if (!s.shadowed.count(key))
+                keys.push_back(move(key));
+        }
+    }
+    return keys;
+}
+
+size_t KVStore::Size() const {
+    size_t total = 0;
+    for (size_t i = 0; i < _stripes.size(); i++) {
+        const Stripe& s = *_stripes[i];
+        auto lock = _lock_shared(s);
+        total += s.entries.size();
+        // every shadowed key is a key of the base that the stripe holds, or
+        // erased
+        if (s.use_base)
+            total += _base_keys_of(i).size() - s.shadowed.size();
+    }
+    return total;
+}
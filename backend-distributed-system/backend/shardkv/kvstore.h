@@ -0,0 +1,207 @@
+#ifndef SHARDING_KVSTORE_H
+#define SHARDING_KVSTORE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "entry_table.h"
+
+class MappedSnapshot;
+struct snapshot_entry;
+
+// default number of lock stripes used by a ShardkvServer's store
+constexpr size_t DEFAULT_STRIPES = 64;
+
+enum class MutationOp { PUT, APPEND, ADD_TO_LIST, REMOVE_FROM_LIST, ERASE };
+
+// a single change to the store. this is what a primary ships to its backup:
+// the backup replays the change itself rather than the request that caused
+// it, so it never repeats side effects like cross-shard appends. the value of
+// an ADD_TO_LIST or REMOVE_FROM_LIST is a comma terminated list of the items
+// to add or remove
+typedef struct mutation {
+  uint64_t seq = 0;
+  MutationOp op;
+  std::string key;
+  std::string value;
+  std::string author;
+} mutation_t;
+
+// called under the stripe lock with every change made to the store. it must
+// return the sequence number of the change: mutation.seq if already set (a
+// replayed change), a fresh one otherwise
+using Journal = std::function<uint64_t(const mutation_t&)>;
+
+// Key-value storage split into independently locked stripes. Every key lives
+// in the stripe selected by its hash: readers of a stripe share its lock, and
+// writers only exclude operations on the same stripe, so traffic on different
+// keys proceeds in parallel. Every method locks exactly one stripe at a time,
+// which makes it impossible to deadlock on the store itself.
+//
+// A store can start out from a MappedSnapshot (see SetBase) instead of
+// empty: keys it does not hold are read from the snapshot, and an entry is
+// only copied into the store the first time it changes.
+//
+// Every method that changes the store returns the sequence number of the
+// change, or 0 if it turned out to be a no-op.
+class KVStore {
+ public:
+  explicit KVStore(size_t num_stripes = DEFAULT_STRIPES);
+
+  // must be set before the store is shared between threads
+  void SetJournal(Journal journal) { _journal = std::move(journal); }
+  // called with how long a thread waited for the lock of a stripe, whenever
+  // the lock was held when it asked. must be set before the store is shared
+  // between threads
+  void SetLockWait(std::function<void(std::chrono::nanoseconds)> on_wait) {
+    _on_lock_wait = std::move(on_wait);
+  }
+  // serves every key of base that the store does not hold from base. must be
+  // called at most once, on an empty store, before it is shared between
+  // threads
+  void SetBase(std::shared_ptr<const MappedSnapshot> base);
+
+  // copies the value of key (see entry_t::Flatten) into value. returns false
+  // if the key is missing
+  bool Get(const std::string& key, std::string* value) const;
+  // copies the author of key into author. returns false if the key is missing
+  bool GetAuthor(const std::string& key, std::string* author) const;
+  // copies the value (flattened), author and sequence number of key into e,
+  // all under one lock. returns false if the key is missing
+  bool GetEntry(const std::string& key, entry_t* e) const;
+  bool Contains(const std::string& key) const;
+  // copies up to limit members of the set stored at key, starting after
+  // cursor (see MemberSet::Page), into members, and the cursor of the next
+  // page into next. a key holding a plain list is paged through the same
+  // way. returns false if the key is missing
+  bool ListMembers(const std::string& key, uint64_t cursor, size_t limit,
+                   std::vector<std::string>* members, uint64_t* next) const;
+
+  // Get for every one of keys, locking every stripe involved only once.
+  // values[i] is the value of keys[i], or nullopt if it is missing
+  std::vector<std::optional<std::string>> MultiGet(
+      const std::vector<std::string>& keys) const;
+  // the same, for keys held elsewhere (in a request, say)
+  std::vector<std::optional<std::string>> MultiGet(
+      const std::vector<const std::string*>& keys) const;
+
+  // inserts or replaces the entry for key
+  uint64_t Put(const std::string& key, const std::string& value,
+               const std::string& author = "");
+  // appends value to the current value of key, creating the key if needed
+  uint64_t Append(const std::string& key, const std::string& value);
+  // like Append, but does nothing if key is missing
+  uint64_t AppendIfPresent(const std::string& key, const std::string& value);
+  // treats key as a set and adds item to it unless it is already there. a
+  // key holding a comma terminated list ("a,b,") becomes the set of its items
+  uint64_t AddToList(const std::string& key, const std::string& item);
+  // adds every one of items to that set, in a single change
+  uint64_t AddToList(const std::string& key,
+                     const std::vector<std::string>& items);
+  // removes item from the set stored at key
+  uint64_t RemoveFromList(const std::string& key, const std::string& item);
+  // removes every one of items from that set, in a single change
+  uint64_t RemoveFromList(const std::string& key,
+                          const std::vector<std::string>& items);
+  // removes key. returns 0 if it was not there
+  uint64_t Erase(const std::string& key);
+
+  // makes every one of changes (not replayed: their seq must be 0), locking
+  // every stripe involved only once. changes to the same key are made in
+  // order. the value and author of every PUT are moved into the store, the
+  // keys are left alone. returns the sequence number of each change, 0 for a
+  // no-op
+  std::vector<uint64_t> MultiMutate(std::vector<mutation_t>* changes);
+
+  // replays a change made on another store. changes that are not newer than
+  // the entry they touch are skipped, so replaying a change that is already
+  // reflected in the entry is harmless
+  uint64_t Apply(mutation_t m);
+  // drops every entry, and the base, without going through the journal
+  void Clear();
+
+  // copies out every entry whose key satisfies pred. stripes are visited one
+  // at a time under a shared lock, so writers are only ever held off one
+  // stripe at a time
+  std::vector<std::pair<std::string, entry_t>> Collect(
+      const std::function<bool(const std::string&)>& pred) const;
+  // calls fn on every entry, holding a shared lock on one stripe at a time
+  void ForEach(
+      const std::function<void(const std::string&, const entry_t&)>& fn) const;
+
+  // copies out every entry of stripe i (0 <= i < NumStripes()), so that the
+  // store can be walked without holding any lock while using what was read
+  std::vector<std::pair<std::string, entry_t>> CollectStripe(size_t i) const;
+
+  // copies out every key, in no particular order
+  std::vector<std::string> Keys() const;
+
+  size_t NumStripes() const { return _stripes.size(); }
+  size_t Size() const;
+
+ private:
+  struct Stripe {
+    mutable std::shared_mutex mutex;
+    EntryTable entries;
+    // whether keys missing from entries are looked up in _base
+    bool use_base = false;
+    // the keys of _base that entries took over (they may have been erased
+    // since), and which must not be read from _base anymore
+    std::unordered_set<std::string> shadowed;
+  };
+
+  // the lock of s, timed for _on_lock_wait only if it has to be waited for
+  std::unique_lock<std::shared_mutex> _lock(Stripe& s) const;
+  std::shared_lock<std::shared_mutex> _lock_shared(const Stripe& s) const;
+  size_t _stripe_index(std::string_view key) const;
+  Stripe& _stripe_of(const std::string& key);
+  const Stripe& _stripe_of(const std::string& key) const;
+  // the indices of keys, grouped by the stripe each key lives in
+  std::vector<std::vector<size_t>> _by_stripe(
+      const std::vector<const std::string*>& keys) const;
+  // the entry of key in _base, if s still reads key from there. called with
+  // the lock of s (the stripe of key) held
+  std::optional<snapshot_entry> _base_find(const Stripe& s,
+                                           const std::string& key) const;
+  // copies the entry of key from _base into s, if s still reads key from
+  // there. returns where it went, or the end of s.entries. called with the
+  // lock of s held exclusively
+  EntryTable::iterator _promote(Stripe& s, const std::string& key);
+  // the positions in _base of the keys of stripe i, computed the first time
+  // a stripe is walked
+  const std::vector<size_t>& _base_keys_of(size_t i) const;
+  // calls fn on every entry of stripe i, those read from _base included.
+  // called with the lock of stripe i held
+  void _walk_locked(
+      size_t i,
+      const std::function<void(const std::string&, const entry_t&)>& fn) const;
+  // applies m under its stripe's lock. if only_if_present, a missing key is
+  // left alone. if replay, m is skipped when its entry is already as recent.
+  // a PUT moves its value and author into the entry, once journaled
+  uint64_t _mutate(mutation_t&& m, bool only_if_present, bool replay);
+  // the same, with the lock of s (the stripe of m.key) already held
+  uint64_t _mutate_locked(Stripe& s, mutation_t& m, bool only_if_present,
+                          bool replay);
+
+  std::vector<std::unique_ptr<Stripe>> _stripes;
+  Journal _journal;
+  std::function<void(std::chrono::nanoseconds)> _on_lock_wait;
+  std::shared_ptr<const MappedSnapshot> _base;
+  mutable std::once_flag _base_index_once;
+  mutable std::vector<std::vector<size_t>> _base_index;
+  // sequence numbers handed out when no journal is set
+  std::atomic<uint64_t> _last_seq{0};
+};
+
+#endif  // SHARDING_KVSTORE_H
@@ -0,0 +1,52 @@
+#include <algorithm>
+
+#include "load_tracker.h"
+using namespace std;
+
+void LoadTracker::Reset(const ShardTable& table, uint16_t self) {
+    _shards.clear();
+    _slots.assign(table.NumShards(), NONE);
+    for (size_t i = 0; i < table.NumShards(); i++) {
+        if (self == ShardTable::NONE || table.ShardOwner(i) != self)
+            continue;
+        _slots[i] = _shards.size();
+        _shards.push_back(table.Shard(i));
+    }
+    _counts = make_unique<atomic<uint64_t>[]>(_shards.size() * BUCKETS);
+    _since = chrono::steady_clock::now();
+}
+
+vector<shard_load_t> LoadTracker::Take() {
+    auto now = chrono::steady_clock::now();
+    double seconds = max(chrono::duration<double>(now - _since).count(), 1e-3);
+    _since = now;
+
+    vector<shard_load_t> loads;
+    for (size_t i = 0; i < _shards.size(); i++) {
+        const shard_t& s = _shards[i];
+        uint64_t counts[BUCKETS], total = 0;
+        for (size_t b = 0; b < BUCKETS; b++) {
+            counts[b] = _counts[i * BUCKETS + b].exchange(0, memory_order_relaxed);
+            total += counts[b];
+        }
+        // the bucket boundary leaving the closest to half the requests on
+        // either side. bucket b starts at the first key k with
+        // _bucket(s, k) == b
+        unsigned __int128 width = (unsigned __int128)s.upper - s.lower + 1;
+        uint64_t split = s.lower;
+        uint64_t left = 0, best = UINT64_MAX;
+        for (size_t b = 1; b < BUCKETS; b++) {
+            left += counts[b - 1];
+            unsigned __int128 first = (b * width + BUCKETS - 1) / BUCKETS;
+            if (first >= width)
+                break;
+            uint64_t imbalance = left * 2 > total ? left * 2 - total : total - left * 2;
+            if (imbalance < best) {
+                best = imbalance;
+                split = s.lower + first - 1;
+            }
+        }
+        loads.push_back({s, total / seconds, split});
+    }
+    return loads;
+}
@@ -0,0 +1,55 @@
+#ifndef SHARDING_LOAD_TRACKER_H
+#define SHARDING_LOAD_TRACKER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "../common/common.h"
+#include "../common/shard_table.h"
+
+// Counts the requests a server gets for each of its shards, for the
+// shardmaster to decide which shards to split, merge or move. Every shard
+// is cut into BUCKETS ranges of keys of equal width with a counter each, so
+// that Take can tell where to split a shard to halve its load, however
+// skewed the load is inside it. Only the shards of the server itself get
+// counters, so that a table of millions of shards spread over many servers
+// costs every one of them its own share.
+//
+// Record and Take can be called concurrently, Reset cannot be called
+// concurrently with anything (ShardkvServer calls it holding its
+// configuration lock exclusively, and the others holding it shared).
+class LoadTracker {
+ public:
+  static constexpr size_t BUCKETS = 16;
+
+  // starts counting afresh, for the shards of table on server self
+  void Reset(const ShardTable& table, uint16_t self);
+  // counts a request for key, which is in shard i of the table, one of ours
+  void Record(size_t i, uint64_t key) {
+    uint32_t slot = _slots[i];
+    _counts[slot * BUCKETS + _bucket(_shards[slot], key)].fetch_add(1, std::memory_order_relaxed);
+  }
+  // the load of each shard of ours since the last Take (or Reset), after
+  // which counting starts over
+  std::vector<shard_load_t> Take();
+
+ private:
+  static size_t _bucket(const shard_t& s, uint64_t key) {
+    // 128 bits, as shards can be up to 2^64 - 1 keys wide
+    return (unsigned __int128)(key - s.lower) * BUCKETS / ((unsigned __int128)s.upper - s.lower + 1);
+  }
+
+  // our shards, and where each shard of the table is in them (NONE if it is
+  // not ours)
+  static constexpr uint32_t NONE = UINT32_MAX;
+  std::vector<shard_t> _shards;
+  std::vector<uint32_t> _slots;
+  // BUCKETS counters per shard of ours
+  std::unique_ptr<std::atomic<uint64_t>[]> _counts;
+  std::chrono::steady_clock::time_point _since;
+};
+
+#endif  // SHARDING_LOAD_TRACKER_H
@@ -1,15 +1,72 @@
 #include <grpcpp/grpcpp.h>
 #include <unistd.h>
 #include <cstdio>
+#include <optional>
+#include <string>
 
 #include "shardkv.h"
+#include "../common/server_options.h"
 
 int main(int argc, char** argv) {
-  if (argc != 4) {
+  if (argc < 4) {
     fprintf(stderr, "usage: ./shardkv <PORT> <SHARD MANAGER HOSTNAME> " \
-                    "<SHARD MANAGER PORT>\n");
+                    "<SHARD MANAGER PORT> [--replication=acked|queued] " \
+                    "[--data-dir=<DIR>] [--fsync=write|batch|interval] " \
+                    "[--fsync-interval-ms=<MS>] [--snapshot-mb=<MB>] " \
+                    "[--metrics-port=<PORT>] [--log-level=debug|info|warn|error|off] %s\n",
+            SERVER_FLAGS_USAGE);
     return 1;
   }
+  // acked: writes are acknowledged once the backup applied them
+  // queued: as soon as they are queued for the backup
+  ReplicationMode mode = ReplicationMode::ACKED;
+  // without a data directory the server keeps everything in memory only
+  wal_options_t wal;
+  // where Prometheus can scrape what the Stats RPC reports, if anywhere
+  int metrics_port = 0;
+  // sync or callback, and the threads, limits and keepalive of the server
+  server_options_t server_options;
+  for (int i = 4; i < argc; i++) {
+    std::string flag(argv[i]);
+    auto value = [&flag](const std::string& name) -> std::optional<std::string> {
+      if (flag.rfind(name + "=", 0) != 0) return std::nullopt;
+      return flag.substr(name.size() + 1);
+    };
+    if (flag == "--replication=queued") {
+      mode = ReplicationMode::QUEUED;
+    } else if (flag == "--replication=acked") {
+      mode = ReplicationMode::ACKED;
+    } else if (auto dir = value("--data-dir")) {
+      wal.dir = *dir;
+    } else if (flag == "--fsync=write") {
+      // every write is fsynced on its own
+      wal.fsync = FsyncPolicy::WRITE;
+    } else if (flag == "--fsync=batch") {
+      // writes that arrive together share an fsync
+      wal.fsync = FsyncPolicy::BATCH;
+    } else if (flag == "--fsync=interval") {
+      // the log is fsynced every --fsync-interval-ms, writes do not wait
+      wal.fsync = FsyncPolicy::INTERVAL;
+    } else if (auto ms = value("--fsync-interval-ms")) {
+      wal.interval = std::chrono::milliseconds(std::stoul(*ms));
+    } else if (auto mb = value("--snapshot-mb")) {
+      wal.snapshot_bytes = std::stoul(*mb) << 20;
+    } else if (auto p = value("--metrics-port")) {
+      metrics_port = std::stoi(*p);
+    } else if (parse_server_flag(flag, &server_options)) {
+      // see server_options_t
+    } else if (auto level = value("--log-level")) {
+      auto parsed = parse_log_level(*level);
+      if (!parsed) {
+        fprintf(stderr, "unknown log level: %s\n", level->c_str());
+        return 1;
+      }
+      Logger::Shared().SetLevel(*parsed);
+    } else {
+      fprintf(stderr, "unknown option: %s\n", argv[i]);
+      return 1;
+    }
+  }
   // get our hostname so we can construct address for shardkv. we need this
   // because the shardmanager will know us by our hostname and port, so we should
   // track that.
@@ -25,11 +82,19 @@ int main(int argc, char** argv) {
       std::string(argv[2]) + ":" + std::string(argv[3]);
   fprintf(stdout, "Shardmanager on: %s\n", shardmaster_addr.c_str());
 
-  ::grpc::ServerBuilder builder;
-  builder.AddListeningPort(addr, ::grpc::InsecureServerCredentials());
-  ShardkvServer shardkv(addr, shardmaster_addr);
-  builder.RegisterService(&shardkv);
-  std::unique_ptr<::grpc::Server> server = builder.BuildAndStart();
+  ShardkvServer shardkv(addr, shardmaster_addr, mode, wal);
+  ShardkvCallbackService callback_service(&shardkv);
+  if (metrics_port && !ServeMetrics(metrics_port, [&]() { return shardkv.Prometheus(); })) {
+    fprintf(stderr, "cannot serve metrics on port %d\n", metrics_port);
+    return 1;
+  }
+  std::unique_ptr<::grpc::Server> server = StartServer(
+      addr, server_options,
+      server_options.mode == ServerMode::CALLBACK ? static_cast<::grpc::Service*>(&callback_service) : &shardkv);
+  if (server == nullptr) {
+    fprintf(stderr, "cannot listen on %s\n", addr.c_str());
+    return 1;
+  }
 
   server->Wait();
   return 0;
@@ -0,0 +1,221 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include "mapped_snapshot.h"
+#include "../common/log.h"
+using namespace std;
+
+// integers are in host byte order: a snapshot is only ever read back on the
+// machine that wrote it
+static const char SNAPSHOT_MAGIC[8] = {'K', 'V', 'S', 'N', 'A', 'P', 'M', 'M'};
+static const uint32_t SNAPSHOT_VERSION = 1;
+
+typedef struct snapshot_header {
+    char magic[8];
+    uint32_t version;
+    // of the header, with crc set to 0
+    uint32_t crc;
+    uint64_t count;
+    uint64_t max_seq;
+    uint64_t log_seq;
+    uint64_t heap_bytes;
+    uint32_t log_crc;
+    uint32_t unused;
+} snapshot_header_t;
+
+typedef struct snapshot_slot {
+    // where the key of the entry starts in the heap. its value and its
+    // author follow it
+    uint64_t offset;
+    uint64_t seq;
+    uint32_t key_bytes;
+    uint32_t value_bytes;
+    uint32_t author_bytes;
+    // of the key, value and author
+    uint32_t crc;
+} snapshot_slot_t;
+
+// snapshots are written out in pieces of about this size
+static const size_t SNAPSHOT_WRITE_BYTES = 1 << 20;
+
+uint32_t crc32(const char* data, size_t n, uint32_t crc) {
+    static const auto table = []() {
+        array<uint32_t, 256> t{};
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+            t[i] = c;
+        }
+        return t;
+    }();
+    uint32_t c = crc ^ 0xffffffff;
+    for (size_t i = 0; i < n; i++)
+        c = table[(c ^ static_cast<uint8_t>(data[i])) & 0xff] ^ (c >> 8);
+    return c ^ 0xffffffff;
+}
+
+static uint32_t header_crc(snapshot_header_t h) {
+    h.crc = 0;
+    return crc32(reinterpret_cast<const char*>(&h), sizeof(h));
+}
+
+// a snapshot that passed the checks of Open can only be inconsistent if the
+// disk corrupted it, and then no answer read from it can be trusted
+static void corrupt(size_t slot) {
+    LOG(ERROR) << "Snapshot: entry " << slot << " is corrupt";
+    Logger::Shared().Flush();
+    abort();
+}
+
+static bool write_all(int fd, const string& data) {
+    size_t done = 0;
+    while (done < data.size()) {
+        ssize_t n = write(fd, data.data() + done, data.size() - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        done += n;
+    }
+    return true;
+}
+
+bool MappedSnapshot::Write(int fd, const KVStore& store, uint64_t log_seq, uint32_t log_crc, size_t* count) {
+    vector<string> keys = store.Keys();
+    sort(keys.begin(), keys.end());
+
+    snapshot_header_t header{};
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.version = SNAPSHOT_VERSION;
+    header.log_seq = log_seq;
+    header.log_crc = log_crc;
+    // the heap goes after a slot for every key, and the header and the slots
+    // are written last, once the entries have been read
+    vector<snapshot_slot_t> slots(keys.size());
+    if (lseek(fd, sizeof(header) + slots.size() * sizeof(snapshot_slot_t), SEEK_SET) < 0)
+        return false;
+    string data;
+    entry_t e;
+    for (const auto& key : keys) {
+        if (!store.GetEntry(key, &e))
+            continue;
+        snapshot_slot_t& slot = slots[header.count++];
+        slot.offset = header.heap_bytes;
+        slot.seq = e.seq;
+        slot.key_bytes = key.size();
+        slot.value_bytes = e.value.size();
+        slot.author_bytes = e.author.size();
+        slot.crc = crc32(key.data(), key.size());
+        slot.crc = crc32(e.value.data(), e.value.size(), slot.crc);
+        slot.crc = crc32(e.author.data(), e.author.size(), slot.crc);
+        header.heap_bytes += key.size() + e.value.size() + e.author.size();
+        header.max_seq = max(header.max_seq, e.seq);
+        data += key;
+        data += e.value;
+        data += e.author;
+        if (data.size() < SNAPSHOT_WRITE_BYTES)
+            continue;
+        if (!write_all(fd, data))
+            return false;
+        data.clear();
+    }
+    if (!write_all(fd, data))
+        return false;
+    header.crc = header_crc(header);
+
+    data.assign(reinterpret_cast<const char*>(&header), sizeof(header));
+    data.append(reinterpret_cast<const char*>(slots.data()), slots.size() * sizeof(snapshot_slot_t));
+    if (lseek(fd, 0, SEEK_SET) < 0 || !write_all(fd, data))
+        return false;
+    *count = header.count;
+    return true;
+}
+
+shared_ptr<const MappedSnapshot> MappedSnapshot::Open(const string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return nullptr;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(snapshot_header_t)) {
+        close(fd);
+        return nullptr;
+    }
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    // the mapping outlives the file descriptor
+    close(fd);
+    if (data == MAP_FAILED)
+        return nullptr;
+    shared_ptr<MappedSnapshot> snapshot(new MappedSnapshot());
+    snapshot->_data = static_cast<const char*>(data);
+    snapshot->_bytes = st.st_size;
+    // lookups jump around the file
+    madvise(data, st.st_size, MADV_RANDOM);
+
+    snapshot_header_t header;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0 ||
+        header.version != SNAPSHOT_VERSION || header.crc != header_crc(header) ||
+        header.heap_bytes > snapshot->_bytes - sizeof(header) ||
+        header.count > (snapshot->_bytes - sizeof(header) - header.heap_bytes) / sizeof(snapshot_slot_t))
+        return nullptr;
+    snapshot->_slots = snapshot->_data + sizeof(header);
+    snapshot->_heap = snapshot->_data + snapshot->_bytes - header.heap_bytes;
+    snapshot->_heap_bytes = header.heap_bytes;
+    snapshot->_count = header.count;
+    snapshot->_max_seq = header.max_seq;
+    snapshot->_log_seq = header.log_seq;
+    snapshot->_log_crc = header.log_crc;
+    return snapshot;
+}
+
+MappedSnapshot::~MappedSnapshot() {
+    if (_data)
+        munmap(const_cast<char*>(_data), _bytes);
+}
+
+string_view MappedSnapshot::_key(size_t i) const {
+    snapshot_slot_t slot;
+    memcpy(&slot, _slots + i * sizeof(slot), sizeof(slot));
+    if (slot.offset > _heap_bytes || slot.key_bytes > _heap_bytes - slot.offset)
+        corrupt(i);
+    return {_heap + slot.offset, slot.key_bytes};
+}
+
+snapshot_entry_t MappedSnapshot::At(size_t i) const {
+    snapshot_slot_t slot;
+    memcpy(&slot, _slots + i * sizeof(slot), sizeof(slot));
+    uint64_t bytes = (uint64_t)slot.key_bytes + slot.value_bytes + slot.author_bytes;
+    if (slot.offset > _heap_bytes || bytes > _heap_bytes - slot.offset ||
+        crc32(_heap + slot.offset, bytes) != slot.crc)
+        corrupt(i);
+    const char* p = _heap + slot.offset;
+    snapshot_entry_t e;
+    e.key = {p, slot.key_bytes};
+    e.value = {p + slot.key_bytes, slot.value_bytes};
+    e.author = {p + slot.key_bytes + slot.value_bytes, slot.author_bytes};
+    e.seq = slot.seq;
+    return e;
+}
+
+optional<snapshot_entry_t> MappedSnapshot::Find(string_view key) const {
+    size_t lo = 0, hi = _count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int c = _key(mid).compare(key);
+        if (c == 0)
+            return At(mid);
+        if (c < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return nullopt;
+}
@@ -0,0 +1,84 @@
+#ifndef SHARDING_MAPPED_SNAPSHOT_H
+#define SHARDING_MAPPED_SNAPSHOT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "kvstore.h"
+
+// crc32 (IEEE) of data, the checksum used by the files of the write-ahead
+// log and by snapshots. crc is that of whatever came before data, so that a
+// checksum can be computed a piece at a time
+uint32_t crc32(const char* data, size_t n, uint32_t crc = 0);
+
+// an entry of a MappedSnapshot. the views point into the mapping, and stay
+// valid as long as the snapshot does
+typedef struct snapshot_entry {
+  std::string_view key;
+  std::string_view value;
+  std::string_view author;
+  uint64_t seq = 0;
+} snapshot_entry_t;
+
+// Read-only copy of a store on disk, used without loading it: the file is
+// mapped into memory and entries are found by binary search, so opening a
+// snapshot takes the same time whatever its size, and only the pages that
+// are read ever come off the disk.
+//
+// The file holds a header, then one fixed-size slot per entry sorted by key,
+// then the heap the slots point into (the key, value and author of every
+// entry, back to back), which ends the file. Unused slots may sit between
+// the last slot and the heap. The header carries a format version and its own
+// checksum, and every slot the checksum of its entry, which is verified
+// when the entry is read rather than when the file is opened.
+class MappedSnapshot {
+ public:
+  // writes a snapshot of store to fd, and the number of entries it holds to
+  // count. the keys are collected and sorted first, then every entry is read
+  // from the store as it is written out, so only one value is copied at a
+  // time. the store may change meanwhile: an entry is written as it is when
+  // read, and keys added after they were collected are left out (as are
+  // keys erased before they were read). log_seq and log_crc are kept for the
+  // write-ahead log (see WriteAheadLog). returns false, with errno set, if
+  // writing failed
+  static bool Write(int fd, const KVStore& store, uint64_t log_seq,
+                    uint32_t log_crc, size_t* count);
+  // maps the snapshot at path. returns nullptr if it cannot be read or is
+  // not a snapshot this version understands
+  static std::shared_ptr<const MappedSnapshot> Open(const std::string& path);
+
+  ~MappedSnapshot();
+  MappedSnapshot(const MappedSnapshot&) = delete;
+  MappedSnapshot& operator=(const MappedSnapshot&) = delete;
+
+  std::optional<snapshot_entry_t> Find(std::string_view key) const;
+  // the i-th entry in key order (0 <= i < Size())
+  snapshot_entry_t At(size_t i) const;
+  size_t Size() const { return _count; }
+  // the highest sequence number of an entry
+  uint64_t MaxSeq() const { return _max_seq; }
+  uint64_t LogSeq() const { return _log_seq; }
+  uint32_t LogCrc() const { return _log_crc; }
+
+ private:
+  MappedSnapshot() = default;
+  // the key of slot i, without verifying the checksum of the entry
+  std::string_view _key(size_t i) const;
+
+  const char* _data = nullptr;
+  size_t _bytes = 0;
+  const char* _slots = nullptr;
+  const char* _heap = nullptr;
+  size_t _heap_bytes = 0;
+  size_t _count = 0;
+  uint64_t _max_seq = 0;
+  uint64_t _log_seq = 0;
+  uint32_t _log_crc = 0;
+};
+
+#endif  // SHARDING_MAPPED_SNAPSHOT_H
@@ -0,0 +1,43 @@
+#include "member_set.h"
+using namespace std;
+
+bool MemberSet::Add(const string& member) {
+    auto [it, added] = _position.try_emplace(member, _last_position + 1);
+    if (!added)
+        return false;
+    _last_position++;
+    // positions only grow, so this always goes at the end
+    _by_position.emplace_hint(_by_position.end(), _last_position, member);
+    return true;
+}
+
+bool MemberSet::Remove(const string& member) {
+    auto it = _position.find(member);
+    if (it == _position.end())
+        return false;
+    _by_position.erase(it->second);
+    _position.erase(it);
+    return true;
+}
+
+string MemberSet::Join() const {
+    size_t length = 0;
+    for (const auto& [p, m] : _by_position)
+        length += m.size() + 1;
+    string joined;
+    joined.reserve(length);
+    for (const auto& [p, m] : _by_position) {
+        joined += m;
+        joined += ',';
+    }
+    return joined;
+}
+
+uint64_t MemberSet::Page(uint64_t cursor, size_t limit, vector<string>* out) const {
+    auto it = _by_position.upper_bound(cursor);
+    for (size_t n = 0; it != _by_position.end() && n < limit; ++it, ++n) {
+        out->push_back(it->second);
+        cursor = it->first;
+    }
+    return it == _by_position.end() ? 0 : cursor;
+}
@@ -0,0 +1,40 @@
+#ifndef SHARDING_MEMBER_SET_H
+#define SHARDING_MEMBER_SET_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// The members of a set-valued key (all_users, user_<id>_posts), in the order
+// they were added. Membership is a hash lookup; every member also gets an
+// increasing position, which keeps the order for Join and gives paginated
+// reads a cursor that stays valid while members come and go.
+class MemberSet {
+ public:
+  // returns false if member was already there
+  bool Add(const std::string& member);
+  // returns false if member was not there
+  bool Remove(const std::string& member);
+  bool Contains(const std::string& member) const {
+    return _position.count(member) > 0;
+  }
+  size_t Size() const { return _position.size(); }
+
+  // the members as a comma terminated list ("a,b,"), which is what a Get
+  // of the key returns
+  std::string Join() const;
+  // appends to out up to limit members added after position cursor (0 for
+  // the first page). returns the cursor of the next page, or 0 if there is
+  // none
+  uint64_t Page(uint64_t cursor, size_t limit,
+                std::vector<std::string>* out) const;
+
+ private:
+  std::unordered_map<std::string, uint64_t> _position;
+  std::map<uint64_t, std::string> _by_position;
+  uint64_t _last_position = 0;
+};
+
+#endif  // SHARDING_MEMBER_SET_H
@@ -0,0 +1,226 @@
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+#include "outbox.h"
+#include "../common/common.h"
+using namespace std;
+
+Outbox::Outbox(KVStore* store, Resolve resolve, Send send, Metrics* metrics)
+    : _store(store), _resolve(move(resolve)), _send(move(send)), _metrics(metrics) {
+    _delivery_seconds = _metrics->Histogram("shardkv_outbox_delivery_seconds",
+                                            "Time from adding an item to the outbox to its delivery.");
+    _delivered_total = _metrics->Counter("shardkv_outbox_delivered_total",
+                                         "Items of the outbox delivered to another server.");
+}
+
+uint64_t Outbox::Add(const string& key, const vector<string>& items) {
+    // in the store first: once Add returns, the items survive a failover
+    uint64_t seq = _store->AddToList(OUTBOX_PREFIX + key, items);
+    lock_guard<mutex> lock(_mutex);
+    if (_started)
+        _queue(key, items, Clock::now());
+    return seq;
+}
+
+void Outbox::Start() {
+    uint64_t epoch;
+    {
+        lock_guard<mutex> lock(_mutex);
+        if (_started)
+            return;
+        _started = true;
+        epoch = ++_epoch;
+    }
+    // what Add kept while we were not started (or before a failover or a
+    // restart). an Add from now on queues its items itself, and queueing
+    // them twice is harmless
+    auto kept = _store->Collect([](const string& k) {
+        return k.compare(0, strlen(OUTBOX_PREFIX), OUTBOX_PREFIX) == 0;
+    });
+    lock_guard<mutex> lock(_mutex);
+    if (epoch != _epoch)
+        return;
+    auto now = Clock::now();
+    for (auto& [k, e] : kept) {
+        vector<string> items = parse_value(move(e).Flatten(), ",");
+        if (!items.empty())
+            _queue(k.substr(strlen(OUTBOX_PREFIX)), items, now);
+    }
+}
+
+void Outbox::Stop() {
+    lock_guard<mutex> lock(_mutex);
+    if (!_started)
+        return;
+    _started = false;
+    _epoch++;
+    _pending.clear();
+    _destinations.clear();
+    _changed.notify_all();
+}
+
+void Outbox::Reroute() {
+    lock_guard<mutex> lock(_mutex);
+    vector<string> keys;
+    for (const auto& [key, p] : _pending)
+        keys.push_back(key);
+    for (const auto& key : keys)
+        _route(key);
+}
+
+void Outbox::_queue(const string& key, const vector<string>& items, Clock::time_point added) {
+    auto [it, inserted] = _pending.try_emplace(key);
+    for (const auto& item : items)
+        it->second.items.try_emplace(item, added);
+    if (inserted) {
+        _route(key);
+    } else {
+        _wake(it->second.destination);
+        _changed.notify_all();
+    }
+}
+
+void Outbox::_route(const string& key) {
+    pending_t& p = _pending[key];
+    string destination = _resolve(key);
+    if (_destinations.count(p.destination) && destination != p.destination)
+        _destinations[p.destination].keys.erase(key);
+    p.destination = destination;
+    _destinations[destination].keys.insert(key);
+    _wake(destination);
+    _changed.notify_all();
+}
+
+void Outbox::_wake(const string& destination) {
+    // items for a set no server is in charge of wait for a new configuration
+    destination_t& d = _destinations[destination];
+    if (destination.empty() || d.sending)
+        return;
+    d.sending = true;
+    thread sender([this, destination, epoch = _epoch]() { _send_loop(destination, epoch); });
+    sender.detach();
+}
+
+void Outbox::_send_loop(string destination, uint64_t epoch) {
+    unique_lock<mutex> lock(_mutex);
+    while (epoch == _epoch) {
+        // Stop and Reroute may change the map while we do not hold the lock
+        destination_t* d = &_destinations[destination];
+        if (d->keys.empty()) {
+            bool woken = _changed.wait_for(lock, OUTBOX_IDLE, [&]() {
+                return epoch != _epoch || !_destinations[destination].keys.empty();
+            });
+            if (!woken) {
+                _destinations[destination].sending = false;
+                return;
+            }
+            continue;
+        }
+
+        // a batch of up to OUTBOX_BATCH_ITEMS items, with one Append per set
+        vector<pair<string, vector<string>>> batch;
+        size_t batched = 0;
+        for (const auto& key : d->keys) {
+            if (batched >= OUTBOX_BATCH_ITEMS)
+                break;
+            batch.emplace_back(key, vector<string>());
+            for (const auto& [item, added] : _pending[key].items) {
+                if (batched >= OUTBOX_BATCH_ITEMS)
+                    break;
+                batch.back().second.push_back(item);
+                batched++;
+            }
+        }
+        lock.unlock();
+        vector<bool> sent;
+        string error;
+        for (const auto& [key, items] : batch) {
+            string joined;
+            for (const auto& item : items)
+                joined += (joined.empty() ? "" : ",") + item;
+            sent.push_back(_send(destination, key, joined, &error));
+            if (!sent.back())
+                break;
+        }
+        lock.lock();
+        if (epoch != _epoch)
+            return;
+
+        d = &_destinations[destination];
+        auto now = Clock::now();
+        size_t delivered = 0;
+        for (size_t i = 0; i < sent.size() && sent[i]; i++, delivered++) {
+            const auto& [key, items] = batch[i];
+            auto p = _pending.find(key);
+            for (const auto& item : items) {
+                if (p != _pending.end()) {
+                    auto added = p->second.items.find(item);
+                    if (added != p->second.items.end()) {
+                        _metrics->Record(_delivery_seconds, now - added->second);
+                        p->second.items.erase(added);
+                    }
+                }
+            }
+            _metrics->Add(_delivered_total, items.size());
+            d->delivered += items.size();
+            if (p != _pending.end() && p->second.items.empty()) {
+                _destinations[p->second.destination].keys.erase(key);
+                _pending.erase(p);
+            }
+        }
+        chrono::milliseconds backoff(0);
+        if (!sent.empty() && !sent.back()) {
+            d->failing++;
+            d->failures++;
+            d->last_error = error;
+            // the set may have moved to another server
+            vector<string> keys(d->keys.begin(), d->keys.end());
+            for (const auto& key : keys)
+                _route(key);
+            backoff = min(OUTBOX_MAX_BACKOFF, OUTBOX_MIN_BACKOFF * (1 << min<uint32_t>(d->failing - 1, 16)));
+        } else {
+            d->failing = 0;
+        }
+
+        // delivered, whether or not an Add queued them again meanwhile. a
+        // change to the store is journaled, which Add must not wait for
+        lock.unlock();
+        for (size_t i = 0; i < delivered; i++)
+            _store->RemoveFromList(OUTBOX_PREFIX + batch[i].first, batch[i].second);
+        lock.lock();
+        if (backoff.count())
+            _changed.wait_for(lock, backoff, [&]() { return epoch != _epoch; });
+    }
+}
+
+vector<outbox_stats_t> Outbox::Stats() const {
+    lock_guard<mutex> lock(_mutex);
+    auto now = Clock::now();
+    vector<outbox_stats_t> stats;
+    for (const auto& [destination, d] : _destinations) {
+        outbox_stats_t s{destination, 0, chrono::milliseconds(0), d.delivered, d.failures, d.last_error};
+        for (const auto& key : d.keys) {
+            const pending_t& p = _pending.at(key);
+            s.pending += p.items.size();
+            for (const auto& [item, added] : p.items)
+                s.lag = max(s.lag, chrono::duration_cast<chrono::milliseconds>(now - added));
+        }
+        stats.push_back(move(s));
+    }
+    return stats;
+}
+
+string Outbox::Prometheus() const {
+    auto stats = Stats();
+    string pending = "# HELP shardkv_outbox_pending Items of the outbox waiting for a server.\n"
+                     "# TYPE shardkv_outbox_pending gauge\n";
+    string lag = "# HELP shardkv_outbox_lag_seconds Time the oldest item of the outbox has waited for a server.\n"
+                 "# TYPE shardkv_outbox_lag_seconds gauge\n";
+    for (const auto& s : stats) {
+        string labels = "{destination=\"" + s.destination + "\"} ";
+        pending += "shardkv_outbox_pending" + labels + to_string(s.pending) + "\n";
+        lag += "shardkv_outbox_lag_seconds" + labels + to_string(s.lag.count() / 1000.0) + "\n";
+    }
+    return pending + lag;
+}
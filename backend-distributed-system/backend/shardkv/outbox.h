@@ -0,0 +1,123 @@
+#ifndef SHARDING_OUTBOX_H
+#define SHARDING_OUTBOX_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "kvstore.h"
+#include "../common/metrics.h"
+
+// the outbox keeps what it has to add to the set at key under this prefix
+// + key, in the store
+constexpr char OUTBOX_PREFIX[] = "outbox_";
+// items sent to one destination in a single round of Appends, at most
+constexpr size_t OUTBOX_BATCH_ITEMS = 1024;
+// a destination that keeps failing is retried this far apart, at most
+constexpr std::chrono::milliseconds OUTBOX_MIN_BACKOFF(50);
+constexpr std::chrono::milliseconds OUTBOX_MAX_BACKOFF(5000);
+// a delivery that takes longer is given up, to be retried
+constexpr std::chrono::seconds OUTBOX_SEND_TIMEOUT(5);
+// the sender of a destination with nothing to send stops after this long
+constexpr std::chrono::milliseconds OUTBOX_IDLE(1000);
+
+// what the outbox holds for one destination
+typedef struct outbox_stats {
+  std::string destination;
+  uint64_t pending;
+  // since the oldest pending item was added
+  std::chrono::milliseconds lag;
+  uint64_t delivered;
+  uint64_t failures;
+  std::string last_error;
+} outbox_stats_t;
+
+// Items to add to sets kept by other servers (the user_<id>_posts of an
+// author on another shard). Add puts them in the store first, under
+// OUTBOX_PREFIX + the key of the set, so they are journaled, replicated and
+// snapshotted like any other change and outlive a failover or a restart.
+// While the outbox is started (on a primary), every destination has a
+// sender thread that delivers its items in batches, backs off while the
+// destination fails, and takes what was delivered out of the store. A set
+// ignores items it already holds, so an item delivered twice (the primary
+// went away before taking it out) does no harm.
+class Outbox {
+ public:
+  // adds the comma separated items to the set at key on server. on failure,
+  // error says why
+  using Send = std::function<bool(const std::string& server, const std::string& key,
+                                  const std::string& items, std::string* error)>;
+  // the server the set at key is on, "" if none is
+  using Resolve = std::function<std::string(const std::string& key)>;
+
+  Outbox(KVStore* store, Resolve resolve, Send send, Metrics* metrics);
+
+  // keeps items for the set at key until they are delivered. returns the
+  // sequence number of the change to the store, 0 if it held them already
+  uint64_t Add(const std::string& key, const std::vector<std::string>& items);
+  // starts delivering everything the store holds, and whatever is added
+  void Start();
+  // stops delivering. the store keeps what was not delivered
+  void Stop();
+  // finds the destination of every set again, e.g. for a new configuration
+  void Reroute();
+
+  std::vector<outbox_stats_t> Stats() const;
+  // the pending items and lag of every destination, as Prometheus gauges
+  std::string Prometheus() const;
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  typedef struct pending {
+    std::string destination;
+    // item -> when it was added
+    std::map<std::string, Clock::time_point> items;
+  } pending_t;
+
+  typedef struct destination {
+    // of _pending
+    std::set<std::string> keys;
+    // whether a sender thread is running for it
+    bool sending = false;
+    // failures since the last delivery, for the backoff
+    uint32_t failing = 0;
+    uint64_t delivered = 0;
+    uint64_t failures = 0;
+    std::string last_error;
+  } destination_t;
+
+  // queues items for key (under _mutex)
+  void _queue(const std::string& key, const std::vector<std::string>& items, Clock::time_point added);
+  // moves key to the queue of its current destination (under _mutex)
+  void _route(const std::string& key);
+  // starts the sender of destination if it is not running (under _mutex)
+  void _wake(const std::string& destination);
+  // the sender thread of destination, until it idles or the outbox stops
+  void _send_loop(std::string destination, uint64_t epoch);
+
+  KVStore* _store;
+  Resolve _resolve;
+  Send _send;
+  Metrics* _metrics;
+  size_t _delivery_seconds;
+  size_t _delivered_total;
+
+  mutable std::mutex _mutex;
+  // signalled when items are queued and when the outbox stops
+  std::condition_variable _changed;
+  bool _started = false;
+  // bumped by Start and Stop, so that senders of an older start give up
+  uint64_t _epoch = 0;
+  // key of the set -> what it still has to get
+  std::map<std::string, pending_t> _pending;
+  std::map<std::string, destination_t> _destinations;
+};
+
+#endif  // SHARDING_OUTBOX_H
@@ -0,0 +1,124 @@
+#include <algorithm>
+
+#include "replication_log.h"
+#include "../common/log.h"
+using namespace std;
+
+uint64_t ReplicationLog::Append(const mutation_t& m) {
+    lock_guard<mutex> lock(_mutex);
+    if (m.seq) {
+        _last = max(_last, m.seq);
+        return m.seq;
+    }
+    uint64_t seq = ++_last;
+    if (!_attached) {
+        _floor = _last;
+        return seq;
+    }
+    if (_pending.size() >= MAX_PENDING_MUTATIONS) {
+        // the backup is hopelessly behind: drop everything it has not
+        // acknowledged, the sender will tell it to resync
+        LOG(WARN) << "Replication log overflow, backup has to resync";
+        _pending.clear();
+        _floor = _last;
+        return seq;
+    }
+    _pending.push_back(m);
+    _pending.back().seq = seq;
+    _appended.notify_all();
+    return seq;
+}
+
+uint64_t ReplicationLog::LastSeq() const {
+    lock_guard<mutex> lock(_mutex);
+    return _last;
+}
+
+void ReplicationLog::Attach() {
+    multimap<uint64_t, function<void()>> callbacks;
+    {
+        lock_guard<mutex> lock(_mutex);
+        _attached = true;
+        _pending.clear();
+        _floor = _last;
+        _acked = _last;
+        _acked_cv.notify_all();
+        callbacks.swap(_ack_callbacks);
+    }
+    for (auto& [seq, done] : callbacks)
+        done();
+}
+
+void ReplicationLog::Detach() {
+    multimap<uint64_t, function<void()>> callbacks;
+    {
+        lock_guard<mutex> lock(_mutex);
+        _attached = false;
+        _pending.clear();
+        _floor = _last;
+        _appended.notify_all();
+        _acked_cv.notify_all();
+        callbacks.swap(_ack_callbacks);
+    }
+    for (auto& [seq, done] : callbacks)
+        done();
+}
+
+bool ReplicationLog::Attached() const {
+    lock_guard<mutex> lock(_mutex);
+    return _attached;
+}
+
+bool ReplicationLog::Covers(uint64_t seq) const {
+    lock_guard<mutex> lock(_mutex);
+    return _attached && seq >= _floor && seq <= _last;
+}
+
+bool ReplicationLog::Read(uint64_t after, size_t max, chrono::milliseconds timeout,
+                          vector<mutation_t>* out) {
+    unique_lock<mutex> lock(_mutex);
+    _appended.wait_for(lock, timeout, [&]() { return !_attached || _last != after; });
+    if (!_attached || after < _floor || after > _last)
+        return false;
+    for (auto it = _pending.begin() + (after - _floor); it != _pending.end() && out->size() < max; ++it)
+        out->push_back(*it);
+    return true;
+}
+
+void ReplicationLog::Ack(uint64_t seq) {
+    vector<function<void()>> callbacks;
+    {
+        lock_guard<mutex> lock(_mutex);
+        if (seq > _last)
+            return;
+        _acked = max(_acked, seq);
+        while (!_pending.empty() && _pending.front().seq <= _acked) {
+            _pending.pop_front();
+            _floor++;
+        }
+        _acked_cv.notify_all();
+        auto end = _ack_callbacks.upper_bound(_acked);
+        for (auto it = _ack_callbacks.begin(); it != end; ++it)
+            callbacks.push_back(move(it->second));
+        _ack_callbacks.erase(_ack_callbacks.begin(), end);
+    }
+    // outside of the lock: they may well append more
+    for (auto& done : callbacks)
+        done();
+}
+
+void ReplicationLog::WaitForAck(uint64_t seq) {
+    unique_lock<mutex> lock(_mutex);
+    _acked_cv.wait(lock, [&]() { return !_attached || _acked >= seq; });
+}
+
+void ReplicationLog::WhenAcked(uint64_t seq, function<void()> done) {
+    {
+        lock_guard<mutex> lock(_mutex);
+        if (_attached && _acked < seq) {
+            _ack_callbacks.emplace(seq, move(done));
+            return;
+        }
+    }
+    done();
+}
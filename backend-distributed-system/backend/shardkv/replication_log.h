@@ -0,0 +1,77 @@
+#ifndef SHARDING_REPLICATION_LOG_H
+#define SHARDING_REPLICATION_LOG_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "kvstore.h"
+
+// when a write is acknowledged to the client while a backup is attached
+enum class ReplicationMode {
+  // as soon as it is in the primary's replication log
+  QUEUED,
+  // once the backup has applied it
+  ACKED
+};
+
+// beyond this many unacknowledged mutations the log gives up on the backup,
+// which then has to take a new Snapshot of the primary
+constexpr size_t MAX_PENDING_MUTATIONS = 1 << 20;
+
+// Ordered log of the mutations a primary still has to ship to its backup.
+// Every mutation gets the next sequence number; while a backup is attached,
+// mutations are kept from the moment of Attach() until the backup
+// acknowledges them. Mutations that arrive with a sequence number (replayed
+// on a backup) are not kept, they only move the numbering forward so that a
+// backup that becomes primary continues where its old primary left off.
+class ReplicationLog {
+ public:
+  // assigns m its sequence number (unless it has one) and returns it
+  uint64_t Append(const mutation_t& m);
+  uint64_t LastSeq() const;
+
+  // starts keeping mutations for a (new) backup, forgetting any old one.
+  // everything up to now is considered acknowledged
+  void Attach();
+  // stops keeping mutations and releases everyone waiting on an ack
+  void Detach();
+  bool Attached() const;
+
+  // true if every mutation after seq can still be read from the log, i.e. a
+  // backup that applied everything up to seq can be brought up to date
+  bool Covers(uint64_t seq) const;
+  // copies up to max mutations following after into out, waiting up to
+  // timeout for one to show up. returns false if after is not covered
+  bool Read(uint64_t after, size_t max, std::chrono::milliseconds timeout,
+            std::vector<mutation_t>* out);
+  // the backup has applied every mutation up to seq
+  void Ack(uint64_t seq);
+  // blocks until seq is acknowledged or the backup goes away
+  void WaitForAck(uint64_t seq);
+  // WaitForAck without blocking: calls done once seq is acknowledged or the
+  // backup goes away, on the thread that acknowledges it (or right away)
+  void WhenAcked(uint64_t seq, std::function<void()> done);
+
+ private:
+  mutable std::mutex _mutex;
+  // signalled on Append
+  std::condition_variable _appended;
+  // signalled on Ack and Detach
+  std::condition_variable _acked_cv;
+  bool _attached = false;
+  uint64_t _last = 0;
+  uint64_t _acked = 0;
+  // _pending holds exactly the mutations numbered _floor + 1 .. _last
+  uint64_t _floor = 0;
+  std::deque<mutation_t> _pending;
+  // what WhenAcked is to call, by the sequence number it waits for
+  std::multimap<uint64_t, std::function<void()>> _ack_callbacks;
+};
+
+#endif  // SHARDING_REPLICATION_LOG_H
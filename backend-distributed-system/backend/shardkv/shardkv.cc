@@ -1,39 +1,163 @@
 #include <grpcpp/grpcpp.h>
-#include <iostream>
 
 #include "shardkv.h"
 using namespace std;
 
-bool ShardkvServer::_manages_key(const string& key) {
-    return key == "all_users" || _server_of(key) == shardmanager_address;
+void ShardkvServer::_register_metrics() {
+    auto rpc = [this](const char* name) {
+        return _metrics.Histogram("shardkv_rpc_seconds", "Time to serve an RPC.",
+                                  string("rpc=\"") + name + "\"");
+    };
+    _h.get = rpc("Get");
+    _h.list_members = rpc("ListMembers");
+    _h.put = rpc("Put");
+    _h.append = rpc("Append");
+    _h.del = rpc("Delete");
+    _h.multi_get = rpc("MultiGet");
+    _h.multi_put = rpc("MultiPut");
+    _h.multi_delete = rpc("MultiDelete");
+    _h.snapshot = rpc("Snapshot");
+    _h.migrate_shard = rpc("MigrateShard");
+    auto phase = [this](const char* name) {
+        return _metrics.Histogram("shardkv_phase_seconds", "Time spent in one part of the work behind RPCs.",
+                                  string("phase=\"") + name + "\"");
+    };
+    // only when the lock was held by someone else
+    _h.lock_wait = phase("lock_wait");
+    // the write-ahead log, and in ACKED mode the backup
+    _h.commit_wait = phase("commit_wait");
+    // one Append of the outbox
+    _h.remote_append = phase("remote_append");
+    // to one server, retries included
+    _h.migrate = phase("migrate");
+    _h.replication_send = phase("replication_send");
+    _h.replication_apply = phase("replication_apply");
+    _h.snapshot_install = phase("snapshot_install");
+    _h.compact = phase("compact");
+    _c.keys_migrated = _metrics.Counter("shardkv_keys_migrated_total", "Keys moved to the server now responsible for them.");
+    _c.append_retries = _metrics.Counter("shardkv_retries_total", "Calls to another server that failed and were retried.",
+                                         "op=\"append\"");
+    _c.migrate_retries = _metrics.Counter("shardkv_retries_total", "Calls to another server that failed and were retried.",
+                                          "op=\"migrate\"");
+    _c.mutations_replicated = _metrics.Counter("shardkv_mutations_replicated_total", "Mutations sent to the backup.");
+    _c.mutations_applied = _metrics.Counter("shardkv_mutations_applied_total", "Mutations of the primary applied as a backup.");
 }
 
-string ShardkvServer::_server_of(const string& key) {
-    unsigned int ikey = extractID(key);
-    return (--_keys_assignments.upper_bound(shard_t{ikey, ikey}))->second;
-    /*string target_server = find_if(servers_shards.begin(), servers_shards.end(),
-                                [&key](const auto& p) -> bool {
-                                    return any_of(p.second.begin(), p.second.end(),
-                                        [&key](shard_t s) -> bool { return shard_has_key(s, extractID(key)); });
-                                })->first;
-    return target_server;*/
+bool ShardkvServer::_manages(const parsed_key_t& key) {
+    // our outbox stays with us, whatever the shard of the sets it is for
+    if (key.type == KeyType::ALL_USERS || key.type == KeyType::OUTBOX)
+        return true;
+    shared_lock<shared_mutex> lock(_config_mutex);
+    return _self != ShardTable::NONE && _assignments.OwnerOf(key.id) == _self;
 }
 
-bool ShardkvServer::_key_is_for_user(const std::string& key) {
-    return key.front() == 'u' && key.back() != 's';
+bool ShardkvServer::_serves(const parsed_key_t& key) {
+    if (key.type == KeyType::ALL_USERS)
+        return true;
+    if (key.type == KeyType::OUTBOX)
+        return false;
+    shared_lock<shared_mutex> lock(_config_mutex);
+    // keys placed by hash have no shard to count the load of
+    if (_assignments.Hashed())
+        return _self != ShardTable::NONE && _assignments.OwnerOf(key.id) == _self;
+    size_t shard = _assignments.ShardOf(key.id);
+    if (_self == ShardTable::NONE || shard == ShardTable::NO_SHARD || _assignments.ShardOwner(shard) != _self)
+        return false;
+    _load.Record(shard, key.id);
+    return true;
 }
 
-bool ShardkvServer::_key_is_for_post(const std::string& key) {
-    return key.front() == 'p';
+string ShardkvServer::_server_of(const parsed_key_t& key) {
+    shared_lock<shared_mutex> lock(_config_mutex);
+    uint16_t owner = _assignments.OwnerOf(key.id);
+    return owner == ShardTable::NONE ? "" : _assignments.Server(owner);
 }
 
-string ShardkvServer::_remove_user(std::string& users, const std::string& user) {
-    vector<string> tokens = parse_value(users, ",");
-    string new_value = "";
-    for (const auto& t : tokens)
-        if (t != user)
-            new_value += t + ",";
-    return new_value;
+uint64_t ShardkvServer::_readable_seq() {
+    // no _mutex: reads must not wait behind heartbeats and replication
+    if (_is_primary)
+        return _log.LastSeq();
+    return _synced ? _applied_seq.load() : 0;
+}
+
+void ShardkvServer::_wait_committed(uint64_t seq) {
+    if (!seq)
+        return;
+    Metrics::Timer timer(&_metrics, _h.commit_wait);
+    if (_wal)
+        _wal->WaitDurable();
+    if (_mode == ReplicationMode::ACKED)
+        _log.WaitForAck(seq);
+}
+
+void ShardkvServer::_when_committed(uint64_t seq, function<void()> done) {
+    if (!seq)
+        return done();
+    auto start = chrono::steady_clock::now();
+    auto durable = [this, seq, start, done = move(done)]() mutable {
+        auto committed = [this, start, done = move(done)]() {
+            _metrics.Record(_h.commit_wait, chrono::steady_clock::now() - start);
+            done();
+        };
+        if (_mode == ReplicationMode::ACKED)
+            _log.WhenAcked(seq, move(committed));
+        else
+            committed();
+    };
+    if (_wal)
+        _wal->WhenDurable(move(durable));
+    else
+        durable();
+}
+
+uint64_t ShardkvServer::_journal(const mutation_t& m) {
+    if (!_wal)
+        return _log.Append(m);
+    lock_guard<mutex> lock(_journal_mutex);
+    uint64_t seq = _log.Append(m);
+    _wal->Append(m, seq, !_installing);
+    return seq;
+}
+
+void ShardkvServer::_recover(wal_options_t options) {
+    auto start = chrono::steady_clock::now();
+    auto wal = make_unique<WriteAheadLog>(move(options));
+    // replayed mutations keep their sequence numbers, and only move the
+    // numbering of the replication log forward
+    _store.SetJournal([this](const mutation_t& m) { return _log.Append(m); });
+    size_t snapshot_keys = 0;
+    size_t replayed = wal->Open(
+        [this, &snapshot_keys](shared_ptr<const MappedSnapshot> snapshot) {
+            // the snapshot is read in place rather than replayed, so the
+            // numbering has to be moved past its entries here
+            _log.Append({snapshot->MaxSeq(), MutationOp::PUT, "", "", ""});
+            snapshot_keys = snapshot->Size();
+            _store.SetBase(move(snapshot));
+        },
+        [this](const mutation_t& m) { _store.Apply(m); });
+    _wal = move(wal);
+    auto elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start);
+    LOG(INFO)<<address<<" recovered a snapshot of "<<snapshot_keys<<" keys and "<<replayed
+        <<" records (up to mutation "<<_log.LastSeq()<<") in "<<elapsed.count()<<" ms";
+}
+
+// m is moved into out, which the store copied it out for in the first place
+static void to_proto(mutation_t&& m, Mutation* out) {
+    out->set_seq(m.seq);
+    out->set_op(static_cast<Mutation::Op>(m.op));
+    out->set_key(move(m.key));
+    out->set_data(move(m.value));
+    out->set_user(move(m.author));
+}
+
+static void to_proto(const mutation_t& m, Mutation* out) {
+    to_proto(mutation_t(m), out);
+}
+
+// takes the strings of m, which is thrown away right after
+static mutation_t from_proto(Mutation&& m) {
+    return {m.seq(), static_cast<MutationOp>(m.op()), move(*m.mutable_key()),
+            move(*m.mutable_data()), move(*m.mutable_user())};
 }
 
 /**
@@ -41,25 +165,70 @@ string ShardkvServer::_remove_user(std::string& users, const std::string& user)
  * request and if its value can be found, we should either set the appropriate
  * field in the response Otherwise, we should return an error. An error should
  * also be returned if the server is not responsible for the specified key
+ * A backup serves the read too, as long as it has applied at least the
+ * min_seq mutations the request asks for.
  *
  * @param context - you can ignore this
  * @param request a message containing a key
  * @param response we store the value for the specified key here
  * @return ::grpc::Status::OK on success, or
  * ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "<your error message
- * here>")
+ * here>"), or ::grpc::Status(::grpc::StatusCode::FAILED_PRECONDITION, ...)
+ * if our store is behind min_seq
  */
 ::grpc::Status ShardkvServer::Get(::grpc::ServerContext* context,
                                   const ::GetRequest* request,
                                   ::GetResponse* response) {
-    string key = request->key();
+    Metrics::Timer timer(&_metrics, _h.get);
+    const string& key = request->key();
+
+    if (!_serves_key(key))
+        return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "Not responsible for key");
+    // taken before the read, so the value reflects at least seq
+    uint64_t seq = _readable_seq();
+    if (seq < request->min_seq())
+        return ::grpc::Status(::grpc::StatusCode::FAILED_PRECONDITION, "Behind the requested sequence number");
+    // the value is copied once, out of the store and straight into the
+    // response
+    if (!_store.Get(key, response->mutable_data()))
+        return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "Key not found");
+    response->set_seq(seq);
+    return ::grpc::Status::OK;
+}
+
+/**
+ * Reads a set-valued key (all_users, user_<id>_posts) one page at a time,
+ * instead of as a single comma separated string like Get does.
+ *
+ * @param context - you can ignore this
+ * @param request the key, the cursor returned with the previous page (0 for
+ * the first one) and the maximum number of members to return
+ * @param response the members, and the cursor of the next page (0 if this
+ * was the last one)
+ * @return ::grpc::Status::OK on success, or
+ * ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "<your error message
+ * here>")
+ */
+::grpc::Status ShardkvServer::ListMembers(::grpc::ServerContext* context,
+                                          const ::ListMembersRequest* request,
+                                          ::ListMembersResponse* response) {
+    Metrics::Timer timer(&_metrics, _h.list_members);
+    const string& key = request->key();
 
-    lock_guard<mutex> lock(*_mutex);
-    if (!_manages_key(key))
+    if (!_serves_key(key))
         return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "Not responsible for key");
-    if (_database.find(key) == _database.end())
+    uint64_t seq = _readable_seq();
+    if (seq < request->min_seq())
+        return ::grpc::Status(::grpc::StatusCode::FAILED_PRECONDITION, "Behind the requested sequence number");
+    size_t limit = request->limit() ? min<size_t>(request->limit(), MAX_PAGE_SIZE) : DEFAULT_PAGE_SIZE;
+    vector<string> members;
+    uint64_t next;
+    if (!_store.ListMembers(key, request->cursor(), limit, &members, &next))
         return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "Key not found");
-    response->set_data(_database[key]);
+    for (auto& m : members)
+        response->add_members(move(m));
+    response->set_next_cursor(next);
+    response->set_seq(seq);
     return ::grpc::Status::OK;
 }
 
@@ -69,6 +238,8 @@ string ShardkvServer::_remove_user(std::string& users, const std::string& user)
  * If the item already exists, you must replace its previous value.
  * This function should error if the server is not responsible for the specified
  * key.
+ * A post whose author another server is in charge of makes it into the
+ * author's user_<id>_posts after Put returns, from the outbox.
  *
  * @param context - you can ignore this
  * @param request A message containing a key-value pair
@@ -80,58 +251,67 @@ string ShardkvServer::_remove_user(std::string& users, const std::string& user)
 ::grpc::Status ShardkvServer::Put(::grpc::ServerContext* context,
                                   const ::PutRequest* request,
                                   Empty* response) {
-    string key = request->key();
-    string value = request->data();
-    string user = request->user();
-    
-    lock_guard<mutex> lock(*_mutex);
-
-    if (_stub_to_backup != nullptr) {
-        // cerr<<address<<" sending put to backup "<<_backup_address<<endl;
-        ::grpc::ClientContext cc;
-        Empty put_response;
-        ::grpc::Status result;
-        do {
-            result = _stub_to_backup->Put(&cc, *request, &put_response);
-        } while(!result.ok());
-    }
+    Metrics::Timer timer(&_metrics, _h.put);
+    uint64_t seq = 0;
+    ::grpc::Status status = _put(request, &seq);
+    _wait_committed(seq);
+    return status;
+}
+
+::grpc::Status ShardkvServer::_put(const ::PutRequest* request, uint64_t* last_seq) {
+    const string& key = request->key();
+    const string& value = request->data();
+    const string& user = request->user();
 
-    if (!_manages_key(key))
+    // the backup is kept up to date by the replication stream (see
+    // ReplicateToBackup), here we only wait for it in ACKED mode
+    parsed_key_t parsed = parse_key(key);
+    if (!_serves(parsed))
         return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "Not responsible for key");
-    _database[key] = value;
-    if (_key_is_for_user(key)) {
-        _database["all_users"] += key + ",";
-    } else if(_key_is_for_post(key)) {
-        _authors[key] = user;
-        string responsible = _server_of(user);
+    uint64_t seq = 0;
+    if (parsed.type == KeyType::USER) {
+        // a user already listed adds nothing to all_users, but its new value
+        // still has to be committed before we answer
+        seq = _store.Put(key, value);
+        seq = max(seq, _store.AddToList("all_users", key));
+    } else if (parsed.type == KeyType::POST) {
+        seq = _store.Put(key, value, user);
+        parsed_key_t author = parse_key(user);
         string user_id_posts_key = user + "_posts";
-        if(responsible == shardmanager_address) {
-            vector<string> tokens = parse_value(_database[user_id_posts_key], ",");
-            if (count(tokens.begin(), tokens.end(), key) == 0)
-                _database[user_id_posts_key] += key + ",";
+        if (_manages(author)) {
+            seq = max(seq, _store.AddToList(user_id_posts_key, key));
         } else {
-            // create a stub for the target server
-            auto stub = Shardkv::NewStub(grpc::CreateChannel(responsible, grpc::InsecureChannelCredentials()));
-            bool done = false;
-            // keep trying to move the key until it succeeds
-            while (!done) {
-                ::grpc::ClientContext cc;
-                AppendRequest append_request;
-                append_request.set_key(user_id_posts_key);
-                append_request.set_data(key);
-                Empty append_response;
-                auto put_result = stub->Append(&cc, append_request, &append_response);
-                done = put_result.ok();
-                if (!done)
-                    cerr<<"Append "<<key<<" to "<<responsible<<" failed, retrying ..."<<endl;
-            }
+            // the other server gets it from the outbox, in the background
+            seq = max(seq, _outbox.Add(user_id_posts_key, {key}));
         }
     } else {
-        cerr << "PUT Warning: key " << key << " is not for a user or a post" << endl;
+        seq = _store.Put(key, value);
+        LOG(WARN) << "PUT Warning: key " << key << " is not for a user or a post";
     }
+    *last_seq = seq;
     return ::grpc::Status::OK;
 }
 
+bool ShardkvServer::_send_append(const string& server, const string& key, const string& data, string* error) {
+    Metrics::Timer timer(&_metrics, _h.remote_append);
+    auto stub = ChannelPool::Shared().Stub<Shardkv>(server);
+    ::grpc::ClientContext cc;
+    // the outbox retries, after backing off, rather than wait on a server that is down
+    cc.set_deadline(chrono::system_clock::now() + OUTBOX_SEND_TIMEOUT);
+    AppendRequest append_request;
+    append_request.set_key(key);
+    append_request.set_data(data);
+    Empty append_response;
+    auto status = stub->Append(&cc, append_request, &append_response);
+    ChannelPool::Shared().Report(server, status);
+    if (!status.ok()) {
+        _metrics.Add(_c.append_retries);
+        *error = status.error_message();
+        LOG(WARN)<<"Append to "<<key<<" on "<<server<<" failed, retrying later: "<<*error;
+    }
+    return status.ok();
+}
+
 /**
  * Appends the data in the request to whatever data the specified key maps to.
  * If the key is not mapped to anything, this method should be equivalent to a
@@ -148,28 +328,35 @@ string ShardkvServer::_remove_user(std::string& users, const std::string& user)
 ::grpc::Status ShardkvServer::Append(::grpc::ServerContext* context,
                                      const ::AppendRequest* request,
                                      Empty* response) {
-    string key = request->key();
-    string value = request->data();
+    Metrics::Timer timer(&_metrics, _h.append);
+    uint64_t seq = 0;
+    ::grpc::Status status = _append(request, &seq);
+    _wait_committed(seq);
+    return status;
+}
+
+::grpc::Status ShardkvServer::_append(const ::AppendRequest* request, uint64_t* last_seq) {
+    const string& key = request->key();
+    const string& value = request->data();
 
-    lock_guard<mutex> lock(*_mutex);
-    if (!_manages_key(key))
+    parsed_key_t parsed = parse_key(key);
+    if (!_serves(parsed))
         return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "Not responsible for key");
-    if (_database.find(key) != _database.end() || !(_key_is_for_post(key) || _key_is_for_user(key))) {
-        if (key.back() == 's') {
-            vector<string> tokens = parse_value(_database[key], ",");
-            // if(tokens.size()) cerr<<tokens[0]<<" | value = "<<value<<endl;
-            if (count(tokens.begin(), tokens.end(), value) == 0)
-                _database[key] += value + ",";
-        } else
-            _database[key] += value;
+    if (parsed.type != KeyType::POST && parsed.type != KeyType::USER) {
+        if (parsed.type == KeyType::USER_POSTS || parsed.type == KeyType::ALL_USERS)
+            *last_seq = _store.AddToList(key, value);
+        else
+            *last_seq = _store.Append(key, value);
+        return ::grpc::Status::OK;
+    }
+    if (uint64_t seq = _store.AppendIfPresent(key, value)) {
+        *last_seq = seq;
         return ::grpc::Status::OK;
     }
-    ::grpc::ServerContext sc;
     PutRequest put_request;
-    Empty resp;
     put_request.set_key(key);
     put_request.set_data(value);
-    return Put(&sc, &put_request, &resp);
+    return _put(&put_request, last_seq);
 }
 
 /**
@@ -187,125 +374,362 @@ string ShardkvServer::_remove_user(std::string& users, const std::string& user)
 ::grpc::Status ShardkvServer::Delete(::grpc::ServerContext* context,
                                            const ::DeleteRequest* request,
                                            Empty* response) {
-    string key = request->key();
+    Metrics::Timer timer(&_metrics, _h.del);
+    uint64_t seq = 0;
+    ::grpc::Status status = _delete(request, &seq);
+    _wait_committed(seq);
+    return status;
+}
 
-    lock_guard<mutex> lock(*_mutex);
-    if (!_manages_key(key))
+::grpc::Status ShardkvServer::_delete(const ::DeleteRequest* request, uint64_t* last_seq) {
+    const string& key = request->key();
+
+    parsed_key_t parsed = parse_key(key);
+    if (!_serves(parsed))
         return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "Not responsible for key");
-    if (_database.find(key) == _database.end())
+    uint64_t seq = _store.Erase(key);
+    if (!seq)
         return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "Key not found");
 
-    _database.erase(key);
-    if (_key_is_for_user(key)) {
+    if (parsed.type == KeyType::USER) {
         // remove the user key from the "all_users" key
-        _database["all_users"] = _remove_user(_database["all_users"], key);
+        seq = max(seq, _store.RemoveFromList("all_users", key));
     }
+    *last_seq = seq;
     return ::grpc::Status::OK;
 }
 
 /**
- * This method is called in a separate thread on periodic intervals (see the
- * constructor in shardkv.h for how this is done). It should query the shardmaster
- * for an updated configuration of how shards are distributed. You should then
- * find this server in that configuration and look at the shards associated with
- * it. These are the shards that the shardmaster deems this server responsible
- * for. Check that every key you have stored on this server is one that the
- * server is actually responsible for according to the shardmaster. If this
- * server is no longer responsible for a key, you should find the server that
- * is, and call the Put RPC in order to transfer the key/value pair to that
- * server. You should not let the Put RPC fail. That is, the RPC should be
- * continually retried until success. After the put RPC succeeds, delete the
- * key/value pair from this server's storage. Think about concurrency issues like
- * potential deadlock as you write this function!
+ * Get for several keys at once. The store is read one stripe at a time, each
+ * stripe locked once for all the keys that live in it.
  *
- * @param stub a grpc stub for the shardmaster, which we use to invoke the Query
- * method!
+ * @param context - you can ignore this
+ * @param request the keys, all of which we must be responsible for
+ * @param response the value of every key that was found
+ * @return ::grpc::Status::OK on success (even if some keys are missing), or
+ * ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, ...) if we are not
+ * responsible for one of the keys, or
+ * ::grpc::Status(::grpc::StatusCode::FAILED_PRECONDITION, ...) as in Get
  */
-void ShardkvServer::QueryShardmaster(Shardmaster::Stub* stub) {
-    ::grpc::ClientContext cc;
-    Empty request;
-    QueryResponse response;
-    // query shardmaster for updated configuration (should always succeed)
-    auto query_result = stub->Query(&cc, request, &response);
-    if(!query_result.ok()) {
-        cerr<<"Query to shardmaster failed with error: "<<query_result.error_message()<<endl;
-        cerr<<"Primary = "<<_is_primary<<endl;
-        return;
+::grpc::Status ShardkvServer::MultiGet(::grpc::ServerContext* context,
+                                       const ::MultiGetRequest* request,
+                                       ::MultiGetResponse* response) {
+    Metrics::Timer timer(&_metrics, _h.multi_get);
+    // the keys are read where they are, in the request
+    vector<const string*> keys;
+    for (const auto& key : request->keys()) {
+        if (!_serves_key(key))
+            return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "Not responsible for key " + key);
+        keys.push_back(&key);
+    }
+    uint64_t seq = _readable_seq();
+    if (seq < request->min_seq())
+        return ::grpc::Status(::grpc::StatusCode::FAILED_PRECONDITION, "Behind the requested sequence number");
+    for (auto& value : _store.MultiGet(keys)) {
+        response->add_found(value.has_value());
+        response->add_values(value ? move(*value) : "");
     }
-    assert(query_result.ok());
+    response->set_seq(seq);
+    return ::grpc::Status::OK;
+}
 
-    // build a map with the results of the query
-    vector<pair<shard_t, string>> shards_servers;
-    for (const auto& e : response.config())
-        for (const auto& s : e.shards())
-            shards_servers.push_back({{s.lower(), s.upper()}, e.server()});
+/**
+ * Put for several keys at once. The keys are written one stripe at a time,
+ * then the lists the new keys belong to (all_users, user_<id>_posts) are
+ * updated with a single change per list, or a single change to the outbox
+ * for a list kept by another server.
+ *
+ * @param context - you can ignore this
+ * @param request the Puts, all on keys we are responsible for
+ * @param response An empty message, as we don't need to return any data
+ * @return ::grpc::Status::OK on success, or
+ * ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, ...) if we are not
+ * responsible for one of the keys, in which case nothing is written
+ */
+::grpc::Status ShardkvServer::MultiPut(::grpc::ServerContext* context,
+                                       const ::MultiPutRequest* request,
+                                       Empty* response) {
+    Metrics::Timer timer(&_metrics, _h.multi_put);
+    uint64_t seq = 0;
+    ::grpc::Status status = _multi_put(request, &seq);
+    _wait_committed(seq);
+    return status;
+}
 
+::grpc::Status ShardkvServer::_multi_put(const ::MultiPutRequest* request, uint64_t* last_seq) {
+    vector<KeyType> types;
+    for (const auto& put : request->puts()) {
+        parsed_key_t parsed = parse_key(put.key());
+        if (!_serves(parsed))
+            return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "Not responsible for key " + put.key());
+        types.push_back(parsed.type);
+    }
+    vector<mutation_t> changes;
+    vector<string> users;
+    // the posts added for every author
+    map<string, vector<string>> posts_of;
+    for (int i = 0; i < request->puts_size(); i++) {
+        const auto& put = request->puts(i);
+        const string& key = put.key();
+        if (types[i] == KeyType::USER) {
+            changes.push_back({0, MutationOp::PUT, key, put.data(), ""});
+            users.push_back(key);
+        } else if (types[i] == KeyType::POST) {
+            changes.push_back({0, MutationOp::PUT, key, put.data(), put.user()});
+            posts_of[put.user()].push_back(key);
+        } else {
+            changes.push_back({0, MutationOp::PUT, key, put.data(), ""});
+            LOG(WARN) << "PUT Warning: key " << key << " is not for a user or a post";
+        }
+    }
+    uint64_t seq = 0;
+    for (uint64_t s : _store.MultiMutate(&changes))
+        seq = max(seq, s);
+    if (!users.empty())
+        seq = max(seq, _store.AddToList("all_users", users));
+    for (const auto& [user, posts] : posts_of) {
+        parsed_key_t author = parse_key(user);
+        if (_manages(author))
+            seq = max(seq, _store.AddToList(user + "_posts", posts));
+        else
+            seq = max(seq, _outbox.Add(user + "_posts", posts));
+    }
+    *last_seq = seq;
+    return ::grpc::Status::OK;
+}
 
-    // lock the mutex to avoid concurrent access to the database
-    unique_lock<mutex> lock(*_mutex);
-    // update the keys assignments
-    _keys_assignments = map{shards_servers.begin(), shards_servers.end()};
-    if (!_is_primary) {
-        // if this is a backup server, it should not redistribute keys
-        return;
+/**
+ * Delete for several keys at once, one stripe at a time. Keys that are not
+ * there are skipped.
+ *
+ * @param context - you can ignore this
+ * @param request the keys, all of which we must be responsible for
+ * @param response how many of the keys were deleted
+ * @return ::grpc::Status::OK on success, or
+ * ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, ...) if we are not
+ * responsible for one of the keys, in which case nothing is deleted
+ */
+::grpc::Status ShardkvServer::MultiDelete(::grpc::ServerContext* context,
+                                          const ::MultiDeleteRequest* request,
+                                          ::MultiDeleteResponse* response) {
+    Metrics::Timer timer(&_metrics, _h.multi_delete);
+    uint64_t seq = 0;
+    ::grpc::Status status = _multi_delete(request, response, &seq);
+    _wait_committed(seq);
+    return status;
+}
+
+::grpc::Status ShardkvServer::_multi_delete(const ::MultiDeleteRequest* request, ::MultiDeleteResponse* response,
+                                            uint64_t* last_seq) {
+    vector<mutation_t> changes;
+    vector<KeyType> types;
+    for (const auto& key : request->keys()) {
+        parsed_key_t parsed = parse_key(key);
+        if (!_serves(parsed))
+            return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "Not responsible for key " + key);
+        changes.push_back({0, MutationOp::ERASE, key, "", ""});
+        types.push_back(parsed.type);
+    }
+    vector<uint64_t> seqs = _store.MultiMutate(&changes);
+    uint64_t seq = 0;
+    uint32_t deleted = 0;
+    vector<string> users;
+    for (size_t i = 0; i < changes.size(); i++) {
+        if (!seqs[i])
+            continue;
+        deleted++;
+        seq = max(seq, seqs[i]);
+        if (types[i] == KeyType::USER)
+            users.push_back(changes[i].key);
     }
+    if (!users.empty())
+        seq = max(seq, _store.RemoveFromList("all_users", users));
+    response->set_deleted(deleted);
+    *last_seq = seq;
+    return ::grpc::Status::OK;
+}
 
-    // find keys that need to be redistributed and to which server
-    // this is saved in a map
-    unordered_map<string, vector<string>> keys_to_redostribute;
-    for(auto& [k, v] : _database) {
-        if (!_manages_key(k)) {
-            string target_server = _server_of(k);
-            if (keys_to_redostribute.find(target_server) == keys_to_redostribute.end())
-                keys_to_redostribute[target_server] = vector<string>();
-            keys_to_redostribute[target_server].push_back(k);
+/**
+ * This method is called in a separate thread (see the constructor in
+ * shardkv.h for how this is done). It opens a Watch stream on the
+ * shardmaster, which sends the configuration of how shards are distributed
+ * every time it changes, and installs each new configuration. The work of
+ * moving keys around is left to RedistributeKeys, run by the rebalance
+ * thread, so that a long migration does not hold up newer configurations.
+ *
+ * @param stub a grpc stub for the shardmaster, which we use to invoke the
+ * Watch method!
+ */
+void ShardkvServer::WatchShardmaster(Shardmaster::Stub* stub) {
+    ::grpc::ClientContext cc;
+    WatchRequest request;
+    {
+        shared_lock<shared_mutex> config_lock(_config_mutex);
+        request.set_from_version(_config_version);
+        request.set_epoch(_config_epoch);
+    }
+    auto reader = stub->Watch(&cc, request);
+    QueryResponse response;
+    while (reader->Read(&response)) {
+        // build a table with the new configuration
+        ShardTable assignments;
+        vector<string> servers;
+        vector<vector<shard_t>> shards;
+        for (const auto& e : response.config()) {
+            servers.push_back(e.server());
+            shards.emplace_back();
+            for (const auto& s : e.shards())
+                shards.back().push_back({s.lower(), s.upper()});
+        }
+        if (response.placement() == PLACEMENT_HASH)
+            assignments.PlaceByHash(servers, response.vnodes(),
+                                    {response.key_space().lower(), response.key_space().upper()});
+        else
+            assignments.Assign(servers, shards);
+
+        // update the keys assignments
+        {
+            unique_lock<shared_mutex> config_lock(_config_mutex);
+            // a restarted shardmaster counts versions from 0 again
+            if (response.epoch() == _config_epoch && response.version() <= _config_version)
+                continue;
+            _assignments = move(assignments);
+            _self = _assignments.IndexOf(shardmanager_address);
+            _config_epoch = response.epoch();
+            _config_version = response.version();
+            _load.Reset(_assignments, _self);
         }
+        _outbox.Reroute();
+        lock_guard<mutex> lock(*_mutex);
+        _rebalance_pending = true;
+        _rebalance_cv.notify_one();
     }
-    if(keys_to_redostribute.empty())
-        return;
+    auto status = reader->Finish();
+    LOG(WARN)<<"Watch on shardmaster ended: "<<status.error_message();
+}
 
-    // build all the channels and put requests to redistribute keys to the target servers
-    vector<pair<unique_ptr<Shardkv::Stub>, vector<PutRequest>>> stubs_requests;
-    for (auto& [server, keys] : keys_to_redostribute) {
-        auto stub = Shardkv::NewStub(grpc::CreateChannel(server, grpc::InsecureChannelCredentials()));
-        vector<PutRequest> put_requests;
-        for (auto& k : keys) {
-            PutRequest put_request;
-            put_request.set_key(k);
-            put_request.set_data(_database[k]);
-            if(_key_is_for_post(k))
-                put_request.set_user(_authors[k]);
-            put_requests.push_back(put_request);
+/**
+ * Tells the shardmaster how many requests every shard we hold got since the
+ * last report, and where to split it to halve that load. The shardmaster
+ * uses it to split, merge and move shards when it balances the load, and
+ * ignores it if the configuration changed in the meantime.
+ *
+ * @param stub a grpc stub for the shardmaster
+ */
+void ShardkvServer::ReportLoad(Shardmaster::Stub* stub) {
+    LoadReport report;
+    report.set_server(address);
+    {
+        shared_lock<shared_mutex> config_lock(_config_mutex);
+        if (_self == ShardTable::NONE)
+            return;
+        report.set_version(_config_version);
+        for (const shard_load_t& l : _load.Take()) {
+            ShardLoad* load = report.add_shards();
+            load->mutable_shard()->set_lower(l.shard.lower);
+            load->mutable_shard()->set_upper(l.shard.upper);
+            load->set_rate(l.rate);
+            load->set_split(l.split);
         }
-        stubs_requests.push_back({move(stub), move(put_requests)});
     }
-    // cerr<<"lock releasing"<<endl;
-    lock.unlock();
+    ::grpc::ClientContext cc;
+    cc.set_deadline(chrono::system_clock::now() + LOAD_REPORT_INTERVAL);
+    Empty response;
+    stub->ReportLoad(&cc, report, &response);
+}
 
-    // send the requests to the target servers
-    for (auto& [stub, requests] : stubs_requests) {
-        for (auto& request : requests) {
-            // keep trying to move the key until it succeeds
-            ::grpc::Status put_result;
-            do {
-                ::grpc::ClientContext cc;
-                Empty put_response;
-                put_result = stub->Put(&cc, request, &put_response);
-            } while(!put_result.ok());
+/**
+ * Check that every key you have stored on this server is one that the
+ * server is actually responsible for according to the shardmaster. If this
+ * server is no longer responsible for a key, you should find the server that
+ * is, and transfer the key/value pair to that server. The transfer should not
+ * fail: it is continually retried until success. After it succeeds, delete
+ * the key/value pair from this server's storage. Think about concurrency
+ * issues like potential deadlock as you write this function!
+ *
+ * Keys to move are copied out one store stripe at a time, so clients keep
+ * being served on every stripe the scan is not currently looking at. They
+ * are then shipped with one MigrateShard stream per target server rather
+ * than a Put per key, with all targets served in parallel.
+ */
+void ShardkvServer::RedistributeKeys() {
+    {
+        lock_guard<mutex> lock(*_mutex);
+        if (!_is_primary) {
+            // if this is a backup server, it should not redistribute keys
+            return;
         }
     }
 
-    lock.lock();
-    for (auto& [server, keys] : keys_to_redostribute) {
-        for (auto& k : keys) {
-            _database.erase(k);
-            _authors.erase(k);
-            if(_key_is_for_user(k))
-                _database["all_users"] = _remove_user(_database["all_users"], k);
+    // find keys that need to be redistributed and to which server
+    // this is saved in a map
+    auto to_move = _store.Collect([this](const string& k) { return !_manages_key(k); });
+    if(to_move.empty())
+        return;
+
+    // group the keys by the server they go to, and move them to every
+    // server in parallel
+    unordered_map<string, vector<pair<string, entry_t>>> keys_to_redistribute;
+    for (auto& [k, e] : to_move)
+        keys_to_redistribute[_server_of(parse_key(k))].push_back({k, move(e)});
+    vector<thread> migrations;
+    for (auto& [server, entries] : keys_to_redistribute)
+        migrations.emplace_back([this, &server = server, &entries = entries]() { _migrate(server, entries); });
+    for (auto& t : migrations)
+        t.join();
+
+    vector<string> users;
+    for (auto& [server, entries] : keys_to_redistribute) {
+        for (auto& [k, e] : entries) {
+            _store.Erase(k);
+            if (parse_key(k).type == KeyType::USER)
+                users.push_back(k);
         }
     }
+    if (!users.empty())
+        _store.RemoveFromList("all_users", users);
 }
 
+void ShardkvServer::_migrate(const string& server, const vector<pair<string, entry_t>>& entries) {
+    // keep trying to move the keys until it succeeds. the receiver simply
+    // overwrites keys it already got, so it is fine to send them all again
+    Metrics::Timer timer(&_metrics, _h.migrate);
+    ::grpc::Status result;
+    do {
+        auto stub = ChannelPool::Shared().Stub<Shardkv>(server);
+        ::grpc::ClientContext cc;
+        Empty response;
+        auto writer = stub->MigrateShard(&cc, &response);
+        MigrateBatch batch;
+        size_t bytes = 0;
+        bool broken = false;
+        for (const auto& [k, e] : entries) {
+            string value = e.Flatten();
+            bytes += k.size() + value.size() + e.author.size();
+            to_proto({0, MutationOp::PUT, k, move(value), e.author}, batch.add_entries());
+            if (bytes < MIGRATE_BATCH_BYTES)
+                continue;
+            if (!writer->Write(batch)) {
+                broken = true;
+                break;
+            }
+            batch.clear_entries();
+            bytes = 0;
+        }
+        if (!broken && batch.entries_size() > 0)
+            writer->Write(batch);
+        writer->WritesDone();
+        result = writer->Finish();
+        auto backoff = ChannelPool::Shared().Report(server, result);
+        if (!result.ok()) {
+            _metrics.Add(_c.migrate_retries);
+            LOG(WARN)<<"Migration of "<<entries.size()<<" keys to "<<server<<" failed ("<<result.error_message()<<"), retrying ...";
+            // most likely the target has not seen the new configuration yet
+            this_thread::sleep_for(backoff);
+        }
+    } while (!result.ok());
+    _metrics.Add(_c.keys_migrated, entries.size());
+}
 
 /**
  * This method is called in a separate thread on periodic intervals (see the
@@ -332,38 +756,146 @@ void ShardkvServer::PingShardmanager(Shardkv::Stub* stub) {
     stub->Ping(&cc, request, &response);
     lock.lock();
     shardmaster_address = response.shardmaster();
-    // cerr<<address<<" PINGED "<<_viewnumber<<endl;
+    LOG(DEBUG)<<address<<" pinged, view "<<response.id()<<" primary "<<response.primary()<<" backup "<<response.backup();
+    bool was_primary = _is_primary;
     _is_primary = response.primary() == address;
+    bool promoted = _is_primary && !was_primary;
+    bool demoted = was_primary && !_is_primary;
+    if (promoted) {
+        // we may hold keys our old primary was still moving away
+        _rebalance_pending = true;
+        _rebalance_cv.notify_one();
+    }
     bool is_backup = !_is_primary && response.backup() == address;
     if (_is_primary && !response.backup().empty()) {
         if (response.backup() != _backup_address) {
-            cerr<<address<<" creating channel towards "<<response.backup()<<endl;
+            LOG(INFO)<<address<<" replicating towards "<<response.backup();
             _backup_address = response.backup();
-            _stub_to_backup = Shardkv::NewStub(grpc::CreateChannel(response.backup(), grpc::InsecureChannelCredentials()));
+            _log.Attach();
         }
-    } else if (_stub_to_backup != nullptr || _backup_address != "") {
-        cerr<<address<<" deleting channel towards "<<_backup_address<<endl;
-        _stub_to_backup = nullptr;
+    } else if (_backup_address != "") {
+        LOG(INFO)<<address<<" no longer replicating towards "<<_backup_address;
         _backup_address = "";
+        _log.Detach();
     }
-    if (is_backup && _viewnumber == 0) {
-        unique_ptr<Shardkv::Stub> stub = Shardkv::NewStub(grpc::CreateChannel(response.primary(), grpc::InsecureChannelCredentials()));        
-        ::grpc::ClientContext cc;
-        DumpResponse response;
-        Empty request;
+    if (is_backup && response.primary() != _synced_with)
+        _synced = false;
+    if (is_backup && !_synced) {
+        // copy the whole store of the primary, the replication stream brings
+        // it up to date from there
+        string primary = response.primary();
         lock.unlock();
-        ::grpc::Status status = stub->Dump(&cc, request, &response);
+        bool ok = _install_snapshot(primary);
         lock.lock();
-        if (status.ok()) {
-            for( const auto& kv : response.database() )
-                this->_database.insert({kv.first, kv.second});
-        } else{
-            cerr<<"Transfer FAILED"<<endl;
+        if (ok) {
+            _synced_with = primary;
+            _synced = true;
         }
     }
     _viewnumber = response.id();
+    lock.unlock();
+    // a new primary delivers the posts its old primary had still to deliver.
+    // Start reads the whole store, which must not hold up heartbeats
+    if (promoted)
+        _outbox.Start();
+    else if (demoted)
+        _outbox.Stop();
+}
+
+/**
+ * Streams the replication log to the backup. The backup opens every stream
+ * by telling how far it got; if the log no longer holds what comes after
+ * that, the backup is told to resync (take a new Snapshot) instead.
+ * Mutations are then sent in batches as they are appended, while a second
+ * thread hands the backup's acknowledgements back to the log.
+ */
+void ShardkvServer::ReplicateToBackup() {
+    const size_t max_batch = 512;
+    const chrono::milliseconds idle(50);
+    string backup;
+    while (true) {
+        string target;
+        {
+            lock_guard<mutex> lock(*_mutex);
+            target = _backup_address;
+        }
+        if (target.empty() || !_log.Attached()) {
+            this_thread::sleep_for(idle);
+            continue;
+        }
+        backup = target;
+
+        auto stub = ChannelPool::Shared().Stub<Shardkv>(backup);
+        ::grpc::ClientContext cc;
+        auto stream = stub->Replicate(&cc);
+        ReplicationAck hello;
+        if (!stream->Read(&hello)) {
+            // the backup is not ready yet (most likely still copying our store)
+            auto backoff = ChannelPool::Shared().Report(backup, stream->Finish());
+            this_thread::sleep_for(max(idle, backoff));
+            continue;
+        }
+        uint64_t after = hello.applied_seq();
+        if (!_log.Covers(after)) {
+            ReplicationBatch batch;
+            batch.set_resync(true);
+            stream->Write(batch);
+            stream->WritesDone();
+            stream->Finish();
+            continue;
+        }
+        _log.Ack(after);
+
+        thread acks([this, &stream]() {
+            ReplicationAck ack;
+            while (stream->Read(&ack))
+                _log.Ack(ack.applied_seq());
+        });
+        while (true) {
+            {
+                lock_guard<mutex> lock(*_mutex);
+                if (_backup_address != backup)
+                    break;
+            }
+            vector<mutation_t> mutations;
+            if (!_log.Read(after, max_batch, idle, &mutations)) {
+                if (_log.Attached()) {
+                    ReplicationBatch batch;
+                    batch.set_resync(true);
+                    stream->Write(batch);
+                }
+                break;
+            }
+            if (mutations.empty())
+                continue;
+            Metrics::Timer timer(&_metrics, _h.replication_send);
+            ReplicationBatch batch;
+            for (auto& m : mutations)
+                to_proto(move(m), batch.add_mutations());
+            if (!stream->Write(batch))
+                break;
+            _metrics.Add(_c.mutations_replicated, mutations.size());
+            after = mutations.back().seq;
+        }
+        cc.TryCancel();
+        acks.join();
+        stream->Finish();
+    }
 }
 
+/**
+ * Writes a snapshot of the store to the write-ahead log, which then drops
+ * every segment before it, so that a restart replays the snapshot and only
+ * what was logged since. Only the keys are copied out at once; entries are
+ * read one at a time as they are written.
+ */
+void ShardkvServer::CompactLog() {
+    Metrics::Timer timer(&_metrics, _h.compact);
+    auto start = chrono::steady_clock::now();
+    size_t count = _wal->WriteSnapshot(_store);
+    auto elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start);
+    LOG(INFO)<<address<<" compacted its write-ahead log into a snapshot of "<<count<<" keys in "<<elapsed.count()<<" ms";
+}
 
 /**
  * PART 3 ONLY
@@ -371,15 +903,318 @@ void ShardkvServer::PingShardmanager(Shardkv::Stub* stub) {
  * This method is called by a backup server when it joins the system for the firt time or after it crashed and restarted.
  * It allows the server to receive a snapshot of all key-value pairs stored by the primary server.
  *
+ * The store is sent one stripe at a time, in chunks of about
+ * SNAPSHOT_CHUNK_BYTES, and no lock is held while a chunk is being written.
+ * Every chunk carries the position of the replication log taken before the
+ * copy started: the copy may already reflect some later writes, but the
+ * backup replays everything after that position anyway and skips whatever
+ * its entries are already as recent as, so it ends up with the same store.
+ *
+ * A backup that restarted with a write-ahead log only misses what happened
+ * since its last change. If our own write-ahead log still holds that change,
+ * we send the changes that followed it instead of the whole store.
+ *
  * @param context - you can ignore this
- * @param request An empty message
- * @param response the whole database
+ * @param request the last change the backup has, if it knows
+ * @param writer where the chunks of the store go
  * @return ::grpc::Status::OK on success, or
- * ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "<your error message
- * here>")
+ * ::grpc::Status(::grpc::StatusCode::CANCELLED, ...) if the backup went away
  */
-::grpc::Status ShardkvServer::Dump(::grpc::ServerContext* context, const Empty* request, ::DumpResponse* response) {
-    lock_guard<mutex> lock(*_mutex);
-    response->mutable_database()->insert(_database.begin(), _database.end());
+::grpc::Status ShardkvServer::Snapshot(::grpc::ServerContext* context, const SnapshotRequest* request,
+                                       ::grpc::ServerWriter<::SnapshotChunk>* writer) {
+    Metrics::Timer timer(&_metrics, _h.snapshot);
+    SnapshotChunk chunk;
+    size_t bytes = 0;
+    if (_wal && request->after_seq()) {
+        {
+            // every mutation up to here is in the write-ahead log
+            lock_guard<mutex> lock(_journal_mutex);
+            chunk.set_seq(_log.LastSeq());
+        }
+        chunk.set_delta(true);
+        bool broken = false;
+        bool found = _wal->ReadSince({request->after_seq(), request->after_crc()}, [&](const mutation_t& m) {
+            bytes += m.key.size() + m.value.size() + m.author.size();
+            to_proto(m, chunk.add_entries());
+            if (bytes < SNAPSHOT_CHUNK_BYTES)
+                return true;
+            broken = !writer->Write(chunk);
+            chunk.clear_entries();
+            bytes = 0;
+            return !broken;
+        });
+        if (broken)
+            return ::grpc::Status(::grpc::StatusCode::CANCELLED, "Backup went away");
+        if (found) {
+            writer->Write(chunk);
+            return ::grpc::Status::OK;
+        }
+        // we no longer have what the backup is missing: send everything
+        chunk.Clear();
+    }
+    chunk.set_seq(_log.LastSeq());
+    for (size_t i = 0; i < _store.NumStripes(); i++) {
+        // the stripe is a copy of our own, so its strings move into the chunk
+        for (auto& [k, e] : _store.CollectStripe(i)) {
+            bytes += k.size() + e.author.size();
+            string value = move(e).Flatten();
+            bytes += value.size();
+            to_proto({e.seq, MutationOp::PUT, move(k), move(value), move(e.author)}, chunk.add_entries());
+            if (bytes < SNAPSHOT_CHUNK_BYTES)
+                continue;
+            if (!writer->Write(chunk))
+                return ::grpc::Status(::grpc::StatusCode::CANCELLED, "Backup went away");
+            chunk.clear_entries();
+            bytes = 0;
+        }
+    }
+    // always send the last chunk, even if empty, so the backup learns seq
+    writer->Write(chunk);
     return ::grpc::Status::OK;
 }
+
+bool ShardkvServer::_install_snapshot(const string& primary) {
+    Metrics::Timer timer(&_metrics, _h.snapshot_install);
+    auto stub = ChannelPool::Shared().Stub<Shardkv>(primary);
+    ::grpc::ClientContext cc;
+    SnapshotRequest request;
+    if (_wal) {
+        wal_position_t last = _wal->LastHistory();
+        request.set_after_seq(last.seq);
+        request.set_after_crc(last.crc);
+    }
+    auto reader = stub->Snapshot(&cc, request);
+    SnapshotChunk chunk;
+    uint64_t seq = 0;
+    size_t count = 0;
+    bool cleared = false;
+    while (reader->Read(&chunk)) {
+        if (!chunk.delta() && !cleared) {
+            // a copy of the whole store, which replaces ours
+            _installing = true;
+            _store.Clear();
+            if (_wal)
+                _wal->Reset();
+            cleared = true;
+        }
+        seq = chunk.seq();
+        for (auto& m : *chunk.mutable_entries())
+            _store.Apply(from_proto(move(m)));
+        count += chunk.entries_size();
+    }
+    _installing = false;
+    ::grpc::Status status = reader->Finish();
+    ChannelPool::Shared().Report(primary, status);
+    if (!status.ok()) {
+        LOG(WARN)<<"Transfer FAILED: "<<status.error_message();
+        return false;
+    }
+    if (cleared)
+        LOG(INFO)<<address<<" installed snapshot of "<<primary<<" ("<<count<<" keys)";
+    else
+        LOG(INFO)<<address<<" caught up with "<<primary<<" ("<<count<<" mutations since "<<request.after_seq()<<")";
+    _applied_seq = seq;
+    return true;
+}
+
+/**
+ * Backup side of the replication stream opened by ReplicateToBackup. We
+ * first tell the primary the last mutation we have, then apply every batch
+ * it sends and acknowledge it. Refused until we hold a copy of the primary.
+ *
+ * @param context - you can ignore this
+ * @param stream batches of mutations in, acknowledgements out
+ * @return ::grpc::Status::OK when the primary closes the stream, or
+ * ::grpc::Status(::grpc::StatusCode::UNAVAILABLE, ...) if we are not a
+ * backup in sync with it
+ */
+::grpc::Status ShardkvServer::Replicate(::grpc::ServerContext* context,
+                                        ::grpc::ServerReaderWriter<::ReplicationAck, ::ReplicationBatch>* stream) {
+    {
+        lock_guard<mutex> lock(*_mutex);
+        if (_is_primary || !_synced)
+            return ::grpc::Status(::grpc::StatusCode::UNAVAILABLE, "Not a backup in sync");
+    }
+    ReplicationAck ack;
+    ack.set_applied_seq(_applied_seq);
+    stream->Write(ack);
+
+    ReplicationBatch batch;
+    while (_synced && stream->Read(&batch)) {
+        if (batch.resync()) {
+            LOG(INFO)<<address<<" asked to resync by the primary";
+            _synced = false;
+            break;
+        }
+        Metrics::Timer timer(&_metrics, _h.replication_apply);
+        for (auto& m : *batch.mutable_mutations())
+            _store.Apply(from_proto(move(m)));
+        if (batch.mutations_size() == 0)
+            continue;
+        // the primary counts on what we acknowledge surviving our crash
+        if (_wal)
+            _wal->WaitDurable();
+        _applied_seq = batch.mutations(batch.mutations_size() - 1).seq();
+        _metrics.Add(_c.mutations_applied, batch.mutations_size());
+        ack.set_applied_seq(_applied_seq);
+        if (!stream->Write(ack))
+            break;
+    }
+    return ::grpc::Status::OK;
+}
+
+/**
+ * Receives keys another server no longer owns, in batches. Unlike Put, keys
+ * are stored as they are: the post_ -> user_<id>_posts fan-out already
+ * happened when the post was first written, and the user_<id>_posts lists
+ * migrate themselves. Only all_users, which every server keeps for its own
+ * users, gets the migrated users added.
+ *
+ * @param context - you can ignore this
+ * @param reader the batches of keys
+ * @param response An empty message, as we don't need to return any data
+ * @return ::grpc::Status::OK on success, or
+ * ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, ...) if a batch holds
+ * a key this server is not responsible for (yet)
+ */
+::grpc::Status ShardkvServer::MigrateShard(::grpc::ServerContext* context,
+                                           ::grpc::ServerReader<::MigrateBatch>* reader,
+                                           Empty* response) {
+    Metrics::Timer timer(&_metrics, _h.migrate_shard);
+    MigrateBatch batch;
+    uint64_t seq = 0;
+    vector<string> users;
+    while (reader->Read(&batch)) {
+        for (const auto& m : batch.entries())
+            if (!_manages_key(m.key()))
+                return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "Not responsible for key " + m.key());
+        for (const auto& m : batch.entries()) {
+            seq = max(seq, _store.Put(m.key(), m.data(), m.user()));
+            if (parse_key(m.key()).type == KeyType::USER)
+                users.push_back(m.key());
+        }
+    }
+    if (!users.empty())
+        seq = max(seq, _store.AddToList("all_users", users));
+    _wait_committed(seq);
+    return ::grpc::Status::OK;
+}
+
+/**
+ * The latency histograms and counters of this server (see Metrics), summed
+ * over every thread at the time of the call, and how far behind the outbox
+ * is for every server it delivers to.
+ *
+ * @param context - you can ignore this
+ * @param request An empty message
+ * @param response the quantiles of every histogram, every counter, the
+ * outbox of every destination, and all of it in the Prometheus text format
+ * @return ::grpc::Status::OK
+ */
+::grpc::Status ShardkvServer::Stats(::grpc::ServerContext* context, const ::StatsRequest* request,
+                                    ::StatsResponse* response) {
+    _metrics.Fill(response);
+    for (const auto& s : _outbox.Stats()) {
+        OutboxStats* o = response->add_outbox();
+        o->set_destination(s.destination);
+        o->set_pending(s.pending);
+        o->set_lag_ms(s.lag.count());
+        o->set_delivered(s.delivered);
+        o->set_failures(s.failures);
+        o->set_last_error(s.last_error);
+    }
+    response->set_prometheus(Prometheus());
+    return ::grpc::Status::OK;
+}
+
+string ShardkvServer::Prometheus() const {
+    return _metrics.Prometheus() + _outbox.Prometheus();
+}
+
+// the handlers of ShardkvServer do not look at their context, the reads are
+// passed none
+::grpc::ServerUnaryReactor* ShardkvCallbackService::Get(::grpc::CallbackServerContext* context,
+                                                        const ::GetRequest* request, ::GetResponse* response) {
+    auto* reactor = context->DefaultReactor();
+    reactor->Finish(_server->Get(nullptr, request, response));
+    return reactor;
+}
+
+::grpc::ServerUnaryReactor* ShardkvCallbackService::ListMembers(::grpc::CallbackServerContext* context,
+                                                                const ::ListMembersRequest* request,
+                                                                ::ListMembersResponse* response) {
+    auto* reactor = context->DefaultReactor();
+    reactor->Finish(_server->ListMembers(nullptr, request, response));
+    return reactor;
+}
+
+::grpc::ServerUnaryReactor* ShardkvCallbackService::MultiGet(::grpc::CallbackServerContext* context,
+                                                             const ::MultiGetRequest* request,
+                                                             ::MultiGetResponse* response) {
+    auto* reactor = context->DefaultReactor();
+    reactor->Finish(_server->MultiGet(nullptr, request, response));
+    return reactor;
+}
+
+::grpc::ServerUnaryReactor* ShardkvCallbackService::Stats(::grpc::CallbackServerContext* context,
+                                                          const ::StatsRequest* request, ::StatsResponse* response) {
+    auto* reactor = context->DefaultReactor();
+    reactor->Finish(_server->Stats(nullptr, request, response));
+    return reactor;
+}
+
+template <typename Write>
+::grpc::ServerUnaryReactor* ShardkvCallbackService::_write(::grpc::CallbackServerContext* context, size_t histogram,
+                                                           Write write) {
+    auto* reactor = context->DefaultReactor();
+    auto start = chrono::steady_clock::now();
+    uint64_t seq = 0;
+    ::grpc::Status status = write(&seq);
+    _server->_when_committed(seq, [this, reactor, status, histogram, start]() {
+        _server->_metrics.Record(histogram, chrono::steady_clock::now() - start);
+        reactor->Finish(status);
+    });
+    return reactor;
+}
+
+::grpc::ServerUnaryReactor* ShardkvCallbackService::Put(::grpc::CallbackServerContext* context,
+                                                        const ::PutRequest* request, Empty* response) {
+    return _write(context, _server->_h.put, [&](uint64_t* seq) { return _server->_put(request, seq); });
+}
+
+::grpc::ServerUnaryReactor* ShardkvCallbackService::Append(::grpc::CallbackServerContext* context,
+                                                           const ::AppendRequest* request, Empty* response) {
+    return _write(context, _server->_h.append, [&](uint64_t* seq) { return _server->_append(request, seq); });
+}
+
+::grpc::ServerUnaryReactor* ShardkvCallbackService::Delete(::grpc::CallbackServerContext* context,
+                                                           const ::DeleteRequest* request, Empty* response) {
+    return _write(context, _server->_h.del, [&](uint64_t* seq) { return _server->_delete(request, seq); });
+}
+
+::grpc::ServerUnaryReactor* ShardkvCallbackService::MultiPut(::grpc::CallbackServerContext* context,
+                                                             const ::MultiPutRequest* request, Empty* response) {
+    return _write(context, _server->_h.multi_put, [&](uint64_t* seq) { return _server->_multi_put(request, seq); });
+}
+
+::grpc::ServerUnaryReactor* ShardkvCallbackService::MultiDelete(::grpc::CallbackServerContext* context,
+                                                                const ::MultiDeleteRequest* request,
+                                                                ::MultiDeleteResponse* response) {
+    return _write(context, _server->_h.multi_delete,
+                  [&](uint64_t* seq) { return _server->_multi_delete(request, response, seq); });
+}
+
+::grpc::Status ShardkvCallbackService::Snapshot(::grpc::ServerContext* context, const ::SnapshotRequest* request,
+                                                ::grpc::ServerWriter<::SnapshotChunk>* writer) {
+    return _server->Snapshot(context, request, writer);
+}
+
+::grpc::Status ShardkvCallbackService::Replicate(
+        ::grpc::ServerContext* context, ::grpc::ServerReaderWriter<::ReplicationAck, ::ReplicationBatch>* stream) {
+    return _server->Replicate(context, stream);
+}
+
+::grpc::Status ShardkvCallbackService::MigrateShard(::grpc::ServerContext* context,
+                                                    ::grpc::ServerReader<::MigrateBatch>* reader, Empty* response) {
+    return _server->MigrateShard(context, reader, response);
+}
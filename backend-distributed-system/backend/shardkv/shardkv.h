@@ -4,43 +4,111 @@
 #include <grpcpp/grpcpp.h>
 #include <thread>
 #include "../common/common.h"
+#include "../common/channel_pool.h"
+#include "../common/log.h"
+#include "../common/metrics.h"
+#include "../common/shard_table.h"
 #include <unordered_map>
 #include <mutex>
+#include <condition_variable>
+#include <shared_mutex>
 #include <iostream>
 #include <fstream>
 #include <unordered_set>
 #include <map>
 
+#include "kvstore.h"
+#include "load_tracker.h"
+#include "mapped_snapshot.h"
+#include "outbox.h"
+#include "replication_log.h"
+#include "write_ahead_log.h"
 #include "../build/shardkv.grpc.pb.h"
 #include "../build/shardmaster.grpc.pb.h"
 
+// a Snapshot is sent in chunks of roughly this many bytes of keys and values
+constexpr size_t SNAPSHOT_CHUNK_BYTES = 1 << 20;
+// and keys moved to another server in MigrateShard batches of this size
+constexpr size_t MIGRATE_BATCH_BYTES = 1 << 20;
+// members returned by ListMembers when the request has no limit, and at most
+constexpr size_t DEFAULT_PAGE_SIZE = 100;
+constexpr size_t MAX_PAGE_SIZE = 10000;
+// how often the load of our shards is reported to the shardmaster
+constexpr std::chrono::seconds LOAD_REPORT_INTERVAL(1);
+
 class ShardkvServer : public Shardkv::Service {
   using Empty = google::protobuf::Empty;
 
  public:
-  explicit ShardkvServer(std::string addr, const std::string& shardmanager_addr)
+  explicit ShardkvServer(std::string addr, const std::string& shardmanager_addr,
+                         ReplicationMode mode = ReplicationMode::ACKED,
+                         wal_options_t wal = wal_options_t())
       : address(std::move(addr)),
         shardmanager_address(shardmanager_addr),
-        _mutex(std::make_shared<std::mutex>()) {
+        _mutex(std::make_shared<std::mutex>()),
+        _viewnumber(0),
+        _is_primary(false),
+        _mode(mode),
+        _synced(false),
+        _applied_seq(0),
+        _outbox(&_store, [this](const std::string& key) { return _server_of(parse_key(key)); },
+                [this](const std::string& server, const std::string& key, const std::string& items,
+                       std::string* error) { return _send_append(server, key, items, error); },
+                &_metrics) {
+    _register_metrics();
+    // with a write-ahead log, start from whatever it holds
+    if (!wal.dir.empty())
+        _recover(std::move(wal));
+    // every change to the store goes through the replication log (and the
+    // write-ahead log)
+    _store.SetJournal([this](const mutation_t& m) { return _journal(m); });
+    _store.SetLockWait([this](std::chrono::nanoseconds waited) { _metrics.Record(_h.lock_wait, waited); });
 
-    // This thread will query the shardmaster every 100 milliseconds for updates
-    std::thread query(
+    // This thread follows the configuration pushed by the shardmaster
+    std::thread watch(
             [this]() {
-                // TODO: Assignment 2 Implement the QueryShardmaster(...) function
                 std::chrono::milliseconds timespan(100);
                 while (shardmaster_address.empty()) {
                     std::this_thread::sleep_for(timespan);
                 }
-                auto stub = Shardmaster::NewStub(
-                        grpc::CreateChannel(shardmaster_address, grpc::InsecureChannelCredentials()));
                 while (true) {
-                    this->QueryShardmaster(stub.get());
+                    auto stub = ChannelPool::Shared().Stub<Shardmaster>(shardmaster_address);
+                    this->WatchShardmaster(stub.get());
+                    // the stream broke, reconnect
                     std::this_thread::sleep_for(timespan);
                 }
             }
             );
     // we detach the thread so we don't have to wait for it to terminate later
-    query.detach();
+    watch.detach();
+
+    // This thread tells the shardmaster how busy our shards are
+    std::thread report(
+            [this]() {
+                while (true) {
+                    std::this_thread::sleep_for(LOAD_REPORT_INTERVAL);
+                    if (shardmaster_address.empty())
+                        continue;
+                    auto stub = ChannelPool::Shared().Stub<Shardmaster>(shardmaster_address);
+                    this->ReportLoad(stub.get());
+                }
+            });
+    report.detach();
+
+    // This thread moves away the keys we are no longer responsible for,
+    // whenever the configuration changes or we become primary
+    std::thread rebalance(
+            [this]() {
+                while (true) {
+                    {
+                        std::unique_lock<std::mutex> lock(*_mutex);
+                        _rebalance_cv.wait(lock, [this]() { return _rebalance_pending; });
+                        _rebalance_pending = false;
+                    }
+                    this->RedistributeKeys();
+                }
+            });
+    rebalance.detach();
 
 
     std::thread heartbeat(
@@ -48,8 +116,7 @@ class ShardkvServer : public Shardkv::Service {
             // TODO: Assignment 2 - Implement PingShardmanager(...) function
             // TODO: Assignment 3 - Extends PingShardmanager(...) function as described in the instructions
             std::chrono::milliseconds timespan(100);
-            auto stub = Shardkv::NewStub(
-                    grpc::CreateChannel(sm_addr, grpc::InsecureChannelCredentials()));
+            auto stub = ChannelPool::Shared().Stub<Shardkv>(sm_addr);
             while (true) {
                 PingShardmanager(stub.get());
                 std::this_thread::sleep_for(timespan);
@@ -58,6 +125,23 @@ class ShardkvServer : public Shardkv::Service {
         shardmanager_addr);
     // we detach the thread so we don't have to wait for it to terminate later
     heartbeat.detach();
+
+    // This thread streams the replication log to the backup, if there is one
+    std::thread sender([this]() { ReplicateToBackup(); });
+    sender.detach();
+
+    if (_wal) {
+        // This thread compacts the write-ahead log into a snapshot of the
+        // store whenever it has grown enough
+        std::thread compact([this]() {
+            while (true) {
+                std::this_thread::sleep_for(std::chrono::seconds(1));
+                if (_wal->NeedsSnapshot())
+                    this->CompactLog();
+            }
+        });
+        compact.detach();
+    }
   };
 
 
@@ -65,6 +149,9 @@ class ShardkvServer : public Shardkv::Service {
   ::grpc::Status Get(::grpc::ServerContext* context,
                      const ::GetRequest* request,
                      ::GetResponse* response) override;
+  ::grpc::Status ListMembers(::grpc::ServerContext* context,
+                             const ::ListMembersRequest* request,
+                             ::ListMembersResponse* response) override;
   ::grpc::Status Put(::grpc::ServerContext* context,
                      const ::PutRequest* request, Empty* response) override;
   ::grpc::Status Append(::grpc::ServerContext* context,
@@ -73,20 +160,57 @@ class ShardkvServer : public Shardkv::Service {
   ::grpc::Status Delete(::grpc::ServerContext* context,
                         const ::DeleteRequest* request,
                         Empty* response) override;
-    ::grpc::Status Dump(::grpc::ServerContext* context,
-                        const ::google::protobuf::Empty* request,
-                        ::DumpResponse* response);
+  ::grpc::Status MultiGet(::grpc::ServerContext* context,
+                          const ::MultiGetRequest* request,
+                          ::MultiGetResponse* response) override;
+  ::grpc::Status MultiPut(::grpc::ServerContext* context,
+                          const ::MultiPutRequest* request,
+                          Empty* response) override;
+  ::grpc::Status MultiDelete(::grpc::ServerContext* context,
+                             const ::MultiDeleteRequest* request,
+                             ::MultiDeleteResponse* response) override;
+  ::grpc::Status Snapshot(::grpc::ServerContext* context,
+                          const ::SnapshotRequest* request,
+                          ::grpc::ServerWriter<::SnapshotChunk>* writer) override;
+  ::grpc::Status Replicate(
+      ::grpc::ServerContext* context,
+      ::grpc::ServerReaderWriter<::ReplicationAck, ::ReplicationBatch>* stream) override;
+  ::grpc::Status MigrateShard(::grpc::ServerContext* context,
+                              ::grpc::ServerReader<::MigrateBatch>* reader,
+                              Empty* response) override;
+  ::grpc::Status Stats(::grpc::ServerContext* context,
+                       const ::StatsRequest* request,
+                       ::StatsResponse* response) override;
 
-  // TODO this will be called in a separate thread, here is where you want to
-  // query the shardmaster for configuration updates and respond to changes
-  // appropriately (i.e. transferring keys, no longer serving keys, etc.)
-  void QueryShardmaster(Shardmaster::Stub* stub);
+  // what Stats reports in the Prometheus text format, for ServeMetrics
+  std::string Prometheus() const;
+
+  // this is called in a separate thread: it follows the configuration
+  // published by the shardmaster until the Watch stream breaks
+  void WatchShardmaster(Shardmaster::Stub* stub);
+
+  // this is called in a separate thread every LOAD_REPORT_INTERVAL: it sends
+  // the load of our shards since the last call to the shardmaster
+  void ReportLoad(Shardmaster::Stub* stub);
+
+  // moves every key this server is no longer responsible for to the server
+  // that is (i.e. transferring keys, no longer serving keys, etc.)
+  void RedistributeKeys();
 
   // TODO this will be called in a separate thread, here is where you want to
   // ping the shardmanager to get updates about the sharmaster (part 2) and the views changes (part 3)
   void PingShardmanager(Shardkv::Stub* stub);
 
+  // this runs in a separate thread for the whole life of the server: while
+  // this is a primary with a backup, it streams the replication log to it
+  void ReplicateToBackup();
+
+  // replaces the write-ahead log up to now with a snapshot of the store
+  void CompactLog();
+
  private:
+  friend class ShardkvCallbackService;
+
   // address we're running on (hostname:port)
   const std::string address;
   // address of shardmanager passed as constructor's parameter
@@ -95,29 +219,157 @@ class ShardkvServer : public Shardkv::Service {
   std::string shardmaster_address;
 
   // TODO add any fields you want here!
-  // to manage concurrent access to resources
+  // to manage concurrent access to the view state
   std::shared_ptr<std::mutex> _mutex;
-  // map of key value pairs
-  std::unordered_map<std::string, std::string> _database;
-  // vector of shards mapping keys assignments
-  std::map<shard_t, std::string> _keys_assignments;
-  // map of posts to users ids
-  std::unordered_map<std::string, std::string> _authors;
+  // mutations still to be shipped to the backup
+  ReplicationLog _log;
+  // every mutation, on disk. null when running in memory only
+  std::unique_ptr<WriteAheadLog> _wal;
+  // makes the write-ahead log hold mutations in sequence number order
+  std::mutex _journal_mutex;
+  // set while a Snapshot of the primary replaces our store: its entries are
+  // not part of the shard's history (see WriteAheadLog)
+  std::atomic<bool> _installing{false};
+  // key value pairs (and the author of every post), lock striped
+  KVStore _store;
+  // guards _assignments, _self, _config_epoch, _config_version and _load
+  mutable std::shared_mutex _config_mutex;
+  // the server every shard is on
+  ShardTable _assignments;
+  // our own index in _assignments (ShardTable::NONE if we hold no shard)
+  uint16_t _self = ShardTable::NONE;
+  // epoch and version of the configuration _assignments comes from (see
+  // QueryResponse)
+  uint64_t _config_epoch = 0;
+  uint64_t _config_version = 0;
+  // requests served for each shard of _assignments, since the last report
+  LoadTracker _load;
+  // set (under _mutex) to have the rebalance thread run RedistributeKeys
+  bool _rebalance_pending = false;
+  std::condition_variable _rebalance_cv;
   // last view number
   std::size_t _viewnumber;
-  bool _is_primary;
+  // changed under _mutex, read without it (see _readable_seq)
+  std::atomic<bool> _is_primary;
   std::string _backup_address;
-  std::unique_ptr<Shardkv::Stub> _stub_to_backup;
+  ReplicationMode _mode;
+  // as a backup: the primary our store is a copy of, and whether it is one
+  std::string _synced_with;
+  std::atomic<bool> _synced;
+  // as a backup: last mutation of the primary reflected in our store
+  std::atomic<uint64_t> _applied_seq;
+  // latency of every RPC and of the phases of the work behind them
+  Metrics _metrics;
+  // what we record in _metrics, registered by _register_metrics
+  struct {
+    size_t get, list_members, put, append, del, multi_get, multi_put, multi_delete, snapshot, migrate_shard;
+    size_t lock_wait, commit_wait, remote_append, migrate, replication_send, replication_apply, snapshot_install,
+        compact;
+  } _h;
+  struct {
+    size_t keys_migrated, append_retries, migrate_retries, mutations_replicated, mutations_applied;
+  } _c;
+  // posts to add to the user_<id>_posts of authors other servers are in
+  // charge of, delivered while we are primary
+  Outbox _outbox;
 
 
+  void _register_metrics();
   // tell if this server manages a key
-  bool _manages_key(const std::string& key);
-  // get the server which is in charge of managing a key
-  std::string _server_of(const std::string& key);
+  bool _manages(const parsed_key_t& key);
+  bool _manages_key(const std::string& key) { return _manages(parse_key(key)); }
+  // _manages, for the key of a request: counts the request towards the load
+  // of the key's shard if we serve it
+  bool _serves(const parsed_key_t& key);
+  bool _serves_key(const std::string& key) { return _serves(parse_key(key)); }
+  // get the server which is in charge of managing a key ("" if none is)
+  std::string _server_of(const parsed_key_t& key);
+
+  // mutations of the shard group our store reflects: everything for a
+  // primary, what we applied for a backup in sync, 0 otherwise
+  uint64_t _readable_seq();
+  // Appends data to key on server, once; how _outbox delivers
+  bool _send_append(const std::string& server, const std::string& key,
+                    const std::string& data, std::string* error);
+  // waits until mutation seq is as durable as the write-ahead log promises,
+  // and in ACKED mode until the backup has applied it
+  void _wait_committed(uint64_t seq);
+  // the same without waiting: calls done once seq is committed, on whichever
+  // thread commits it
+  void _when_committed(uint64_t seq, std::function<void()> done);
+  // the write RPCs without the wait for their changes to be committed: each
+  // makes its changes and sets last_seq to the last of them (0 if none), for
+  // _wait_committed or _when_committed
+  ::grpc::Status _put(const ::PutRequest* request, uint64_t* last_seq);
+  ::grpc::Status _append(const ::AppendRequest* request, uint64_t* last_seq);
+  ::grpc::Status _delete(const ::DeleteRequest* request, uint64_t* last_seq);
+  ::grpc::Status _multi_put(const ::MultiPutRequest* request, uint64_t* last_seq);
+  ::grpc::Status _multi_delete(const ::MultiDeleteRequest* request, ::MultiDeleteResponse* response,
+                               uint64_t* last_seq);
+  // numbers m and logs it; the journal of _store
+  uint64_t _journal(const mutation_t& m);
+  // opens the write-ahead log, replaying it into _store
+  void _recover(wal_options_t options);
+  // as a backup: replaces our store with a Snapshot of primary
+  bool _install_snapshot(const std::string& primary);
+  // moves entries to server with MigrateShard, retrying until it succeeds
+  void _migrate(const std::string& server,
+                const std::vector<std::pair<std::string, entry_t>>& entries);
+};
+
+// The RPCs of a ShardkvServer for ServerMode::CALLBACK. Reads are answered
+// right away, on the thread of the callback; writes make their changes there
+// and finish once the changes are committed (see _when_committed), from the
+// thread that commits them, so that no thread is held while the write-ahead
+// log and the backup catch up. The streams are served by the synchronous
+// handlers of the server.
+class ShardkvCallbackService
+    : public Shardkv::WithCallbackMethod_Get<Shardkv::WithCallbackMethod_ListMembers<
+          Shardkv::WithCallbackMethod_Put<Shardkv::WithCallbackMethod_Append<
+              Shardkv::WithCallbackMethod_Delete<Shardkv::WithCallbackMethod_MultiGet<
+                  Shardkv::WithCallbackMethod_MultiPut<Shardkv::WithCallbackMethod_MultiDelete<
+                      Shardkv::WithCallbackMethod_Stats<Shardkv::Service>>>>>>>>> {
+  using Empty = google::protobuf::Empty;
+
+ public:
+  explicit ShardkvCallbackService(ShardkvServer* server) : _server(server) {}
+
+  ::grpc::ServerUnaryReactor* Get(::grpc::CallbackServerContext* context, const ::GetRequest* request,
+                                  ::GetResponse* response) override;
+  ::grpc::ServerUnaryReactor* ListMembers(::grpc::CallbackServerContext* context,
+                                          const ::ListMembersRequest* request,
+                                          ::ListMembersResponse* response) override;
+  ::grpc::ServerUnaryReactor* Put(::grpc::CallbackServerContext* context, const ::PutRequest* request,
+                                  Empty* response) override;
+  ::grpc::ServerUnaryReactor* Append(::grpc::CallbackServerContext* context, const ::AppendRequest* request,
+                                     Empty* response) override;
+  ::grpc::ServerUnaryReactor* Delete(::grpc::CallbackServerContext* context, const ::DeleteRequest* request,
+                                     Empty* response) override;
+  ::grpc::ServerUnaryReactor* MultiGet(::grpc::CallbackServerContext* context, const ::MultiGetRequest* request,
+                                       ::MultiGetResponse* response) override;
+  ::grpc::ServerUnaryReactor* MultiPut(::grpc::CallbackServerContext* context, const ::MultiPutRequest* request,
+                                       Empty* response) override;
+  ::grpc::ServerUnaryReactor* MultiDelete(::grpc::CallbackServerContext* context,
+                                          const ::MultiDeleteRequest* request,
+                                          ::MultiDeleteResponse* response) override;
+  ::grpc::ServerUnaryReactor* Stats(::grpc::CallbackServerContext* context, const ::StatsRequest* request,
+                                    ::StatsResponse* response) override;
+
+  ::grpc::Status Snapshot(::grpc::ServerContext* context, const ::SnapshotRequest* request,
+                          ::grpc::ServerWriter<::SnapshotChunk>* writer) override;
+  ::grpc::Status Replicate(
+      ::grpc::ServerContext* context,
+      ::grpc::ServerReaderWriter<::ReplicationAck, ::ReplicationBatch>* stream) override;
+  ::grpc::Status MigrateShard(::grpc::ServerContext* context, ::grpc::ServerReader<::MigrateBatch>* reader,
+                              Empty* response) override;
+
+ private:
+  ShardkvServer* _server;
 
-  bool _key_is_for_user(const std::string& key);
-  bool _key_is_for_post(const std::string& key);
-  std::string _remove_user(std::string& users, const std::string& user);
+  // finishes a write once write (one of the _put... of the server) is
+  // committed, recording the time it took in histogram
+  template <typename Write>
+  ::grpc::ServerUnaryReactor* _write(::grpc::CallbackServerContext* context, size_t histogram, Write write);
 };
 
 #endif  // SHARDING_SHARDKV_H
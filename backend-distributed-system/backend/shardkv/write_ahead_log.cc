@@ -0,0 +1,415 @@
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+#include "mapped_snapshot.h"
+#include "write_ahead_log.h"
+#include "../common/log.h"
+using namespace std;
+
+// a record is framed as <payload length><crc32 of payload><payload>, and its
+// payload is <seq><op><history><key length><key><value length><value>
+// <author length><author>. integers are in host byte order: the log is only
+// ever read back on the machine that wrote it
+static const size_t FRAME_HEADER_BYTES = 8;
+
+template <typename T>
+static void put(string* out, T v) {
+    out->append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+static void put_string(string* out, const string& s) {
+    put<uint32_t>(out, s.size());
+    out->append(s);
+}
+
+template <typename T>
+static bool get(const string& in, size_t* pos, T* v) {
+    if (in.size() - *pos < sizeof(T))
+        return false;
+    memcpy(v, in.data() + *pos, sizeof(T));
+    *pos += sizeof(T);
+    return true;
+}
+
+static bool get_string(const string& in, size_t* pos, string* s) {
+    uint32_t n;
+    if (!get(in, pos, &n) || in.size() - *pos < n)
+        return false;
+    s->assign(in, *pos, n);
+    *pos += n;
+    return true;
+}
+
+// appends the record of m, numbered seq, to out and returns its checksum
+static uint32_t encode(const mutation_t& m, uint64_t seq, bool history, string* out) {
+    string payload;
+    put<uint64_t>(&payload, seq);
+    put<uint8_t>(&payload, static_cast<uint8_t>(m.op));
+    put<uint8_t>(&payload, history);
+    put_string(&payload, m.key);
+    put_string(&payload, m.value);
+    put_string(&payload, m.author);
+    uint32_t crc = crc32(payload.data(), payload.size());
+    put<uint32_t>(out, payload.size());
+    put<uint32_t>(out, crc);
+    out->append(payload);
+    return crc;
+}
+
+// calls fn on every record of data from pos on, up to the end or the first
+// record that is torn or corrupt
+static void decode_all(const string& data, size_t pos,
+                       const function<bool(const mutation_t&, bool, uint32_t)>& fn) {
+    while (data.size() - pos >= FRAME_HEADER_BYTES) {
+        uint32_t len = 0, crc = 0;
+        if (!get(data, &pos, &len) || !get(data, &pos, &crc) || data.size() - pos < len || crc32(data.data() + pos, len) != crc)
+            return;
+        string payload = data.substr(pos, len);
+        pos += len;
+        size_t p = 0;
+        mutation_t m;
+        uint8_t op = 0, history = 0;
+        if (!get(payload, &p, &m.seq) || !get(payload, &p, &op) || !get(payload, &p, &history) ||
+            !get_string(payload, &p, &m.key) || !get_string(payload, &p, &m.value) ||
+            !get_string(payload, &p, &m.author))
+            return;
+        m.op = static_cast<MutationOp>(op);
+        if (!fn(m, history, crc))
+            return;
+    }
+}
+
+static string read_file(const string& path) {
+    ifstream in(path, ios::binary);
+    stringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+// the log cannot go on once the disk fails it: a write it acknowledged might
+// not survive a crash
+static void check(bool ok, const string& what) {
+    if (ok)
+        return;
+    LOG(ERROR) << "Write-ahead log: " << what << " failed: " << strerror(errno);
+    Logger::Shared().Flush();
+    abort();
+}
+
+static void write_all(int fd, const string& data) {
+    size_t done = 0;
+    while (done < data.size()) {
+        ssize_t n = write(fd, data.data() + done, data.size() - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        check(n > 0, "write");
+        done += n;
+    }
+}
+
+static void sync_dir(const string& dir) {
+    int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    check(fd >= 0, "open " + dir);
+    check(fsync(fd) == 0, "fsync " + dir);
+    close(fd);
+}
+
+// the segments (name "wal") or snapshots (name "snapshot") in dir, by number
+static map<uint64_t, string> list_files(const string& dir, const string& name) {
+    map<uint64_t, string> files;
+    string prefix = name + ".";
+    for (const auto& f : filesystem::directory_iterator(dir)) {
+        string file = f.path().filename().string();
+        if (file.rfind(prefix, 0) != 0 || file.find_first_not_of("0123456789", prefix.size()) != string::npos)
+            continue;
+        files[stoull(file.substr(prefix.size()))] = f.path().string();
+    }
+    return files;
+}
+
+WriteAheadLog::WriteAheadLog(wal_options_t options) : _options(move(options)) {}
+
+WriteAheadLog::~WriteAheadLog() {
+    {
+        lock_guard<mutex> lock(_mutex);
+        _closing = true;
+        _appended_cv.notify_all();
+    }
+    if (_flusher.joinable())
+        _flusher.join();
+    if (_fd >= 0) {
+        lock_guard<mutex> write_lock(_write_mutex);
+        _flush(true);
+        close(_fd);
+    }
+}
+
+string WriteAheadLog::_path(const string& name, uint64_t n) const {
+    char file[64];
+    snprintf(file, sizeof(file), "%s.%020llu", name.c_str(), (unsigned long long)n);
+    return _options.dir + "/" + file;
+}
+
+size_t WriteAheadLog::Open(const function<void(shared_ptr<const MappedSnapshot>)>& load,
+                           const function<void(const mutation_t&)>& apply) {
+    filesystem::create_directories(_options.dir);
+    // files from an interrupted snapshot
+    for (const auto& f : filesystem::directory_iterator(_options.dir))
+        if (f.path().extension() == ".tmp")
+            filesystem::remove(f.path());
+
+    size_t replayed = 0;
+    auto snapshots = list_files(_options.dir, "snapshot");
+    uint64_t first = 0;
+    if (!snapshots.empty()) {
+        first = snapshots.rbegin()->first;
+        auto snapshot = MappedSnapshot::Open(snapshots.rbegin()->second);
+        check(snapshot != nullptr, "reading " + snapshots.rbegin()->second);
+        _last_history = {snapshot->LogSeq(), snapshot->LogCrc()};
+        load(move(snapshot));
+    }
+    auto segments = list_files(_options.dir, "wal");
+    for (auto it = segments.lower_bound(first); it != segments.end(); ++it) {
+        decode_all(read_file(it->second), 0, [&](const mutation_t& m, bool history, uint32_t crc) {
+            apply(m);
+            replayed++;
+            if (history)
+                _last_history = {m.seq, crc};
+            return true;
+        });
+    }
+    _drop_before(first);
+
+    uint64_t next = max(first, segments.empty() ? 0 : segments.rbegin()->first) + 1;
+    {
+        lock_guard<mutex> write_lock(_write_mutex);
+        _rotate(next);
+    }
+    if (_options.fsync != FsyncPolicy::WRITE)
+        _flusher = thread([this]() { _flush_loop(); });
+    return replayed;
+}
+
+void WriteAheadLog::Append(const mutation_t& m, uint64_t seq, bool history) {
+    {
+        lock_guard<mutex> lock(_mutex);
+        uint32_t crc = encode(m, seq, history, &_buffer);
+        if (history)
+            _last_history = {seq, crc};
+        _appended++;
+        if (_options.fsync == FsyncPolicy::BATCH)
+            _appended_cv.notify_one();
+    }
+}
+
+void WriteAheadLog::WaitDurable() {
+    if (_options.fsync == FsyncPolicy::INTERVAL)
+        return;
+    unique_lock<mutex> lock(_mutex);
+    uint64_t target = _appended;
+    if (_options.fsync == FsyncPolicy::WRITE) {
+        // we write it out ourselves, along with whatever the writers queued
+        // behind the write lock appended meanwhile. they find it durable once
+        // they get the lock, and share our fsync
+        while (_durable < target) {
+            lock.unlock();
+            {
+                lock_guard<mutex> write_lock(_write_mutex);
+                _flush(true);
+            }
+            lock.lock();
+        }
+        return;
+    }
+    _durable_cv.wait(lock, [&]() { return _durable >= target; });
+}
+
+void WriteAheadLog::WhenDurable(function<void()> done) {
+    if (_options.fsync == FsyncPolicy::WRITE) {
+        WaitDurable();
+    } else if (_options.fsync != FsyncPolicy::INTERVAL) {
+        lock_guard<mutex> lock(_mutex);
+        if (_durable < _appended) {
+            _durable_callbacks.emplace(_appended, move(done));
+            return;
+        }
+    }
+    done();
+}
+
+vector<function<void()>> WriteAheadLog::_made_durable(uint64_t upto) {
+    _durable = upto;
+    _durable_cv.notify_all();
+    vector<function<void()>> callbacks;
+    auto end = _durable_callbacks.upper_bound(upto);
+    for (auto it = _durable_callbacks.begin(); it != end; ++it)
+        callbacks.push_back(move(it->second));
+    _durable_callbacks.erase(_durable_callbacks.begin(), end);
+    return callbacks;
+}
+
+wal_position_t WriteAheadLog::LastHistory() const {
+    lock_guard<mutex> lock(_mutex);
+    return _last_history;
+}
+
+bool WriteAheadLog::ReadSince(const wal_position_t& after,
+                              const function<bool(const mutation_t&)>& fn) {
+    if (!after.seq)
+        return false;
+    {
+        // what is still buffered has to be read too
+        lock_guard<mutex> write_lock(_write_mutex);
+        _flush(false);
+    }
+    shared_lock<shared_mutex> files_lock(_files_mutex);
+    bool found = false, more = true;
+    for (const auto& [n, path] : list_files(_options.dir, "wal")) {
+        decode_all(read_file(path), 0, [&](const mutation_t& m, bool history, uint32_t crc) {
+            if (!history)
+                return true;
+            if (found)
+                return more = fn(m);
+            found = m.seq == after.seq && crc == after.crc;
+            return true;
+        });
+        if (!more)
+            break;
+    }
+    return found;
+}
+
+bool WriteAheadLog::NeedsSnapshot() const {
+    lock_guard<mutex> lock(_mutex);
+    return _since_snapshot >= _options.snapshot_bytes;
+}
+
+size_t WriteAheadLog::WriteSnapshot(const KVStore& store) {
+    uint64_t n;
+    wal_position_t last;
+    {
+        lock_guard<mutex> write_lock(_write_mutex);
+        n = _segment + 1;
+        last = _rotate(n);
+        lock_guard<mutex> lock(_mutex);
+        _since_snapshot = 0;
+    }
+
+    string tmp = _path("snapshot", n) + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    check(fd >= 0, "open " + tmp);
+    size_t count;
+    check(MappedSnapshot::Write(fd, store, last.seq, last.crc, &count), "write " + tmp);
+    check(fdatasync(fd) == 0, "fdatasync " + tmp);
+    close(fd);
+    check(rename(tmp.c_str(), _path("snapshot", n).c_str()) == 0, "rename " + tmp);
+    sync_dir(_options.dir);
+    _drop_before(n);
+    return count;
+}
+
+void WriteAheadLog::Reset() {
+    uint64_t n;
+    {
+        lock_guard<mutex> write_lock(_write_mutex);
+        n = _segment + 1;
+        _rotate(n);
+        lock_guard<mutex> lock(_mutex);
+        _last_history = {};
+        _since_snapshot = 0;
+    }
+    _drop_before(n);
+}
+
+void WriteAheadLog::_flush_loop() {
+    unique_lock<mutex> lock(_mutex);
+    while (!_closing) {
+        if (_options.fsync == FsyncPolicy::BATCH)
+            _appended_cv.wait(lock, [this]() { return _closing || _durable < _appended; });
+        else
+            _appended_cv.wait_for(lock, _options.interval, [this]() { return _closing; });
+        lock.unlock();
+        {
+            // whatever is appended while this batch is being written and
+            // fsynced goes into the next one
+            lock_guard<mutex> write_lock(_write_mutex);
+            _flush(true);
+        }
+        lock.lock();
+    }
+}
+
+void WriteAheadLog::_flush(bool sync) {
+    string batch;
+    uint64_t upto;
+    {
+        lock_guard<mutex> lock(_mutex);
+        if (_buffer.empty() && (!sync || _durable == _appended))
+            return;
+        batch.swap(_buffer);
+        upto = _appended;
+    }
+    write_all(_fd, batch);
+    if (sync)
+        check(fdatasync(_fd) == 0, "fdatasync");
+    vector<function<void()>> callbacks;
+    {
+        lock_guard<mutex> lock(_mutex);
+        _since_snapshot += batch.size();
+        if (sync && upto > _durable)
+            callbacks = _made_durable(upto);
+    }
+    for (auto& done : callbacks)
+        done();
+}
+
+wal_position_t WriteAheadLog::_rotate(uint64_t n) {
+    wal_position_t last;
+    if (_fd >= 0) {
+        string batch;
+        uint64_t upto;
+        {
+            // everything appended from here on goes to segment n
+            lock_guard<mutex> lock(_mutex);
+            batch.swap(_buffer);
+            upto = _appended;
+            last = _last_history;
+        }
+        write_all(_fd, batch);
+        check(fdatasync(_fd) == 0, "fdatasync");
+        close(_fd);
+        vector<function<void()>> callbacks;
+        {
+            lock_guard<mutex> lock(_mutex);
+            _since_snapshot += batch.size();
+            if (upto > _durable)
+                callbacks = _made_durable(upto);
+        }
+        for (auto& done : callbacks)
+            done();
+    }
+    string path = _path("wal", n);
+    _fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    check(_fd >= 0, "open " + path);
+    sync_dir(_options.dir);
+    _segment = n;
+    return last;
+}
+
+void WriteAheadLog::_drop_before(uint64_t n) {
+    unique_lock<shared_mutex> files_lock(_files_mutex);
+    for (const string name : {"wal", "snapshot"})
+        for (const auto& [k, path] : list_files(_options.dir, name))
+            if (k < n)
+                filesystem::remove(path);
+}
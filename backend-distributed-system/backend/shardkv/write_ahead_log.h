@@ -0,0 +1,171 @@
+#ifndef SHARDING_WRITE_AHEAD_LOG_H
+#define SHARDING_WRITE_AHEAD_LOG_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "kvstore.h"
+
+class MappedSnapshot;
+
+// when a change is on disk
+enum class FsyncPolicy {
+  // a write is written out and fsynced by the thread that waits for it
+  // (WaitDurable), once the store is done with it; writes waiting at the
+  // same time share the fsync
+  WRITE,
+  // changes are written in batches, one fsync per batch (group commit); a
+  // write is acknowledged once the batch it is in has been fsynced
+  BATCH,
+  // changes are written and fsynced every interval, and acknowledged
+  // without waiting for it: a crash loses up to one interval of writes
+  INTERVAL
+};
+
+typedef struct wal_options {
+  // directory holding the log segments and snapshots. no log if empty
+  std::string dir;
+  FsyncPolicy fsync = FsyncPolicy::BATCH;
+  // how often INTERVAL writes the log out
+  std::chrono::milliseconds interval{100};
+  // a snapshot is taken once the log has grown this much since the last one
+  size_t snapshot_bytes = 64 << 20;
+} wal_options_t;
+
+// a change the log holds, identified by its sequence number and the checksum
+// of its record. two servers holding a change with the same sequence number
+// and checksum hold the same change (see WriteAheadLog::ReadSince)
+typedef struct wal_position {
+  uint64_t seq = 0;
+  uint32_t crc = 0;
+} wal_position_t;
+
+// Durable, append-only log of the changes made to a KVStore, kept in dir as
+// numbered segment files (wal.<n>) next to the latest snapshot of the store
+// (snapshot.<n>: the store as of the start of segment n, see MappedSnapshot).
+// Reopening the log maps the snapshot, which the store reads from in place,
+// and replays every segment after it.
+//
+// Changes are buffered by Append and written out by a flusher thread, or
+// under FsyncPolicy::WRITE by the threads waiting for them (changes nobody
+// waits for go out with the next wait, snapshot or close). Append does no
+// I/O, since it is called under the locks of the store. Records are
+// checksummed, so a record torn by a crash ends the replay of its segment;
+// every Open starts a new segment, so nothing is ever appended after a torn
+// record.
+//
+// Every record is flagged as part of the history of the shard or not. The
+// history is what the primary's own writes and the replication stream carry,
+// in sequence number order; the entries of a store copied from another
+// server are not part of it, since they do not say what happened before
+// them. Only history records can be used to bring a server up to date with
+// ReadSince.
+class WriteAheadLog {
+ public:
+  explicit WriteAheadLog(wal_options_t options);
+  ~WriteAheadLog();
+
+  WriteAheadLog(const WriteAheadLog&) = delete;
+  WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+  // hands the latest snapshot, if there is one, to load, then replays every
+  // segment after it into apply and starts a new segment to append to. must
+  // be called once, before anything else. returns the number of records
+  // replayed
+  size_t Open(
+      const std::function<void(std::shared_ptr<const MappedSnapshot>)>& load,
+      const std::function<void(const mutation_t&)>& apply);
+
+  // logs m as the change numbered seq. history is false for changes that
+  // are not part of the history of the shard (see above). changes must be
+  // appended in the order they are made to the store
+  void Append(const mutation_t& m, uint64_t seq, bool history = true);
+  // blocks until every change appended so far is as durable as the fsync
+  // policy promises: fsynced for WRITE and BATCH, right away for INTERVAL
+  void WaitDurable();
+  // WaitDurable without blocking: calls done once every change appended so
+  // far is durable, on the thread that made it so (or right away). under
+  // FsyncPolicy::WRITE the caller makes it so, and does block
+  void WhenDurable(std::function<void()> done);
+  // the last history record appended (or replayed), {0, 0} if none
+  wal_position_t LastHistory() const;
+
+  // calls fn, in order, on every history record that follows the one at
+  // after, if the log still holds that one. fn returns false to stop early.
+  // returns false, without calling fn, if the log does not hold after
+  bool ReadSince(const wal_position_t& after,
+                 const std::function<bool(const mutation_t&)>& fn);
+
+  // true once the log has grown by options.snapshot_bytes since the last
+  // snapshot
+  bool NeedsSnapshot() const;
+  // starts a new segment and writes a snapshot of store as of its start or
+  // later (see MappedSnapshot::Write): the store may change while it is
+  // being written, as every change since is in the new segment. every
+  // segment before the new one is then deleted. returns the number of
+  // entries in the snapshot
+  size_t WriteSnapshot(const KVStore& store);
+  // forgets everything logged so far: the store is about to be replaced
+  void Reset();
+
+ private:
+  // every fsync policy but WRITE flushes from this thread
+  void _flush_loop();
+  // writes the buffer out to the current segment (and fsyncs it if sync).
+  // called with _write_mutex held
+  void _flush(bool sync);
+  // records that everything up to upto is durable, and hands back the
+  // callbacks of WhenDurable that were waiting for it. called with _mutex
+  // held; the callbacks are to be called without
+  std::vector<std::function<void()>> _made_durable(uint64_t upto);
+  // flushes and closes the current segment and opens segment n. returns the
+  // last history record before segment n. called with _write_mutex held
+  wal_position_t _rotate(uint64_t n);
+  // deletes every segment and snapshot numbered below n
+  void _drop_before(uint64_t n);
+  std::string _path(const std::string& name, uint64_t n) const;
+
+  const wal_options_t _options;
+
+  // serialises writes to the current segment, and rotation. guards _segment
+  // and _fd
+  std::mutex _write_mutex;
+  // the segment being appended to, and its file descriptor
+  uint64_t _segment = 0;
+  int _fd = -1;
+
+  // guards everything below, up to _closing
+  mutable std::mutex _mutex;
+  // signalled on Append (for the flusher) and on close
+  std::condition_variable _appended_cv;
+  // signalled whenever records become durable
+  std::condition_variable _durable_cv;
+  // records appended but not written yet
+  std::string _buffer;
+  // records appended and records fsynced, ever
+  uint64_t _appended = 0;
+  uint64_t _durable = 0;
+  // what WhenDurable is to call, by the record it waits for
+  std::multimap<uint64_t, std::function<void()>> _durable_callbacks;
+  wal_position_t _last_history;
+  // bytes written since the last snapshot
+  size_t _since_snapshot = 0;
+  bool _closing = false;
+
+  // held (shared) by readers of old segments, which must not be deleted
+  // under them
+  std::shared_mutex _files_mutex;
+  std::thread _flusher;
+};
+
+#endif  // SHARDING_WRITE_AHEAD_LOG_H
@@ -1,15 +1,55 @@
 #include <grpcpp/grpcpp.h>
 #include <unistd.h>
 #include <cstdio>
+#include <optional>
+#include <string>
 
 #include "shardkv_manager.h"
+#include "../common/server_options.h"
 
 int main(int argc, char** argv) {
-  if (argc != 4) {
+  if (argc < 4) {
     fprintf(stderr, "usage: ./shardmanager <PORT> <SHARDMASTER HOSTNAME> " \
-                    "<SHARDMASTER PORT>\n");
+                    "<SHARDMASTER PORT> " \
+                    "[--reads=primary|round_robin|least_outstanding] " \
+                    "[--metrics-port=<PORT>] [--log-level=debug|info|warn|error|off] %s\n",
+            SERVER_FLAGS_USAGE);
     return 1;
   }
+  // where Gets go: always the primary, or spread over primary and backup
+  ReadPolicy read_policy = ReadPolicy::PRIMARY;
+  // where Prometheus can scrape what the Stats RPC reports, if anywhere
+  int metrics_port = 0;
+  // sync or callback, and the threads, limits and keepalive of the server
+  server_options_t server_options;
+  for (int i = 4; i < argc; i++) {
+    std::string flag(argv[i]);
+    auto value = [&flag](const std::string& name) -> std::optional<std::string> {
+      if (flag.rfind(name + "=", 0) != 0) return std::nullopt;
+      return flag.substr(name.size() + 1);
+    };
+    if (flag == "--reads=round_robin") {
+      read_policy = ReadPolicy::ROUND_ROBIN;
+    } else if (flag == "--reads=least_outstanding") {
+      read_policy = ReadPolicy::LEAST_OUTSTANDING;
+    } else if (flag == "--reads=primary") {
+      read_policy = ReadPolicy::PRIMARY;
+    } else if (auto p = value("--metrics-port")) {
+      metrics_port = std::stoi(*p);
+    } else if (parse_server_flag(flag, &server_options)) {
+      // see server_options_t
+    } else if (auto level = value("--log-level")) {
+      auto parsed = parse_log_level(*level);
+      if (!parsed) {
+        fprintf(stderr, "unknown log level: %s\n", level->c_str());
+        return 1;
+      }
+      Logger::Shared().SetLevel(*parsed);
+    } else {
+      fprintf(stderr, "unknown option: %s\n", argv[i]);
+      return 1;
+    }
+  }
   // get our hostname so we can construct address for shardkv. we need this
   // because the shardmaster will know us by our hostname and port, so we should
   // track that.
@@ -25,11 +65,19 @@ int main(int argc, char** argv) {
       std::string(argv[2]) + ":" + std::string(argv[3]);
   fprintf(stdout, "Shardmaster on: %s\n", shardmaster_addr.c_str());
 
-  ::grpc::ServerBuilder builder;
-  builder.AddListeningPort(addr, ::grpc::InsecureServerCredentials());
-  ShardkvManager shardkv(addr, shardmaster_addr);
-  builder.RegisterService(&shardkv);
-  std::unique_ptr<::grpc::Server> server = builder.BuildAndStart();
+  ShardkvManager shardkv(addr, shardmaster_addr, read_policy);
+  ShardkvManagerCallbackService callback_service(&shardkv);
+  if (metrics_port && !ServeMetrics(metrics_port, [&]() { return shardkv.GetMetrics().Prometheus(); })) {
+    fprintf(stderr, "cannot serve metrics on port %d\n", metrics_port);
+    return 1;
+  }
+  std::unique_ptr<::grpc::Server> server = StartServer(
+      addr, server_options,
+      server_options.mode == ServerMode::CALLBACK ? static_cast<::grpc::Service*>(&callback_service) : &shardkv);
+  if (server == nullptr) {
+    fprintf(stderr, "cannot listen on %s\n", addr.c_str());
+    return 1;
+  }
 
   server->Wait();
   return 0;
@@ -1,15 +1,78 @@
 #include <grpcpp/grpcpp.h>
-#include <iostream>
 #include <algorithm>
 
 #include "shardkv_manager.h"
 using namespace std;
 
+void ShardkvManager::_register_metrics() {
+    auto rpc = [this](const char* name) {
+        return _metrics.Histogram("shardkv_manager_rpc_seconds", "Time to serve an RPC, forwarding included.",
+                                  string("rpc=\"") + name + "\"");
+    };
+    _h.get = rpc("Get");
+    _h.list_members = rpc("ListMembers");
+    _h.put = rpc("Put");
+    _h.append = rpc("Append");
+    _h.del = rpc("Delete");
+    _h.multi_get = rpc("MultiGet");
+    _h.multi_put = rpc("MultiPut");
+    _h.multi_delete = rpc("MultiDelete");
+    _h.migrate_shard = rpc("MigrateShard");
+    _h.ping = rpc("Ping");
+    _backup_fallbacks = _metrics.Counter("shardkv_manager_backup_fallbacks_total",
+                                         "Reads the backup could not answer, sent to the primary instead.");
+}
+
+template <typename Request, typename Response>
+::grpc::Status ShardkvManager::_forward_read(
+        ::grpc::Status (Shardkv::Stub::*call)(::grpc::ClientContext*, const Request&, Response*),
+        const Request& request, Response* response) {
+    auto primary = _primary_replica();
+    if (primary == nullptr) {
+        return ::grpc::Status(::grpc::StatusCode::UNAVAILABLE, "No primary server");
+    }
+    auto replica = _read_replica(primary);
+    LOG(DEBUG)<<address<<" forwarding read to "<<replica->address;
+    if (replica != primary) {
+        // a backup that has applied nothing would answer from an empty store
+        Request backup_request(request);
+        backup_request.set_min_seq(max<uint64_t>(request.min_seq(), 1));
+        ::grpc::ClientContext cc;
+        InFlight in_flight(*replica);
+        auto status = ((*replica->stub).*call)(&cc, backup_request, response);
+        // the backup is behind (the primary never is) or gone: ask the primary
+        if (status.error_code() != ::grpc::StatusCode::FAILED_PRECONDITION &&
+            status.error_code() != ::grpc::StatusCode::UNAVAILABLE)
+            return status;
+        _metrics.Add(_backup_fallbacks);
+    }
+    ::grpc::ClientContext cc;
+    InFlight in_flight(*primary);
+    return ((*primary->stub).*call)(&cc, request, response);
+}
+
+template <typename Request, typename Response>
+::grpc::Status ShardkvManager::_forward_write(
+        ::grpc::Status (Shardkv::Stub::*call)(::grpc::ClientContext*, const Request&, Response*),
+        const Request& request, Response* response) {
+    auto primary = _primary_replica();
+    if (primary == nullptr) {
+        return ::grpc::Status(::grpc::StatusCode::UNAVAILABLE, "No primary server");
+    }
+    LOG(DEBUG)<<address<<" forwarding write to "<<primary->address;
+    ::grpc::ClientContext cc;
+    InFlight in_flight(*primary);
+    return ((*primary->stub).*call)(&cc, request, response);
+}
+
 /**
  * This method is analogous to a hashmap lookup. A key is supplied in the
  * request and if its value can be found, we should either set the appropriate
  * field in the response Otherwise, we should return an error. An error should
  * also be returned if the server is not responsible for the specified key
+ * Depending on the read policy the read may go to the backup, which only
+ * answers once it has applied what the request asks for (at least one
+ * mutation, and request->min_seq); otherwise the primary answers.
  *
  * @param context - you can ignore this
  * @param request a message containing a key
@@ -21,13 +84,25 @@ using namespace std;
 ::grpc::Status ShardkvManager::Get(::grpc::ServerContext* context,
                                   const ::GetRequest* request,
                                   ::GetResponse* response) {
-    lock_guard<mutex> lock(*_mutex);
-    if( _primary_stub == nullptr){
-        return ::grpc::Status(::grpc::StatusCode::UNAVAILABLE, "No primary server");
-    }
-    ::grpc::ClientContext cc;
-    cerr<<"Forwarding get to "<<_current_primary()<<endl;
-    return _primary_stub->Get(&cc, *request, response);
+    Metrics::Timer timer(&_metrics, _h.get);
+    return _forward_read(&Shardkv::Stub::Get, *request, response);
+}
+
+/**
+ * Forwards a paginated read of a set-valued key to the primary, or to the
+ * backup like Get does.
+ *
+ * @param context - you can ignore this
+ * @param request the key, cursor and page size
+ * @param response the page of members, filled in by the primary
+ * @return the status returned by the primary, or
+ * ::grpc::Status(::grpc::StatusCode::UNAVAILABLE, ...) if there is none
+ */
+::grpc::Status ShardkvManager::ListMembers(::grpc::ServerContext* context,
+                                           const ::ListMembersRequest* request,
+                                           ::ListMembersResponse* response) {
+    Metrics::Timer timer(&_metrics, _h.list_members);
+    return _forward_read(&Shardkv::Stub::ListMembers, *request, response);
 }
 
 /**
@@ -47,17 +122,8 @@ using namespace std;
 ::grpc::Status ShardkvManager::Put(::grpc::ServerContext* context,
                                   const ::PutRequest* request,
                                   Empty* response) {
-    lock_guard<mutex> lock(*_mutex);
-    if( _primary_stub == nullptr){
-        return ::grpc::Status(::grpc::StatusCode::UNAVAILABLE, "No primary server");
-    }
-    ::grpc::ClientContext cc;
-    // cerr<<address<<" forwarding put to "<<_primary_address<<endl;
-    ::grpc::Status result_status = _primary_stub->Put(&cc, *request, response);
-    if (!result_status.ok()){
-        //cerr<<"shardmaster "<<address<<" received error from primary "<<_current_primary()<<"  >>  "<<result_status.error_message()<<" | key was "<<request->key()<<endl;
-    }
-    return result_status;
+    Metrics::Timer timer(&_metrics, _h.put);
+    return _forward_write(&Shardkv::Stub::Put, *request, response);
 }
 
 /**
@@ -76,12 +142,8 @@ using namespace std;
 ::grpc::Status ShardkvManager::Append(::grpc::ServerContext* context,
                                      const ::AppendRequest* request,
                                      Empty* response) {
-    lock_guard<mutex> lock(*_mutex);
-    if( _primary_stub == nullptr){
-        return ::grpc::Status(::grpc::StatusCode::UNAVAILABLE, "No primary server");
-    }
-    ::grpc::ClientContext cc;
-    return _primary_stub->Append(&cc, *request, response);
+    Metrics::Timer timer(&_metrics, _h.append);
+    return _forward_write(&Shardkv::Stub::Append, *request, response);
 }
 
 /**
@@ -99,12 +161,83 @@ using namespace std;
 ::grpc::Status ShardkvManager::Delete(::grpc::ServerContext* context,
                                            const ::DeleteRequest* request,
                                            Empty* response) {
-    lock_guard<mutex> lock(*_mutex);
-    if( _primary_stub == nullptr) {
+    Metrics::Timer timer(&_metrics, _h.del);
+    return _forward_write(&Shardkv::Stub::Delete, *request, response);
+}
+
+/**
+ * Forwards a Get of several keys, like Get.
+ *
+ * @param context - you can ignore this
+ * @param request the keys
+ * @param response the values, filled in by the server that answered
+ * @return the status returned by that server, or
+ * ::grpc::Status(::grpc::StatusCode::UNAVAILABLE, ...) if there is no primary
+ */
+::grpc::Status ShardkvManager::MultiGet(::grpc::ServerContext* context,
+                                        const ::MultiGetRequest* request,
+                                        ::MultiGetResponse* response) {
+    Metrics::Timer timer(&_metrics, _h.multi_get);
+    return _forward_read(&Shardkv::Stub::MultiGet, *request, response);
+}
+
+/**
+ * Forwards a Put of several keys to the primary.
+ *
+ * @param context - you can ignore this
+ * @param request the Puts
+ * @param response An empty message, as we don't need to return any data
+ * @return the status returned by the primary, or
+ * ::grpc::Status(::grpc::StatusCode::UNAVAILABLE, ...) if there is none
+ */
+::grpc::Status ShardkvManager::MultiPut(::grpc::ServerContext* context,
+                                        const ::MultiPutRequest* request,
+                                        Empty* response) {
+    Metrics::Timer timer(&_metrics, _h.multi_put);
+    return _forward_write(&Shardkv::Stub::MultiPut, *request, response);
+}
+
+/**
+ * Forwards a Delete of several keys to the primary.
+ *
+ * @param context - you can ignore this
+ * @param request the keys
+ * @param response how many keys were deleted, filled in by the primary
+ * @return the status returned by the primary, or
+ * ::grpc::Status(::grpc::StatusCode::UNAVAILABLE, ...) if there is none
+ */
+::grpc::Status ShardkvManager::MultiDelete(::grpc::ServerContext* context,
+                                           const ::MultiDeleteRequest* request,
+                                           ::MultiDeleteResponse* response) {
+    Metrics::Timer timer(&_metrics, _h.multi_delete);
+    return _forward_write(&Shardkv::Stub::MultiDelete, *request, response);
+}
+
+/**
+ * Relays a key migration from another server to our primary, batch by batch.
+ *
+ * @param context - you can ignore this
+ * @param reader the batches of keys sent to us
+ * @param response An empty message, as we don't need to return any data
+ * @return the status returned by the primary, or
+ * ::grpc::Status(::grpc::StatusCode::UNAVAILABLE, ...) if there is none
+ */
+::grpc::Status ShardkvManager::MigrateShard(::grpc::ServerContext* context,
+                                            ::grpc::ServerReader<::MigrateBatch>* reader,
+                                            Empty* response) {
+    Metrics::Timer timer(&_metrics, _h.migrate_shard);
+    auto primary = _primary_replica();
+    if (primary == nullptr) {
         return ::grpc::Status(::grpc::StatusCode::UNAVAILABLE, "No primary server");
     }
     ::grpc::ClientContext cc;
-    return _primary_stub->Delete(&cc, *request, response);
+    auto writer = primary->stub->MigrateShard(&cc, response);
+    MigrateBatch batch;
+    while (reader->Read(&batch))
+        if (!writer->Write(batch))
+            break;
+    writer->WritesDone();
+    return writer->Finish();
 }
 
 /**
@@ -121,6 +254,7 @@ using namespace std;
  */
 ::grpc::Status ShardkvManager::Ping(::grpc::ServerContext* context, const PingRequest* request,
                                        ::PingResponse* response){
+    Metrics::Timer timer(&_metrics, _h.ping);
     size_t view_number = request->viewnumber();
     string server_name = request->server();
 
@@ -131,21 +265,20 @@ using namespace std;
         // first time ping is called
         _views.push_back({server_name, ""});
         _current++;
-        _primary_stub = Shardkv::NewStub(grpc::CreateChannel(server_name, grpc::InsecureChannelCredentials()));
+        _view_changed();
         response->set_primary(_current_primary());
         response->set_backup(_current_backup());
     } else if (server_name == _current_primary()) {
         // ping from primary
         // update acknowledged view
-        // if(_acknowledged < view_number)
-        //     cerr<<address<<" ACKED "<<view_number<<endl;
         if(view_number > _acknowledged)
             _acknowledged = view_number;
-        // cerr<<address<<" ACKED = "<<_acknowledged<<" CUR = "<<_current<<" VN = "<<view_number<<endl;
+        LOG(DEBUG)<<address<<" acknowledged = "<<_acknowledged<<" current = "<<_current<<" view number = "<<view_number;
         if (_acknowledged == _current) {
             // update current view if there are more recent views to acknowledge
             if (_current < _latest()) {
                 _current++;
+                _view_changed();
             }
             // send current view
             response->set_primary(_current_primary());
@@ -188,8 +321,203 @@ using namespace std;
         response->set_backup(_current_backup());
     }
     response->set_id(_current);
-    // cerr<<"RES FOR "<<server_name<<" = "<<_current<<endl;
+    LOG(DEBUG)<<address<<" answered ping of "<<server_name<<" with view "<<_current;
     _last_ping[server_name].Push(chrono::high_resolution_clock::now());
     return ::grpc::Status(::grpc::StatusCode::OK, sm_address);
 }
 
+shared_ptr<replica_t> ShardkvManager::_read_replica(const shared_ptr<replica_t>& primary) {
+    if (_read_policy == ReadPolicy::PRIMARY)
+        return primary;
+    shared_ptr<replica_t> backup;
+    {
+        lock_guard<mutex> lock(_replica_mutex);
+        backup = _backup;
+    }
+    if (backup == nullptr)
+        return primary;
+    if (_read_policy == ReadPolicy::ROUND_ROBIN)
+        return _reads++ % 2 ? backup : primary;
+    return backup->outstanding < primary->outstanding ? backup : primary;
+}
+
+void ShardkvManager::_view_changed() {
+    // only ever changed under _mutex, which we hold
+    vector<shared_ptr<replica_t>> old = {_primary, _backup};
+    auto replica_of = [&old](const string& addr) {
+        if (addr.empty())
+            return shared_ptr<replica_t>();
+        // a server that stays in the view keeps its replica (and count of
+        // outstanding requests), even if it went from backup to primary
+        for (const auto& r : old)
+            if (r != nullptr && r->address == addr)
+                return r;
+        auto r = make_shared<replica_t>();
+        r->address = addr;
+        r->stub = ChannelPool::Shared().Stub<Shardkv>(addr);
+        return r;
+    };
+    auto primary = replica_of(_current_primary());
+    auto backup = replica_of(_current_backup());
+    lock_guard<mutex> lock(_replica_mutex);
+    _primary = move(primary);
+    _backup = move(backup);
+}
+
+/**
+ * The latency histograms and counters of this shardmanager (see Metrics),
+ * summed over every thread at the time of the call.
+ *
+ * @param context - you can ignore this
+ * @param request An empty message
+ * @param response the quantiles of every histogram, every counter, and all
+ * of it in the Prometheus text format
+ * @return ::grpc::Status::OK
+ */
+::grpc::Status ShardkvManager::Stats(::grpc::ServerContext* context, const ::StatsRequest* request,
+                                     ::StatsResponse* response) {
+    _metrics.Fill(response);
+    response->set_prometheus(_metrics.Prometheus());
+    return ::grpc::Status::OK;
+}
+
+template <typename Request, typename Response>
+void ShardkvManagerCallbackService::_send(shared_ptr<replica_t> replica, AsyncCall<Request, Response> call,
+                                          const Request* request, Response* response,
+                                          function<void(::grpc::Status)> done) {
+    auto cc = make_shared<::grpc::ClientContext>();
+    replica->outstanding++;
+    auto* stub = replica->stub->async();
+    (stub->*call)(cc.get(), request, response,
+                  [replica, cc, done = move(done)](::grpc::Status status) {
+                      replica->outstanding--;
+                      done(move(status));
+                  });
+}
+
+template <typename Request, typename Response>
+::grpc::ServerUnaryReactor* ShardkvManagerCallbackService::_forward_read(::grpc::CallbackServerContext* context,
+                                                                         size_t histogram,
+                                                                         AsyncCall<Request, Response> call,
+                                                                         const Request* request,
+                                                                         Response* response) {
+    auto* reactor = context->DefaultReactor();
+    auto primary = _manager->_primary_replica();
+    if (primary == nullptr) {
+        reactor->Finish(::grpc::Status(::grpc::StatusCode::UNAVAILABLE, "No primary server"));
+        return reactor;
+    }
+    auto start = chrono::steady_clock::now();
+    auto finish = [this, reactor, histogram, start](::grpc::Status status) {
+        _manager->_metrics.Record(histogram, chrono::steady_clock::now() - start);
+        reactor->Finish(status);
+    };
+    auto replica = _manager->_read_replica(primary);
+    if (replica == primary) {
+        _send(primary, call, request, response, finish);
+        return reactor;
+    }
+    // as in ShardkvManager::_forward_read
+    auto backup_request = make_shared<Request>(*request);
+    backup_request->set_min_seq(max<uint64_t>(request->min_seq(), 1));
+    _send(replica, call, backup_request.get(), response,
+          [this, backup_request, primary, call, request, response, finish](::grpc::Status status) {
+              if (status.error_code() != ::grpc::StatusCode::FAILED_PRECONDITION &&
+                  status.error_code() != ::grpc::StatusCode::UNAVAILABLE) {
+                  finish(move(status));
+                  return;
+              }
+              _manager->_metrics.Add(_manager->_backup_fallbacks);
+              response->Clear();
+              _send(primary, call, request, response, finish);
+          });
+    return reactor;
+}
+
+template <typename Request, typename Response>
+::grpc::ServerUnaryReactor* ShardkvManagerCallbackService::_forward_write(::grpc::CallbackServerContext* context,
+                                                                          size_t histogram,
+                                                                          AsyncCall<Request, Response> call,
+                                                                          const Request* request,
+                                                                          Response* response) {
+    auto* reactor = context->DefaultReactor();
+    auto primary = _manager->_primary_replica();
+    if (primary == nullptr) {
+        reactor->Finish(::grpc::Status(::grpc::StatusCode::UNAVAILABLE, "No primary server"));
+        return reactor;
+    }
+    auto start = chrono::steady_clock::now();
+    _send(primary, call, request, response, [this, reactor, histogram, start](::grpc::Status status) {
+        _manager->_metrics.Record(histogram, chrono::steady_clock::now() - start);
+        reactor->Finish(status);
+    });
+    return reactor;
+}
+
+::grpc::ServerUnaryReactor* ShardkvManagerCallbackService::Get(::grpc::CallbackServerContext* context,
+                                                               const ::GetRequest* request, ::GetResponse* response) {
+    return _forward_read(context, _manager->_h.get, &Shardkv::Stub::async::Get, request, response);
+}
+
+::grpc::ServerUnaryReactor* ShardkvManagerCallbackService::ListMembers(::grpc::CallbackServerContext* context,
+                                                                       const ::ListMembersRequest* request,
+                                                                       ::ListMembersResponse* response) {
+    return _forward_read(context, _manager->_h.list_members, &Shardkv::Stub::async::ListMembers, request,
+                         response);
+}
+
+::grpc::ServerUnaryReactor* ShardkvManagerCallbackService::MultiGet(::grpc::CallbackServerContext* context,
+                                                                    const ::MultiGetRequest* request,
+                                                                    ::MultiGetResponse* response) {
+    return _forward_read(context, _manager->_h.multi_get, &Shardkv::Stub::async::MultiGet, request, response);
+}
+
+::grpc::ServerUnaryReactor* ShardkvManagerCallbackService::Put(::grpc::CallbackServerContext* context,
+                                                               const ::PutRequest* request, Empty* response) {
+    return _forward_write(context, _manager->_h.put, &Shardkv::Stub::async::Put, request, response);
+}
+
+::grpc::ServerUnaryReactor* ShardkvManagerCallbackService::Append(::grpc::CallbackServerContext* context,
+                                                                  const ::AppendRequest* request, Empty* response) {
+    return _forward_write(context, _manager->_h.append, &Shardkv::Stub::async::Append, request, response);
+}
+
+::grpc::ServerUnaryReactor* ShardkvManagerCallbackService::Delete(::grpc::CallbackServerContext* context,
+                                                                  const ::DeleteRequest* request, Empty* response) {
+    return _forward_write(context, _manager->_h.del, &Shardkv::Stub::async::Delete, request, response);
+}
+
+::grpc::ServerUnaryReactor* ShardkvManagerCallbackService::MultiPut(::grpc::CallbackServerContext* context,
+                                                                    const ::MultiPutRequest* request,
+                                                                    Empty* response) {
+    return _forward_write(context, _manager->_h.multi_put, &Shardkv::Stub::async::MultiPut, request, response);
+}
+
+::grpc::ServerUnaryReactor* ShardkvManagerCallbackService::MultiDelete(::grpc::CallbackServerContext* context,
+                                                                       const ::MultiDeleteRequest* request,
+                                                                       ::MultiDeleteResponse* response) {
+    return _forward_write(context, _manager->_h.multi_delete, &Shardkv::Stub::async::MultiDelete, request,
+                          response);
+}
+
+::grpc::ServerUnaryReactor* ShardkvManagerCallbackService::Ping(::grpc::CallbackServerContext* context,
+                                                                const ::PingRequest* request,
+                                                                ::PingResponse* response) {
+    auto* reactor = context->DefaultReactor();
+    reactor->Finish(_manager->Ping(nullptr, request, response));
+    return reactor;
+}
+
+::grpc::ServerUnaryReactor* ShardkvManagerCallbackService::Stats(::grpc::CallbackServerContext* context,
+                                                                 const ::StatsRequest* request,
+                                                                 ::StatsResponse* response) {
+    auto* reactor = context->DefaultReactor();
+    reactor->Finish(_manager->Stats(nullptr, request, response));
+    return reactor;
+}
+
+::grpc::Status ShardkvManagerCallbackService::MigrateShard(::grpc::ServerContext* context,
+                                                           ::grpc::ServerReader<::MigrateBatch>* reader,
+                                                           Empty* response) {
+    return _manager->MigrateShard(context, reader, response);
+}
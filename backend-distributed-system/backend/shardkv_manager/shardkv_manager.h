@@ -4,8 +4,13 @@
 #include <grpcpp/grpcpp.h>
 #include <thread>
 #include "../common/common.h"
+#include "../common/channel_pool.h"
+#include "../common/log.h"
+#include "../common/metrics.h"
 #include <unordered_map>
 #include <mutex>
+#include <atomic>
+#include <functional>
 #include <iostream>
 #include <fstream>
 
@@ -24,16 +29,48 @@ public:
     }
 };
 
+// which server of the group reads (Get, ListMembers) are forwarded to.
+// writes always go to the primary
+enum class ReadPolicy {
+  PRIMARY,
+  // the primary and the backup in turn
+  ROUND_ROBIN,
+  // whichever of the two has fewer requests in flight
+  LEAST_OUTSTANDING
+};
+
+// a server of the current view that requests are forwarded to
+typedef struct replica {
+  std::string address;
+  std::shared_ptr<Shardkv::Stub> stub;
+  // forwarded requests that have not returned yet
+  std::atomic<int> outstanding{0};
+} replica_t;
+
+// counts a request as outstanding on a replica for as long as it is in scope
+class InFlight {
+ public:
+  explicit InFlight(replica_t& r) : _replica(r) { _replica.outstanding++; }
+  ~InFlight() { _replica.outstanding--; }
+
+ private:
+  replica_t& _replica;
+};
+
 class ShardkvManager : public Shardkv::Service {
   using Empty = google::protobuf::Empty;
 
  public:
-  explicit ShardkvManager(std::string addr, const std::string& shardmaster_addr)
+  explicit ShardkvManager(std::string addr, const std::string& shardmaster_addr,
+                          ReadPolicy read_policy = ReadPolicy::PRIMARY)
       : address(std::move(addr)),
         sm_address(shardmaster_addr),
+        _read_policy(read_policy),
         _mutex(std::make_shared<std::mutex>()),
         _views{{"",""}},
+        _current{0},
         _acknowledged{0} {
+      _register_metrics();
       // TODO: Part 3
       // This thread will check for last shardkv server ping and update the view accordingly if needed
       std::thread heartbeatChecker(
@@ -47,21 +84,22 @@ class ShardkvManager : public Shardkv::Service {
                       bool primary_dead = !_current_primary().empty() && _last_ping[_current_primary()].GetPingInterval() > dead_interval;
                       bool backup_dead = !_current_backup().empty() && _last_ping[_current_backup()].GetPingInterval() > dead_interval;
                       if (primary_dead) {
-                        std::cerr<<"Primary "<<_current_primary()<<" dead at "<<_last_ping[_current_primary()].GetPingInterval()<<std::endl;
+                        LOG(WARN)<<"Primary "<<_current_primary()<<" dead at "<<_last_ping[_current_primary()].GetPingInterval();
                         assert(_current == _acknowledged);
                         _views.push_back({_views.back().begin()+1, _views.back().end()});
                         if(_views.back().size() == 1)
                             _views.back().push_back("");
                         _current++;
-                        _primary_stub = Shardkv::NewStub(grpc::CreateChannel(_current_primary(), grpc::InsecureChannelCredentials()));
+                        _view_changed();
                       } else if (backup_dead) {
-                        std::cerr<<"Backup "<<_current_backup()<<" dead at "<<_last_ping[_current_backup()].GetPingInterval()<<std::endl;
+                        LOG(WARN)<<"Backup "<<_current_backup()<<" dead at "<<_last_ping[_current_backup()].GetPingInterval();
                         assert(_current == _acknowledged);
                         _views.push_back(_views.back());
                         _views.back().erase(_views.back().begin()+1);
                         if(_views.back().size() == 1)
                             _views.back().push_back("");
                         _current++;
+                        _view_changed();
                       }
                   }
               });
@@ -73,6 +111,9 @@ class ShardkvManager : public Shardkv::Service {
   ::grpc::Status Get(::grpc::ServerContext* context,
                      const ::GetRequest* request,
                      ::GetResponse* response) override;
+  ::grpc::Status ListMembers(::grpc::ServerContext* context,
+                             const ::ListMembersRequest* request,
+                             ::ListMembersResponse* response) override;
   ::grpc::Status Put(::grpc::ServerContext* context,
                      const ::PutRequest* request, Empty* response) override;
   ::grpc::Status Append(::grpc::ServerContext* context,
@@ -81,10 +122,30 @@ class ShardkvManager : public Shardkv::Service {
   ::grpc::Status Delete(::grpc::ServerContext* context,
                         const ::DeleteRequest* request,
                         Empty* response) override;
+  ::grpc::Status MultiGet(::grpc::ServerContext* context,
+                          const ::MultiGetRequest* request,
+                          ::MultiGetResponse* response) override;
+  ::grpc::Status MultiPut(::grpc::ServerContext* context,
+                          const ::MultiPutRequest* request,
+                          Empty* response) override;
+  ::grpc::Status MultiDelete(::grpc::ServerContext* context,
+                             const ::MultiDeleteRequest* request,
+                             ::MultiDeleteResponse* response) override;
   ::grpc::Status Ping(::grpc::ServerContext* context, const PingRequest* request,
                         ::PingResponse* response) override;
+  ::grpc::Status MigrateShard(::grpc::ServerContext* context,
+                              ::grpc::ServerReader<::MigrateBatch>* reader,
+                              Empty* response) override;
+  ::grpc::Status Stats(::grpc::ServerContext* context,
+                       const ::StatsRequest* request,
+                       ::StatsResponse* response) override;
+
+  // what Stats reports, for ServeMetrics
+  const Metrics& GetMetrics() const { return _metrics; }
 
  private:
+    friend class ShardkvManagerCallbackService;
+
     // address we're running on (hostname:port)
     const std::string address;
 
@@ -93,9 +154,18 @@ class ShardkvManager : public Shardkv::Service {
 
     // TODO add any fields you want here!
     
-    // stub for primary server
-    std::unique_ptr<Shardkv::Stub> _primary_stub;
-    // mutex for primary server
+    ReadPolicy _read_policy;
+    // reads forwarded so far, for ROUND_ROBIN
+    std::atomic<uint64_t> _reads{0};
+
+    // primary and backup of the current view. only replaced as a whole,
+    // under both _mutex and _replica_mutex. forwarding a request copies them
+    // under _replica_mutex alone, which is never held for longer than a
+    // copy, so it never waits for _mutex
+    std::shared_ptr<replica_t> _primary;
+    std::shared_ptr<replica_t> _backup;
+    std::mutex _replica_mutex;
+    // mutex for the views
     std::shared_ptr<std::mutex> _mutex;
     // vector of views (each view is a vector like [primary, backup, idle0, idle1, ...])
     std::vector<std::vector<std::string>> _views;
@@ -105,6 +175,38 @@ class ShardkvManager : public Shardkv::Service {
     std::size_t _acknowledged;
     // map of last ping time for each server
     std::unordered_map<std::string, PingInterval> _last_ping;
+    // latency of every RPC, forwarding included
+    Metrics _metrics;
+    // what we record in _metrics, registered by _register_metrics
+    struct {
+      size_t get, list_members, put, append, del, multi_get, multi_put, multi_delete, migrate_shard, ping;
+    } _h;
+    // reads the backup could not answer, which went to the primary after all
+    size_t _backup_fallbacks;
+
+    void _register_metrics();
+
+    // the server requests go to, nullptr while there is no primary
+    inline std::shared_ptr<replica_t> _primary_replica() {
+      std::lock_guard<std::mutex> lock(_replica_mutex);
+      return _primary;
+    }
+    // where the next read goes under _read_policy: primary or the backup
+    std::shared_ptr<replica_t> _read_replica(const std::shared_ptr<replica_t>& primary);
+    // forwards a read (one of the Stub's Get, ListMembers, MultiGet) to the
+    // server _read_replica picks, or to the primary if that one is behind
+    template <typename Request, typename Response>
+    ::grpc::Status _forward_read(
+        ::grpc::Status (Shardkv::Stub::*call)(::grpc::ClientContext*, const Request&, Response*),
+        const Request& request, Response* response);
+    // forwards a write to the primary
+    template <typename Request, typename Response>
+    ::grpc::Status _forward_write(
+        ::grpc::Status (Shardkv::Stub::*call)(::grpc::ClientContext*, const Request&, Response*),
+        const Request& request, Response* response);
+    // points _primary and _backup to the servers of the current view. called
+    // with _mutex held whenever _current changes
+    void _view_changed();
 
     inline const std::string& _current_primary() { return _views[_current][0]; }
     inline const std::string& _current_backup() { return _views[_current][1]; }
@@ -114,4 +216,72 @@ class ShardkvManager : public Shardkv::Service {
     inline const std::string& _latest_primary() { return _views.back()[0]; }
     inline const std::string& _latest_backup() { return _views.back()[1]; }
 };
+// The RPCs of a ShardkvManager for ServerMode::CALLBACK: requests are
+// forwarded with the asynchronous API of the stubs and finished from the
+// callback of the forwarded call, so that no thread of the manager waits on
+// the server that answers. Reads go where they would in SYNC mode, backup
+// fallback included. MigrateShard is a stream, and is served by the
+// synchronous handler of the manager.
+class ShardkvManagerCallbackService
+    : public Shardkv::WithCallbackMethod_Get<Shardkv::WithCallbackMethod_ListMembers<
+          Shardkv::WithCallbackMethod_Put<Shardkv::WithCallbackMethod_Append<
+              Shardkv::WithCallbackMethod_Delete<Shardkv::WithCallbackMethod_MultiGet<
+                  Shardkv::WithCallbackMethod_MultiPut<Shardkv::WithCallbackMethod_MultiDelete<
+                      Shardkv::WithCallbackMethod_Ping<Shardkv::WithCallbackMethod_Stats<Shardkv::Service>>>>>>>>>> {
+  using Empty = google::protobuf::Empty;
+
+ public:
+  explicit ShardkvManagerCallbackService(ShardkvManager* manager) : _manager(manager) {}
+
+  ::grpc::ServerUnaryReactor* Get(::grpc::CallbackServerContext* context, const ::GetRequest* request,
+                                  ::GetResponse* response) override;
+  ::grpc::ServerUnaryReactor* ListMembers(::grpc::CallbackServerContext* context,
+                                          const ::ListMembersRequest* request,
+                                          ::ListMembersResponse* response) override;
+  ::grpc::ServerUnaryReactor* Put(::grpc::CallbackServerContext* context, const ::PutRequest* request,
+                                  Empty* response) override;
+  ::grpc::ServerUnaryReactor* Append(::grpc::CallbackServerContext* context, const ::AppendRequest* request,
+                                     Empty* response) override;
+  ::grpc::ServerUnaryReactor* Delete(::grpc::CallbackServerContext* context, const ::DeleteRequest* request,
+                                     Empty* response) override;
+  ::grpc::ServerUnaryReactor* MultiGet(::grpc::CallbackServerContext* context, const ::MultiGetRequest* request,
+                                       ::MultiGetResponse* response) override;
+  ::grpc::ServerUnaryReactor* MultiPut(::grpc::CallbackServerContext* context, const ::MultiPutRequest* request,
+                                       Empty* response) override;
+  ::grpc::ServerUnaryReactor* MultiDelete(::grpc::CallbackServerContext* context,
+                                          const ::MultiDeleteRequest* request,
+                                          ::MultiDeleteResponse* response) override;
+  ::grpc::ServerUnaryReactor* Ping(::grpc::CallbackServerContext* context, const ::PingRequest* request,
+                                   ::PingResponse* response) override;
+  ::grpc::ServerUnaryReactor* Stats(::grpc::CallbackServerContext* context, const ::StatsRequest* request,
+                                    ::StatsResponse* response) override;
+
+  ::grpc::Status MigrateShard(::grpc::ServerContext* context, ::grpc::ServerReader<::MigrateBatch>* reader,
+                              Empty* response) override;
+
+ private:
+  template <typename Request, typename Response>
+  using AsyncCall = void (Shardkv::Stub::async::*)(::grpc::ClientContext*, const Request*, Response*,
+                                                   std::function<void(::grpc::Status)>);
+
+  // calls replica with call, counting the call as outstanding on it until
+  // it returns, and then done with its status
+  template <typename Request, typename Response>
+  static void _send(std::shared_ptr<replica_t> replica, AsyncCall<Request, Response> call, const Request* request,
+                    Response* response, std::function<void(::grpc::Status)> done);
+  // _forward_read and _forward_write of the manager, finishing the request
+  // once the forwarded call returns and recording the time it took in
+  // histogram
+  template <typename Request, typename Response>
+  ::grpc::ServerUnaryReactor* _forward_read(::grpc::CallbackServerContext* context, size_t histogram,
+                                            AsyncCall<Request, Response> call, const Request* request,
+                                            Response* response);
+  template <typename Request, typename Response>
+  ::grpc::ServerUnaryReactor* _forward_write(::grpc::CallbackServerContext* context, size_t histogram,
+                                             AsyncCall<Request, Response> call, const Request* request,
+                                             Response* response);
+
+  ShardkvManager* _manager;
+};
+
 #endif  // SHARDING_SHARDKV_MANAGER_H
@@ -1,24 +1,104 @@
 #include <unistd.h>
+#include <cstdint>
 #include <cstdio>
+#include <optional>
 #include "shardmaster.h"
+#include "../common/server_options.h"
 
 int main(int argc, char** argv) {
-  if (argc != 2) {
-    fprintf(stderr, "usage: ./shardmaster <PORT>\n");
+  if (argc < 2) {
+    fprintf(stderr, "usage: ./shardmaster <PORT> [--auto-balance] " \
+                    "[--rebalance=even|minimal] [--placement=range|hash] " \
+                    "[--vnodes=<N>] [--min-key=<ID>] [--max-key=<ID>] " \
+                    "[--metrics-port=<PORT>] [--log-level=debug|info|warn|error|off] %s\n",
+            SERVER_FLAGS_USAGE);
+    return 1;
+  }
+  shardmaster_options_t options;
+  // --auto-balance: split, merge and move shards according to their load
+  // --rebalance=even: Join and Leave split the key space evenly again from
+  // scratch
+  // --rebalance=minimal: they only move the keys needed to even out the
+  // servers
+  // --placement=range: servers hold ranges of ids
+  // --placement=hash: ids are spread over the servers by consistent hashing,
+  // with --vnodes points per server on the ring
+  // --min-key, --max-key: the ids to place, MIN_KEY .. MAX_KEY by default
+  // --metrics-port: serve what the Stats RPC reports over HTTP as well, for
+  // Prometheus
+  // --log-level: the least severe lines logged, info by default
+  // and the flags of server_options_t: sync or callback, the threads,
+  // limits and keepalive of the server
+  int metrics_port = 0;
+  server_options_t server_options;
+  for (int i = 2; i < argc; i++) {
+    std::string flag(argv[i]);
+    auto value = [&flag](const std::string& name) -> std::optional<std::string> {
+      if (flag.rfind(name + "=", 0) != 0) return std::nullopt;
+      return flag.substr(name.size() + 1);
+    };
+    if (flag == "--auto-balance") {
+      options.auto_balance = true;
+    } else if (flag == "--rebalance=even") {
+      options.rebalance = RebalanceMode::EVEN;
+    } else if (flag == "--rebalance=minimal") {
+      options.rebalance = RebalanceMode::MINIMAL;
+    } else if (flag == "--placement=range") {
+      options.placement = Placement::RANGE;
+    } else if (flag == "--placement=hash") {
+      options.placement = Placement::HASH;
+    } else if (auto n = value("--vnodes")) {
+      options.vnodes = std::stoul(*n);
+    } else if (auto id = value("--min-key")) {
+      options.key_space.lower = std::stoull(*id);
+    } else if (auto id = value("--max-key")) {
+      options.key_space.upper = std::stoull(*id);
+    } else if (auto port = value("--metrics-port")) {
+      metrics_port = std::stoi(*port);
+    } else if (parse_server_flag(flag, &server_options)) {
+      // see server_options_t
+    } else if (auto level = value("--log-level")) {
+      auto parsed = parse_log_level(*level);
+      if (!parsed) {
+        fprintf(stderr, "unknown log level: %s\n", level->c_str());
+        return 1;
+      }
+      Logger::Shared().SetLevel(*parsed);
+    } else {
+      fprintf(stderr, "unknown option: %s\n", argv[i]);
+      return 1;
+    }
+  }
+  if (options.placement == Placement::HASH && (options.auto_balance || options.vnodes == 0)) {
+    fprintf(stderr, "--placement=hash needs --vnodes > 0 and no --auto-balance\n");
+    return 1;
+  }
+  // one more than the last id must still be an id, for ranges to end
+  if (options.key_space.lower > options.key_space.upper || options.key_space.upper == UINT64_MAX) {
+    fprintf(stderr, "--min-key must be at most --max-key, which must be below %llu\n",
+            (unsigned long long)UINT64_MAX);
     return 1;
   }
   // shardmaster service
-  StaticShardmaster shardmaster;
+  StaticShardmaster shardmaster(options);
+  if (metrics_port && !ServeMetrics(metrics_port, [&]() { return shardmaster.GetMetrics().Prometheus(); })) {
+    fprintf(stderr, "cannot serve metrics on port %d\n", metrics_port);
+    return 1;
+  }
   // construct address
   char hostnamebuf[256];
   gethostname(hostnamebuf, 256);
   // construct addresses
   std::string hostname(hostnamebuf);
   std::string addr = hostname + ":" + std::string(argv[1]);
-  ::grpc::ServerBuilder builder;
-  builder.AddListeningPort(addr, ::grpc::InsecureServerCredentials());
-  builder.RegisterService(&shardmaster);
-  std::unique_ptr<::grpc::Server> server = builder.BuildAndStart();
+  ShardmasterCallbackService callback_service(&shardmaster);
+  std::unique_ptr<::grpc::Server> server = StartServer(
+      addr, server_options,
+      server_options.mode == ServerMode::CALLBACK ? static_cast<::grpc::Service*>(&callback_service) : &shardmaster);
+  if (server == nullptr) {
+    fprintf(stderr, "cannot listen on %s\n", addr.c_str());
+    return 1;
+  }
   fprintf(stdout, "Listening on: %s\n", addr.c_str());
   server->Wait();
   return 0;
@@ -1,19 +1,344 @@
+#include <algorithm>
+#include <optional>
+#include <thread>
+
 #include "shardmaster.h"
 using namespace std;
 
-const shard_t StaticShardmaster::ALL_KEYS_SHARD = {MIN_KEY, MAX_KEY};
-const size_t StaticShardmaster::NUM_SHARDS = MAX_KEY - MIN_KEY + 1;
-
-StaticShardmaster::StaticShardmaster() : _mutex(make_unique<mutex>()) { }
+StaticShardmaster::StaticShardmaster(const shardmaster_options_t& options)
+    : _mutex(make_unique<mutex>()),
+      _epoch(chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now().time_since_epoch()).count()),
+      _version(0), _moved_keys(0), _rebalance(options.rebalance),
+      _placement(options.placement), _vnodes(options.vnodes), _key_space(options.key_space) {
+    auto rpc = [this](const char* name) {
+        return _metrics.Histogram("shardmaster_rpc_seconds", "Time to serve an RPC.",
+                                  string("rpc=\"") + name + "\"");
+    };
+    _h.join = rpc("Join");
+    _h.leave = rpc("Leave");
+    _h.move = rpc("Move");
+    _h.query = rpc("Query");
+    _h.report_load = rpc("ReportLoad");
+    _h.balance = _metrics.Histogram("shardmaster_balance_seconds", "Time of a load balancing round.");
+    _c.configs = _metrics.Counter("shardmaster_configs_total", "Configurations published.");
+    _c.keys_moved = _metrics.Counter("shardmaster_keys_moved_total",
+                                     "Keys given to another server by the configuration changes.");
+    _c.watch_updates = _metrics.Counter("shardmaster_watch_updates_total", "Configurations sent on Watch streams.");
+    // there are no shards to balance when keys are placed by hash
+    if (!options.auto_balance || _placement == Placement::HASH)
+        return;
+    // This thread splits, merges and moves shards as their load changes
+    thread balance([this]() {
+        while (true) {
+            this_thread::sleep_for(BALANCE_INTERVAL);
+            lock_guard<mutex> lock(*_mutex);
+            Metrics::Timer timer(&_metrics, _h.balance);
+            _balance();
+        }
+    });
+    // we detach the thread so we don't have to wait for it to terminate later
+    balance.detach();
+}
 
 void StaticShardmaster::_reassign_shards() {
-    vector<shard_t> new_shards = split_shard(ALL_KEYS_SHARD, _server_list.size());
+    // the ring places the keys on whatever servers there are
+    if (_placement == Placement::HASH)
+        return;
+    if (_rebalance == RebalanceMode::MINIMAL) {
+        _reassign_minimal();
+        return;
+    }
+    vector<shard_t> new_shards = split_shard(_key_space, _server_list.size());
     for (size_t i = 0; i < _server_list.size(); i++) {
         _servers[_server_list[i]].clear();
         _servers[_server_list[i]].push_back(new_shards[i]);
     }
 }
 
+void StaticShardmaster::_reassign_minimal() {
+    if (_server_list.empty())
+        return;
+    // the keys nobody holds: all of them before the first Join, those of the
+    // servers that left on a Leave
+    vector<shard_t> held;
+    for (const auto& server : _server_list)
+        held.insert(held.end(), _servers[server].begin(), _servers[server].end());
+    sortAscendingInterval(held);
+    vector<shard_t> free;
+    uint64_t next = _key_space.lower;
+    for (const auto& shard : held) {
+        if (shard.lower > next)
+            free.push_back({next, shard.lower - 1});
+        next = max(next, shard.upper + 1);
+    }
+    if (next <= _key_space.upper)
+        free.push_back({next, _key_space.upper});
+
+    // every server gets keys / n keys, and the ones that hold the most
+    // one more, so that the fewest keys move
+    vector<string> by_size = _server_list;
+    stable_sort(by_size.begin(), by_size.end(), [this](const string& a, const string& b) {
+        return shardRangeSize(_servers[a]) > shardRangeSize(_servers[b]);
+    });
+    size_t keys = size(_key_space);
+    unordered_map<string, size_t> quota;
+    for (size_t i = 0; i < by_size.size(); i++)
+        quota[by_size[i]] = keys / by_size.size() + (i < keys % by_size.size() ? 1 : 0);
+
+    // servers over their quota give up the keys at the end of their ranges
+    for (const auto& server : _server_list) {
+        vector<shard_t>& shards = _servers[server];
+        sortAscendingInterval(shards);
+        size_t held_keys = shardRangeSize(shards);
+        size_t excess = held_keys > quota[server] ? held_keys - quota[server] : 0;
+        while (excess > 0) {
+            shard_t& last = shards.back();
+            if (size(last) <= excess) {
+                excess -= size(last);
+                free.push_back(last);
+                shards.pop_back();
+            } else {
+                pair<shard_t, shard_t> halves = split_shard_at(last, last.upper - excess);
+                free.push_back(halves.second);
+                last = halves.first;
+                excess = 0;
+            }
+        }
+    }
+
+    // and servers under it take the free keys in order, so that what they
+    // get stays in as few ranges as possible
+    sortAscendingInterval(free);
+    size_t f = 0;
+    for (const auto& server : _server_list) {
+        vector<shard_t>& shards = _servers[server];
+        size_t held_keys = shardRangeSize(shards);
+        size_t missing = held_keys < quota[server] ? quota[server] - held_keys : 0;
+        while (missing > 0) {
+            shard_t& first = free[f];
+            if (size(first) <= missing) {
+                missing -= size(first);
+                shards.push_back(first);
+                f++;
+            } else {
+                pair<shard_t, shard_t> halves = split_shard_at(first, first.lower + missing - 1);
+                shards.push_back(halves.first);
+                first = halves.second;
+                missing = 0;
+            }
+        }
+        // neighbouring ranges of a server are one shard
+        sortAscendingInterval(shards);
+        vector<shard_t> merged;
+        for (const auto& shard : shards) {
+            if (!merged.empty() && merged.back().upper + 1 == shard.lower)
+                merged.back().upper = shard.upper;
+            else
+                merged.push_back(shard);
+        }
+        shards = move(merged);
+    }
+}
+
+void StaticShardmaster::_balance() {
+    // the load of every shard of the current configuration, over the servers
+    // of its group that reported it, and where the busiest one would split it
+    auto now = chrono::steady_clock::now();
+    map<pair<uint64_t, uint64_t>, shard_load_t> loads;
+    map<pair<uint64_t, uint64_t>, double> busiest;
+    for (const auto& [reporter, report] : _reports) {
+        if (report.version != _version || now - report.received > REPORT_TTL)
+            continue;
+        for (const auto& l : report.shards) {
+            pair<uint64_t, uint64_t> bounds{l.shard.lower, l.shard.upper};
+            auto [it, inserted] = loads.try_emplace(bounds, l);
+            if (!inserted)
+                it->second.rate += l.rate;
+            if (l.rate >= busiest[bounds])
+                it->second.split = l.split;
+            busiest[bounds] = max(busiest[bounds], l.rate);
+        }
+    }
+
+    // a shard must stay hot (or cold) for a few rounds in a row before
+    // anything is done about it. a shard nobody reported on is neither, which
+    // is the case of every shard for a round or two after any change
+    map<pair<uint64_t, uint64_t>, int> streaks;
+    unordered_map<string, double> server_load;
+    vector<pair<string, shard_load_t>> hot;
+    for (const auto& server : _server_list) {
+        server_load[server] = 0;
+        for (const auto& shard : _servers[server]) {
+            pair<uint64_t, uint64_t> bounds{shard.lower, shard.upper};
+            auto it = loads.find(bounds);
+            if (it == loads.end())
+                continue;
+            double rate = it->second.rate;
+            server_load[server] += rate;
+            int streak = _streaks.count(bounds) ? _streaks[bounds] : 0;
+            if (rate > HOT_THRESH && shard.lower < shard.upper)
+                streak = max(streak, 0) + 1;
+            else if (rate < COLD_THRESH)
+                streak = min(streak, 0) - 1;
+            else
+                streak = 0;
+            streaks[bounds] = streak;
+            if (streak >= HOT_ROUNDS)
+                hot.push_back({server, it->second});
+        }
+    }
+    _streaks = move(streaks);
+
+    layout_t before = _layout();
+    bool changed = false;
+    // split every hot shard where its load is halved and give one of the
+    // halves to the least busy server, if that leaves the busiest of the two
+    // less busy than we are now. there is no point in splitting it otherwise
+    for (const auto& [server, load] : hot) {
+        string target = *min_element(_server_list.begin(), _server_list.end(),
+                                     [&](const string& a, const string& b) { return server_load[a] < server_load[b]; });
+        double half = load.rate / 2;
+        if (target == server || server_load[target] + half >= server_load[server])
+            continue;
+        shard_t shard = load.shard;
+        uint64_t split = load.split >= shard.lower && load.split < shard.upper
+                             ? load.split : split_shard(shard).first.upper;
+        pair<shard_t, shard_t> halves = split_shard_at(shard, split);
+        vector<shard_t>& shards = _servers[server];
+        *find(shards.begin(), shards.end(), shard) = halves.first;
+        _servers[target].push_back(halves.second);
+        sortAscendingInterval(_servers[target]);
+        server_load[target] += half;
+        server_load[server] -= half;
+        LOG(INFO)<<"Split hot shard "<<shard<<" ("<<load.rate<<" requests/s) at "<<split
+            <<", moving "<<halves.second<<" to "<<target;
+        changed = true;
+    }
+
+    // merge neighbouring shards of a server that have been cold for long
+    // enough, as long as what they make up together is still cold
+    for (const auto& server : _server_list) {
+        vector<shard_t>& shards = _servers[server];
+        vector<shard_t> merged;
+        // load of merged.back(), if it is cold enough to merge
+        optional<double> last_cold;
+        for (auto shard : shards) {
+            pair<uint64_t, uint64_t> bounds{shard.lower, shard.upper};
+            optional<double> cold;
+            if (_streaks.count(bounds) && _streaks[bounds] <= -COLD_ROUNDS)
+                cold = loads[bounds].rate;
+            if (last_cold && cold && merged.back().upper + 1 == shard.lower
+                    && *last_cold + *cold < COLD_THRESH) {
+                LOG(INFO)<<"Merged cold shards "<<merged.back()<<" and "<<shard<<" of "<<server;
+                merged.back().upper = shard.upper;
+                *last_cold += *cold;
+                changed = true;
+                continue;
+            }
+            merged.push_back(shard);
+            last_cold = cold;
+        }
+        shards = move(merged);
+    }
+
+    if (changed)
+        _config_changed(before);
+}
+
+StaticShardmaster::layout_t StaticShardmaster::_layout() {
+    layout_t layout;
+    if (_placement == Placement::HASH) {
+        layout.ring = _server_list;
+        return layout;
+    }
+    for (const auto& server : _server_list)
+        for (const auto& shard : _servers[server])
+            layout.shards.push_back({shard, server});
+    sort(layout.shards.begin(), layout.shards.end(),
+         [](const auto& a, const auto& b) { return a.first.lower < b.first.lower; });
+    return layout;
+}
+
+uint64_t StaticShardmaster::_moved_between(const layout_t& before, const layout_t& after) {
+    uint64_t moved = 0;
+    if (_placement == Placement::RANGE) {
+        // the shards of both, side by side: every pair that overlaps is a
+        // range of keys that moved if their servers differ
+        size_t i = 0, j = 0;
+        while (i < before.shards.size() && j < after.shards.size()) {
+            const auto& [b, b_server] = before.shards[i];
+            const auto& [a, a_server] = after.shards[j];
+            uint64_t lower = max(b.lower, a.lower), upper = min(b.upper, a.upper);
+            if (lower <= upper && b_server != a_server)
+                moved += upper - lower + 1;
+            if (b.upper < a.upper)
+                i++;
+            else
+                j++;
+        }
+        return moved;
+    }
+
+    HashRing b, a;
+    b.Build(before.ring, _vnodes);
+    a.Build(after.ring, _vnodes);
+    if (b.Empty() || a.Empty())
+        return 0;
+    if (size(_key_space) <= EXACT_MOVED_KEYS) {
+        for (uint64_t key = _key_space.lower; key <= _key_space.upper; key++) {
+            if (before.ring[b.OwnerOf(key)] != after.ring[a.OwnerOf(key)])
+                moved++;
+        }
+        return moved;
+    }
+    // the points of both rings cut it in arcs (p, q] that a single server
+    // holds in either. the keys that moved are about as many as the share
+    // of the ring taken by the arcs whose server changed
+    vector<uint64_t> points = b.Points();
+    points.insert(points.end(), a.Points().begin(), a.Points().end());
+    sort(points.begin(), points.end());
+    points.erase(unique(points.begin(), points.end()), points.end());
+    const long double ring = 0x1p64L;
+    long double changed = 0;
+    for (size_t i = 0; i < points.size(); i++) {
+        uint64_t q = points[i];
+        if (before.ring[b.OwnerOfHash(q)] == after.ring[a.OwnerOfHash(q)])
+            continue;
+        // the first arc wraps around from the last point
+        uint64_t p = points[i == 0 ? points.size() - 1 : i - 1];
+        changed += points.size() == 1 ? ring : (long double)(q - p);
+    }
+    return changed / ring * size(_key_space);
+}
+
+void StaticShardmaster::_config_changed(const layout_t& before) {
+    _moved_keys = _moved_between(before, _layout());
+    _version++;
+    _metrics.Add(_c.configs);
+    _metrics.Add(_c.keys_moved, _moved_keys);
+    _changed.notify_all();
+}
+
+void StaticShardmaster::_fill_config(::QueryResponse* response) {
+    response->clear_config();
+    response->set_version(_version);
+    response->set_epoch(_epoch);
+    response->set_moved_keys(_moved_keys);
+    response->set_placement(_placement == Placement::HASH ? PLACEMENT_HASH : PLACEMENT_RANGE);
+    response->set_vnodes(_placement == Placement::HASH ? _vnodes : 0);
+    response->mutable_key_space()->set_lower(_key_space.lower);
+    response->mutable_key_space()->set_upper(_key_space.upper);
+    for (const auto& server : _server_list) {
+        ConfigEntry* entry = response->add_config();
+        entry->set_server(server);
+        for (const auto& shard : _servers[server]) {
+            Shard* response_shard = entry->add_shards();
+            response_shard->set_lower(shard.lower);
+            response_shard->set_upper(shard.upper);
+        }
+    }
+}
+
 /**
  * Based on the server specified in JoinRequest, you should update the
  * shardmaster's internal representation that this server has joined. Remember,
@@ -33,18 +358,21 @@ void StaticShardmaster::_reassign_shards() {
 ::grpc::Status StaticShardmaster::Join(::grpc::ServerContext* context,
                                        const ::JoinRequest* request,
                                        Empty* response) {
+    Metrics::Timer timer(&_metrics, _h.join);
     string server = request->server();
     lock_guard<mutex> lock(*_mutex);
     if (_servers.find(server) != _servers.end()) {
         return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "Server already exists");
     }
-    if (_servers.size() == NUM_SHARDS) {
+    if (_servers.size() == size(_key_space)) {
         return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "No shards left to give");
     }
     
+    layout_t before = _layout();
     _server_list.push_back(server);
     _servers[server] = vector<shard_t>();
     _reassign_shards();
+    _config_changed(before);
     return ::grpc::Status::OK;
 }
 
@@ -67,16 +395,23 @@ void StaticShardmaster::_reassign_shards() {
 ::grpc::Status StaticShardmaster::Leave(::grpc::ServerContext* context,
                                         const ::LeaveRequest* request,
                                         Empty* response) {
+    Metrics::Timer timer(&_metrics, _h.leave);
     lock_guard<mutex> lock(*_mutex);
+    // a request naming an unknown server changes nothing
     for (const auto& server : request->servers()) {
         if (_servers.find(server) == _servers.end()) {
             return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "Server does not exist");
         }
+    }
+
+    layout_t before = _layout();
+    for (const auto& server : request->servers()) {
         _servers.erase(server);
         _server_list.erase(remove(_server_list.begin(), _server_list.end(), server), _server_list.end());
     }
 
     _reassign_shards();
+    _config_changed(before);
 
     return ::grpc::Status::OK;
 }
@@ -99,15 +434,20 @@ void StaticShardmaster::_reassign_shards() {
 ::grpc::Status StaticShardmaster::Move(::grpc::ServerContext* context,
                                        const ::MoveRequest* request,
                                        Empty* response) {
+    Metrics::Timer timer(&_metrics, _h.move);
     // Hint: Take a look at get_overlap in common.{h, cc}
     // Using the function will save you lots of time and effort!
     const string& target_server = request->server();
     const shard_t shard{request->shard().lower(), request->shard().upper()};
+    if (_placement == Placement::HASH) {
+        return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "Keys are placed by hash, there are no shards to move");
+    }
     lock_guard<mutex> lock(*_mutex);
     if (_servers.find(target_server) == _servers.end()) {
         return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "Server does not exist");
     }
 
+    layout_t before = _layout();
     for (const auto& server : _server_list) {
         vector<shard_t>& shards = _servers[server];
         vector<shard_t> new_shards;
@@ -139,6 +479,7 @@ void StaticShardmaster::_reassign_shards() {
     }
     _servers[target_server].push_back(shard);
     sortAscendingInterval(_servers[target_server]);
+    _config_changed(before);
 
     return ::grpc::Status::OK;
 }
@@ -160,16 +501,133 @@ void StaticShardmaster::_reassign_shards() {
 ::grpc::Status StaticShardmaster::Query(::grpc::ServerContext* context,
                                         const StaticShardmaster::Empty* request,
                                         ::QueryResponse* response) {
+    Metrics::Timer timer(&_metrics, _h.query);
     lock_guard<mutex> lock(*_mutex);
-    for (const auto& server : _server_list) {
-        ConfigEntry* entry = response->add_config();
-        entry->set_server(server);
-        for (const auto& shard : _servers[server]) {
-            Shard* response_shard = entry->add_shards();
-            response_shard->set_lower(shard.lower);
-            response_shard->set_upper(shard.upper);
+    _fill_config(response);
+    return ::grpc::Status::OK;
+}
+
+/**
+ * Takes the load a key-value server saw on the shards of its group since its
+ * last report. Only the latest report of every server is kept, and it only
+ * counts while it is recent and about the current configuration.
+ *
+ * @param context - you can ignore this
+ * @param request the server, the configuration version it holds and the
+ * load of every shard of its group
+ * @param response An empty message, as we don't need to return any data
+ * @return ::grpc::Status::OK
+ */
+::grpc::Status StaticShardmaster::ReportLoad(::grpc::ServerContext* context,
+                                             const ::LoadReport* request,
+                                             Empty* response) {
+    Metrics::Timer timer(&_metrics, _h.report_load);
+    report_t report{request->version(), chrono::steady_clock::now(), {}};
+    for (const auto& l : request->shards())
+        report.shards.push_back({{l.shard().lower(), l.shard().upper()}, l.rate(), l.split()});
+    lock_guard<mutex> lock(*_mutex);
+    _reports[request->server()] = move(report);
+    return ::grpc::Status::OK;
+}
+
+/**
+ * Streams the configuration to the caller every time it changes, starting
+ * with the current one if it is newer than request->from_version(), or if
+ * that is a version of another epoch (a shardmaster that ran before). Servers
+ * and clients keep one of these open instead of calling Query periodically,
+ * so nothing is sent (or rebuilt on their side) while nothing changes.
+ *
+ * @param context - used to notice when the caller goes away
+ * @param request the last version the caller has seen (0 for none), and its
+ * epoch
+ * @param writer where every new configuration is sent, as a QueryResponse
+ * @return ::grpc::Status::OK once the caller goes away
+ */
+::grpc::Status StaticShardmaster::Watch(::grpc::ServerContext* context,
+                                        const ::WatchRequest* request,
+                                        ::grpc::ServerWriter<::QueryResponse>* writer) {
+    uint64_t seen = request->from_version();
+    // the version the caller saw means nothing if it is from another epoch
+    bool stale = request->epoch() != _epoch;
+    QueryResponse response;
+    while (!context->IsCancelled()) {
+        {
+            unique_lock<mutex> lock(*_mutex);
+            // wake up now and then to notice callers that went away
+            if (!_changed.wait_for(lock, chrono::seconds(1), [&]() { return stale || _version > seen; }))
+                continue;
+            _fill_config(&response);
+            seen = _version;
+            stale = false;
         }
+        if (!writer->Write(response))
+            break;
+        _metrics.Add(_c.watch_updates);
     }
-    
     return ::grpc::Status::OK;
 }
+
+/**
+ * The latency histograms and counters of the shardmaster (see Metrics),
+ * summed over every thread at the time of the call.
+ *
+ * @param context - you can ignore this
+ * @param request An empty message
+ * @param response the quantiles of every histogram, every counter, and all
+ * of it in the Prometheus text format
+ * @return ::grpc::Status::OK
+ */
+::grpc::Status StaticShardmaster::Stats(::grpc::ServerContext* context, const ::StatsRequest* request,
+                                        ::StatsResponse* response) {
+    _metrics.Fill(response);
+    response->set_prometheus(_metrics.Prometheus());
+    return ::grpc::Status::OK;
+}
+
+::grpc::ServerUnaryReactor* ShardmasterCallbackService::Join(::grpc::CallbackServerContext* context,
+                                                             const ::JoinRequest* request, Empty* response) {
+    auto* reactor = context->DefaultReactor();
+    reactor->Finish(_shardmaster->Join(nullptr, request, response));
+    return reactor;
+}
+
+::grpc::ServerUnaryReactor* ShardmasterCallbackService::Leave(::grpc::CallbackServerContext* context,
+                                                              const ::LeaveRequest* request, Empty* response) {
+    auto* reactor = context->DefaultReactor();
+    reactor->Finish(_shardmaster->Leave(nullptr, request, response));
+    return reactor;
+}
+
+::grpc::ServerUnaryReactor* ShardmasterCallbackService::Move(::grpc::CallbackServerContext* context,
+                                                             const ::MoveRequest* request, Empty* response) {
+    auto* reactor = context->DefaultReactor();
+    reactor->Finish(_shardmaster->Move(nullptr, request, response));
+    return reactor;
+}
+
+::grpc::ServerUnaryReactor* ShardmasterCallbackService::Query(::grpc::CallbackServerContext* context,
+                                                              const Empty* request, ::QueryResponse* response) {
+    auto* reactor = context->DefaultReactor();
+    reactor->Finish(_shardmaster->Query(nullptr, request, response));
+    return reactor;
+}
+
+::grpc::ServerUnaryReactor* ShardmasterCallbackService::ReportLoad(::grpc::CallbackServerContext* context,
+                                                                   const ::LoadReport* request, Empty* response) {
+    auto* reactor = context->DefaultReactor();
+    reactor->Finish(_shardmaster->ReportLoad(nullptr, request, response));
+    return reactor;
+}
+
+::grpc::ServerUnaryReactor* ShardmasterCallbackService::Stats(::grpc::CallbackServerContext* context,
+                                                              const ::StatsRequest* request,
+                                                              ::StatsResponse* response) {
+    auto* reactor = context->DefaultReactor();
+    reactor->Finish(_shardmaster->Stats(nullptr, request, response));
+    return reactor;
+}
+
+::grpc::Status ShardmasterCallbackService::Watch(::grpc::ServerContext* context, const ::WatchRequest* request,
+                                                 ::grpc::ServerWriter<::QueryResponse>* writer) {
+    return _shardmaster->Watch(context, request, writer);
+}
@@ -2,14 +2,67 @@
 #define SHARDING_SHARDMASTER_H
 
 #include "../common/common.h"
+#include "../common/hash_ring.h"
+#include "../common/log.h"
+#include "../common/metrics.h"
 
 #include <grpcpp/grpcpp.h>
+#include <chrono>
+#include <map>
 #include <unordered_map>
 #include <string>
 #include <vector>
 #include <mutex>
+#include <condition_variable>
 #include "../build/shardmaster.grpc.pb.h"
 
+// how often the shardmaster balances the load, when it does
+constexpr std::chrono::seconds BALANCE_INTERVAL(1);
+// load reports older than this are ignored
+constexpr std::chrono::seconds REPORT_TTL(3);
+// balancing rounds in a row a shard has to be hot before it is split, or
+// cold before it is merged with a neighbour
+constexpr int HOT_ROUNDS = 3;
+constexpr int COLD_ROUNDS = 5;
+
+// how Join and Leave hand out the key space
+enum class RebalanceMode {
+  // every server gets an even slice of it, cut again from scratch: nearly
+  // every key changes server
+  EVEN,
+  // servers keep what they hold, and only the keys needed to even them out
+  // move: slices of every server to one that joins, the ranges of one that
+  // leaves to the others
+  MINIMAL
+};
+
+// how keys are placed on the servers
+enum class Placement {
+  // servers hold shards, ranges of ids
+  RANGE,
+  // ids are placed by consistent hashing (see HashRing): Join and Leave only
+  // change the servers on the ring, and there are no shards to Move
+  HASH
+};
+
+// keys up to which the moved_keys of a configuration are counted one by one
+// with Placement::HASH. over more keys, they are estimated from the share of
+// the ring that changed server
+constexpr uint64_t EXACT_MOVED_KEYS = 1 << 20;
+
+typedef struct shardmaster_options {
+  // split, merge and move shards according to the load the key-value servers
+  // report, on top of the split Join and Leave make and whatever Move asks for
+  bool auto_balance = false;
+  RebalanceMode rebalance = RebalanceMode::EVEN;
+  Placement placement = Placement::RANGE;
+  // points every server gets on the ring with Placement::HASH, which
+  // auto_balance and rebalance do not apply to
+  uint32_t vnodes = DEFAULT_VNODES;
+  // the ids to place on the servers. upper must be below UINT64_MAX
+  shard_t key_space{MIN_KEY, MAX_KEY};
+} shardmaster_options_t;
+
 class StaticShardmaster : public Shardmaster::Service {
   using Empty = google::protobuf::Empty;
 
@@ -23,8 +76,19 @@ public:
                       const ::MoveRequest *request, Empty *response) override;
   ::grpc::Status Query(::grpc::ServerContext *context, const Empty *request,
                        ::QueryResponse *response) override;
+  ::grpc::Status Watch(::grpc::ServerContext *context,
+                       const ::WatchRequest *request,
+                       ::grpc::ServerWriter<::QueryResponse> *writer) override;
+  ::grpc::Status ReportLoad(::grpc::ServerContext *context,
+                            const ::LoadReport *request, Empty *response) override;
+  ::grpc::Status Stats(::grpc::ServerContext *context,
+                       const ::StatsRequest *request,
+                       ::StatsResponse *response) override;
 
-  StaticShardmaster();
+  explicit StaticShardmaster(const shardmaster_options_t& options = {});
+
+  // what Stats reports, for ServeMetrics
+  const Metrics& GetMetrics() const { return _metrics; }
 
 private:
   // TODO add any fields you want here!
@@ -34,11 +98,93 @@ private:
   std::unique_ptr<std::mutex> _mutex;
   std::unordered_map<std::string, std::vector<shard_t>> _servers;
   std::vector<std::string> _server_list;
+  // when we started, in microseconds since the Unix epoch: a restarted
+  // shardmaster counts _version from 0 again, under a new epoch
+  const uint64_t _epoch;
+  // bumped (under _mutex) on every change of the configuration
+  uint64_t _version;
+  // signalled whenever _version is bumped
+  std::condition_variable _changed;
+  // keys the change to _version gave to another server
+  uint64_t _moved_keys;
+  const RebalanceMode _rebalance;
+  const Placement _placement;
+  const uint32_t _vnodes;
+  const shard_t _key_space;
+
+  // the last load report of every key-value server
+  typedef struct report {
+    uint64_t version;
+    std::chrono::steady_clock::time_point received;
+    std::vector<shard_load_t> shards;
+  } report_t;
+  std::unordered_map<std::string, report_t> _reports;
+  // balancing rounds in a row every shard has been hot (> 0) or cold (< 0)
+  // for, by {lower, upper}
+  std::map<std::pair<uint64_t, uint64_t>, int> _streaks;
+  // latency of every RPC (Watch streams excepted) and balancing round
+  Metrics _metrics;
+  // what we record in _metrics, registered by the constructor
+  struct {
+    size_t join, leave, move, query, report_load, balance;
+  } _h;
+  struct {
+    size_t configs, keys_moved, watch_updates;
+  } _c;
 
   void _reassign_shards();
-  
-  static const shard_t ALL_KEYS_SHARD;
-  static const size_t NUM_SHARDS;
+  // RebalanceMode::MINIMAL of _reassign_shards
+  void _reassign_minimal();
+  // one round of load balancing. must be called with _mutex held
+  void _balance();
+  // who holds the keys: every shard and its server, by lower bound, or the
+  // servers on the ring with Placement::HASH
+  typedef struct layout {
+    std::vector<std::pair<shard_t, std::string>> shards;
+    std::vector<std::string> ring;
+  } layout_t;
+  layout_t _layout();
+  // keys held in both layouts, by different servers
+  uint64_t _moved_between(const layout_t& before, const layout_t& after);
+  // must be called with _mutex held. before is what _layout returned
+  // before the change
+  void _config_changed(const layout_t& before);
+  void _fill_config(::QueryResponse *response);
+};
+
+// The RPCs of a StaticShardmaster for ServerMode::CALLBACK. The unary ones
+// only take the lock of the shardmaster and return, and are answered inline;
+// Watch is a stream, and keeps a thread of the synchronous part per watcher.
+class ShardmasterCallbackService
+    : public Shardmaster::WithCallbackMethod_Join<Shardmaster::WithCallbackMethod_Leave<
+          Shardmaster::WithCallbackMethod_Move<Shardmaster::WithCallbackMethod_Query<
+              Shardmaster::WithCallbackMethod_ReportLoad<Shardmaster::WithCallbackMethod_Stats<
+                  Shardmaster::Service>>>>>> {
+  using Empty = google::protobuf::Empty;
+
+public:
+  explicit ShardmasterCallbackService(StaticShardmaster *shardmaster) : _shardmaster(shardmaster) {}
+
+  ::grpc::ServerUnaryReactor *Join(::grpc::CallbackServerContext *context,
+                                   const ::JoinRequest *request, Empty *response) override;
+  ::grpc::ServerUnaryReactor *Leave(::grpc::CallbackServerContext *context,
+                                    const ::LeaveRequest *request, Empty *response) override;
+  ::grpc::ServerUnaryReactor *Move(::grpc::CallbackServerContext *context,
+                                   const ::MoveRequest *request, Empty *response) override;
+  ::grpc::ServerUnaryReactor *Query(::grpc::CallbackServerContext *context, const Empty *request,
+                                    ::QueryResponse *response) override;
+  ::grpc::ServerUnaryReactor *ReportLoad(::grpc::CallbackServerContext *context,
+                                         const ::LoadReport *request, Empty *response) override;
+  ::grpc::ServerUnaryReactor *Stats(::grpc::CallbackServerContext *context,
+                                    const ::StatsRequest *request,
+                                    ::StatsResponse *response) override;
+
+  ::grpc::Status Watch(::grpc::ServerContext *context,
+                       const ::WatchRequest *request,
+                       ::grpc::ServerWriter<::QueryResponse> *writer) override;
+
+private:
+  StaticShardmaster *_shardmaster;
 };
 
 #endif // SHARDING_SHARDMASTER_H
@@ -6,6 +6,7 @@
 #include "../shardkv/shardkv.h"
 #include "../shardmaster/shardmaster.h"
 #include "../shardkv_manager/shardkv_manager.h"
+#include "../common/channel_pool.h"
 #include "test_utils.h"
 
 using Empty = google::protobuf::Empty;
@@ -50,7 +51,8 @@ std::vector<pid_t> start_shardkvs_proc(const Addrs& addrs,
 }
 
 pid_t start_shardkv_proc(const std::string& addr,
-                         const std::string& shardmaster_addr) {
+                         const std::string& shardmaster_addr,
+                         const std::vector<std::string>& flags) {
   pid_t pid = fork();
   assert(pid != -1);
   if (!pid) {
@@ -68,20 +70,24 @@ pid_t start_shardkv_proc(const std::string& addr,
     args.push_back(const_cast<char*>(tokens[1].c_str()));
     args.push_back(const_cast<char*>(sm_tokens[0].c_str()));
     args.push_back(const_cast<char*>(sm_tokens[1].c_str()));
+    for (const auto& flag : flags) {
+      args.push_back(const_cast<char*>(flag.c_str()));
+    }
     args.push_back(0);
     execv("./shardkv", args.data());
   }
   return pid;
 }
 
-void start_shardmaster(const std::string& addr) {
-  spawn_service_in_thread<StaticShardmaster>(addr);
+void start_shardmaster(const std::string& addr,
+                       const shardmaster_options_t& options) {
+  spawn_service_in_thread<StaticShardmaster, shardmaster_options_t>(
+      addr, shardmaster_options_t(options));
 }
 
 bool test_get_impl(const std::string& addr, std::string key,
                    const std::optional<std::string>& value) {
-  auto channel = grpc::CreateChannel(addr, grpc::InsecureChannelCredentials());
-  auto stub = Shardkv::NewStub(channel);
+  auto stub = ChannelPool::Shared().Stub<Shardkv>(addr);
 
   ::grpc::ClientContext cc;
   GetRequest req;
@@ -123,8 +129,7 @@ bool test_get(const std::string& addr, std::string key,
 
 bool test_put(const std::string& addr, std::string key,
               const std::string& value, std::string user, bool success) {
-  auto channel = grpc::CreateChannel(addr, grpc::InsecureChannelCredentials());
-  auto stub = Shardkv::NewStub(channel);
+  auto stub = ChannelPool::Shared().Stub<Shardkv>(addr);
 
   ::grpc::ClientContext cc;
   PutRequest req;
@@ -139,8 +144,7 @@ bool test_put(const std::string& addr, std::string key,
 
 bool test_append(const std::string& addr, std::string key,
                  const std::string& value, bool success) {
-  auto channel = grpc::CreateChannel(addr, grpc::InsecureChannelCredentials());
-  auto stub = Shardkv::NewStub(channel);
+  auto stub = ChannelPool::Shared().Stub<Shardkv>(addr);
 
   ::grpc::ClientContext cc;
   AppendRequest req;
@@ -154,8 +158,7 @@ bool test_append(const std::string& addr, std::string key,
 
 bool test_delete(const std::string& addr, std::string key,
                  bool success) {
-  auto channel = grpc::CreateChannel(addr, grpc::InsecureChannelCredentials());
-  auto stub = Shardkv::NewStub(channel);
+  auto stub = ChannelPool::Shared().Stub<Shardkv>(addr);
 
   ::grpc::ClientContext cc;
   DeleteRequest req;
@@ -166,13 +169,68 @@ bool test_delete(const std::string& addr, std::string key,
   return status.ok() == success;
 }
 
+bool test_multi_put(const std::string& addr,
+                    const std::vector<std::vector<std::string>>& puts,
+                    bool success) {
+  auto stub = ChannelPool::Shared().Stub<Shardkv>(addr);
+
+  ::grpc::ClientContext cc;
+  MultiPutRequest req;
+  Empty res;
+  for (const auto& p : puts) {
+    PutRequest* put = req.add_puts();
+    put->set_key(p[0]);
+    put->set_data(p[1]);
+    put->set_user(p[2]);
+  }
+
+  auto status = stub->MultiPut(&cc, req, &res);
+  return status.ok() == success;
+}
+
+bool test_multi_get(const std::string& addr,
+                    const std::vector<std::string>& keys,
+                    const std::vector<std::optional<std::string>>& values) {
+  auto stub = ChannelPool::Shared().Stub<Shardkv>(addr);
+
+  ::grpc::ClientContext cc;
+  MultiGetRequest req;
+  MultiGetResponse res;
+  for (const auto& key : keys) req.add_keys(key);
+
+  auto status = stub->MultiGet(&cc, req, &res);
+  if (!status.ok() || res.values_size() != (int)keys.size() ||
+      res.found_size() != (int)keys.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < keys.size(); i++) {
+    std::optional<std::string> value;
+    if (res.found(i)) value = res.values(i);
+    if (value != values[i]) return false;
+  }
+  return true;
+}
+
+bool test_multi_delete(const std::string& addr,
+                       const std::vector<std::string>& keys,
+                       const std::optional<uint32_t>& deleted) {
+  auto stub = ChannelPool::Shared().Stub<Shardkv>(addr);
+
+  ::grpc::ClientContext cc;
+  MultiDeleteRequest req;
+  MultiDeleteResponse res;
+  for (const auto& key : keys) req.add_keys(key);
+
+  auto status = stub->MultiDelete(&cc, req, &res);
+  if (!deleted.has_value()) return !status.ok();
+  return status.ok() && res.deleted() == deleted.value();
+}
+
 // testing functions for shardmaster - for join/leave/move we will have to call
 // query anyway so maybe bundle them?
 bool test_join(const std::string& shardmaster_addr, const std::string& addr,
                bool success) {
-  auto channel =
-      grpc::CreateChannel(shardmaster_addr, grpc::InsecureChannelCredentials());
-  auto stub = Shardmaster::NewStub(channel);
+  auto stub = ChannelPool::Shared().Stub<Shardmaster>(shardmaster_addr);
 
   ::grpc::ClientContext cc;
   JoinRequest req;
@@ -186,9 +244,7 @@ bool test_join(const std::string& shardmaster_addr, const std::string& addr,
 
 bool test_leave(const std::string& shardmaster_addr, const Addrs& addrs,
                 bool success) {
-  auto channel =
-      grpc::CreateChannel(shardmaster_addr, grpc::InsecureChannelCredentials());
-  auto stub = Shardmaster::NewStub(channel);
+  auto stub = ChannelPool::Shared().Stub<Shardmaster>(shardmaster_addr);
 
   ::grpc::ClientContext cc;
   LeaveRequest req;
@@ -203,9 +259,7 @@ bool test_leave(const std::string& shardmaster_addr, const Addrs& addrs,
 
 bool test_move(const std::string& shardmaster_addr, const std::string& addr,
                const shard_t& shard, bool success) {
-  auto channel =
-      grpc::CreateChannel(shardmaster_addr, grpc::InsecureChannelCredentials());
-  auto stub = Shardmaster::NewStub(channel);
+  auto stub = ChannelPool::Shared().Stub<Shardmaster>(shardmaster_addr);
 
   ::grpc::ClientContext cc;
   MoveRequest req;
@@ -219,11 +273,10 @@ bool test_move(const std::string& shardmaster_addr, const std::string& addr,
   return status.ok() == success;
 }
 
-bool test_query(const std::string& shardmaster_addr,
-                const std::map<std::string, std::vector<shard_t>>& m) {
-  auto channel =
-      grpc::CreateChannel(shardmaster_addr, grpc::InsecureChannelCredentials());
-  auto stub = Shardmaster::NewStub(channel);
+bool test_query_impl(const std::string& shardmaster_addr,
+                     const std::map<std::string, std::vector<shard_t>>& m,
+                     const std::optional<uint64_t>& moved_keys) {
+  auto stub = ChannelPool::Shared().Stub<Shardmaster>(shardmaster_addr);
 
   ::grpc::ClientContext cc;
   Empty req;
@@ -233,6 +286,9 @@ bool test_query(const std::string& shardmaster_addr,
   if (!status.ok()) {
     return false;
   }
+  if (moved_keys.has_value() && response.moved_keys() != moved_keys.value()) {
+    return false;
+  }
 
   // read response into a map then check if it's equal to what we expect (m)
   std::map<std::string, std::vector<shard_t>> res_map;
@@ -277,10 +333,19 @@ bool test_query(const std::string& shardmaster_addr,
   return true;
 }
 
+bool test_query(const std::string& shardmaster_addr,
+                const std::map<std::string, std::vector<shard_t>>& m) {
+  return test_query_impl(shardmaster_addr, m, std::nullopt);
+}
+
+bool test_query(const std::string& shardmaster_addr,
+                const std::map<std::string, std::vector<shard_t>>& m,
+                uint64_t moved_keys) {
+  return test_query_impl(shardmaster_addr, m, moved_keys);
+}
+
 bool test_gdpr_delete(const std::string& shardmaster_addr, std::string user, bool success){
-    auto channel =
-      grpc::CreateChannel(shardmaster_addr, grpc::InsecureChannelCredentials());
-    auto stub = Shardmaster::NewStub(channel);
+    auto stub = ChannelPool::Shared().Stub<Shardmaster>(shardmaster_addr);
 
     ::grpc::ClientContext cc;
     GDPRDeleteRequest req;
@@ -10,6 +10,7 @@
 #include <thread>
 #include <vector>
 #include "../common/common.h"
+#include "../shardmaster/shardmaster.h"
 
 using Addrs = std::vector<std::string>;
 
@@ -65,10 +66,13 @@ std::vector<pid_t> start_shardkvs_proc(const Addrs& addrs,
 void start_shardkv(const std::string& addr,
                    const std::string& shardmaster_addr);
 
+// flags are passed on to the shardkv binary (e.g. --data-dir=...)
 pid_t start_shardkv_proc(const std::string& addr,
-                         const std::string& shardmaster_addr);
+                         const std::string& shardmaster_addr,
+                         const std::vector<std::string>& flags = {});
 
-void start_shardmaster(const std::string& addr);
+void start_shardmaster(const std::string& addr,
+                       const shardmaster_options_t& options = {});
 
 void start_shardmanager(const std::string& addr, const std::string& shardmaster_addr);
 
@@ -85,6 +89,22 @@ bool test_append(const std::string& addr, std::string key,
 bool test_delete(const std::string& addr, std::string key,
                  bool success);
 
+// puts is a list of {key, value, user}
+bool test_multi_put(const std::string& addr,
+                    const std::vector<std::vector<std::string>>& puts,
+                    bool success);
+
+// values[i] is the value expected for keys[i], nullopt if it should be missing
+bool test_multi_get(const std::string& addr,
+                    const std::vector<std::string>& keys,
+                    const std::vector<std::optional<std::string>>& values);
+
+// deleted is the number of keys expected to be deleted, nullopt if the
+// request should fail
+bool test_multi_delete(const std::string& addr,
+                       const std::vector<std::string>& keys,
+                       const std::optional<uint32_t>& deleted);
+
 // testing functions for shardmaster
 bool test_join(const std::string& shardmaster_addr, const std::string& addr,
                bool success);
@@ -98,6 +118,11 @@ bool test_move(const std::string& shardmaster_addr, const std::string& addr,
 bool test_query(const std::string& shardmaster_addr,
                 const std::map<std::string, std::vector<shard_t>>& m);
 
+// like test_query, and the last change also moved moved_keys keys
+bool test_query(const std::string& shardmaster_addr,
+                const std::map<std::string, std::vector<shard_t>>& m,
+                uint64_t moved_keys);
+
 bool test_gdpr_delete(const std::string& shardmaster_addr, std::string user,
                bool success);
 
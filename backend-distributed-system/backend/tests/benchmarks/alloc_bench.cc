@@ -0,0 +1,161 @@
+#include <malloc.h>
+#include <unistd.h>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../../common/channel_pool.h"
+#include "../../shardkv/shardkv.h"
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+// Heap allocations made for every Get, Put and MultiGet, with small and
+// large values. malloc, calloc and realloc are replaced below to count every
+// allocation of the process (operator new goes through malloc too): once
+// inside the handler of the primary only, and once over everything the
+// process does, client and grpc on both ends included. The client talks to
+// the primary directly, without a shardmanager in between.
+
+extern "C" void* __libc_malloc(size_t);
+extern "C" void* __libc_calloc(size_t, size_t);
+extern "C" void* __libc_realloc(void*, size_t);
+
+static atomic<uint64_t> process_allocs{0}, process_bytes{0};
+// only counted while a handler runs on this thread
+static thread_local bool in_handler = false;
+static thread_local uint64_t handler_allocs = 0, handler_bytes = 0;
+
+static void count(size_t bytes) {
+  process_allocs.fetch_add(1, memory_order_relaxed);
+  process_bytes.fetch_add(bytes, memory_order_relaxed);
+  if (in_handler) {
+    handler_allocs++;
+    handler_bytes += bytes;
+  }
+}
+
+extern "C" void* malloc(size_t n) {
+  count(n);
+  return __libc_malloc(n);
+}
+extern "C" void* calloc(size_t n, size_t size) {
+  count(n * size);
+  return __libc_calloc(n, size);
+}
+extern "C" void* realloc(void* p, size_t n) {
+  count(n);
+  return __libc_realloc(p, n);
+}
+
+static atomic<uint64_t> total_handler_allocs{0}, total_handler_bytes{0};
+
+class CountingShardkvServer : public ShardkvServer {
+ public:
+  using ShardkvServer::ShardkvServer;
+
+  ::grpc::Status Get(::grpc::ServerContext* context, const ::GetRequest* request,
+                     ::GetResponse* response) override {
+    return counted([&]() { return ShardkvServer::Get(context, request, response); });
+  }
+  ::grpc::Status Put(::grpc::ServerContext* context, const ::PutRequest* request,
+                     google::protobuf::Empty* response) override {
+    return counted([&]() { return ShardkvServer::Put(context, request, response); });
+  }
+  ::grpc::Status MultiGet(::grpc::ServerContext* context, const ::MultiGetRequest* request,
+                          ::MultiGetResponse* response) override {
+    return counted([&]() { return ShardkvServer::MultiGet(context, request, response); });
+  }
+
+ private:
+  template <typename F>
+  ::grpc::Status counted(F handler) {
+    handler_allocs = handler_bytes = 0;
+    in_handler = true;
+    ::grpc::Status status = handler();
+    in_handler = false;
+    total_handler_allocs += handler_allocs;
+    total_handler_bytes += handler_bytes;
+    return status;
+  }
+};
+
+constexpr int NUM_RPCS = 200;
+constexpr int MULTI_GET_KEYS = 2;
+
+enum class Rpc { GET, PUT, MULTI_GET };
+
+void run(Shardkv::Stub* stub, Rpc rpc, const char* name, const string& value) {
+  auto call = [&](int i) {
+    ::grpc::ClientContext cc;
+    ::grpc::Status status;
+    if (rpc == Rpc::PUT) {
+      PutRequest req;
+      req.set_key("post_" + to_string(i % 2));
+      req.set_data(value);
+      req.set_user("user_1");
+      google::protobuf::Empty res;
+      status = stub->Put(&cc, req, &res);
+    } else if (rpc == Rpc::GET) {
+      GetRequest req;
+      req.set_key("post_" + to_string(i % 2));
+      GetResponse res;
+      status = stub->Get(&cc, req, &res);
+    } else {
+      MultiGetRequest req;
+      for (int k = 0; k < MULTI_GET_KEYS; k++) req.add_keys("post_" + to_string(k));
+      MultiGetResponse res;
+      status = stub->MultiGet(&cc, req, &res);
+    }
+    assert(status.ok());
+  };
+  // warm up whatever grpc sets up on the first calls
+  for (int i = 0; i < 10; i++) call(i);
+
+  total_handler_allocs = total_handler_bytes = 0;
+  uint64_t allocs = process_allocs, bytes = process_bytes;
+  for (int i = 0; i < NUM_RPCS; i++) call(i);
+  allocs = process_allocs - allocs;
+  bytes = process_bytes - bytes;
+  printf("%-10s%10zu%16.1f%16.0f%16.1f%16.0f\n", name, value.size(),
+         (double)total_handler_allocs / NUM_RPCS, (double)total_handler_bytes / NUM_RPCS,
+         (double)allocs / NUM_RPCS, (double)bytes / NUM_RPCS);
+  fflush(stdout);
+}
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  string shardmaster = hostname + ":9700";
+  string manager = hostname + ":9701";
+  string primary = hostname + ":9702";
+
+  start_shardmaster(shardmaster);
+  start_shardmanager(manager, shardmaster);
+  spawn_service_in_thread<CountingShardkvServer, const string&, const string&>(
+      primary, primary, manager);
+  assert(test_join(shardmaster, manager, true));
+  // wait for the view and the configuration to settle
+  this_thread::sleep_for(chrono::milliseconds(2000));
+  auto stub = ChannelPool::Shared().Stub<Shardkv>(primary);
+
+  printf("%-10s%10s%16s%16s%16s%16s\n", "rpc", "value", "handler allocs", "handler bytes",
+         "process allocs", "process bytes");
+  for (size_t size : {100, 1 << 20}) {
+    string value(size, 'x');
+    run(stub.get(), Rpc::PUT, "Put", value);
+    run(stub.get(), Rpc::GET, "Get", value);
+    run(stub.get(), Rpc::MULTI_GET, "MultiGet", value);
+  }
+  printf("(per rpc, averaged over %d, bytes as asked of malloc; MultiGet reads %d keys)\n",
+         NUM_RPCS, MULTI_GET_KEYS);
+  // the servers run in detached threads
+  fflush(stdout);
+  _exit(0);
+}
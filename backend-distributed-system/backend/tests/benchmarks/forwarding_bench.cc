@@ -0,0 +1,114 @@
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../../shardkv/shardkv.h"
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+// Throughput of the shardmanager forwarding Gets and Puts to its primary, as
+// the number of concurrent clients grows. The primary adds FORWARD_DELAY to
+// every request, standing in for the network between the shardmanager and a
+// primary on another machine, so that the numbers show how many requests the
+// shardmanager keeps in flight rather than how fast the CPU is. Every client
+// has its own channel to the shardmanager, so that they do not share a
+// connection.
+
+const chrono::milliseconds FORWARD_DELAY(1);
+
+class DelayedShardkvServer : public ShardkvServer {
+ public:
+  using ShardkvServer::ShardkvServer;
+
+  ::grpc::Status Get(::grpc::ServerContext* context, const ::GetRequest* request,
+                     ::GetResponse* response) override {
+    this_thread::sleep_for(FORWARD_DELAY);
+    return ShardkvServer::Get(context, request, response);
+  }
+  ::grpc::Status Put(::grpc::ServerContext* context, const ::PutRequest* request,
+                     google::protobuf::Empty* response) override {
+    this_thread::sleep_for(FORWARD_DELAY);
+    return ShardkvServer::Put(context, request, response);
+  }
+};
+
+constexpr int NUM_KEYS = 1000;
+const chrono::milliseconds RUN_TIME(2000);
+const vector<int> CONCURRENCY = {1, 2, 4, 8, 16, 32};
+
+double run(const string& manager, int num_clients) {
+  atomic<bool> stop{false};
+  atomic<long> ops{0};
+  vector<thread> clients;
+  for (int c = 0; c < num_clients; c++) {
+    clients.emplace_back([&, c]() {
+      grpc::ChannelArguments args;
+      // one connection per client
+      args.SetInt("bench.client", c);
+      auto stub = Shardkv::NewStub(
+          grpc::CreateCustomChannel(manager, grpc::InsecureChannelCredentials(), args));
+      long done = 0;
+      for (int i = c; !stop.load(memory_order_relaxed); i += num_clients) {
+        string key = "post_" + to_string(i % NUM_KEYS);
+        ::grpc::ClientContext cc;
+        ::grpc::Status status;
+        if (i % 4 == 0) {
+          PutRequest req;
+          req.set_key(key);
+          req.set_data("some post content that is not too long");
+          req.set_user("user_" + to_string(i % NUM_KEYS));
+          google::protobuf::Empty res;
+          status = stub->Put(&cc, req, &res);
+        } else {
+          GetRequest req;
+          req.set_key(key);
+          GetResponse res;
+          status = stub->Get(&cc, req, &res);
+        }
+        if (status.ok()) done++;
+      }
+      ops += done;
+    });
+  }
+  this_thread::sleep_for(RUN_TIME);
+  stop = true;
+  for (auto& t : clients) t.join();
+  return ops / chrono::duration<double>(RUN_TIME).count();
+}
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  string shardmaster = hostname + ":9300";
+  string manager = hostname + ":9301";
+  string primary = hostname + ":9302";
+
+  start_shardmaster(shardmaster);
+  start_shardmanager(manager, shardmaster);
+  spawn_service_in_thread<DelayedShardkvServer, const string&, const string&>(
+      primary, primary, manager);
+  assert(test_join(shardmaster, manager, true));
+  // wait for the view and the configuration to settle
+  this_thread::sleep_for(chrono::milliseconds(2000));
+  for (int i = 0; i < NUM_KEYS; i++)
+    assert(test_put(manager, "post_" + to_string(i), "some post content",
+                    "user_" + to_string(i), true));
+
+  printf("%-10s%14s\n", "clients", "ops/s");
+  for (int n : CONCURRENCY) {
+    printf("%-10d%14.0f\n", n, run(manager, n));
+    fflush(stdout);
+  }
+  printf("(3 Gets for every Put, through the shardmanager, %lld ms away from the primary)\n",
+         (long long)FORWARD_DELAY.count());
+  // the servers run in detached threads
+  fflush(stdout);
+  _exit(0);
+}
@@ -0,0 +1,79 @@
+#include <string.h>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../../common/common.h"
+#include "../../common/shard_table.h"
+
+using namespace std;
+
+// Cost of deciding whether a server is responsible for a key, which every
+// request does at least once. "strtok + map" is how it used to be done: copy
+// the key, split it on '_' into a vector of strings, stoi the id, look its
+// shard up in a std::map and compare the address of its server with ours.
+// "parse_key + ShardTable" parses the key in place and compares server
+// indices.
+
+constexpr int NUM_SERVERS = 4;
+constexpr int NUM_LOOKUPS = 2000000;
+
+int old_extract_id(std::string key) {
+  std::vector<std::string> tokens;
+  char* save;
+  char* tok = strtok_r((char*)key.c_str(), "_", &save);
+  while (tok != NULL) {
+    tokens.push_back(std::string(tok));
+    tok = strtok_r(NULL, "_", &save);
+  }
+  assert(tokens.size() > 1);
+  return stoi(tokens[1]);
+}
+
+int main() {
+  vector<string> servers;
+  for (int i = 0; i < NUM_SERVERS; i++) servers.push_back("server" + to_string(i) + ":8000");
+  const string& self = servers[1];
+
+  map<shard_t, string> assignments_map;
+  ShardTable assignments;
+  vector<shard_t> shards = split_shard({MIN_KEY, MAX_KEY}, NUM_SERVERS);
+  for (int i = 0; i < NUM_SERVERS; i++) {
+    assignments_map[shards[i]] = servers[i];
+    assignments.Insert(servers[i], shards[i]);
+  }
+  uint16_t self_index = assignments.IndexOf(self);
+
+  vector<string> keys;
+  mt19937 rng(1);
+  uniform_int_distribution<unsigned int> id(MIN_KEY, MAX_KEY);
+  for (int i = 0; i < NUM_LOOKUPS; i++) {
+    unsigned int k = id(rng);
+    keys.push_back(i % 2 ? "post_" + to_string(k) : "user_" + to_string(k));
+  }
+
+  auto start = chrono::steady_clock::now();
+  size_t ours = 0;
+  for (const auto& key : keys) {
+    unsigned int ikey = old_extract_id(key);
+    ours += (--assignments_map.upper_bound(shard_t{ikey, ikey}))->second == self;
+  }
+  double old_rate = NUM_LOOKUPS / chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+  start = chrono::steady_clock::now();
+  size_t ours_new = 0;
+  for (const auto& key : keys) {
+    ours_new += assignments.OwnerOf(parse_key(key).id) == self_index;
+  }
+  double new_rate = NUM_LOOKUPS / chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+  if (ours != ours_new) fprintf(stderr, "the two disagree: %zu vs %zu\n", ours, ours_new);
+  printf("%-26s%14.0f\n", "strtok + map", old_rate);
+  printf("%-26s%14.0f\n", "parse_key + ShardTable", new_rate);
+  printf("(keys routed/s, %d servers)\n", NUM_SERVERS);
+  return 0;
+}
@@ -0,0 +1,352 @@
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../../common/channel_pool.h"
+#include "../../common/shard_table.h"
+#include "../../shardkv/shardkv.h"
+#include "../../shardmaster/shardmaster.h"
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+// End-to-end load on a whole cluster: a shardmaster and --groups groups, each
+// a shardmanager with a primary and a backup (shardkv processes, so that
+// they can be killed). --clients threads send a mix of Get, Put, Append and
+// Delete on --keys posts for --seconds, through the shardmanager of the group
+// owning every key, as the configuration the shardmaster pushes says. Keys
+// are picked uniformly or following a Zipfian distribution (the popular keys
+// scattered over the key space). Prints the throughput of every second, then
+// the throughput and latency percentiles of every operation.
+//
+// --event changes the cluster halfway through the run (or at --event-at):
+//   join   one more group joins (it is started with the others)
+//   leave  the last group leaves
+//   move   the first tenth of the key space moves to the last group
+//   kill   the primary of the first group is killed
+//
+// Appends make the popular posts grow until a Put replaces them. Must run
+// from the directory holding the shardkv binary, like the fault tolerance
+// tests.
+
+enum class Op { GET, PUT, APPEND, DELETE };
+const char* OP_NAMES[] = {"Get", "Put", "Append", "Delete"};
+constexpr int NUM_OPS = 4;
+
+enum class Event { NONE, JOIN, LEAVE, MOVE, KILL };
+
+typedef struct kvbench_options {
+  int groups = 2;
+  int clients = 16;
+  int seconds = 10;
+  int keys = 10000;
+  size_t value_size = 100;
+  // weights of Get, Put, Append and Delete
+  vector<double> mix = {70, 20, 5, 5};
+  // 0 for uniform keys
+  double zipf = 0;
+  Event event = Event::NONE;
+  // seconds into the run, half of it by default
+  optional<int> event_at;
+  int port = 9800;
+} kvbench_options_t;
+
+shared_mutex config_mutex;
+ShardTable config;
+
+void watch(const string& shardmaster) {
+  auto stub = ChannelPool::Shared().Stub<Shardmaster>(shardmaster);
+  ::grpc::ClientContext cc;
+  auto reader = stub->Watch(&cc, WatchRequest());
+  QueryResponse response;
+  while (reader->Read(&response)) {
+    ShardTable table;
+    for (const auto& e : response.config())
+      for (const auto& s : e.shards()) table.Insert(e.server(), {s.lower(), s.upper()});
+    unique_lock<shared_mutex> lock(config_mutex);
+    config = move(table);
+  }
+}
+
+// several posts per id, since ids only go from MIN_KEY to MAX_KEY
+uint64_t post_id(int i) { return MIN_KEY + i % (MAX_KEY - MIN_KEY + 1); }
+string post_key(int i) { return "post_" + to_string(post_id(i)) + "_" + to_string(i); }
+
+// latencies of one operation, in microseconds, and how many failed
+struct op_stats_t {
+  vector<double> latencies;
+  long errors = 0;
+};
+
+double percentile(const vector<double>& sorted, double p) {
+  if (sorted.empty()) return 0;
+  return sorted[min(sorted.size() - 1, (size_t)(sorted.size() * p))];
+}
+
+optional<kvbench_options_t> parse(int argc, char** argv) {
+  kvbench_options_t options;
+  for (int i = 1; i < argc; i++) {
+    string flag(argv[i]);
+    auto value = [&flag](const string& name) -> optional<string> {
+      if (flag.rfind(name + "=", 0) != 0) return nullopt;
+      return flag.substr(name.size() + 1);
+    };
+    if (auto v = value("--groups")) {
+      options.groups = stoi(*v);
+    } else if (auto v = value("--clients")) {
+      options.clients = stoi(*v);
+    } else if (auto v = value("--seconds")) {
+      options.seconds = stoi(*v);
+    } else if (auto v = value("--keys")) {
+      options.keys = stoi(*v);
+    } else if (auto v = value("--value-size")) {
+      options.value_size = stoul(*v);
+    } else if (auto v = value("--mix")) {
+      // get:put:append:delete
+      options.mix.clear();
+      for (size_t start = 0; start <= v->size();) {
+        size_t end = min(v->find(':', start), v->size());
+        options.mix.push_back(stod(v->substr(start, end - start)));
+        start = end + 1;
+      }
+      if (options.mix.size() != NUM_OPS) return nullopt;
+    } else if (flag == "--dist=uniform") {
+      options.zipf = 0;
+    } else if (flag == "--dist=zipf") {
+      options.zipf = 0.99;
+    } else if (auto v = value("--zipf")) {
+      options.zipf = stod(*v);
+    } else if (flag == "--event=none") {
+      options.event = Event::NONE;
+    } else if (flag == "--event=join") {
+      options.event = Event::JOIN;
+    } else if (flag == "--event=leave") {
+      options.event = Event::LEAVE;
+    } else if (flag == "--event=move") {
+      options.event = Event::MOVE;
+    } else if (flag == "--event=kill") {
+      options.event = Event::KILL;
+    } else if (auto v = value("--event-at")) {
+      options.event_at = stoi(*v);
+    } else if (auto v = value("--port")) {
+      options.port = stoi(*v);
+    } else {
+      fprintf(stderr, "unknown option: %s\n", argv[i]);
+      return nullopt;
+    }
+  }
+  if (options.groups < 1 || options.clients < 1 || options.seconds < 1 || options.keys < 1)
+    return nullopt;
+  // the last group leaves, or receives a shard, so there must be another
+  if ((options.event == Event::LEAVE || options.event == Event::MOVE) && options.groups < 2)
+    return nullopt;
+  return options;
+}
+
+int main(int argc, char** argv) {
+  auto parsed = parse(argc, argv);
+  if (!parsed) {
+    fprintf(stderr, "usage: ./kvbench [--groups=<N>] [--clients=<N>] [--seconds=<S>] "
+                    "[--keys=<N>] [--value-size=<B>] [--mix=<GET>:<PUT>:<APPEND>:<DELETE>] "
+                    "[--dist=uniform|zipf] [--zipf=<THETA>] "
+                    "[--event=none|join|leave|move|kill] [--event-at=<S>] [--port=<PORT>]\n");
+    return 1;
+  }
+  const kvbench_options_t& options = *parsed;
+  int event_at = options.event_at.value_or(options.seconds / 2);
+
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  // a group that joins during the run is started with the others
+  int groups = options.groups + (options.event == Event::JOIN ? 1 : 0);
+  string shardmaster = hostname + ":" + to_string(options.port);
+  start_shardmaster(shardmaster);
+  vector<string> managers;
+  vector<pid_t> primaries, pids;
+  for (int g = 0; g < groups; g++) {
+    int base = options.port + 1 + 3 * g;
+    managers.push_back(hostname + ":" + to_string(base));
+    start_shardmanager(managers[g], shardmaster);
+    pid_t primary = start_shardkv_proc(hostname + ":" + to_string(base + 1), managers[g]);
+    primaries.push_back(primary);
+    pids.push_back(primary);
+  }
+  // let the primaries become primaries before the backups show up
+  this_thread::sleep_for(chrono::milliseconds(1000));
+  for (int g = 0; g < groups; g++)
+    pids.push_back(start_shardkv_proc(hostname + ":" + to_string(options.port + 3 + 3 * g), managers[g]));
+  this_thread::sleep_for(chrono::milliseconds(3000));
+  for (int g = 0; g < options.groups; g++) assert(test_join(shardmaster, managers[g], true));
+  thread(watch, shardmaster).detach();
+  // wait for the views and the configuration to settle
+  this_thread::sleep_for(chrono::seconds(2));
+
+  const string value(options.value_size, 'x');
+  // the rank of every key in popularity, scattered over the key space so
+  // that the popular keys do not all fall in the same shard
+  vector<int> by_rank(options.keys);
+  for (int i = 0; i < options.keys; i++) by_rank[i] = i;
+  shuffle(by_rank.begin(), by_rank.end(), mt19937(0));
+  vector<double> weights;
+  for (int k = 0; k < options.keys; k++) weights.push_back(1 / pow(k + 1, options.zipf));
+
+  // sends op on post i to the group owning it. false if it failed, other
+  // than for a missing key
+  auto send = [&](const vector<unique_ptr<Shardkv::Stub>>& stubs, Op op, int i) {
+    size_t group;
+    {
+      shared_lock<shared_mutex> lock(config_mutex);
+      uint16_t owner = config.OwnerOf(post_id(i));
+      if (owner == ShardTable::NONE) return false;
+      group = find(managers.begin(), managers.end(), config.Server(owner)) - managers.begin();
+    }
+    ::grpc::ClientContext cc;
+    cc.set_deadline(chrono::system_clock::now() + chrono::seconds(2));
+    ::grpc::Status status;
+    google::protobuf::Empty empty;
+    if (op == Op::GET) {
+      GetRequest req;
+      req.set_key(post_key(i));
+      GetResponse res;
+      status = stubs[group]->Get(&cc, req, &res);
+    } else if (op == Op::PUT) {
+      PutRequest req;
+      req.set_key(post_key(i));
+      req.set_data(value);
+      req.set_user("user_" + to_string(post_id(i)));
+      status = stubs[group]->Put(&cc, req, &empty);
+    } else if (op == Op::APPEND) {
+      AppendRequest req;
+      req.set_key(post_key(i));
+      req.set_data(value);
+      status = stubs[group]->Append(&cc, req, &empty);
+    } else {
+      DeleteRequest req;
+      req.set_key(post_key(i));
+      status = stubs[group]->Delete(&cc, req, &empty);
+    }
+    // the server looked for the key, which a Delete may have removed
+    return status.ok() || status.error_message() == "Key not found";
+  };
+  auto make_stubs = [&]() {
+    vector<unique_ptr<Shardkv::Stub>> stubs;
+    for (const auto& manager : managers) stubs.push_back(ChannelPool::Shared().Stub<Shardkv>(manager));
+    return stubs;
+  };
+
+  // every post starts out there
+  {
+    vector<thread> loaders;
+    for (int c = 0; c < options.clients; c++) {
+      loaders.emplace_back([&, c]() {
+        auto stubs = make_stubs();
+        for (int i = c; i < options.keys; i += options.clients)
+          while (!send(stubs, Op::PUT, i)) this_thread::sleep_for(chrono::milliseconds(10));
+      });
+    }
+    for (auto& t : loaders) t.join();
+  }
+
+  atomic<bool> stop{false};
+  atomic<long> done{0}, failed{0};
+  vector<vector<op_stats_t>> stats(options.clients, vector<op_stats_t>(NUM_OPS));
+  vector<thread> clients;
+  for (int c = 0; c < options.clients; c++) {
+    clients.emplace_back([&, c]() {
+      mt19937 rng(c + 1);
+      discrete_distribution<int> key(weights.begin(), weights.end());
+      discrete_distribution<int> mix(options.mix.begin(), options.mix.end());
+      auto stubs = make_stubs();
+      while (!stop.load(memory_order_relaxed)) {
+        Op op = static_cast<Op>(mix(rng));
+        int i = by_rank[key(rng)];
+        auto start = chrono::steady_clock::now();
+        bool ok = send(stubs, op, i);
+        auto end = chrono::steady_clock::now();
+        op_stats_t& s = stats[c][static_cast<int>(op)];
+        if (ok) {
+          s.latencies.push_back(chrono::duration<double, micro>(end - start).count());
+          done++;
+        } else {
+          s.errors++;
+          failed++;
+          // most likely a server behind on the configuration, or a group
+          // without a primary for now
+          this_thread::sleep_for(chrono::milliseconds(1));
+        }
+      }
+    });
+  }
+
+  printf("%-8s%12s%12s\n", "time", "ops/s", "errors/s");
+  fflush(stdout);
+  for (int s = 1; s <= options.seconds; s++) {
+    if (s - 1 == event_at) {
+      const char* what = "";
+      switch (options.event) {
+        case Event::NONE:
+          break;
+        case Event::JOIN:
+          what = "join";
+          assert(test_join(shardmaster, managers.back(), true));
+          break;
+        case Event::LEAVE:
+          what = "leave";
+          assert(test_leave(shardmaster, {managers.back()}, true));
+          break;
+        case Event::MOVE:
+          what = "move";
+          assert(test_move(shardmaster, managers.back(),
+                           {MIN_KEY, MIN_KEY + (MAX_KEY - MIN_KEY) / 10}, true));
+          break;
+        case Event::KILL:
+          what = "kill";
+          kill(primaries[0], SIGKILL);
+          break;
+      }
+      if (options.event != Event::NONE) printf("-- %s\n", what);
+    }
+    long before_done = done, before_failed = failed;
+    this_thread::sleep_for(chrono::seconds(1));
+    printf("%-8s%12ld%12ld\n", (to_string(s) + "s").c_str(), done - before_done, failed - before_failed);
+    fflush(stdout);
+  }
+  stop = true;
+  for (auto& t : clients) t.join();
+
+  printf("\n%-8s%12s%10s%12s%12s%12s%12s\n", "op", "ops/s", "errors", "p50 (us)", "p99 (us)",
+         "p999 (us)", "max (us)");
+  for (int op = 0; op < NUM_OPS; op++) {
+    vector<double> all;
+    long errors = 0;
+    for (const auto& client : stats) {
+      all.insert(all.end(), client[op].latencies.begin(), client[op].latencies.end());
+      errors += client[op].errors;
+    }
+    if (all.empty() && errors == 0) continue;
+    sort(all.begin(), all.end());
+    printf("%-8s%12.0f%10ld%12.0f%12.0f%12.0f%12.0f\n", OP_NAMES[op],
+           all.size() / (double)options.seconds, errors, percentile(all, 0.5),
+           percentile(all, 0.99), percentile(all, 0.999), all.empty() ? 0 : all.back());
+  }
+  printf("(%d groups of a primary and a backup, %d clients, %d posts of %zu bytes, %s keys)\n",
+         options.groups, options.clients, options.keys, options.value_size,
+         options.zipf > 0 ? ("zipf " + to_string(options.zipf).substr(0, 4)).c_str() : "uniform");
+  fflush(stdout);
+  cleanup_children(pids);
+  // the shardmaster and shardmanagers run in detached threads
+  _exit(0);
+}
@@ -0,0 +1,110 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "../../shardkv/kvstore.h"
+
+using namespace std;
+
+// Throughput of the ShardkvServer storage engines under a 90% Get / 10% Put
+// mix on the post_<id> key space. "global mutex" reproduces the previous
+// engine (one std::mutex around an unordered_map), the other two are KVStore
+// with a single reader/writer stripe and with the default number of stripes.
+
+constexpr int NUM_KEYS = 1000;
+constexpr int READ_PERCENT = 90;
+const chrono::milliseconds RUN_TIME(1000);
+
+class GlobalMutexStore {
+ public:
+  bool Get(const string& key, string* value) {
+    lock_guard<mutex> lock(_mutex);
+    auto it = _database.find(key);
+    if (it == _database.end()) return false;
+    *value = it->second;
+    return true;
+  }
+  void Put(const string& key, const string& value) {
+    lock_guard<mutex> lock(_mutex);
+    _database[key] = value;
+  }
+
+ private:
+  mutex _mutex;
+  unordered_map<string, string> _database;
+};
+
+template <typename Store>
+double run(Store& store, int num_threads) {
+  vector<string> keys;
+  for (int i = 0; i < NUM_KEYS; i++) {
+    keys.push_back("post_" + to_string(i));
+    store.Put(keys.back(), "some post content that is not too long");
+  }
+
+  atomic<bool> stop{false};
+  atomic<uint64_t> total{0};
+  vector<thread> threads;
+  for (int t = 0; t < num_threads; t++) {
+    threads.emplace_back([&, t]() {
+      mt19937 rng(t);
+      uniform_int_distribution<int> key_dist(0, NUM_KEYS - 1);
+      uniform_int_distribution<int> op_dist(0, 99);
+      string value;
+      uint64_t ops = 0;
+      while (!stop.load(memory_order_relaxed)) {
+        const string& key = keys[key_dist(rng)];
+        if (op_dist(rng) < READ_PERCENT)
+          store.Get(key, &value);
+        else
+          store.Put(key, "updated post content");
+        ops++;
+      }
+      total += ops;
+    });
+  }
+  this_thread::sleep_for(RUN_TIME);
+  stop = true;
+  for (auto& t : threads) t.join();
+  return total.load() / chrono::duration<double>(RUN_TIME).count();
+}
+
+int main() {
+  const vector<int> thread_counts = {1, 4, 16, 64};
+
+  printf("%-22s", "engine \\ threads");
+  for (int n : thread_counts) printf("%14d", n);
+  printf("\n");
+
+  printf("%-22s", "global mutex");
+  for (int n : thread_counts) {
+    GlobalMutexStore store;
+    printf("%14.0f", run(store, n));
+    fflush(stdout);
+  }
+  printf("\n");
+
+  printf("%-22s", "KVStore, 1 stripe");
+  for (int n : thread_counts) {
+    KVStore store(1);
+    printf("%14.0f", run(store, n));
+    fflush(stdout);
+  }
+  printf("\n");
+
+  printf("%-22s", "KVStore, 64 stripes");
+  for (int n : thread_counts) {
+    KVStore store(DEFAULT_STRIPES);
+    printf("%14.0f", run(store, n));
+    fflush(stdout);
+  }
+  printf("\n(ops/s, %d%% Get / %d%% Put over %d keys)\n", READ_PERCENT,
+         100 - READ_PERCENT, NUM_KEYS);
+  return 0;
+}
@@ -0,0 +1,167 @@
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <mutex>
+#include <random>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../../common/channel_pool.h"
+#include "../../common/shard_table.h"
+#include "../../shardkv/shardkv.h"
+#include "../../shardmaster/shardmaster.h"
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+// Throughput of a cluster under a skewed load, with the shards split evenly
+// between the groups (a plain shardmaster) and balanced by load (one started
+// with auto_balance). Clients read user_<id> with ids following a Zipfian
+// distribution, the most popular ids being the lowest ones, so that most of
+// the load falls on the first shard of an even split. Every server handles
+// one request at a time and takes SERVICE_TIME for it, standing in for a
+// machine with a bounded capacity, so the numbers show how well the load is
+// spread rather than how fast the CPU is.
+
+const chrono::milliseconds SERVICE_TIME(2);
+constexpr int NUM_GROUPS = 4;
+constexpr int NUM_CLIENTS = 32;
+constexpr double ZIPF_S = 1.0;
+const chrono::seconds WINDOW(4);
+constexpr int STATIC_WINDOWS = 4;
+constexpr int BALANCED_WINDOWS = 10;
+
+class BoundedShardkvServer : public ShardkvServer {
+ public:
+  using ShardkvServer::ShardkvServer;
+
+  ::grpc::Status Get(::grpc::ServerContext* context, const ::GetRequest* request,
+                     ::GetResponse* response) override {
+    lock_guard<mutex> lock(_busy);
+    this_thread::sleep_for(SERVICE_TIME);
+    return ShardkvServer::Get(context, request, response);
+  }
+
+ private:
+  mutex _busy;
+};
+
+// the configuration, as the clients see it
+shared_mutex config_mutex;
+ShardTable config;
+
+void watch(const string& shardmaster) {
+  auto stub = ChannelPool::Shared().Stub<Shardmaster>(shardmaster);
+  ::grpc::ClientContext cc;
+  auto reader = stub->Watch(&cc, WatchRequest());
+  QueryResponse response;
+  while (reader->Read(&response)) {
+    ShardTable table;
+    for (const auto& e : response.config())
+      for (const auto& s : e.shards()) table.Insert(e.server(), {s.lower(), s.upper()});
+    unique_lock<shared_mutex> lock(config_mutex);
+    config = move(table);
+  }
+}
+
+// runs the clients against the cluster of shardmaster, printing the
+// throughput of every WINDOW. returns the average over the last half of
+// them, once things have settled
+double run(const char* name, int port, bool auto_balance, int windows) {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  string shardmaster = hostname + ":" + to_string(port);
+  {
+    unique_lock<shared_mutex> lock(config_mutex);
+    config.Clear();
+  }
+  shardmaster_options_t options;
+  options.auto_balance = auto_balance;
+  start_shardmaster(shardmaster, options);
+  // the shardmanager of every group, and its only server
+  vector<string> managers, servers;
+  for (int g = 0; g < NUM_GROUPS; g++) {
+    managers.push_back(hostname + ":" + to_string(port + 1 + g));
+    servers.push_back(hostname + ":" + to_string(port + 1 + NUM_GROUPS + g));
+    start_shardmanager(managers[g], shardmaster);
+    spawn_service_in_thread<BoundedShardkvServer, const string&, const string&>(
+        servers[g], servers[g], managers[g]);
+    assert(test_join(shardmaster, managers[g], true));
+  }
+  thread(watch, shardmaster).detach();
+  // wait for the views and the configuration to settle
+  this_thread::sleep_for(chrono::seconds(2));
+  {
+    shared_lock<shared_mutex> lock(config_mutex);
+    assert(config.Servers().size() == NUM_GROUPS);
+  }
+
+  // P(id = k) proportional to 1 / (k + 1)^ZIPF_S
+  vector<double> weights;
+  for (unsigned int k = MIN_KEY; k <= MAX_KEY; k++) weights.push_back(1 / pow(k - MIN_KEY + 1, ZIPF_S));
+
+  atomic<bool> stop{false};
+  atomic<long> ops{0};
+  vector<thread> clients;
+  for (int c = 0; c < NUM_CLIENTS; c++) {
+    clients.emplace_back([&, c]() {
+      mt19937 rng(c);
+      discrete_distribution<unsigned int> id(weights.begin(), weights.end());
+      vector<unique_ptr<Shardkv::Stub>> stubs;
+      for (const auto& server : servers) stubs.push_back(ChannelPool::Shared().Stub<Shardkv>(server));
+      while (!stop.load(memory_order_relaxed)) {
+        unsigned int key = MIN_KEY + id(rng);
+        uint16_t owner;
+        {
+          shared_lock<shared_mutex> lock(config_mutex);
+          owner = config.OwnerOf(key);
+          owner = find(managers.begin(), managers.end(), config.Server(owner)) - managers.begin();
+        }
+        GetRequest req;
+        req.set_key("user_" + to_string(key));
+        GetResponse res;
+        ::grpc::ClientContext cc;
+        auto status = stubs[owner]->Get(&cc, req, &res);
+        // the key is not there, which is fine: the server looked for it
+        if (status.ok() || status.error_message() == "Key not found") ops++;
+      }
+    });
+  }
+
+  double total = 0;
+  for (int w = 0; w < windows; w++) {
+    long before = ops;
+    this_thread::sleep_for(WINDOW);
+    double rate = (ops - before) / chrono::duration<double>(WINDOW).count();
+    if (w >= windows / 2) total += rate;
+    size_t shards;
+    {
+      shared_lock<shared_mutex> lock(config_mutex);
+      shards = config.NumShards();
+    }
+    printf("%-10s%6lds%12.0f%8zu\n", name, (w + 1) * WINDOW.count(), rate, shards);
+    fflush(stdout);
+  }
+  stop = true;
+  for (auto& t : clients) t.join();
+  return total / (windows - windows / 2);
+}
+
+int main() {
+  printf("%-10s%7s%12s%8s\n", "sharding", "time", "Get/s", "shards");
+  double even = run("even", 9300, false, STATIC_WINDOWS);
+  double balanced = run("balanced", 9400, true, BALANCED_WINDOWS);
+  printf("(%d groups of one server taking %lld ms per request, %d clients, zipf s=%.1f)\n",
+         NUM_GROUPS, (long long)SERVICE_TIME.count(), NUM_CLIENTS, ZIPF_S);
+  printf("balanced/even: %.2fx\n", balanced / even);
+  // the servers run in detached threads
+  fflush(stdout);
+  _exit(0);
+}
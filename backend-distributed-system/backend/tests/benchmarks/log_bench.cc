@@ -0,0 +1,83 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../../common/log.h"
+
+using namespace std;
+
+// What a line of log costs the thread that logs it: writing it to cerr (what
+// the servers did), handing it to the Logger, and a LOG below the level. Every
+// thread logs bursts of BURST lines, then pauses for the flusher to catch up,
+// as the servers log in bursts (a failover, a migration) and not all the
+// time; only the bursts are timed. stderr goes to /dev/null, so that the
+// write itself is only a syscall.
+
+constexpr int BURST = 500;
+constexpr int BURSTS = 20;
+
+enum class Sink { CERR, LOGGER, DISABLED };
+
+// ns per line, as seen by the threads that log
+double run(Sink sink, int num_threads) {
+  atomic<uint64_t> total_ns{0};
+  vector<thread> threads;
+  for (int t = 0; t < num_threads; t++) {
+    threads.emplace_back([&, t]() {
+      string server = "host:" + to_string(9000 + t);
+      for (int b = 0; b < BURSTS; b++) {
+        auto start = chrono::steady_clock::now();
+        for (int i = 0; i < BURST; i++) {
+          if (sink == Sink::CERR)
+            cerr << server << " migration of " << i << " keys failed, retrying ..." << endl;
+          else if (sink == Sink::LOGGER)
+            LOG(WARN) << server << " migration of " << i << " keys failed, retrying ...";
+          else
+            LOG(DEBUG) << server << " migration of " << i << " keys failed, retrying ...";
+        }
+        chrono::nanoseconds elapsed = chrono::steady_clock::now() - start;
+        total_ns += elapsed.count();
+        this_thread::sleep_for(Logger::FLUSH_INTERVAL * 2);
+      }
+    });
+  }
+  for (auto& t : threads) t.join();
+  Logger::Shared().Flush();
+  return (double)total_ns / (num_threads * BURSTS * BURST);
+}
+
+int main() {
+  const vector<int> thread_counts = {1, 4, 16};
+  // the bursts are well within the rate limit and the rings
+  Logger::Shared().SetRateLimit(0);
+  Logger::Shared().SetLevel(LogLevel::INFO);
+  int devnull = open("/dev/null", O_WRONLY);
+  int saved = dup(STDERR_FILENO);
+  dup2(devnull, STDERR_FILENO);
+
+  printf("%-28s", "ns per line \\ threads");
+  for (int n : thread_counts) printf("%12d", n);
+  printf("\n");
+  const pair<Sink, const char*> sinks[] = {
+      {Sink::CERR, "cerr << ... << endl"},
+      {Sink::LOGGER, "LOG(WARN)"},
+      {Sink::DISABLED, "LOG(DEBUG), level INFO"},
+  };
+  for (const auto& [sink, name] : sinks) {
+    printf("%-28s", name);
+    for (int n : thread_counts) {
+      printf("%12.1f", run(sink, n));
+      fflush(stdout);
+    }
+    printf("\n");
+  }
+  printf("(%d bursts of %d lines per thread, stderr to /dev/null)\n", BURSTS, BURST);
+  dup2(saved, STDERR_FILENO);
+  return 0;
+}
@@ -0,0 +1,172 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../../common/metrics.h"
+#include "../../shardkv/kvstore.h"
+
+using namespace std;
+
+// What recording latencies costs. First the cost of a Metrics::Record and of
+// a Metrics::Timer (two clock reads and a Record), next to a histogram whose
+// cells are shared by every thread and bumped with fetch_add. Then the Get
+// path of a ShardkvServer without its RPC layer: KVStore::Get alone, with the
+// lock wait hook set, and with a Timer around every Get as the Get handler
+// has, under a 90% Get / 10% Put mix. Last, what a collection costs after
+// many short-lived threads recorded (as migration and outbox threads do).
+
+constexpr int NUM_KEYS = 1000;
+constexpr int READ_PERCENT = 90;
+const chrono::milliseconds RUN_TIME(1000);
+
+// a histogram of the same buckets every thread writes to
+class SharedHistogram {
+ public:
+  void Record(chrono::nanoseconds elapsed) {
+    uint64_t ns = elapsed.count();
+    size_t b = 0;
+    if (ns >= 1024) {
+      int msb = 63 - __builtin_clzll(ns);
+      b = min<size_t>(1 + 2 * (msb - 10) + ((ns >> (msb - 1)) & 1), Metrics::BUCKETS - 1);
+    }
+    _buckets[b].fetch_add(1, memory_order_relaxed);
+    _sum.fetch_add(ns, memory_order_relaxed);
+  }
+
+ private:
+  atomic<uint64_t> _buckets[Metrics::BUCKETS] = {};
+  atomic<uint64_t> _sum{0};
+};
+
+// ns per call of record, on every thread at once
+template <typename F>
+double per_call(int num_threads, F record) {
+  const int calls = 2000000;
+  vector<thread> threads;
+  auto start = chrono::steady_clock::now();
+  for (int t = 0; t < num_threads; t++) {
+    threads.emplace_back([&record, t]() {
+      for (uint64_t i = 0; i < calls; i++) record(chrono::nanoseconds((i * 7919 + t) & 0xfffff));
+    });
+  }
+  for (auto& t : threads) t.join();
+  chrono::duration<double, nano> elapsed = chrono::steady_clock::now() - start;
+  return elapsed.count() / calls;
+}
+
+enum class Timing { NONE, LOCK_WAIT, LOCK_WAIT_AND_RPC };
+
+double run(Timing timing, int num_threads) {
+  KVStore store(DEFAULT_STRIPES);
+  Metrics metrics;
+  size_t get = metrics.Histogram("get_seconds", "");
+  size_t lock_wait = metrics.Histogram("lock_wait_seconds", "");
+  if (timing != Timing::NONE)
+    store.SetLockWait([&](chrono::nanoseconds waited) { metrics.Record(lock_wait, waited); });
+  vector<string> keys;
+  for (int i = 0; i < NUM_KEYS; i++) {
+    keys.push_back("post_" + to_string(i));
+    store.Put(keys.back(), "some post content that is not too long");
+  }
+
+  atomic<bool> stop{false};
+  atomic<uint64_t> total{0};
+  vector<thread> threads;
+  for (int t = 0; t < num_threads; t++) {
+    threads.emplace_back([&, t]() {
+      mt19937 rng(t);
+      uniform_int_distribution<int> key_dist(0, NUM_KEYS - 1);
+      uniform_int_distribution<int> op_dist(0, 99);
+      string value;
+      uint64_t ops = 0;
+      while (!stop.load(memory_order_relaxed)) {
+        const string& key = keys[key_dist(rng)];
+        if (op_dist(rng) >= READ_PERCENT) {
+          store.Put(key, "updated post content");
+        } else if (timing == Timing::LOCK_WAIT_AND_RPC) {
+          Metrics::Timer timer(&metrics, get);
+          store.Get(key, &value);
+        } else {
+          store.Get(key, &value);
+        }
+        ops++;
+      }
+      total += ops;
+    });
+  }
+  this_thread::sleep_for(RUN_TIME);
+  stop = true;
+  for (auto& t : threads) t.join();
+  return total.load() / chrono::duration<double>(RUN_TIME).count();
+}
+
+int main() {
+  const vector<int> thread_counts = {1, 4};
+
+  printf("%-28s", "ns per call \\ threads");
+  for (int n : thread_counts) printf("%12d", n);
+  printf("\n");
+
+  printf("%-28s", "shared atomic histogram");
+  for (int n : thread_counts) {
+    SharedHistogram h;
+    printf("%12.1f", per_call(n, [&h](chrono::nanoseconds ns) { h.Record(ns); }));
+    fflush(stdout);
+  }
+  printf("\n");
+
+  printf("%-28s", "Metrics::Record");
+  for (int n : thread_counts) {
+    Metrics metrics;
+    size_t h = metrics.Histogram("h", "");
+    printf("%12.1f", per_call(n, [&](chrono::nanoseconds ns) { metrics.Record(h, ns); }));
+    fflush(stdout);
+  }
+  printf("\n");
+
+  printf("%-28s", "Metrics::Timer");
+  for (int n : thread_counts) {
+    Metrics metrics;
+    size_t h = metrics.Histogram("h", "");
+    printf("%12.1f", per_call(n, [&](chrono::nanoseconds) { Metrics::Timer timer(&metrics, h); }));
+    fflush(stdout);
+  }
+  printf("\n\n");
+
+  printf("%-28s", "Get path ops/s \\ threads");
+  for (int n : thread_counts) printf("%12d", n);
+  printf("\n");
+  const pair<Timing, const char*> timings[] = {
+      {Timing::NONE, "untimed"},
+      {Timing::LOCK_WAIT, "lock wait"},
+      {Timing::LOCK_WAIT_AND_RPC, "lock wait + Get timer"},
+  };
+  for (const auto& [timing, name] : timings) {
+    printf("%-28s", name);
+    for (int n : thread_counts) {
+      printf("%12.0f", run(timing, n));
+      fflush(stdout);
+    }
+    printf("\n");
+  }
+  printf("(%d%% Get / %d%% Put over %d keys)\n\n", READ_PERCENT, 100 - READ_PERCENT, NUM_KEYS);
+
+  printf("%-28s%12s\n", "short-lived threads", "collect us");
+  for (int n : {10, 1000}) {
+    Metrics metrics;
+    size_t h = metrics.Histogram("h", "");
+    for (int i = 0; i < n; i++) thread([&]() { metrics.Record(h, chrono::microseconds(1)); }).join();
+    auto start = chrono::steady_clock::now();
+    auto collected = metrics.CollectHistograms();
+    chrono::duration<double, micro> elapsed = chrono::steady_clock::now() - start;
+    // the counts of the threads that are gone are all still there
+    if (collected[0].count != (uint64_t)n) fprintf(stderr, "collected %llu of %d\n",
+                                                   (unsigned long long)collected[0].count, n);
+    printf("%-28d%12.1f\n", n, elapsed.count());
+  }
+  return 0;
+}
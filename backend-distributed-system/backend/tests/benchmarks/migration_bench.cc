@@ -0,0 +1,97 @@
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../../shardkv/shardkv.h"
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+// Time it takes to rebalance a loaded server. NUM_KEYS posts (first argument,
+// 100000 by default) are written to the only server of the cluster, then a
+// second server joins and takes over half of the key space. The rebalance is
+// over once a random sample of the keys that move can all be read from the
+// new owner.
+
+constexpr int NUM_LOADERS = 8;
+constexpr int SAMPLE = 1000;
+
+string post_key(int i) {
+  // several posts per id, since ids only go from MIN_KEY to MAX_KEY
+  return "post_" + to_string(i % (MAX_KEY + 1)) + "_" + to_string(i);
+}
+
+int main(int argc, char** argv) {
+  int num_keys = argc > 1 ? atoi(argv[1]) : 100000;
+
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  string shardmaster = hostname + ":9200";
+  string skv_1 = hostname + ":9201";
+  string skv_2 = hostname + ":9202";
+  string sv_1 = hostname + ":9211";
+  string sv_2 = hostname + ":9212";
+
+  start_shardmaster(shardmaster);
+  start_shardmanager(skv_1, shardmaster);
+  start_shardmanager(skv_2, shardmaster);
+  start_shardkv(sv_1, skv_1);
+  start_shardkv(sv_2, skv_2);
+  assert(test_join(shardmaster, skv_1, true));
+  // wait for the view and the configuration to settle
+  this_thread::sleep_for(chrono::milliseconds(2000));
+
+  auto load_start = chrono::steady_clock::now();
+  vector<thread> loaders;
+  for (int l = 0; l < NUM_LOADERS; l++) {
+    loaders.emplace_back([&, l]() {
+      auto stub = Shardkv::NewStub(grpc::CreateChannel(sv_1, grpc::InsecureChannelCredentials()));
+      for (int i = l; i < num_keys; i += NUM_LOADERS) {
+        PutRequest req;
+        req.set_key(post_key(i));
+        req.set_data("some post content that is not too long");
+        req.set_user("user_" + to_string(i % (MAX_KEY + 1)));
+        google::protobuf::Empty res;
+        ::grpc::ClientContext cc;
+        assert(stub->Put(&cc, req, &res).ok());
+      }
+    });
+  }
+  for (auto& t : loaders) t.join();
+  printf("loaded %d keys in %.2f s\n", num_keys,
+         chrono::duration<double>(chrono::steady_clock::now() - load_start).count());
+
+  // skv_2 takes over ids 501 .. 1000
+  mt19937 rng(0);
+  vector<int> sample;
+  while (sample.size() < SAMPLE) {
+    int i = uniform_int_distribution<int>(0, num_keys - 1)(rng);
+    if (i % (MAX_KEY + 1) > MAX_KEY / 2) sample.push_back(i);
+  }
+
+  auto start = chrono::steady_clock::now();
+  assert(test_join(shardmaster, skv_2, true));
+  auto stub = Shardkv::NewStub(grpc::CreateChannel(sv_2, grpc::InsecureChannelCredentials()));
+  for (int i : sample) {
+    while (true) {
+      GetRequest req;
+      req.set_key(post_key(i));
+      GetResponse res;
+      ::grpc::ClientContext cc;
+      if (stub->Get(&cc, req, &res).ok()) break;
+      this_thread::sleep_for(chrono::milliseconds(10));
+    }
+  }
+  printf("rebalanced in %.2f s\n",
+         chrono::duration<double>(chrono::steady_clock::now() - start).count());
+  // the servers run in detached threads
+  fflush(stdout);
+  _exit(0);
+}
@@ -0,0 +1,94 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../../common/common.h"
+#include "../../common/shard_table.h"
+#include "../../shardmaster/shardmaster.h"
+
+using namespace std;
+
+// How evenly sequential ids are spread over the groups, with range and hash
+// placement. Ids are handed out one after the other, and sign-ups come in
+// bursts of BURST consecutive ids: with ranges, a whole burst lands on the
+// group holding the newest range. For every burst we take the share of it
+// the busiest group gets (1 / NUM_GROUPS would be perfect), and for the
+// whole key space how much more than the average the fullest group holds.
+// The configurations come from a StaticShardmaster (called directly, without
+// grpc) and are routed through a ShardTable, as the servers do, which also
+// gives the cost of a lookup.
+
+constexpr int NUM_GROUPS = 8;
+constexpr unsigned int BURST = 50;
+constexpr int NUM_LOOKUPS = 2000000;
+
+ShardTable configure(Placement placement, uint32_t vnodes) {
+  shardmaster_options_t options;
+  options.placement = placement;
+  options.vnodes = vnodes;
+  StaticShardmaster shardmaster(options);
+  google::protobuf::Empty empty;
+  for (int g = 0; g < NUM_GROUPS; g++) {
+    JoinRequest req;
+    req.set_server("group" + to_string(g) + ":8000");
+    assert(shardmaster.Join(nullptr, &req, &empty).ok());
+  }
+  QueryResponse config;
+  assert(shardmaster.Query(nullptr, &empty, &config).ok());
+  ShardTable table;
+  if (config.placement() == PLACEMENT_HASH) {
+    vector<string> servers;
+    for (const auto& e : config.config()) servers.push_back(e.server());
+    table.PlaceByHash(servers, config.vnodes(),
+                      {config.key_space().lower(), config.key_space().upper()});
+  }
+  for (const auto& e : config.config())
+    for (const auto& s : e.shards()) table.Insert(e.server(), {s.lower(), s.upper()});
+  return table;
+}
+
+void run(const char* name, Placement placement, uint32_t vnodes) {
+  ShardTable table = configure(placement, vnodes);
+
+  double burst_share = 0, worst_share = 0;
+  int bursts = 0;
+  vector<unsigned int> total(NUM_GROUPS);
+  for (unsigned int first = MIN_KEY; first + BURST - 1 <= MAX_KEY; first += BURST) {
+    vector<unsigned int> counts(NUM_GROUPS);
+    for (unsigned int id = first; id < first + BURST; id++) counts[table.OwnerOf(id)]++;
+    double share = (double)*max_element(counts.begin(), counts.end()) / BURST;
+    burst_share += share;
+    worst_share = max(worst_share, share);
+    bursts++;
+  }
+  for (unsigned int id = MIN_KEY; id <= MAX_KEY; id++) total[table.OwnerOf(id)]++;
+  double imbalance = *max_element(total.begin(), total.end()) / ((MAX_KEY - MIN_KEY + 1.0) / NUM_GROUPS);
+
+  mt19937 rng(1);
+  uniform_int_distribution<unsigned int> id(MIN_KEY, MAX_KEY);
+  vector<unsigned int> ids;
+  for (int i = 0; i < NUM_LOOKUPS; i++) ids.push_back(id(rng));
+  auto start = chrono::steady_clock::now();
+  size_t sum = 0;
+  for (unsigned int k : ids) sum += table.OwnerOf(k);
+  double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / NUM_LOOKUPS;
+  if (sum == 0) fprintf(stderr, "every id on the first group?\n");
+
+  printf("%-12s%13.1f%%%13.1f%%%12.2fx%12.1f\n", name, 100 * burst_share / bursts,
+         100 * worst_share, imbalance, ns);
+}
+
+int main() {
+  printf("%-12s%14s%14s%13s%12s\n", "placement", "burst share", "worst burst", "fullest", "ns/lookup");
+  run("range", Placement::RANGE, 0);
+  run("hash/16", Placement::HASH, 16);
+  run("hash/128", Placement::HASH, 128);
+  run("hash/512", Placement::HASH, 512);
+  printf("(%d groups, bursts of %u sequential ids over %llu .. %llu, perfect share %.1f%%)\n",
+         NUM_GROUPS, BURST, (unsigned long long)MIN_KEY, (unsigned long long)MAX_KEY,
+         100.0 / NUM_GROUPS);
+  return 0;
+}
@@ -0,0 +1,106 @@
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../../shardkv/shardkv.h"
+#include "../../shardkv_manager/shardkv_manager.h"
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+// Get throughput through the shardmanager under each read policy, with a
+// primary and a backup. Every server handles one Get at a time and spends
+// SERVICE_TIME on it, standing in for a server saturated by its reads, so
+// that the numbers show how much read capacity the backup adds rather than
+// how fast the (shared) CPU is. Every configuration runs in its own cluster,
+// on ports base .. base + 3.
+
+constexpr int NUM_KEYS = 1000;
+constexpr int NUM_CLIENTS = 16;
+const chrono::milliseconds SERVICE_TIME(1);
+const chrono::milliseconds RUN_TIME(3000);
+
+class SaturatedShardkvServer : public ShardkvServer {
+ public:
+  using ShardkvServer::ShardkvServer;
+
+  ::grpc::Status Get(::grpc::ServerContext* context, const ::GetRequest* request,
+                     ::GetResponse* response) override {
+    lock_guard<mutex> lock(_serving);
+    this_thread::sleep_for(SERVICE_TIME);
+    return ShardkvServer::Get(context, request, response);
+  }
+
+ private:
+  mutex _serving;
+};
+
+double run(const string& hostname, int base, ReadPolicy policy) {
+  string shardmaster = hostname + ":" + to_string(base);
+  string manager = hostname + ":" + to_string(base + 1);
+  string primary = hostname + ":" + to_string(base + 2);
+  string backup = hostname + ":" + to_string(base + 3);
+
+  start_shardmaster(shardmaster);
+  spawn_service_in_thread<ShardkvManager, const string&, const string&, const ReadPolicy&>(
+      manager, manager, shardmaster, policy);
+  spawn_service_in_thread<SaturatedShardkvServer, const string&, const string&>(
+      primary, primary, manager);
+  // let the primary become primary before the backup shows up
+  this_thread::sleep_for(chrono::milliseconds(500));
+  spawn_service_in_thread<SaturatedShardkvServer, const string&, const string&>(
+      backup, backup, manager);
+  assert(test_join(shardmaster, manager, true));
+  // wait for the view and the configuration to settle
+  this_thread::sleep_for(chrono::milliseconds(2000));
+  for (int i = 0; i < NUM_KEYS; i++)
+    assert(test_put(manager, "post_" + to_string(i), "some post content",
+                    "user_" + to_string(i), true));
+
+  atomic<bool> stop{false};
+  atomic<long> ops{0};
+  vector<thread> clients;
+  for (int c = 0; c < NUM_CLIENTS; c++) {
+    clients.emplace_back([&, c]() {
+      auto stub = ChannelPool::Shared().Stub<Shardkv>(manager);
+      long done = 0;
+      for (int i = c; !stop.load(memory_order_relaxed); i += NUM_CLIENTS) {
+        GetRequest req;
+        req.set_key("post_" + to_string(i % NUM_KEYS));
+        GetResponse res;
+        ::grpc::ClientContext cc;
+        if (stub->Get(&cc, req, &res).ok()) done++;
+      }
+      ops += done;
+    });
+  }
+  this_thread::sleep_for(RUN_TIME);
+  stop = true;
+  for (auto& t : clients) t.join();
+  return ops / chrono::duration<double>(RUN_TIME).count();
+}
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  printf("%-20s%14s\n", "read policy", "Gets/s");
+  auto report = [](const char* name, double ops) {
+    printf("%-20s%14.0f\n", name, ops);
+    fflush(stdout);
+  };
+  report("primary", run(hostname, 9400, ReadPolicy::PRIMARY));
+  report("round robin", run(hostname, 9410, ReadPolicy::ROUND_ROBIN));
+  report("least outstanding", run(hostname, 9420, ReadPolicy::LEAST_OUTSTANDING));
+  printf("(%d clients, %lld ms per Get, one Get at a time per server)\n", NUM_CLIENTS,
+         (long long)SERVICE_TIME.count());
+  // the servers run in detached threads
+  fflush(stdout);
+  _exit(0);
+}
@@ -0,0 +1,164 @@
+#include <unistd.h>
+#include <wait.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../../common/channel_pool.h"
+#include "../../common/shard_table.h"
+#include "../../shardkv/shardkv.h"
+#include "../../shardmaster/shardmaster.h"
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+// Keys moved, and time taken to move them, when a group joins or leaves a
+// loaded cluster, with Join and Leave splitting the key space evenly from
+// scratch (RebalanceMode::EVEN) and moving only what they need to
+// (RebalanceMode::MINIMAL). NUM_KEYS posts (first argument, 20000 by default)
+// are spread over the groups, then one more joins, or the last one leaves.
+// The move is over once a random sample of the posts that changed group can
+// all be read from their new one. Every run is a process of its own, so that
+// the groups of one do not slow down the next.
+
+constexpr int NUM_LOADERS = 8;
+constexpr int SAMPLE = 1000;
+constexpr int BASE_PORT = 9500;
+
+string post_key(int i) {
+  // several posts per id, since ids only go from MIN_KEY to MAX_KEY
+  return "post_" + to_string(i % (MAX_KEY + 1)) + "_" + to_string(i);
+}
+
+ShardTable query(const string& shardmaster, uint64_t* moved_keys) {
+  auto stub = ChannelPool::Shared().Stub<Shardmaster>(shardmaster);
+  ::grpc::ClientContext cc;
+  google::protobuf::Empty req;
+  QueryResponse response;
+  assert(stub->Query(&cc, req, &response).ok());
+  ShardTable table;
+  for (const auto& e : response.config())
+    for (const auto& s : e.shards()) table.Insert(e.server(), {s.lower(), s.upper()});
+  if (moved_keys) *moved_keys = response.moved_keys();
+  return table;
+}
+
+// groups before and after the change (one more is a Join, one less a Leave)
+void run(int before, int after, RebalanceMode mode, int num_keys) {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  int groups = max(before, after);
+  string shardmaster = hostname + ":" + to_string(BASE_PORT);
+  shardmaster_options_t options;
+  options.rebalance = mode;
+  start_shardmaster(shardmaster, options);
+  // the shardmanager of every group, and its only server
+  vector<string> managers, servers;
+  for (int g = 0; g < groups; g++) {
+    managers.push_back(hostname + ":" + to_string(BASE_PORT + 1 + g));
+    servers.push_back(hostname + ":" + to_string(BASE_PORT + 1 + groups + g));
+    start_shardmanager(managers[g], shardmaster);
+    start_shardkv(servers[g], managers[g]);
+  }
+  for (int g = 0; g < before; g++) assert(test_join(shardmaster, managers[g], true));
+  // wait for the views and the configuration to settle
+  this_thread::sleep_for(chrono::seconds(2));
+  // and connect to every server now, so that the time it takes is not
+  // counted in the move (the servers share the same channels)
+  for (const auto& server : servers) {
+    GetRequest req;
+    req.set_key("user_0");
+    GetResponse res;
+    ::grpc::ClientContext cc;
+    ChannelPool::Shared().Stub<Shardkv>(server)->Get(&cc, req, &res);
+  }
+
+  // the server of the group holding every post, in a configuration
+  auto server_of = [&](const ShardTable& table, int i) {
+    const string& manager = table.Server(table.OwnerOf(i % (MAX_KEY + 1)));
+    return servers[find(managers.begin(), managers.end(), manager) - managers.begin()];
+  };
+  ShardTable old_config = query(shardmaster, nullptr);
+  vector<thread> loaders;
+  for (int l = 0; l < NUM_LOADERS; l++) {
+    loaders.emplace_back([&, l]() {
+      for (int i = l; i < num_keys; i += NUM_LOADERS) {
+        auto stub = ChannelPool::Shared().Stub<Shardkv>(server_of(old_config, i));
+        PutRequest req;
+        req.set_key(post_key(i));
+        req.set_data("some post content that is not too long");
+        req.set_user("user_" + to_string(i % (MAX_KEY + 1)));
+        // a server may still be catching up with the configuration
+        while (true) {
+          google::protobuf::Empty res;
+          ::grpc::ClientContext cc;
+          if (stub->Put(&cc, req, &res).ok()) break;
+          this_thread::sleep_for(chrono::milliseconds(10));
+        }
+      }
+    });
+  }
+  for (auto& t : loaders) t.join();
+
+  auto start = chrono::steady_clock::now();
+  if (after > before)
+    assert(test_join(shardmaster, managers[before], true));
+  else
+    assert(test_leave(shardmaster, {managers[after]}, true));
+  uint64_t moved_ids;
+  ShardTable new_config = query(shardmaster, &moved_ids);
+  vector<int> moved;
+  for (int i = 0; i < num_keys; i++)
+    if (server_of(old_config, i) != server_of(new_config, i)) moved.push_back(i);
+  mt19937 rng(0);
+  shuffle(moved.begin(), moved.end(), rng);
+  vector<int> sample(moved.begin(), moved.begin() + min<size_t>(SAMPLE, moved.size()));
+
+  for (int i : sample) {
+    auto stub = ChannelPool::Shared().Stub<Shardkv>(server_of(new_config, i));
+    while (true) {
+      GetRequest req;
+      req.set_key(post_key(i));
+      GetResponse res;
+      ::grpc::ClientContext cc;
+      if (stub->Get(&cc, req, &res).ok()) break;
+      this_thread::sleep_for(chrono::milliseconds(10));
+    }
+  }
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  printf("%3d -> %-3d%-9s%10llu%10zu%10.1f%%%10.2f\n", before, after,
+         mode == RebalanceMode::EVEN ? "even" : "minimal", (unsigned long long)moved_ids,
+         moved.size(), 100.0 * moved.size() / num_keys, seconds);
+}
+
+int main(int argc, char** argv) {
+  int num_keys = argc > 1 ? atoi(argv[1]) : 20000;
+  printf("%-10s%-9s%10s%10s%11s%10s\n", "groups", "mode", "ids", "posts", "moved", "time (s)");
+  fflush(stdout);
+  for (auto [before, after] : vector<pair<int, int>>{{2, 3}, {10, 11}, {50, 49}}) {
+    for (RebalanceMode mode : {RebalanceMode::EVEN, RebalanceMode::MINIMAL}) {
+      pid_t pid = fork();
+      assert(pid != -1);
+      if (!pid) {
+        run(before, after, mode, num_keys);
+        // the servers run in detached threads
+        fflush(stdout);
+        _exit(0);
+      }
+      int status;
+      waitpid(pid, &status, 0);
+      assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+  }
+  printf("(%d posts over ids %llu .. %llu, one server per group)\n", num_keys,
+         (unsigned long long)MIN_KEY, (unsigned long long)MAX_KEY);
+  return 0;
+}
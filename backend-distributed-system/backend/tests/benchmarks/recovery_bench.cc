@@ -0,0 +1,167 @@
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../../shardkv/kvstore.h"
+#include "../../shardkv/mapped_snapshot.h"
+#include "../../shardkv/write_ahead_log.h"
+
+using namespace std;
+
+// Cost of the write-ahead log, without gRPC in the way: a KVStore journals
+// every change into a WriteAheadLog the way a ShardkvServer does.
+//
+// The first table is the Put throughput of concurrent writers under every
+// fsync policy, each writer waiting for its change to be durable before the
+// next one (as a client waits for its acknowledgement). BATCH shares every
+// fsync between the writers waiting on it, so it gets closer to INTERVAL the
+// more writers there are.
+//
+// The second table is the time it takes to reopen a log holding a number of
+// keys, each written UPDATES times, and serve a first Get: when all of it has
+// to be replayed, and when a snapshot has been taken, which is mapped and
+// read from in place.
+
+const chrono::milliseconds RUN_TIME(1000);
+const vector<int> WRITERS = {1, 4, 16};
+const vector<int> DATASET_KEYS = {10000, 50000, 100000, 200000};
+constexpr int UPDATES = 3;
+
+string make_dir() {
+  char dir_template[] = "/tmp/recovery_bench_XXXXXX";
+  return mkdtemp(dir_template);
+}
+
+// a store logging into wal, as a ShardkvServer sets it up
+void attach(KVStore& store, WriteAheadLog& wal) {
+  auto journal_mutex = make_shared<mutex>();
+  auto last_seq = make_shared<uint64_t>(0);
+  store.SetJournal([&wal, journal_mutex, last_seq](const mutation_t& m) {
+    lock_guard<mutex> lock(*journal_mutex);
+    uint64_t seq = m.seq ? m.seq : ++*last_seq;
+    wal.Append(m, seq);
+    return seq;
+  });
+}
+
+double run_writers(FsyncPolicy policy, int num_writers) {
+  string dir = make_dir();
+  double ops_per_second;
+  {
+    wal_options_t options;
+    options.dir = dir;
+    options.fsync = policy;
+    WriteAheadLog wal(options);
+    wal.Open([](shared_ptr<const MappedSnapshot>) {}, [](const mutation_t&) {});
+    KVStore store;
+    attach(store, wal);
+
+    atomic<bool> stop{false};
+    atomic<uint64_t> total{0};
+    vector<thread> writers;
+    for (int w = 0; w < num_writers; w++) {
+      writers.emplace_back([&, w]() {
+        uint64_t ops = 0;
+        for (int i = 0; !stop.load(memory_order_relaxed); i++) {
+          store.Put("post_" + to_string(w) + "_" + to_string(i % 1000),
+                    "some post content that is not too long", "user_1");
+          wal.WaitDurable();
+          ops++;
+        }
+        total += ops;
+      });
+    }
+    this_thread::sleep_for(RUN_TIME);
+    stop = true;
+    for (auto& t : writers) t.join();
+    ops_per_second = total.load() / chrono::duration<double>(RUN_TIME).count();
+  }
+  filesystem::remove_all(dir);
+  return ops_per_second;
+}
+
+// fills a log with num_keys keys, snapshots it if asked to, and returns how
+// long it takes to open it again and read a key (in ms)
+double recover(int num_keys, bool snapshot) {
+  string dir = make_dir();
+  wal_options_t options;
+  options.dir = dir;
+  // the durability of the writes is not what is measured here
+  options.fsync = FsyncPolicy::INTERVAL;
+  {
+    WriteAheadLog wal(options);
+    wal.Open([](shared_ptr<const MappedSnapshot>) {}, [](const mutation_t&) {});
+    KVStore store;
+    attach(store, wal);
+    for (int u = 0; u < UPDATES; u++) {
+      for (int i = 0; i < num_keys; i++) {
+        store.Put("post_" + to_string(i),
+                  "post " + to_string(i) + ", version " + to_string(u),
+                  "user_" + to_string(i % 100));
+      }
+    }
+    if (snapshot) {
+      wal.WriteSnapshot(store);
+    }
+  }
+
+  auto start = chrono::steady_clock::now();
+  double elapsed;
+  {
+    WriteAheadLog wal(options);
+    KVStore store;
+    wal.Open([&](shared_ptr<const MappedSnapshot> base) { store.SetBase(move(base)); },
+             [&](const mutation_t& m) { store.Apply(m); });
+    string value;
+    if (!store.Get("post_" + to_string(num_keys / 2), &value)) {
+      fprintf(stderr, "post_%d is missing\n", num_keys / 2);
+    }
+    elapsed = chrono::duration<double, milli>(chrono::steady_clock::now() - start)
+                  .count();
+    if (store.Size() != (size_t)num_keys) {
+      fprintf(stderr, "recovered %zu keys out of %d\n", store.Size(), num_keys);
+    }
+  }
+  filesystem::remove_all(dir);
+  return elapsed;
+}
+
+int main() {
+  printf("%-22s", "fsync \\ writers");
+  for (int n : WRITERS) printf("%14d", n);
+  printf("\n");
+  const vector<pair<const char*, FsyncPolicy>> policies = {
+      {"write", FsyncPolicy::WRITE},
+      {"batch", FsyncPolicy::BATCH},
+      {"interval (100ms)", FsyncPolicy::INTERVAL}};
+  for (auto& [name, policy] : policies) {
+    printf("%-22s", name);
+    for (int n : WRITERS) {
+      printf("%14.0f", run_writers(policy, n));
+      fflush(stdout);
+    }
+    printf("\n");
+  }
+  printf("(Puts/s, each writer waiting for its Put to be durable)\n\n");
+
+  printf("%-22s", "recovery \\ keys");
+  for (int n : DATASET_KEYS) printf("%14d", n);
+  printf("\n");
+  for (bool snapshot : {false, true}) {
+    printf("%-22s", snapshot ? "mapped snapshot" : "log only");
+    for (int n : DATASET_KEYS) {
+      printf("%14.1f", recover(n, snapshot));
+      fflush(stdout);
+    }
+    printf("\n");
+  }
+  printf("(ms to reopen the log and serve a Get, every key written %d times)\n", UPDATES);
+  return 0;
+}
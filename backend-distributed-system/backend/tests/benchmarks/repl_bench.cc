@@ -0,0 +1,122 @@
+#include <chrono>
+#include <cstdio>
+#include <iterator>
+#include <random>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../../common/common.h"
+#include "../../common/tokenizer.h"
+#include "../../repl/regexcommand.h"
+#include "../../repl/repl.h"
+#include "../../repl/tokencommand.h"
+
+using namespace std;
+
+// Lines/s the client REPL gets through a script of commands, with the
+// commands doing nothing but pulling their arguments out of the line. "regex"
+// is how it used to be: every command a RegexCommand tried in turn, and
+// arguments split on a \s+ regex. "tokens" is the dispatch on the first word
+// to TokenCommands, which read their arguments with a Tokenizer.
+
+constexpr int NUM_LINES = 1000000;
+
+vector<string> old_split(const string& s) {
+  vector<string> v;
+  regex ws_re("\\s+");
+  copy(sregex_token_iterator(s.begin(), s.end(), ws_re, -1), sregex_token_iterator(),
+       back_inserter(v));
+  return v;
+}
+
+// total length of the arguments handled, so that none of it is optimized out
+size_t handled = 0;
+
+class OldCommand : public RegexCommand {
+ public:
+  explicit OldCommand(const string& pattern) : RegexCommand(pattern) {}
+  void Handle(const string& line) override {
+    for (const string& token : old_split(line)) handled += token.size();
+  }
+  void PrintHelpMessage() override {}
+};
+
+class NewCommand : public TokenCommand {
+ public:
+  NewCommand(string name, size_t min_args, size_t max_args = SIZE_MAX)
+      : TokenCommand(move(name), min_args, max_args) {}
+  void Handle(const string& line) override {
+    Tokenizer tokens(line);
+    for (string_view token; tokens.Next(&token);) handled += token.size();
+  }
+  void PrintHelpMessage() override {}
+};
+
+class NewAddressCommand : public NewCommand {
+ public:
+  using NewCommand::NewCommand;
+
+ protected:
+  bool ValidArg(size_t /*i*/, string_view arg) override { return IsAddress(arg); }
+};
+
+double run(Repl& repl, const string& script) {
+  istringstream in(script);
+  auto start = chrono::steady_clock::now();
+  for (string line; getline(in, line);) repl.ProcessLine(line);
+  return NUM_LINES / chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+int main() {
+  // a mix of what the client is given, mostly gets and puts
+  mt19937 rng(1);
+  uniform_int_distribution<int> id(0, 1000000), op(0, 9);
+  string script;
+  for (int i = 0; i < NUM_LINES; i++) {
+    string key = "post_" + to_string(id(rng));
+    switch (op(rng)) {
+      case 0: script += "put " + key + " a post about nothing user_" + to_string(id(rng)); break;
+      case 1: script += "append " + key + " and more"; break;
+      case 2: script += "del " + key; break;
+      case 3: script += "mget " + key + " user_1 user_2 user_3"; break;
+      case 4: script += "join server" + to_string(id(rng) % 8) + ":8000"; break;
+      default: script += "get " + key; break;
+    }
+    script += '\n';
+  }
+
+  Repl old_repl;
+  vector<OldCommand> old_commands = {
+      OldCommand("get .+"),  OldCommand("put .+"),  OldCommand("append .+"),
+      OldCommand("del .+"),  OldCommand("mget .+"), OldCommand("mdel .+"),
+      OldCommand("join .*:\\d+"), OldCommand("leave .*:\\d+( .*:\\d+)*"),
+      OldCommand("move .*:\\d+ \\d+ \\d+"), OldCommand("query"),
+  };
+  for (auto& c : old_commands) old_repl.AddCommand(c);
+
+  Repl new_repl;
+  vector<NewCommand> new_commands = {
+      NewCommand("get", 1, 1), NewCommand("put", 2),  NewCommand("append", 2),
+      NewCommand("del", 1, 1), NewCommand("mget", 1), NewCommand("mdel", 1),
+      NewCommand("move", 3, 3), NewCommand("query", 0, 0),
+  };
+  vector<NewAddressCommand> address_commands = {
+      NewAddressCommand("join", 1, 1), NewAddressCommand("leave", 1),
+  };
+  for (auto& c : new_commands) new_repl.AddCommand(c);
+  for (auto& c : address_commands) new_repl.AddCommand(c);
+
+  double old_rate = run(old_repl, script);
+  size_t old_handled = handled;
+  handled = 0;
+  double new_rate = run(new_repl, script);
+
+  if (old_handled != handled)
+    fprintf(stderr, "the two disagree: %zu vs %zu bytes handled\n", old_handled, handled);
+  printf("%-10s%14.0f\n", "regex", old_rate);
+  printf("%-10s%14.0f\n", "tokens", new_rate);
+  printf("(lines/s)\n");
+  return 0;
+}
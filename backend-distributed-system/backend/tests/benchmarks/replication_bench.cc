@@ -0,0 +1,103 @@
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../../shardkv/shardkv.h"
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+// Write throughput and latency of a ShardkvServer primary with no backup,
+// and with a backup in QUEUED and ACKED replication mode. Clients send Puts
+// straight to the primary so that the shardmanager does not get in the way.
+// Every configuration runs in its own shardmaster/shardmanager/shardkv
+// cluster, on ports base .. base + 3.
+
+constexpr int NUM_KEYS = 1000;
+constexpr int NUM_CLIENTS = 8;
+const chrono::milliseconds RUN_TIME(3000);
+
+struct Result {
+  double ops_per_sec;
+  double p50_us;
+  double p99_us;
+};
+
+Result run(const string& hostname, int base, bool with_backup, ReplicationMode mode) {
+  string shardmaster = hostname + ":" + to_string(base);
+  string manager = hostname + ":" + to_string(base + 1);
+  string primary = hostname + ":" + to_string(base + 2);
+  string backup = hostname + ":" + to_string(base + 3);
+
+  start_shardmaster(shardmaster);
+  start_shardmanager(manager, shardmaster);
+  spawn_service_in_thread<ShardkvServer, const string&, const string&, const ReplicationMode&>(
+      primary, primary, manager, mode);
+  // let the primary become primary before the backup shows up
+  this_thread::sleep_for(chrono::milliseconds(500));
+  if (with_backup)
+    spawn_service_in_thread<ShardkvServer, const string&, const string&, const ReplicationMode&>(
+        backup, backup, manager, mode);
+  assert(test_join(shardmaster, manager, true));
+  // wait for the view and the configuration to settle
+  this_thread::sleep_for(chrono::milliseconds(2000));
+
+  atomic<bool> stop{false};
+  vector<vector<double>> latencies(NUM_CLIENTS);
+  vector<thread> clients;
+  for (int c = 0; c < NUM_CLIENTS; c++) {
+    clients.emplace_back([&, c]() {
+      auto stub = Shardkv::NewStub(grpc::CreateChannel(primary, grpc::InsecureChannelCredentials()));
+      int i = c;
+      while (!stop.load(memory_order_relaxed)) {
+        int id = i % NUM_KEYS;
+        i += NUM_CLIENTS;
+        PutRequest req;
+        req.set_key("post_" + to_string(id));
+        req.set_data("some post content that is not too long");
+        req.set_user("user_" + to_string(id));
+        google::protobuf::Empty res;
+        ::grpc::ClientContext cc;
+        auto start = chrono::steady_clock::now();
+        auto status = stub->Put(&cc, req, &res);
+        auto end = chrono::steady_clock::now();
+        if (status.ok())
+          latencies[c].push_back(chrono::duration<double, micro>(end - start).count());
+      }
+    });
+  }
+  this_thread::sleep_for(RUN_TIME);
+  stop = true;
+  for (auto& t : clients) t.join();
+
+  vector<double> all;
+  for (auto& l : latencies) all.insert(all.end(), l.begin(), l.end());
+  sort(all.begin(), all.end());
+  if (all.empty()) return {0, 0, 0};
+  return {all.size() / chrono::duration<double>(RUN_TIME).count(),
+          all[all.size() / 2], all[all.size() * 99 / 100]};
+}
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  printf("%-22s%14s%14s%14s\n", "configuration", "ops/s", "p50 (us)", "p99 (us)");
+  auto report = [](const char* name, Result r) {
+    printf("%-22s%14.0f%14.0f%14.0f\n", name, r.ops_per_sec, r.p50_us, r.p99_us);
+    fflush(stdout);
+  };
+  report("no backup", run(hostname, 9100, false, ReplicationMode::ACKED));
+  report("backup, queued", run(hostname, 9110, true, ReplicationMode::QUEUED));
+  report("backup, acked", run(hostname, 9120, true, ReplicationMode::ACKED));
+  printf("(%d clients, Puts on post_<id> keys)\n", NUM_CLIENTS);
+  // the servers run in detached threads
+  fflush(stdout);
+  _exit(0);
+}
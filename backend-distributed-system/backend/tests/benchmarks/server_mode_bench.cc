@@ -0,0 +1,146 @@
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../../common/server_options.h"
+#include "../../shardkv/shardkv.h"
+#include "../../shardkv_manager/shardkv_manager.h"
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+// Puts and Gets per second through the shardmanager, with the shardmaster,
+// the manager, a primary and its backup (acked replication) all served in
+// SYNC and then in CALLBACK mode. The clients keep a fixed number of calls
+// outstanding with the asynchronous stub, so that the concurrency is that
+// of the calls and not of client threads. In SYNC mode every outstanding
+// call holds a thread of the manager for as long as the primary takes, and
+// every Put a thread of the primary until the backup acked it; in CALLBACK
+// mode neither waits on a thread. Every mode runs in its own cluster, on
+// ports base .. base + 3.
+
+using Empty = google::protobuf::Empty;
+
+constexpr int NUM_KEYS = 1000;
+const int CONCURRENCY[] = {16, 64, 256};
+const chrono::milliseconds RUN_TIME(3000);
+
+// serves a Server in a detached thread, through its CallbackService in
+// CALLBACK mode
+template <typename Server, typename CallbackService, typename... Args>
+void serve(const string& addr, const server_options_t& options, Args... args) {
+  thread thr([=]() {
+    Server server(args...);
+    CallbackService callback_service(&server);
+    auto s = StartServer(addr, options,
+                         options.mode == ServerMode::CALLBACK ? static_cast<::grpc::Service*>(&callback_service)
+                                                              : &server);
+    assert(s != nullptr);
+    s->Wait();
+  });
+  thr.detach();
+  this_thread::sleep_for(chrono::milliseconds(100));
+}
+
+typedef struct slot {
+  unique_ptr<::grpc::ClientContext> cc;
+  PutRequest put;
+  Empty put_response;
+  GetRequest get;
+  GetResponse get_response;
+  // calls issued by the slot
+  long issued = 0;
+} slot_t;
+
+// the calls per second the manager answers with outstanding calls in
+// flight, Puts if writes and Gets otherwise
+double drive(const string& manager, int outstanding, bool writes) {
+  auto stub = ChannelPool::Shared().Stub<Shardkv>(manager);
+  atomic<bool> stop{false};
+  atomic<long> ops{0};
+  mutex m;
+  condition_variable stopped;
+  int running = outstanding;
+  vector<slot_t> slots(outstanding);
+
+  function<void(int)> issue = [&](int i) {
+    slot_t& s = slots[i];
+    s.cc = make_unique<::grpc::ClientContext>();
+    long n = i + outstanding * s.issued++;
+    auto done = [&, i](::grpc::Status status) {
+      if (status.ok()) ops++;
+      if (!stop.load(memory_order_relaxed)) {
+        issue(i);
+        return;
+      }
+      lock_guard<mutex> lock(m);
+      if (--running == 0) stopped.notify_all();
+    };
+    if (writes) {
+      s.put.set_key("post_" + to_string(n % NUM_KEYS));
+      s.put.set_data("some post content");
+      s.put.set_user("user_" + to_string(n % NUM_KEYS));
+      stub->async()->Put(s.cc.get(), &s.put, &s.put_response, done);
+    } else {
+      s.get.set_key("post_" + to_string(n % NUM_KEYS));
+      stub->async()->Get(s.cc.get(), &s.get, &s.get_response, done);
+    }
+  };
+  for (int i = 0; i < outstanding; i++) issue(i);
+  this_thread::sleep_for(RUN_TIME);
+  long counted = ops;
+  stop = true;
+  unique_lock<mutex> lock(m);
+  stopped.wait(lock, [&]() { return running == 0; });
+  return counted / chrono::duration<double>(RUN_TIME).count();
+}
+
+void run(const string& hostname, int base, ServerMode mode, const char* name) {
+  string shardmaster = hostname + ":" + to_string(base);
+  string manager = hostname + ":" + to_string(base + 1);
+  string primary = hostname + ":" + to_string(base + 2);
+  string backup = hostname + ":" + to_string(base + 3);
+
+  server_options_t options;
+  options.mode = mode;
+  serve<StaticShardmaster, ShardmasterCallbackService>(shardmaster, options, shardmaster_options_t());
+  serve<ShardkvManager, ShardkvManagerCallbackService>(manager, options, manager, shardmaster, ReadPolicy::PRIMARY);
+  serve<ShardkvServer, ShardkvCallbackService>(primary, options, primary, manager, ReplicationMode::ACKED,
+                                               wal_options_t());
+  // let the primary become primary before the backup shows up
+  this_thread::sleep_for(chrono::milliseconds(500));
+  serve<ShardkvServer, ShardkvCallbackService>(backup, options, backup, manager, ReplicationMode::ACKED,
+                                               wal_options_t());
+  assert(test_join(shardmaster, manager, true));
+  // wait for the view and the configuration to settle
+  this_thread::sleep_for(chrono::milliseconds(2000));
+  for (int i = 0; i < NUM_KEYS; i++)
+    assert(test_put(manager, "post_" + to_string(i), "some post content", "user_" + to_string(i), true));
+
+  for (int outstanding : CONCURRENCY) {
+    double puts = drive(manager, outstanding, true);
+    double gets = drive(manager, outstanding, false);
+    printf("%-10s%12d%12.0f%12.0f\n", name, outstanding, puts, gets);
+    fflush(stdout);
+  }
+}
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  printf("%-10s%12s%12s%12s\n", "mode", "outstanding", "Puts/s", "Gets/s");
+  run(hostname, 9600, ServerMode::SYNC, "sync");
+  run(hostname, 9610, ServerMode::CALLBACK, "callback");
+  // the servers run in detached threads
+  fflush(stdout);
+  _exit(0);
+}
@@ -0,0 +1,68 @@
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../../common/common.h"
+#include "../../common/shard_table.h"
+
+using namespace std;
+
+// Cost of finding the server of a key in a ShardTable holding many ranges of
+// a 64-bit key space, cut at random points and spread over NUM_SERVERS
+// servers, as a key-value server or client holds them after a shardmaster
+// has split shards a lot. Also how long building the table takes, from the
+// shards of every server as a configuration lists them.
+
+constexpr int NUM_SERVERS = 64;
+constexpr int NUM_LOOKUPS = 4000000;
+constexpr uint64_t KEY_SPACE_UPPER = UINT64_MAX - 1;
+
+void run(size_t num_ranges) {
+  mt19937_64 rng(num_ranges);
+  uniform_int_distribution<uint64_t> key(0, KEY_SPACE_UPPER);
+  vector<uint64_t> cuts;
+  while (cuts.size() < num_ranges - 1) {
+    for (size_t i = cuts.size(); i < num_ranges - 1; i++) cuts.push_back(key(rng));
+    sort(cuts.begin(), cuts.end());
+    cuts.erase(unique(cuts.begin(), cuts.end()), cuts.end());
+    cuts.erase(remove(cuts.begin(), cuts.end(), KEY_SPACE_UPPER), cuts.end());
+  }
+  vector<string> servers;
+  for (int s = 0; s < NUM_SERVERS; s++) servers.push_back("server" + to_string(s) + ":8000");
+  vector<vector<shard_t>> shards(NUM_SERVERS);
+  uint64_t lower = 0;
+  for (size_t i = 0; i < num_ranges; i++) {
+    uint64_t upper = i < cuts.size() ? cuts[i] : KEY_SPACE_UPPER;
+    shards[rng() % NUM_SERVERS].push_back({lower, upper});
+    lower = upper + 1;
+  }
+
+  auto start = chrono::steady_clock::now();
+  ShardTable table;
+  table.Assign(servers, shards);
+  double build_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+  assert(table.NumShards() == num_ranges);
+
+  vector<uint64_t> keys;
+  for (int i = 0; i < NUM_LOOKUPS; i++) keys.push_back(key(rng));
+  start = chrono::steady_clock::now();
+  size_t sum = 0;
+  for (uint64_t k : keys) sum += table.OwnerOf(k);
+  double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / NUM_LOOKUPS;
+  if (sum == 0) fprintf(stderr, "every key on the first server?\n");
+
+  // the lowers, uppers and owners of every shard
+  double bytes = 2 * sizeof(uint64_t) + sizeof(uint16_t);
+  printf("%-10zu%12.1f%14.1f%12.1f\n", num_ranges, ns, build_ms, bytes * num_ranges / (1 << 20));
+}
+
+int main() {
+  printf("%-10s%12s%14s%12s\n", "ranges", "ns/lookup", "build (ms)", "MB");
+  for (size_t n : {1000, 10000, 100000, 1000000}) run(n);
+  printf("(%d random keys of a 64-bit key space, ranges over %d servers)\n", NUM_LOOKUPS, NUM_SERVERS);
+  return 0;
+}
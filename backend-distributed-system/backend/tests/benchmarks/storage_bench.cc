@@ -0,0 +1,78 @@
+#include <malloc.h>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../../shardkv/entry_table.h"
+
+using namespace std;
+
+// Memory per key and single-threaded Get/Put throughput of the table every
+// KVStore stripe keeps its entries in: the previous std::unordered_map (one
+// node allocation per key) against EntryTable (entries packed in slabs,
+// open-addressing index). Keys and entries look like posts: post_<id>, a
+// short post and its author. Memory is what malloc hands out for the table,
+// the keys and the values.
+
+const vector<size_t> NUM_KEYS = {1000000, 10000000};
+constexpr size_t NUM_OPS = 2000000;
+
+size_t heap_bytes() {
+  return mallinfo2().uordblks + mallinfo2().hblkhd;
+}
+
+string key_of(size_t i) { return "post_" + to_string(i); }
+
+template <typename Table>
+void run(const char* name, size_t num_keys) {
+  size_t before = heap_bytes();
+  auto start = chrono::steady_clock::now();
+  auto table = make_unique<Table>();
+  for (size_t i = 0; i < num_keys; i++) {
+    entry_t& e = (*table)[key_of(i)];
+    e.value = "post " + to_string(i);
+    e.author = "user_" + to_string(i % 1000);
+    e.seq = i + 1;
+  }
+  double load = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  double bytes = (double)(heap_bytes() - before) / num_keys;
+
+  vector<string> keys;
+  mt19937 rng(1);
+  uniform_int_distribution<size_t> key_dist(0, num_keys - 1);
+  for (size_t i = 0; i < NUM_OPS; i++)
+    keys.push_back(key_of(key_dist(rng)));
+
+  start = chrono::steady_clock::now();
+  size_t found = 0;
+  for (const auto& k : keys) {
+    auto it = table->find(k);
+    found += it != table->end() && !it->second.value.empty();
+  }
+  double gets = NUM_OPS / chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+  start = chrono::steady_clock::now();
+  for (const auto& k : keys) {
+    entry_t& e = (*table)[k];
+    e.value = "updated";
+    e.seq++;
+  }
+  double puts = NUM_OPS / chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+  if (found != NUM_OPS)
+    fprintf(stderr, "%zu keys missing\n", NUM_OPS - found);
+  printf("%-16s%12zu%14.1f%14.0f%14.0f%12.1f\n", name, num_keys, bytes, gets, puts, load);
+  fflush(stdout);
+}
+
+int main() {
+  printf("%-16s%12s%14s%14s%14s%12s\n", "table", "keys", "bytes/key", "Get/s", "Put/s", "load (s)");
+  for (size_t n : NUM_KEYS) {
+    run<unordered_map<string, entry_t>>("unordered_map", n);
+    run<EntryTable>("EntryTable", n);
+  }
+  return 0;
+}
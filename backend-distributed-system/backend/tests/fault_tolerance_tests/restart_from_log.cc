@@ -0,0 +1,123 @@
+#include <unistd.h>
+#include <cassert>
+#include <filesystem>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+class test_exception : public std::exception {
+    std::string test_description;
+public:
+    test_exception(std::string_view test_description) : test_description(test_description) {};
+    const char * what() const noexcept override {
+        return test_description.c_str();
+    }
+};
+
+// puts post_<first> .. post_<last - 1>, all by user_1
+void put_posts(const string& addr, int first, int last) {
+  for (int i = first; i < last; i++) {
+    if (!test_put(addr, "post_" + to_string(i), "post " + to_string(i), "user_1", true)) {
+      throw test_exception("test_put(addr, \"post_" + to_string(i) + "\", ...)");
+    }
+  }
+}
+
+void get_posts(const string& addr, int first, int last) {
+  for (int i = first; i < last; i++) {
+    if (!test_get(addr, "post_" + to_string(i), "post " + to_string(i))) {
+      throw test_exception("test_get(addr, \"post_" + to_string(i) + "\", ...)");
+    }
+  }
+}
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  string shardmaster_addr = hostname + ":8080";
+  start_shardmaster(shardmaster_addr);
+
+  string skv_1 = hostname + ":13000";
+  string sv1_primary = hostname + ":13001";
+  string sv1_backup = hostname + ":13002";
+
+  // every server keeps its write-ahead log in its own directory. the backup
+  // snapshots its store all the time, so that it restarts from a snapshot
+  char primary_template[] = "/tmp/shardkv_primary_XXXXXX";
+  char backup_template[] = "/tmp/shardkv_backup_XXXXXX";
+  vector<string> primary_flags = {"--data-dir=" + string(mkdtemp(primary_template))};
+  vector<string> backup_flags = {"--data-dir=" + string(mkdtemp(backup_template)),
+                                 "--snapshot-mb=0"};
+
+  start_shardmanager(skv_1, shardmaster_addr);
+
+  pid_t primary = start_shardkv_proc(sv1_primary, skv_1, primary_flags);
+  // wait to make sure the primary is set
+  std::this_thread::sleep_for(std::chrono::milliseconds{1000});
+  pid_t backup = start_shardkv_proc(sv1_backup, skv_1, backup_flags);
+
+  std::chrono::milliseconds timespan(5000);
+  std::this_thread::sleep_for(timespan);
+  try {
+    if (!test_join(shardmaster_addr, skv_1, true)) {
+        throw test_exception("test_join(shardmaster_addr, skv_1, true)");
+    }
+    // sleep to allow shardkvs to query and get initial config
+    std::this_thread::sleep_for(std::chrono::milliseconds{2000});
+
+    put_posts(skv_1, 0, 10);
+    // leave the backup time to snapshot them
+    std::this_thread::sleep_for(std::chrono::milliseconds{2000});
+
+    // the backup dies and misses some writes
+    kill(backup, SIGKILL);
+    std::this_thread::sleep_for(timespan);
+    put_posts(skv_1, 10, 20);
+
+    // it comes back with what it had, and catches up with the primary
+    backup = start_shardkv_proc(sv1_backup, skv_1, backup_flags);
+    std::this_thread::sleep_for(timespan);
+    put_posts(skv_1, 20, 30);
+
+    // the backup takes over from the primary, and has every key
+    kill(primary, SIGKILL);
+    std::this_thread::sleep_for(timespan);
+    get_posts(skv_1, 0, 30);
+    string posts;
+    for (int i = 0; i < 30; i++) {
+      posts += "post_" + to_string(i) + ",";
+    }
+    if (!test_get(skv_1, "user_1_posts", posts)) {
+        throw test_exception("test_get(skv_1, \"user_1_posts\", posts)");
+    }
+
+    // the old primary comes back as the backup and catches up in turn
+    primary = start_shardkv_proc(sv1_primary, skv_1, primary_flags);
+    std::this_thread::sleep_for(timespan);
+    put_posts(skv_1, 30, 40);
+
+    // and takes over in turn, with every key, once the backup dies
+    kill(backup, SIGKILL);
+    std::this_thread::sleep_for(timespan);
+    get_posts(skv_1, 0, 40);
+  } catch (test_exception& e) {
+      std::cout << "Test failed: " << std::endl;
+      std::cout << e.what() << std::endl;
+
+      kill(primary, SIGKILL);
+      kill(backup, SIGKILL);
+      assert(true==false);
+  }
+  kill(primary, SIGKILL);
+  kill(backup, SIGKILL);
+  for (const auto& flags : {primary_flags, backup_flags}) {
+    std::filesystem::remove_all(flags[0].substr(flags[0].find('=') + 1));
+  }
+}
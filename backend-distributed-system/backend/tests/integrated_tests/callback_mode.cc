@@ -0,0 +1,100 @@
+#include <unistd.h>
+#include <cassert>
+#include <optional>
+#include <string>
+#include <thread>
+
+#include "../../common/server_options.h"
+#include "../../shardkv/shardkv.h"
+#include "../../shardkv_manager/shardkv_manager.h"
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+// like spawn_service_in_thread, but serves the server through its callback
+// service (ServerMode::CALLBACK)
+template <typename Server, typename CallbackService, typename... Args>
+void spawn_callback_service_in_thread(const string& addr, Args... args) {
+  thread thr([=]() {
+    Server server(args...);
+    CallbackService service(&server);
+    server_options_t options;
+    options.mode = ServerMode::CALLBACK;
+    auto s = StartServer(addr, options, &service);
+    assert(s != nullptr);
+    s->Wait();
+  });
+  thr.detach();
+  this_thread::sleep_for(chrono::milliseconds(100));
+}
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  string shardmaster_addr = hostname + ":8080";
+  spawn_callback_service_in_thread<StaticShardmaster, ShardmasterCallbackService>(shardmaster_addr,
+                                                                                  shardmaster_options_t());
+
+  const string skv_1 = hostname + ":8081";
+  const string skv_2 = hostname + ":8082";
+  const string sv1 = hostname + ":8001";
+  const string sv2 = hostname + ":8002";
+  const string sv3 = hostname + ":8003";
+
+  // reads of skv_1 alternate between its primary and its backup
+  spawn_callback_service_in_thread<ShardkvManager, ShardkvManagerCallbackService>(skv_1, skv_1, shardmaster_addr,
+                                                                                  ReadPolicy::ROUND_ROBIN);
+  spawn_callback_service_in_thread<ShardkvManager, ShardkvManagerCallbackService>(skv_2, skv_2, shardmaster_addr,
+                                                                                  ReadPolicy::PRIMARY);
+  // writes to sv1 finish once sv2 acked them
+  spawn_callback_service_in_thread<ShardkvServer, ShardkvCallbackService>(sv1, sv1, skv_1, ReplicationMode::ACKED,
+                                                                          wal_options_t());
+  this_thread::sleep_for(chrono::milliseconds(500));
+  spawn_callback_service_in_thread<ShardkvServer, ShardkvCallbackService>(sv2, sv2, skv_1, ReplicationMode::ACKED,
+                                                                          wal_options_t());
+  spawn_callback_service_in_thread<ShardkvServer, ShardkvCallbackService>(sv3, sv3, skv_2, ReplicationMode::ACKED,
+                                                                          wal_options_t());
+
+  assert(test_join(shardmaster_addr, skv_1, true));
+  assert(test_join(shardmaster_addr, skv_2, true));
+  assert(test_query(shardmaster_addr, {{skv_1, {{0, 500}}}, {skv_2, {{501, 1000}}}}));
+  this_thread::sleep_for(chrono::milliseconds(2000));
+
+  // skv_1 has keys 0-500, skv_2 has 501-1000
+  assert(test_put(skv_1, "user_1", "alice", "", true));
+  assert(test_put(skv_1, "post_3", "hi", "user_1", true));
+  assert(test_append(skv_1, "post_3", "!", true));
+  // whichever of primary and backup answers has the writes
+  for (int i = 0; i < 4; i++) {
+    assert(test_get(skv_1, "user_1", "alice"));
+    assert(test_get(skv_1, "post_3", "hi!"));
+  }
+  assert(test_put(skv_1, "user_600", "bob", "", false));
+  assert(test_get(skv_1, "user_600", nullopt));
+
+  assert(test_multi_put(skv_1, {{"user_2", "carol", ""}, {"post_4", "yo", "user_2"}, {"post_5", "hey", "user_900"}},
+                        true));
+  assert(test_multi_get(skv_1, {"user_2", "post_4", "post_5", "user_7"}, {"carol", "yo", "hey", nullopt}));
+  // the post of a user of skv_2 is listed there
+  assert(test_get(skv_2, "user_900_posts", "post_5,"));
+
+  assert(test_delete(skv_1, "post_3", true));
+  assert(test_delete(skv_1, "post_3", false));
+  assert(test_multi_delete(skv_1, {"user_2", "post_4", "user_8"}, 2));
+  for (int i = 0; i < 2; i++) {
+    assert(test_get(skv_1, "post_3", nullopt));
+    assert(test_multi_get(skv_1, {"user_2", "post_4", "user_1"}, {nullopt, nullopt, "alice"}));
+  }
+
+  // the shardmaster answers in callback mode too
+  assert(test_move(shardmaster_addr, skv_2, {400, 500}, true));
+  assert(test_query(shardmaster_addr, {{skv_1, {{0, 399}}}, {skv_2, {{400, 500}, {501, 1000}}}}));
+  this_thread::sleep_for(chrono::milliseconds(1000));
+  assert(test_put(skv_2, "user_450", "dave", "", true));
+  assert(test_get(skv_2, "user_450", "dave"));
+  assert(test_get(skv_2, "user_1", nullopt));
+
+  return 0;
+}
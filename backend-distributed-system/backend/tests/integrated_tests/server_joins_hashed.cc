@@ -0,0 +1,93 @@
+#include <unistd.h>
+#include <google/protobuf/empty.pb.h>
+#include <cassert>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "../../common/channel_pool.h"
+#include "../../common/hash_ring.h"
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+constexpr uint32_t VNODES = 64;
+constexpr unsigned int NUM_POSTS = 40;
+
+QueryResponse query(const string& shardmaster_addr) {
+  auto stub = ChannelPool::Shared().Stub<Shardmaster>(shardmaster_addr);
+  ::grpc::ClientContext cc;
+  google::protobuf::Empty req;
+  QueryResponse response;
+  assert(stub->Query(&cc, req, &response).ok());
+  return response;
+}
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  string shardmaster_addr = hostname + ":8080";
+  shardmaster_options_t options;
+  options.placement = Placement::HASH;
+  options.vnodes = VNODES;
+  start_shardmaster(shardmaster_addr, options);
+
+  string skv_1 = hostname + ":13000";
+  string skv_2 = hostname + ":12000";
+
+  string sv1 = hostname + ":13001";
+  string sv2 = hostname + ":12001";
+
+  start_shardmanager(skv_1, shardmaster_addr);
+  start_shardmanager(skv_2, shardmaster_addr);
+  start_shardkvs({sv1}, skv_1);
+  start_shardkvs({sv2}, skv_2);
+
+  // servers are on the ring, and hold no shards
+  assert(test_join(shardmaster_addr, skv_1, true));
+  QueryResponse config = query(shardmaster_addr);
+  assert(config.placement() == PLACEMENT_HASH);
+  assert(config.vnodes() == VNODES);
+  assert(config.config_size() == 1 && config.config(0).server() == skv_1);
+  assert(config.config(0).shards_size() == 0);
+  assert(test_move(shardmaster_addr, skv_1, {0, 10}, false));
+
+  // sleep to allow shardkvs to query and get initial config
+  std::chrono::milliseconds timespan(5000);
+  std::this_thread::sleep_for(timespan);
+
+  for (unsigned int i = 0; i < NUM_POSTS; i++) {
+    string post = "post_" + to_string(i);
+    assert(test_put(skv_1, post, "content " + to_string(i), "user_1", true));
+  }
+
+  // when a new server joins, it takes the posts next to its points on the
+  // ring, and the others stay
+  assert(test_join(shardmaster_addr, skv_2, true));
+  HashRing ring;
+  ring.Build({skv_1, skv_2}, VNODES);
+  unsigned int moved = 0;
+  for (unsigned int key = MIN_KEY; key <= MAX_KEY; key++) {
+    if (ring.OwnerOf(key) == 1) moved++;
+  }
+  config = query(shardmaster_addr);
+  assert(config.moved_keys() == moved);
+  assert(moved > 0 && moved < MAX_KEY - MIN_KEY + 1);
+
+  // wait for the keys to transfer
+  std::this_thread::sleep_for(timespan);
+  for (unsigned int i = 0; i < NUM_POSTS; i++) {
+    string post = "post_" + to_string(i);
+    string content = "content " + to_string(i);
+    if (ring.OwnerOf(i) == 1) {
+      assert(test_get(skv_1, post, nullopt));
+      assert(test_get(skv_2, post, content));
+    } else {
+      assert(test_get(skv_1, post, content));
+      assert(test_get(skv_2, post, nullopt));
+    }
+  }
+}
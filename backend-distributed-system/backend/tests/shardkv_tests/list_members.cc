@@ -0,0 +1,90 @@
+#include <unistd.h>
+#include <cassert>
+#include <string>
+#include <vector>
+
+#include "../../common/channel_pool.h"
+#include "../../shardkv/shardkv.h"
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+// one page of the set at key, from cursor. returns false if the request
+// failed
+bool list_page(const string& addr, const string& key, uint64_t cursor, uint32_t limit, vector<string>* members,
+               uint64_t* next) {
+  auto stub = ChannelPool::Shared().Stub<Shardkv>(addr);
+  ::grpc::ClientContext cc;
+  ListMembersRequest request;
+  request.set_key(key);
+  request.set_cursor(cursor);
+  request.set_limit(limit);
+  ListMembersResponse response;
+  if (!stub->ListMembers(&cc, request, &response).ok()) return false;
+  members->assign(response.members().begin(), response.members().end());
+  *next = response.next_cursor();
+  return true;
+}
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  string shardmaster_addr = hostname + ":8080";
+  start_shardmaster(shardmaster_addr);
+
+  const string skv_1 = hostname + ":8081";
+  const string skv_2 = hostname + ":8082";
+  const string sv1 = hostname + ":8001";
+  const string sv2 = hostname + ":8002";
+
+  start_shardmanager(skv_1, shardmaster_addr);
+  start_shardmanager(skv_2, shardmaster_addr);
+  start_shardkvs({sv1}, skv_1);
+  start_shardkvs({sv2}, skv_2);
+
+  assert(test_join(shardmaster_addr, skv_1, true));
+  assert(test_join(shardmaster_addr, skv_2, true));
+  std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+
+  // skv_1 has keys 0-500, skv_2 has 501-1000
+  for (int i = 1; i <= 5; i++)
+    assert(test_put(skv_1, "user_" + to_string(i), "name " + to_string(i), "", true));
+  // a user put again and a post put twice are listed once, where they were
+  assert(test_put(skv_1, "user_3", "renamed", "", true));
+  assert(test_put(skv_1, "post_1", "hi", "user_1", true));
+  assert(test_put(skv_1, "post_2", "yo", "user_1", true));
+  assert(test_put(skv_1, "post_1", "hi again", "user_1", true));
+  assert(test_delete(skv_1, "user_2", true));
+  assert(test_get(skv_1, "user_3", "renamed"));
+
+  // pages of two, the last one with no next cursor
+  vector<string> members;
+  uint64_t next;
+  assert(list_page(skv_1, "all_users", 0, 2, &members, &next));
+  assert((members == vector<string>{"user_1", "user_3"}) && next != 0);
+  assert(list_page(skv_1, "all_users", next, 2, &members, &next));
+  assert((members == vector<string>{"user_4", "user_5"}) && next == 0);
+
+  // a page larger than the set holds all of it
+  assert(list_page(skv_1, "user_1_posts", 0, 10, &members, &next));
+  assert((members == vector<string>{"post_1", "post_2"}) && next == 0);
+  // and so does the default page size
+  assert(list_page(skv_1, "all_users", 0, 0, &members, &next));
+  assert(members.size() == 4 && next == 0);
+
+  // a cursor stays valid while the set changes: members added after it are
+  // on the next pages, members removed before it do not shift them
+  assert(list_page(skv_1, "all_users", 0, 2, &members, &next));
+  assert(test_delete(skv_1, "user_1", true));
+  assert(test_put(skv_1, "user_6", "name 6", "", true));
+  assert(list_page(skv_1, "all_users", next, 10, &members, &next));
+  assert((members == vector<string>{"user_4", "user_5", "user_6"}) && next == 0);
+
+  // sets that do not exist, or are not ours
+  assert(!list_page(skv_1, "user_4_posts", 0, 10, &members, &next));
+  assert(!list_page(skv_2, "user_1_posts", 0, 10, &members, &next));
+
+  return 0;
+}
@@ -0,0 +1,67 @@
+#include <unistd.h>
+#include <cassert>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  string shardmaster_addr = hostname + ":8080";
+  start_shardmaster(shardmaster_addr);
+
+  const string skv_1 = hostname + ":8081";
+  const string skv_2 = hostname + ":8082";
+
+  const string sv1 = hostname + ":8001";
+  const string sv2 = hostname + ":8002";
+
+  start_shardmanager(skv_1, shardmaster_addr);
+  start_shardmanager(skv_2, shardmaster_addr);
+
+  start_shardkvs({sv1}, skv_1);
+  start_shardkvs({sv2}, skv_2);
+
+  assert(test_join(shardmaster_addr, skv_1, true));
+  assert(test_join(shardmaster_addr, skv_2, true));
+
+  // sleep to allow shardkvs to query and get initial config
+  std::chrono::milliseconds timespan(1000);
+  std::this_thread::sleep_for(timespan);
+
+  // skv_1 has keys 0-500, skv_2 has 501-1000
+  assert(test_multi_put(skv_1,
+                        {{"user_1", "alice", ""},
+                         {"user_2", "bob", ""},
+                         {"post_3", "hi", "user_1"},
+                         {"post_4", "yo", "user_1"},
+                         {"post_5", "hey", "user_900"}},
+                        true));
+  assert(test_multi_get(
+      skv_1, {"user_1", "user_2", "post_3", "post_4", "post_5", "user_7"},
+      {"alice", "bob", "hi", "yo", "hey", nullopt}));
+  assert(test_get(skv_1, "all_users", "user_1,user_2,"));
+  assert(test_get(skv_1, "user_1_posts", "post_3,post_4,"));
+  // the posts of a user on another server are listed there
+  assert(test_get(skv_2, "user_900_posts", "post_5,"));
+
+  // keys that are not ours fail the whole batch
+  assert(test_multi_put(
+      skv_1, {{"user_6", "carol", ""}, {"user_600", "dave", ""}}, false));
+  assert(test_get(skv_1, "user_6", nullopt));
+  assert(!test_multi_get(skv_2, {"user_1"}, {"alice"}));
+
+  assert(test_multi_delete(skv_1, {"user_2", "post_4", "user_8"}, 2));
+  assert(test_multi_delete(skv_2, {"user_1"}, nullopt));
+  assert(test_multi_get(skv_1, {"user_1", "user_2", "post_4"},
+                        {"alice", nullopt, nullopt}));
+  assert(test_get(skv_1, "all_users", "user_1,"));
+
+  return 0;
+}
@@ -0,0 +1,80 @@
+#include <unistd.h>
+#include <cassert>
+#include <chrono>
+#include <string>
+
+#include "../../common/channel_pool.h"
+#include "../../shardkv/shardkv.h"
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+// what the outbox of the server at addr holds for destination, waiting up to
+// a few seconds for it to satisfy done
+template <typename Done>
+OutboxStats outbox_of(const string& addr, const string& destination, Done done) {
+  OutboxStats found;
+  for (int i = 0; i < 50; i++) {
+    auto stub = ChannelPool::Shared().Stub<Shardkv>(addr);
+    ::grpc::ClientContext cc;
+    StatsRequest request;
+    StatsResponse response;
+    assert(stub->Stats(&cc, request, &response).ok());
+    for (const auto& o : response.outbox())
+      if (o.destination() == destination) found = o;
+    if (done(found)) return found;
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  return found;
+}
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  string shardmaster_addr = hostname + ":8080";
+  start_shardmaster(shardmaster_addr);
+
+  const string skv_1 = hostname + ":8081";
+  const string skv_2 = hostname + ":8082";
+  const string sv1 = hostname + ":8001";
+  const string sv2 = hostname + ":8002";
+
+  start_shardmanager(skv_1, shardmaster_addr);
+  start_shardmanager(skv_2, shardmaster_addr);
+  start_shardkvs({sv1}, skv_1);
+
+  // user_600 is on skv_2, which has no server yet
+  assert(test_join(shardmaster_addr, skv_1, true));
+  assert(test_join(shardmaster_addr, skv_2, true));
+  std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+
+  // not timed: the first call pays for the connections
+  assert(test_put(skv_1, "user_1", "bob", "", true));
+
+  // the post is written even though its author's server is unreachable
+  auto start = std::chrono::steady_clock::now();
+  assert(test_put(skv_1, "post_1", "hello", "user_600", true));
+  assert(test_put(skv_1, "post_2", "world", "user_600", true));
+  assert(std::chrono::steady_clock::now() - start < std::chrono::seconds(1));
+  assert(test_get(skv_1, "post_1", "hello"));
+  // and clients cannot touch the outbox
+  assert(test_get(skv_1, "outbox_user_600_posts", nullopt));
+
+  OutboxStats behind = outbox_of(sv1, skv_2, [](const OutboxStats& o) { return o.failures() > 0; });
+  assert(behind.pending() == 2 && behind.delivered() == 0 && behind.failures() > 0);
+  assert(!behind.last_error().empty());
+
+  // once skv_2 has a server the posts get there
+  start_shardkvs({sv2}, skv_2);
+  assert(test_get(skv_2, "user_600_posts", "post_1,post_2,"));
+  OutboxStats caught_up = outbox_of(sv1, skv_2, [](const OutboxStats& o) { return o.pending() == 0; });
+  assert(caught_up.pending() == 0 && caught_up.delivered() == 2 && caught_up.lag_ms() == 0);
+
+  // and new ones right after
+  assert(test_put(skv_1, "post_3", "again", "user_600", true));
+  assert(test_get(skv_2, "user_600_posts", "post_1,post_2,post_3,"));
+
+  return 0;
+}
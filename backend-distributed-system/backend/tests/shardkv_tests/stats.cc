@@ -0,0 +1,110 @@
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cassert>
+#include <string>
+
+#include "../../common/channel_pool.h"
+#include "../../common/metrics.h"
+#include "../../shardkv/shardkv.h"
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+// the histogram of name and labels in response, or nullptr
+const HistogramStats* find_histogram(const StatsResponse& response, const string& name,
+                                     const string& labels) {
+  for (const auto& h : response.histograms())
+    if (h.name() == name && h.labels() == labels) return &h;
+  return nullptr;
+}
+
+// whatever the server on port answers to a GET /metrics
+string scrape(int port) {
+  int fd = socket(AF_INET6, SOCK_STREAM, 0);
+  sockaddr_in6 addr = {};
+  addr.sin6_family = AF_INET6;
+  addr.sin6_addr = in6addr_loopback;
+  addr.sin6_port = htons(port);
+  assert(connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0);
+  string request = "GET /metrics HTTP/1.0\r\n\r\n";
+  assert(write(fd, request.data(), request.size()) == (ssize_t)request.size());
+  string response;
+  char buf[4096];
+  ssize_t n;
+  while ((n = read(fd, buf, sizeof(buf))) > 0) response.append(buf, n);
+  close(fd);
+  return response;
+}
+
+template <typename Service>
+StatsResponse stats_of(const string& addr) {
+  auto stub = ChannelPool::Shared().Stub<Service>(addr);
+  ::grpc::ClientContext cc;
+  StatsRequest request;
+  StatsResponse response;
+  assert(stub->Stats(&cc, request, &response).ok());
+  return response;
+}
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  string shardmaster_addr = hostname + ":8080";
+  start_shardmaster(shardmaster_addr);
+
+  const string skv_1 = hostname + ":8081";
+  const string sv1 = hostname + ":8001";
+
+  start_shardmanager(skv_1, shardmaster_addr);
+  start_shardkvs({sv1}, skv_1);
+
+  assert(test_join(shardmaster_addr, skv_1, true));
+
+  // sleep to allow shardkvs to query and get initial config
+  std::chrono::milliseconds timespan(1000);
+  std::this_thread::sleep_for(timespan);
+
+  assert(test_put(skv_1, "user_1", "alice", "", true));
+  for (int i = 0; i < 10; i++) assert(test_get(skv_1, "user_1", "alice"));
+  assert(test_get(skv_1, "user_2", nullopt));
+
+  // every Get is counted, those that failed included
+  StatsResponse server = stats_of<Shardkv>(sv1);
+  const HistogramStats* get = find_histogram(server, "shardkv_rpc_seconds", "rpc=\"Get\"");
+  assert(get != nullptr && get->count() == 11);
+  assert(get->p50_us() > 0 && get->p50_us() <= get->p99_us() && get->p99_us() <= get->max_us());
+  const HistogramStats* put = find_histogram(server, "shardkv_rpc_seconds", "rpc=\"Put\"");
+  assert(put != nullptr && put->count() == 1);
+  assert(server.prometheus().find("# TYPE shardkv_rpc_seconds histogram\n") != string::npos);
+  assert(server.prometheus().find("shardkv_rpc_seconds_count{rpc=\"Get\"} 11\n") != string::npos);
+  assert(server.prometheus().find("shardkv_rpc_seconds_bucket{rpc=\"Get\",le=\"+Inf\"} 11\n") !=
+         string::npos);
+
+  StatsResponse manager = stats_of<Shardkv>(skv_1);
+  get = find_histogram(manager, "shardkv_manager_rpc_seconds", "rpc=\"Get\"");
+  assert(get != nullptr && get->count() == 11);
+
+  StatsResponse shardmaster = stats_of<Shardmaster>(shardmaster_addr);
+  const HistogramStats* join = find_histogram(shardmaster, "shardmaster_rpc_seconds", "rpc=\"Join\"");
+  assert(join != nullptr && join->count() == 1);
+  bool configs = false;
+  for (const auto& c : shardmaster.counters())
+    configs |= c.name() == "shardmaster_configs_total" && c.value() == 1;
+  assert(configs);
+
+  // the same text over HTTP
+  Metrics metrics;
+  size_t h = metrics.Histogram("test_seconds", "A test histogram.", "rpc=\"Test\"");
+  metrics.Record(h, std::chrono::microseconds(5));
+  assert(ServeMetrics(8090, [&]() { return metrics.Prometheus(); }));
+  string scraped = scrape(8090);
+  assert(scraped.rfind("HTTP/1.0 200 OK\r\n", 0) == 0);
+  assert(scraped.find("# HELP test_seconds A test histogram.\n") != string::npos);
+  assert(scraped.find("test_seconds_count{rpc=\"Test\"} 1\n") != string::npos);
+  assert(scraped.find("test_seconds_sum{rpc=\"Test\"} 5e-06\n") != string::npos);
+
+  return 0;
+}
@@ -0,0 +1,122 @@
+#include <unistd.h>
+#include <google/protobuf/empty.pb.h>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../../shardmaster/shardmaster.h"
+#include "../../common/channel_pool.h"
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+// the load reported for every shard, by {lower, upper}. shards not in there
+// are neither hot nor cold
+mutex loads_mutex;
+map<pair<unsigned int, unsigned int>, shard_load_t> loads;
+constexpr double LUKEWARM = (HOT_THRESH + COLD_THRESH) / 2;
+
+void set_load(const shard_t& shard, double rate, unsigned int split) {
+  lock_guard<mutex> lock(loads_mutex);
+  loads[{shard.lower, shard.upper}] = {shard, rate, split};
+}
+
+// reports the loads for the current configuration, as the servers of every
+// group would, until stop is set
+void report_loads(const string& shardmaster_addr, atomic<bool>* stop) {
+  auto stub = ChannelPool::Shared().Stub<Shardmaster>(shardmaster_addr);
+  while (!*stop) {
+    ::grpc::ClientContext cc;
+    google::protobuf::Empty req;
+    QueryResponse config;
+    assert(stub->Query(&cc, req, &config).ok());
+    for (const auto& e : config.config()) {
+      LoadReport report;
+      report.set_server(e.server());
+      report.set_version(config.version());
+      for (const auto& s : e.shards()) {
+        ShardLoad* load = report.add_shards();
+        *load->mutable_shard() = s;
+        lock_guard<mutex> lock(loads_mutex);
+        auto it = loads.find({s.lower(), s.upper()});
+        load->set_rate(it == loads.end() ? LUKEWARM : it->second.rate);
+        load->set_split(it == loads.end() ? s.lower() : it->second.split);
+      }
+      ::grpc::ClientContext report_cc;
+      google::protobuf::Empty res;
+      assert(stub->ReportLoad(&report_cc, report, &res).ok());
+    }
+    this_thread::sleep_for(chrono::milliseconds(300));
+  }
+}
+
+// waits for the configuration to become m, for at most timeout
+bool wait_for_config(const string& shardmaster_addr, const map<string, vector<shard_t>>& m,
+                     chrono::seconds timeout) {
+  auto deadline = chrono::steady_clock::now() + timeout;
+  while (chrono::steady_clock::now() < deadline) {
+    if (test_query(shardmaster_addr, m)) return true;
+    this_thread::sleep_for(chrono::milliseconds(100));
+  }
+  return false;
+}
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  string shardmaster_addr = hostname + ":8080";
+  shardmaster_options_t options;
+  options.auto_balance = true;
+  start_shardmaster(shardmaster_addr, options);
+
+  string skv_1 = hostname + ":8081";
+  string skv_2 = hostname + ":8082";
+  map<string, vector<shard_t>> m;
+
+  assert(test_join(shardmaster_addr, skv_1, true));
+  assert(test_join(shardmaster_addr, skv_2, true));
+  m[skv_1].push_back({0, 500});
+  m[skv_2].push_back({501, 1000});
+  assert(test_query(shardmaster_addr, m));
+  m.clear();
+
+  atomic<bool> stop{false};
+  thread reporter(report_loads, shardmaster_addr, &stop);
+
+  // nothing happens while no shard is hot or cold
+  this_thread::sleep_for(chrono::seconds(HOT_ROUNDS + COLD_ROUNDS));
+  m[skv_1].push_back({0, 500});
+  m[skv_2].push_back({501, 1000});
+  assert(test_query(shardmaster_addr, m));
+  m.clear();
+
+  // a hot shard is split where the load is halved, and the half that is
+  // moved goes to the other server, which is not as busy
+  set_load({0, 500}, 10 * HOT_THRESH, 10);
+  m[skv_1].push_back({0, 10});
+  m[skv_2].push_back({11, 500});
+  m[skv_2].push_back({501, 1000});
+  assert(wait_for_config(shardmaster_addr, m, chrono::seconds(4 * HOT_ROUNDS)));
+  // and that is where it stays
+  this_thread::sleep_for(chrono::seconds(HOT_ROUNDS + 1));
+  assert(test_query(shardmaster_addr, m));
+  m.clear();
+
+  // neighbouring cold shards are merged
+  set_load({11, 500}, 1, 11);
+  set_load({501, 1000}, 1, 501);
+  m[skv_1].push_back({0, 10});
+  m[skv_2].push_back({11, 1000});
+  assert(wait_for_config(shardmaster_addr, m, chrono::seconds(4 * COLD_ROUNDS)));
+
+  stop = true;
+  reporter.join();
+  return 0;
+}
@@ -32,6 +32,9 @@ int main() {
   // removing servers that don't exist
   assert(test_leave(shardmaster_addr, {skv_2, skv_3}, false));
   assert(test_query(shardmaster_addr, m));
+  // a leave naming a known server before an unknown one leaves both alone
+  assert(test_leave(shardmaster_addr, {skv_1, skv_3}, false));
+  assert(test_query(shardmaster_addr, m));
 
   // move that targets a server that doesn't exist
   assert(test_move(shardmaster_addr, skv_4, {50, 99}, false));
@@ -0,0 +1,72 @@
+#include <unistd.h>
+#include <google/protobuf/empty.pb.h>
+#include <cassert>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "../../common/channel_pool.h"
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+// a key space far past 32 bits, 2^34 ids wide
+constexpr uint64_t LOWER = 1000000000000ULL;
+constexpr uint64_t UPPER = LOWER + (1ULL << 34) - 1;
+
+QueryResponse query(const string& shardmaster_addr) {
+  auto stub = ChannelPool::Shared().Stub<Shardmaster>(shardmaster_addr);
+  ::grpc::ClientContext cc;
+  google::protobuf::Empty req;
+  QueryResponse response;
+  assert(stub->Query(&cc, req, &response).ok());
+  return response;
+}
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  string shardmaster_addr = hostname + ":8080";
+  shardmaster_options_t options;
+  options.key_space = {LOWER, UPPER};
+  start_shardmaster(shardmaster_addr, options);
+
+  string skv_1 = hostname + ":8081";
+  string skv_2 = hostname + ":8082";
+  map<string, vector<shard_t>> m;
+
+  assert(test_join(shardmaster_addr, skv_1, true));
+  m[skv_1].push_back({LOWER, UPPER});
+  assert(test_query(shardmaster_addr, m, 0));
+  QueryResponse config = query(shardmaster_addr);
+  assert(config.key_space().lower() == LOWER && config.key_space().upper() == UPPER);
+  m.clear();
+
+  assert(test_join(shardmaster_addr, skv_2, true));
+  m[skv_1].push_back({LOWER, LOWER + (1ULL << 33) - 1});
+  m[skv_2].push_back({LOWER + (1ULL << 33), UPPER});
+  assert(test_query(shardmaster_addr, m, 1ULL << 33));
+  m.clear();
+
+  assert(test_move(shardmaster_addr, skv_1, {UPPER - 9, UPPER}, true));
+  m[skv_1].push_back({LOWER, LOWER + (1ULL << 33) - 1});
+  m[skv_1].push_back({UPPER - 9, UPPER});
+  m[skv_2].push_back({LOWER + (1ULL << 33), UPPER - 10});
+  assert(test_query(shardmaster_addr, m, 10));
+  m.clear();
+
+  // by hash, over too many keys to count one by one, the keys moved are
+  // estimated from the ring: about half of them go to the second server
+  string hashed_addr = hostname + ":8090";
+  options.placement = Placement::HASH;
+  start_shardmaster(hashed_addr, options);
+  assert(test_join(hashed_addr, skv_1, true));
+  assert(test_join(hashed_addr, skv_2, true));
+  config = query(hashed_addr);
+  double share = (double)config.moved_keys() / (UPPER - LOWER + 1);
+  assert(share > 0.35 && share < 0.65);
+
+  return 0;
+}
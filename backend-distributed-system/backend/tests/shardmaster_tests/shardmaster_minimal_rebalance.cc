@@ -0,0 +1,76 @@
+#include <unistd.h>
+#include <cassert>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  string shardmaster_addr = hostname + ":8080";
+  shardmaster_options_t options;
+  options.rebalance = RebalanceMode::MINIMAL;
+  start_shardmaster(shardmaster_addr, options);
+
+  string skv_1 = hostname + ":8081";
+  string skv_2 = hostname + ":8082";
+  string skv_3 = hostname + ":8083";
+  string skv_4 = hostname + ":8084";
+  map<string, vector<shard_t>> m;
+
+  assert(test_join(shardmaster_addr, skv_1, true));
+  m[skv_1].push_back({0, 1000});
+  assert(test_query(shardmaster_addr, m, 0));
+  m.clear();
+
+  assert(test_join(shardmaster_addr, skv_2, true));
+  m[skv_1].push_back({0, 500});
+  m[skv_2].push_back({501, 1000});
+  assert(test_query(shardmaster_addr, m, 500));
+  m.clear();
+
+  // the new server only gets the end of the ranges of the others
+  assert(test_join(shardmaster_addr, skv_3, true));
+  m[skv_1].push_back({0, 333});
+  m[skv_2].push_back({501, 834});
+  m[skv_3].push_back({334, 500});
+  m[skv_3].push_back({835, 1000});
+  assert(test_query(shardmaster_addr, m, 333));
+  m.clear();
+
+  assert(test_join(shardmaster_addr, skv_4, true));
+  m[skv_1].push_back({0, 250});
+  m[skv_2].push_back({501, 750});
+  m[skv_3].push_back({334, 500});
+  m[skv_3].push_back({835, 917});
+  m[skv_4].push_back({251, 333});
+  m[skv_4].push_back({751, 834});
+  m[skv_4].push_back({918, 1000});
+  assert(test_query(shardmaster_addr, m, 250));
+  m.clear();
+
+  // only the keys of the server leaving move, and neighbours are merged
+  assert(test_leave(shardmaster_addr, {skv_1}, true));
+  m[skv_2].push_back({0, 83});
+  m[skv_2].push_back({501, 750});
+  m[skv_3].push_back({84, 167});
+  m[skv_3].push_back({334, 500});
+  m[skv_3].push_back({835, 917});
+  m[skv_4].push_back({168, 333});
+  m[skv_4].push_back({751, 834});
+  m[skv_4].push_back({918, 1000});
+  assert(test_query(shardmaster_addr, m, 251));
+  m.clear();
+
+  assert(test_leave(shardmaster_addr, {skv_2, skv_3}, true));
+  m[skv_4].push_back({0, 1000});
+  assert(test_query(shardmaster_addr, m, 668));
+
+  return 0;
+}
@@ -0,0 +1,53 @@
+#include <unistd.h>
+#include <cassert>
+#include <chrono>
+#include <string>
+
+#include "../../common/channel_pool.h"
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+// opens a Watch from version of epoch, and reads the first configuration
+// sent within a second into response. returns false if none was
+bool first_update(const string& shardmaster_addr, uint64_t epoch, uint64_t version, QueryResponse* response) {
+  auto stub = ChannelPool::Shared().Stub<Shardmaster>(shardmaster_addr);
+  ::grpc::ClientContext cc;
+  cc.set_deadline(chrono::system_clock::now() + chrono::seconds(1));
+  WatchRequest req;
+  req.set_from_version(version);
+  req.set_epoch(epoch);
+  auto reader = stub->Watch(&cc, req);
+  bool read = reader->Read(response);
+  cc.TryCancel();
+  reader->Finish();
+  return read;
+}
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  string shardmaster_addr = hostname + ":8080";
+  start_shardmaster(shardmaster_addr);
+
+  assert(test_join(shardmaster_addr, hostname + ":8081", true));
+  assert(test_join(shardmaster_addr, hostname + ":8082", true));
+
+  // a caller that saw nothing gets the current configuration, and its epoch
+  QueryResponse current;
+  assert(first_update(shardmaster_addr, 0, 0, &current));
+  assert(current.version() == 2 && current.epoch() != 0 && current.config_size() == 2);
+
+  // nothing is sent to a caller that is up to date
+  QueryResponse response;
+  assert(!first_update(shardmaster_addr, current.epoch(), current.version(), &response));
+
+  // a caller of another epoch (that of a shardmaster that ran before) gets
+  // the current configuration, even though it saw a higher version
+  assert(first_update(shardmaster_addr, current.epoch() + 1, 10, &response));
+  assert(response.epoch() == current.epoch() && response.version() == 2);
+
+  return 0;
+}
@@ -1,6 +1,7 @@
 import re
 import subprocess
 import sys
+from concurrent.futures import ThreadPoolExecutor
 from time import sleep
 
 import grpc
@@ -9,7 +10,7 @@ from flask_cors import CORS  # comment this on deployment
 from google.protobuf.empty_pb2 import Empty
 
 from shard_config import ShardConfig
-from shardkv_pb2 import AppendRequest, DeleteRequest, GetRequest, PutRequest
+from shardkv_pb2 import AppendRequest, DeleteRequest, GetRequest, MultiGetRequest, PutRequest
 from shardkv_pb2_grpc import ShardkvStub
 from shardmaster_pb2 import GDPRDeleteRequest
 from shardmaster_pb2_grpc import ShardmasterStub
@@ -69,6 +70,63 @@ def shardkvGet(server, key):
     return response.data
 
 
+def shardkvMultiGet(server, keys):
+    """
+    Helper function to make a MultiGet request to a shardkv server.
+
+    Inputs:
+    - server: the shardkv server
+    - keys: the MultiGet request's keys
+
+    Returns:
+    - a dict from every one of keys that exists to its value
+
+    Raises:
+    - grpc.RpcError: if the status is not grpc.StatusCode.OK
+    """
+    # Connect to server
+    channel = grpc.insecure_channel(server)
+    stub = ShardkvStub(channel)
+    # Send MultiGet request
+    response = stub.MultiGet(MultiGetRequest(keys=keys))
+    # retrieve data from response
+    return {
+        key: value
+        for key, value, found in zip(keys, response.values, response.found)
+        if found
+    }
+
+
+def multiGet(keys):
+    """
+    Retrieves the values of keys with one MultiGet request to every server responsible for some of
+    them, all sent at the same time.
+
+    Inputs:
+    - keys: the keys to retrieve
+
+    Returns:
+    - a dict from every one of keys that exists to a (value, server) tuple
+
+    Raises:
+    - IndexError: if no server is responsible for one of the keys
+    - grpc.RpcError: if one of the requests fails
+    """
+    groups = sc.groupByServer(keys, extractId)
+    if not groups:
+        return {}
+    with ThreadPoolExecutor(max_workers=len(groups)) as pool:
+        futures = {
+            server: pool.submit(shardkvMultiGet, server, server_keys)
+            for server, server_keys in groups.items()
+        }
+        results = {}
+        for server, future in futures.items():
+            for key, value in future.result().items():
+                results[key] = (value, server)
+        return results
+
+
 def shardkvPut(server, key, data, user=None):
     """
     Helper function to make a put request to a shardkv server.
@@ -151,21 +209,16 @@ def getAllUsers():
     err = None
     for _ in range(TRIES):
         try:
-            all_users = []
-            for shard_key in sc.config:
-                shard = sc.config[shard_key]
-                server = shard.server
+            users = set()
+            for server in sc.allServers():
                 data = shardkvGet(server, "all_users")
-                if len(data) > 0: 
-                    users = list(filter(None, data.split(",")))
-                    for user in users:
-                        name = shardkvGet(server, user)
-                        all_users.append(
-                            {"userId": user, "userName": name, "shard": server}
-                        )
-            return jsonify(
-                {"users": [dict(t) for t in {tuple(d.items()) for d in all_users}]}
-            )
+                users.update(filter(None, data.split(",")))
+            # fetch every name with one request per server
+            all_users = [
+                {"userId": user, "userName": name, "shard": server}
+                for user, (name, server) in multiGet(list(users)).items()
+            ]
+            return jsonify({"users": all_users})
         except (IndexError, grpc.RpcError) as e:
             err = e
             print("Error encountered in getAllUsers! Updating cache...")
@@ -245,30 +298,30 @@ def allUserPosts():
     post_keys = filter(None, data.split(","))
     post_ids = list(set([extractId(key) for key in post_keys]))
 
-    # for each post, get its content and server
+    # get the content and server of every post, with one request per server; repeat until every
+    # request succeeds
+    post_keys = [f"post_{post_id}" for post_id in post_ids]
     posts = []
     err = None
-    for post_id in post_ids:
-        # repeatedly send a Get request until post content is retrieved
-        for _ in range(TRIES):
-            try:
-                server = sc.getShardServer(post_id)
-                post_key = f"post_{post_id}"
-                post_content = shardkvGet(server, post_key)
-                posts.append(
-                    {"postId": post_key, "postContent": post_content, "shard": server}
-                )
-                err = None
-                break
-            except (IndexError, grpc.RpcError) as e:
-                err = e
-                print("Error encountered in allUserPosts 2! Updating cache...")
-                updateShardConfig(sc, app.config.get("shardmaster_location"))
-            # Sleep for 100ms between queries
-            sleep(0.1)
-        if err:
-            print("Error encountered: ", err)
-            return "", 500
+    for _ in range(TRIES):
+        try:
+            contents = multiGet(post_keys)
+            posts = [
+                {"postId": key, "postContent": contents[key][0], "shard": contents[key][1]}
+                for key in post_keys
+                if key in contents
+            ]
+            err = None
+            break
+        except (IndexError, grpc.RpcError) as e:
+            err = e
+            print("Error encountered in allUserPosts 2! Updating cache...")
+            updateShardConfig(sc, app.config.get("shardmaster_location"))
+        # Sleep for 100ms between queries
+        sleep(0.1)
+    if err:
+        print("Error encountered: ", err)
+        return "", 500
 
     return jsonify({"posts": posts})
 
@@ -374,5 +427,6 @@ if __name__ == "__main__":
     app.config["shardmaster_location"] = sys.argv[1]
 
     updateShardConfig(sc, app.config.get("shardmaster_location"))
+    sc.watch(app.config.get("shardmaster_location"))
 
     app.run(host="0.0.0.0")
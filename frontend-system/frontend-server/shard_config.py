@@ -1,10 +1,35 @@
+import threading
+from bisect import bisect_left
 from collections import namedtuple
+from time import sleep
 
+import grpc
 from sortedcontainers import SortedDict
 
+from shardmaster_pb2 import PLACEMENT_HASH, WatchRequest
+from shardmaster_pb2_grpc import ShardmasterStub
+
 # Define struct for a shard
 Shard = namedtuple("Shard", ("lower", "server"))
 
+MASK64 = (1 << 64) - 1
+
+
+def mix(x):
+    """The splitmix64 finalizer, as HashRing::_mix in the backend's common/hash_ring.h."""
+    x = (x + 0x9E3779B97F4A7C15) & MASK64
+    x = ((x ^ (x >> 30)) * 0xBF58476D1CE4E5B9) & MASK64
+    x = ((x ^ (x >> 27)) * 0x94D049BB133111EB) & MASK64
+    return x ^ (x >> 31)
+
+
+def ringPoint(server, vnode):
+    """Where the vnode-th point of server is on the hash ring, as HashRing::Point."""
+    h = 0xCBF29CE484222325
+    for c in server.encode():
+        h = ((h ^ c) * 0x100000001B3) & MASK64
+    return mix(h ^ mix(vnode))
+
 
 class ShardConfig:
     """
@@ -13,13 +38,26 @@ class ShardConfig:
     linear search).
 
     Initializing a ShardConfig object creates an empty store; use updateConfig with every query to
-    the Shardmaster to update the cache, and getShardServer to retrieve the responsible server.
+    the Shardmaster to update the cache, or watch to have the Shardmaster push every change to it,
+    and getShardServer to retrieve the responsible server.
+
+    When the Shardmaster places keys by consistent hashing, there are no shards: the cache is the
+    sorted points of every server on the hash ring instead, placed exactly like the backend's
+    HashRing does. Ids are 64-bit, and only those of the Shardmaster's key space belong to a
+    server.
     """
 
     def __init__(self):
         self.config = SortedDict()
+        self.ring = None
+        self.key_space = None
+        # the epoch and version of the config (see QueryResponse)
+        self.epoch = 0
+        self.version = 0
 
     def __repr__(self):
+        if self.ring is not None:
+            return f"Shard Config: hash ring of {sorted(set(self.ring[1]))}\n"
         config_str = "Shard Config: [\n"
         for shard_key in self.config:
             shard = self.config[shard_key]
@@ -34,10 +72,53 @@ class ShardConfig:
         Inputs:
         - proto_config: a shardmaster_pb2.QueryResponse
         """
-        self.config.clear()
-        for config in proto_config.config:
-            for shard in config.shards:
-                self.config[shard.upper] = Shard(shard.lower, config.server)
+        # a restarted Shardmaster counts versions from 0 again
+        if proto_config.epoch == self.epoch and proto_config.version < self.version:
+            return
+        # build the new config aside and swap it in, so that readers on other threads never see
+        # a half-built one
+        config = SortedDict()
+        ring = None
+        if proto_config.placement == PLACEMENT_HASH and proto_config.config:
+            # collisions go to the server that comes first by name
+            points = sorted(
+                (ringPoint(entry.server, v), entry.server)
+                for entry in proto_config.config
+                for v in range(proto_config.vnodes)
+            )
+            ring = ([], [])
+            for point, server in points:
+                if ring[0] and ring[0][-1] == point:
+                    continue
+                ring[0].append(point)
+                ring[1].append(server)
+        for entry in proto_config.config:
+            for shard in entry.shards:
+                config[shard.upper] = Shard(shard.lower, entry.server)
+        key_space = (proto_config.key_space.lower, proto_config.key_space.upper)
+        self.config, self.ring, self.key_space = config, ring, key_space
+        self.epoch, self.version = proto_config.epoch, proto_config.version
+
+    def watch(self, sm_server):
+        """
+        Keeps the cache up to date in a background thread, which follows the Shardmaster's Watch
+        stream and reconnects whenever it breaks.
+
+        Inputs:
+        - sm_server: the shardmaster server
+        """
+
+        def follow():
+            stub = ShardmasterStub(grpc.insecure_channel(sm_server))
+            while True:
+                try:
+                    for response in stub.Watch(WatchRequest(from_version=self.version, epoch=self.epoch)):
+                        self.updateConfig(response)
+                except grpc.RpcError as e:
+                    print("Watch on shardmaster failed, reconnecting...", e)
+                sleep(1)
+
+        threading.Thread(target=follow, daemon=True).start()
 
     def getShardServer(self, key_id):
         """
@@ -53,5 +134,45 @@ class ShardConfig:
         Raises:
         - IndexError: if no server is responsible for the ID
         """
-        upper = list(self.config.irange(key_id))[0]
-        return self.config[upper].server
+        ring = self.ring
+        if ring is not None:
+            lower, upper = self.key_space
+            if not lower <= key_id <= upper:
+                raise IndexError(f"id {key_id} is out of the key space")
+            i = bisect_left(ring[0], mix(key_id))
+            return ring[1][i if i < len(ring[0]) else 0]
+        # the first shard ending at or after the id, in O(log n)
+        config = self.config
+        upper, shard = config.peekitem(config.bisect_left(key_id))
+        if key_id < shard.lower:
+            raise IndexError(f"no shard holds id {key_id}")
+        return shard.server
+
+    def allServers(self):
+        """
+        Returns:
+        - the set of the IP:port strings of every server in the configuration
+        """
+        if self.ring is not None:
+            return set(self.ring[1])
+        return {shard.server for shard in self.config.values()}
+
+    def groupByServer(self, keys, extract_id):
+        """
+        Groups keys by the shardkv server responsible for them, so that every server can be sent
+        all of its keys in a single request.
+
+        Inputs:
+        - keys: the keys to group
+        - extract_id: maps a key to its id
+
+        Returns:
+        - a dict from the IP:port string of every server involved to the list of its keys
+
+        Raises:
+        - IndexError: if no server is responsible for one of the keys
+        """
+        groups = {}
+        for key in keys:
+            groups.setdefault(self.getShardServer(extract_id(key)), []).append(key)
+        return groups